@@ -30,6 +30,7 @@ extern "C" {
 #endif
 
 typedef struct pn_buffer_t pn_buffer_t;
+typedef struct pn_buffer_pool_t pn_buffer_pool_t;
 
 PN_EXTERN pn_buffer_t *pn_buffer(size_t capacity);
 PN_EXTERN void pn_buffer_free(pn_buffer_t *buf);
@@ -44,8 +45,32 @@ PN_EXTERN int pn_buffer_trim(pn_buffer_t *buf, size_t left, size_t right);
 PN_EXTERN void pn_buffer_clear(pn_buffer_t *buf);
 PN_EXTERN int pn_buffer_defrag(pn_buffer_t *buf);
 PN_EXTERN pn_bytes_t pn_buffer_bytes(pn_buffer_t *buf);
+PN_EXTERN size_t pn_buffer_segments(pn_buffer_t *buf, pn_bytes_t *segments, size_t count);
+PN_EXTERN size_t pn_buffer_segments_at(pn_buffer_t *buf, size_t offset, pn_bytes_t *segments, size_t count);
+PN_EXTERN pn_bytes_t pn_buffer_reserve(pn_buffer_t *buf, size_t size);
+PN_EXTERN int pn_buffer_extend(pn_buffer_t *buf, size_t size);
 PN_EXTERN int pn_buffer_print(pn_buffer_t *buf);
 
+/* A buffer given a pool takes its storage from it and gives it back
+ * when it grows, is released or is freed.  Storage comes in power of
+ * two size classes, and the pool counts how often it had a block to
+ * hand.  A pool is not thread safe, it belongs with the connection or
+ * thread whose buffers use it.
+ *
+ * A chained buffer holds its bytes in fixed-size chunks from its pool
+ * instead of one ring, so appending never moves what is already
+ * buffered.  Segments give the chunks in order, anything that needs
+ * the bytes in one piece gathers them back into a ring. Clearing a
+ * chained buffer returns its chunks and makes it a ring again. */
+PN_EXTERN pn_buffer_pool_t *pn_buffer_pool(size_t chunk_size);
+PN_EXTERN void pn_buffer_pool_free(pn_buffer_pool_t *pool);
+PN_EXTERN uint64_t pn_buffer_pool_hits(pn_buffer_pool_t *pool);
+PN_EXTERN uint64_t pn_buffer_pool_misses(pn_buffer_pool_t *pool);
+PN_EXTERN void pn_buffer_set_pool(pn_buffer_t *buf, pn_buffer_pool_t *pool);
+PN_EXTERN void pn_buffer_release(pn_buffer_t *buf);
+PN_EXTERN int pn_buffer_chain(pn_buffer_t *buf);
+PN_EXTERN bool pn_buffer_chained(pn_buffer_t *buf);
+
 #ifdef __cplusplus
 }
 #endif
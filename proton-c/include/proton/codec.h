@@ -100,6 +100,29 @@ PN_EXTERN int pn_data_fill(pn_data_t *data, const char *fmt, ...);
 PN_EXTERN int pn_data_vscan(pn_data_t *data, const char *fmt, va_list ap);
 PN_EXTERN int pn_data_scan(pn_data_t *data, const char *fmt, ...);
 
+/**
+ * A format for ::pn_data_fill and ::pn_data_scan compiled ahead of
+ * time, so that it is not parsed again on every use.
+ */
+typedef struct pn_program_t pn_program_t;
+
+/**
+ * Compile a fill/scan format.
+ *
+ * @param[in] fmt a format as accepted by ::pn_data_fill and ::pn_data_scan
+ * @return the compiled format, freed with ::pn_program_free
+ */
+PN_EXTERN pn_program_t *pn_program(const char *fmt);
+PN_EXTERN void pn_program_free(pn_program_t *program);
+
+/**
+ * Like ::pn_data_fill and ::pn_data_scan, with a compiled format.
+ */
+PN_EXTERN int pn_data_vfill_program(pn_data_t *data, pn_program_t *program, va_list ap);
+PN_EXTERN int pn_data_fill_program(pn_data_t *data, pn_program_t *program, ...);
+PN_EXTERN int pn_data_vscan_program(pn_data_t *data, pn_program_t *program, va_list ap);
+PN_EXTERN int pn_data_scan_program(pn_data_t *data, pn_program_t *program, ...);
+
 PN_EXTERN void pn_data_clear(pn_data_t *data);
 PN_EXTERN size_t pn_data_size(pn_data_t *data);
 PN_EXTERN void pn_data_rewind(pn_data_t *data);
@@ -114,8 +137,31 @@ PN_EXTERN pn_type_t pn_data_type(pn_data_t *data);
 PN_EXTERN int pn_data_print(pn_data_t *data);
 PN_EXTERN int pn_data_format(pn_data_t *data, char *bytes, size_t *size);
 PN_EXTERN ssize_t pn_data_encode(pn_data_t *data, char *bytes, size_t size);
+PN_EXTERN ssize_t pn_data_encoded_size(pn_data_t *data);
 PN_EXTERN ssize_t pn_data_decode(pn_data_t *data, const char *bytes, size_t size);
 
+/**
+ * Like ::pn_data_decode, except that the binaries, strings and symbols
+ * decoded refer to bytes rather than being copied.  The bytes must
+ * stay valid and unchanged until the data is cleared or freed, or
+ * until ::pn_data_intern_all is called.
+ *
+ * @param[in] data the data to decode into
+ * @param[in] bytes the encoded bytes
+ * @param[in] size the number of encoded bytes
+ * @return the number of bytes decoded or an error code
+ */
+PN_EXTERN ssize_t pn_data_decode_borrowed(pn_data_t *data, const char *bytes, size_t size);
+
+/**
+ * Copy any bytes the data refers to after ::pn_data_decode_borrowed
+ * into the data itself, so that it may outlive them.
+ *
+ * @param[in] data the data
+ * @return zero on success or an error code
+ */
+PN_EXTERN int pn_data_intern_all(pn_data_t *data);
+
 PN_EXTERN int pn_data_put_list(pn_data_t *data);
 PN_EXTERN int pn_data_put_map(pn_data_t *data);
 PN_EXTERN int pn_data_put_array(pn_data_t *data, bool described, pn_type_t type);
@@ -23,6 +23,7 @@
  */
 
 #include <proton/import_export.h>
+#include <proton/buffer.h>
 #include <proton/type_compat.h>
 #include <stddef.h>
 #include <sys/types.h>
@@ -406,6 +407,20 @@ PN_EXTERN pn_data_t *pn_connection_remote_properties(pn_connection_t *connection
  */
 PN_EXTERN pn_transport_t *pn_connection_transport(pn_connection_t *connection);
 
+/**
+ * Get the buffer pool of a connection.
+ *
+ * The tag and data buffers of the connection's deliveries take their
+ * storage from this pool and give it back when the delivery is
+ * settled, so that deliveries on any of the connection's links reuse
+ * it. The hit and miss counts of the pool show how often it had
+ * storage to hand.
+ *
+ * @param[in] connection the connection object
+ * @return the connection's buffer pool
+ */
+PN_EXTERN pn_buffer_pool_t *pn_connection_buffer_pool(pn_connection_t *connection);
+
 /** @}
  */
 
@@ -1354,5 +1354,9 @@ typedef long long int int64_t;
 %ignore pn_vscan_atoms;
 %ignore pn_data_vfill;
 %ignore pn_data_vscan;
+%ignore pn_data_vfill_program;
+%ignore pn_data_fill_program;
+%ignore pn_data_vscan_program;
+%ignore pn_data_scan_program;
 
 %include "proton/codec.h"
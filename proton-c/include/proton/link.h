@@ -24,6 +24,7 @@
 
 #include <proton/import_export.h>
 #include <proton/type_compat.h>
+#include <proton/types.h>
 #include <stddef.h>
 #include <sys/types.h>
 
@@ -567,6 +568,53 @@ PN_EXTERN void pn_link_offered(pn_link_t *sender, int credit);
  */
 PN_EXTERN ssize_t pn_link_send(pn_link_t *sender, const char *bytes, size_t n);
 
+/**
+ * Create a payload holding a copy of the given message data.
+ *
+ * The caller owns the one reference to the new payload, and releases
+ * it with ::pn_payload_free once it has been handed to every link.
+ *
+ * @param[in] bytes the start of the message data
+ * @param[in] size the number of bytes of message data
+ * @return a new payload, or NULL if it could not be allocated
+ */
+PN_EXTERN pn_payload_t *pn_payload(const char *bytes, size_t size);
+
+/**
+ * Get the message data of a payload.
+ *
+ * @param[in] payload a payload object
+ * @return the bytes of the payload, valid while it is referenced
+ */
+PN_EXTERN pn_bytes_t pn_payload_bytes(pn_payload_t *payload);
+
+/**
+ * Release the caller's reference to a payload.
+ *
+ * Deliveries and queued frames still sending the payload keep it
+ * until they are done with it.
+ *
+ * @param[in] payload a payload object or NULL
+ */
+PN_EXTERN void pn_payload_free(pn_payload_t *payload);
+
+/**
+ * Send a payload as message data for the current delivery on a link.
+ *
+ * If the delivery holds no unsent data the payload is referenced
+ * rather than copied, so the same payload may be sent on many links
+ * for the cost of one copy of it. Otherwise, and if further data is
+ * sent for the delivery with ::pn_link_send, the bytes are copied.
+ *
+ * Every link a payload is sent on must belong to a connection driven
+ * from the thread that created the payload, see ::pn_payload_t.
+ *
+ * @param[in] sender a sender link object
+ * @param[in] payload the payload to send
+ * @return the number of bytes sent, or an error code
+ */
+PN_EXTERN ssize_t pn_link_send_payload(pn_link_t *sender, pn_payload_t *payload);
+
 //PN_EXTERN void pn_link_abort(pn_sender_t *sender);
 
 /** @} */
@@ -624,6 +672,37 @@ PN_EXTERN void pn_link_set_drain(pn_link_t *receiver, bool drain);
  */
 PN_EXTERN ssize_t pn_link_recv(pn_link_t *receiver, char *bytes, size_t n);
 
+/**
+ * Get a read-only view of the message data buffered for the current
+ * delivery on a link.
+ *
+ * This is an alternative to ::pn_link_recv that does not copy the
+ * data. The buffered data is described by segments, in order, which
+ * reference the delivery's own buffer. A small delivery needs at most
+ * two segments, a large one is held in chunks and needs one per chunk;
+ * when count is too small the first count segments are filled in. The
+ * segments remain valid until the data is consumed with
+ * ::pn_link_consume or the transport processes further input. Nothing
+ * is consumed by this call.
+ *
+ * @param[in] receiver a receiving link object
+ * @param[out] segments the array to fill in
+ * @param[in] count the capacity of the segments array
+ * @return the number of segments filled in, PN_EOS once all data of a
+ * complete delivery has been consumed, or an error code
+ */
+PN_EXTERN ssize_t pn_link_recv_segments(pn_link_t *receiver, pn_bytes_t *segments, size_t count);
+
+/**
+ * Discard message data of the current delivery on a link that has
+ * been read through ::pn_link_recv_segments.
+ *
+ * @param[in] receiver a receiving link object
+ * @param[in] size the number of bytes to discard
+ * @return 0 on success, or an error code
+ */
+PN_EXTERN int pn_link_consume(pn_link_t *receiver, size_t size);
+
 /**
  * Check if a link is currently draining.
  *
@@ -147,6 +147,34 @@ PN_EXTERN bool           pn_message_is_inferred(pn_message_t *msg);
  */
 PN_EXTERN int            pn_message_set_inferred(pn_message_t *msg, bool inferred);
 
+/**
+ * Get the lazy flag for a message.
+ *
+ * A lazy message decodes each of its sections the first time it is
+ * accessed rather than in ::pn_message_decode, so that a message that
+ * is only partly inspected is only partly decoded. Errors in a
+ * section are then reported through ::pn_message_error when the
+ * section is decoded. Either way a decoded message keeps its encoded
+ * form, and ::pn_message_encode copies the sections that have not
+ * been modified rather than encoding them again.
+ *
+ * @param[in] msg a message object
+ * @return the value of the lazy flag for the message
+ */
+PN_EXTERN bool           pn_message_is_lazy(pn_message_t *msg);
+
+/**
+ * Set the lazy flag for a message.
+ *
+ * See ::pn_message_is_lazy() for a description of what the lazy flag
+ * is. Clearing the flag decodes any sections not decoded yet.
+ *
+ * @param[in] msg a message object
+ * @param[in] lazy the new value of the lazy flag
+ * @return zero on success or an error code on failure
+ */
+PN_EXTERN int            pn_message_set_lazy(pn_message_t *msg, bool lazy);
+
 // standard message headers and properties
 
 /**
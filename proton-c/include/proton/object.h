@@ -48,6 +48,7 @@ typedef struct {
   uintptr_t (*hashcode)(void *);
   intptr_t (*compare)(void *, void *);
   int (*inspect)(void *, pn_string_t *);
+  const char *name;
 } pn_class_t;
 
 #define PN_CLASS(PREFIX) {                      \
@@ -55,7 +56,8 @@ typedef struct {
     PREFIX ## _finalize,                        \
     PREFIX ## _hashcode,                        \
     PREFIX ## _compare,                         \
-    PREFIX ## _inspect                          \
+    PREFIX ## _inspect,                         \
+    #PREFIX                                     \
 }
 
 PN_EXTERN void *pn_new(size_t size, pn_class_t *clazz);
@@ -71,6 +73,22 @@ PN_EXTERN intptr_t pn_compare(void *a, void *b);
 PN_EXTERN bool pn_equals(void *a, void *b);
 PN_EXTERN int pn_inspect(void *object, pn_string_t *dst);
 
+// Objects of each class that are currently allocated. The name is the
+// one given to PN_CLASS, or NULL for objects without a class. Fills in
+// at most count entries and returns the number of classes.
+typedef struct {
+  const char *name;
+  size_t live;
+  size_t bytes;
+} pn_class_stats_t;
+
+PN_EXTERN size_t pn_class_stats(pn_class_stats_t *stats, size_t count);
+
+// Freed objects are cached per thread for reuse. A thread's cache is
+// released when it exits, or earlier once it is done with proton by
+// calling this.
+PN_EXTERN void pn_object_cache_free(void);
+
 #define PN_REFCOUNT (0x1)
 
 PN_EXTERN pn_list_t *pn_list(size_t capacity, int options);
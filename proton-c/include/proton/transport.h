@@ -24,6 +24,7 @@
 
 #include <proton/import_export.h>
 #include <proton/type_compat.h>
+#include <proton/types.h>
 #include <stddef.h>
 #include <sys/types.h>
 
@@ -394,6 +395,29 @@ PN_EXTERN ssize_t pn_transport_pending(pn_transport_t *transport);
  */
 PN_EXTERN const char *pn_transport_head(pn_transport_t *transport);
 
+/**
+ * Get the transport's pending output as a list of segments.
+ *
+ * This is an alternative to ::pn_transport_pending and
+ * ::pn_transport_head for drivers able to write several buffers at
+ * once, e.g. using writev(). Large transfer payloads are referenced
+ * in place rather than copied into a single contiguous buffer. The
+ * segments are filled in from the head of the output, at most @c
+ * count of them, and remain valid until the next call to
+ * ::pn_transport_pop or any other call that generates output. Written
+ * bytes are removed with ::pn_transport_pop as usual.
+ *
+ * Like ::pn_transport_pending, a negative value is returned once the
+ * transport has no further output to generate.
+ *
+ * @param[in] transport the transport
+ * @param[out] segments the array to fill in
+ * @param[in] count the capacity of the segments array
+ * @return the number of segments filled in, or an error code
+ */
+PN_EXTERN ssize_t pn_transport_head_segments(pn_transport_t *transport,
+                                             pn_bytes_t *segments, size_t count);
+
 /**
  * Copies @c size bytes from the head of the transport to the @c dst
  * pointer.
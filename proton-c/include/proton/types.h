@@ -231,6 +231,23 @@ typedef struct pn_link_t pn_link_t;
  */
 typedef struct pn_delivery_t pn_delivery_t;
 
+/**
+ * An immutable block of message data that may be sent on any number
+ * of links without being copied for each of them.
+ *
+ * A payload is reference counted. Every delivery sending it, and
+ * every transfer frame referring to it that has not yet been
+ * written, holds a reference, and the payload is freed when the last
+ * reference goes. See ::pn_link_send_payload.
+ *
+ * The reference count is not atomic. A payload may only be shared by
+ * connections that are all driven from the same thread, and must not
+ * be freed by the caller from any other thread.
+ *
+ * @ingroup delivery
+ */
+typedef struct pn_payload_t pn_payload_t;
+
 /**
  * An event collector.
  *
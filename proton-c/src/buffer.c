@@ -21,6 +21,7 @@
 
 #include <proton/buffer.h>
 #include <proton/error.h>
+#include <proton/object.h>
 #ifndef __cplusplus
 #include <stdbool.h>
 #endif
@@ -29,29 +30,227 @@
 #include <stdio.h>
 #include "util.h"
 
+typedef struct pni_chunk_t pni_chunk_t;
+
+// a fixed-size piece of a chained buffer, the bytes follow the struct
+struct pni_chunk_t {
+  pni_chunk_t *next;
+  size_t head;
+  size_t tail;
+};
+
+#define pni_chunk_bytes(chunk) ((char *) ((chunk) + 1))
+
+// most free chunks a pool holds on to
+#define PNI_POOL_RETAIN (16)
+
+// ring storage comes in power of two size classes from 16 bytes to
+// 64KiB, and a pool holds on to at most this many bytes of each
+#define PNI_POOL_MIN_CLASS (4)
+#define PNI_POOL_CLASSES (13)
+#define PNI_POOL_CLASS_RETAIN (1024*1024)
+
+typedef struct pni_block_t pni_block_t;
+
+// a free block of ring storage, linked through its own bytes
+struct pni_block_t {
+  pni_block_t *next;
+};
+
+struct pn_buffer_pool_t {
+  size_t chunk_size;
+  size_t free_count;
+  pni_chunk_t *free;
+  pni_block_t *blocks[PNI_POOL_CLASSES];
+  size_t block_count[PNI_POOL_CLASSES];
+  uint64_t hits;
+  uint64_t misses;
+};
+
+static void pn_buffer_pool_finalize(void *object)
+{
+  pn_buffer_pool_t *pool = (pn_buffer_pool_t *) object;
+  while (pool->free) {
+    pni_chunk_t *next = pool->free->next;
+    free(pool->free);
+    pool->free = next;
+  }
+  for (int i = 0; i < PNI_POOL_CLASSES; i++) {
+    while (pool->blocks[i]) {
+      pni_block_t *next = pool->blocks[i]->next;
+      free(pool->blocks[i]);
+      pool->blocks[i] = next;
+    }
+  }
+}
+
+#define pn_buffer_pool_initialize NULL
+#define pn_buffer_pool_hashcode NULL
+#define pn_buffer_pool_compare NULL
+#define pn_buffer_pool_inspect NULL
+
+pn_buffer_pool_t *pn_buffer_pool(size_t chunk_size)
+{
+  static pn_class_t clazz = PN_CLASS(pn_buffer_pool);
+  pn_buffer_pool_t *pool = (pn_buffer_pool_t *) pn_new(sizeof(pn_buffer_pool_t), &clazz);
+  pool->chunk_size = chunk_size;
+  pool->free_count = 0;
+  pool->free = NULL;
+  for (int i = 0; i < PNI_POOL_CLASSES; i++) {
+    pool->blocks[i] = NULL;
+    pool->block_count[i] = 0;
+  }
+  pool->hits = 0;
+  pool->misses = 0;
+  return pool;
+}
+
+void pn_buffer_pool_free(pn_buffer_pool_t *pool)
+{
+  pn_decref(pool);
+}
+
+uint64_t pn_buffer_pool_hits(pn_buffer_pool_t *pool)
+{
+  return pool->hits;
+}
+
+uint64_t pn_buffer_pool_misses(pn_buffer_pool_t *pool)
+{
+  return pool->misses;
+}
+
+static pni_chunk_t *pni_pool_get(pn_buffer_pool_t *pool)
+{
+  pni_chunk_t *chunk = pool->free;
+  if (chunk) {
+    pool->free = chunk->next;
+    pool->free_count--;
+    pool->hits++;
+  } else {
+    chunk = (pni_chunk_t *) malloc(sizeof(pni_chunk_t) + pool->chunk_size);
+    if (!chunk) return NULL;
+    pool->misses++;
+  }
+  chunk->next = NULL;
+  chunk->head = 0;
+  chunk->tail = 0;
+  return chunk;
+}
+
+// return a list of chunks to the pool
+static void pni_pool_put(pn_buffer_pool_t *pool, pni_chunk_t *chunk)
+{
+  while (chunk) {
+    pni_chunk_t *next = chunk->next;
+    if (pool->free_count < PNI_POOL_RETAIN) {
+      chunk->next = pool->free;
+      pool->free = chunk;
+      pool->free_count++;
+    } else {
+      free(chunk);
+    }
+    chunk = next;
+  }
+}
+
+// the size class of ring storage of the given capacity, or -1 when
+// the capacity is not one of them
+static int pni_pool_class(size_t capacity)
+{
+  if (capacity & (capacity - 1)) return -1;
+  for (int i = 0; i < PNI_POOL_CLASSES; i++) {
+    if (capacity == (size_t) 1 << (i + PNI_POOL_MIN_CLASS)) return i;
+  }
+  return -1;
+}
+
+// ring storage of the given capacity, from the pool if it has one of
+// that class to hand
+static char *pni_pool_alloc(pn_buffer_pool_t *pool, size_t capacity)
+{
+  int i = pool ? pni_pool_class(capacity) : -1;
+  if (i >= 0 && pool->blocks[i]) {
+    pni_block_t *block = pool->blocks[i];
+    pool->blocks[i] = block->next;
+    pool->block_count[i]--;
+    pool->hits++;
+    return (char *) block;
+  }
+  if (pool) pool->misses++;
+  return (char *) malloc(capacity);
+}
+
+static void pni_pool_release(pn_buffer_pool_t *pool, char *bytes, size_t capacity)
+{
+  if (!bytes) return;
+  int i = pool ? pni_pool_class(capacity) : -1;
+  if (i >= 0 && (pool->block_count[i] + 1) * capacity <= PNI_POOL_CLASS_RETAIN) {
+    pni_block_t *block = (pni_block_t *) bytes;
+    block->next = pool->blocks[i];
+    pool->blocks[i] = block;
+    pool->block_count[i]++;
+  } else {
+    free(bytes);
+  }
+}
+
+// A buffer is either a single ring of bytes, or once chained, a list
+// of chunks.  While chained the ring is kept but unused.  A buffer with
+// a pool takes its chunks and ring storage from it and gives them back.
 struct pn_buffer_t {
   size_t capacity;
   size_t start;
   size_t size;
   char *bytes;
+  pn_buffer_pool_t *pool;  // reference counted
+  pni_chunk_t *first;
+  pni_chunk_t *last;
+  bool chained;
 };
 
+// drop the chunks and go back to the ring, which is left empty
+static void pni_chain_clear(pn_buffer_t *buf)
+{
+  pni_pool_put(buf->pool, buf->first);
+  buf->chained = false;
+  buf->first = NULL;
+  buf->last = NULL;
+  buf->start = 0;
+  buf->size = 0;
+}
+
+static void pn_buffer_finalize(void *object)
+{
+  pn_buffer_t *buf = (pn_buffer_t *) object;
+  if (buf->chained) pni_chain_clear(buf);
+  pni_pool_release(buf->pool, buf->bytes, buf->capacity);
+  pn_decref(buf->pool);
+}
+
+#define pn_buffer_initialize NULL
+#define pn_buffer_hashcode NULL
+#define pn_buffer_compare NULL
+#define pn_buffer_inspect NULL
+
 pn_buffer_t *pn_buffer(size_t capacity)
 {
-  pn_buffer_t *buf = (pn_buffer_t *) malloc(sizeof(pn_buffer_t));
+  static pn_class_t clazz = PN_CLASS(pn_buffer);
+  pn_buffer_t *buf = (pn_buffer_t *) pn_new(sizeof(pn_buffer_t), &clazz);
   buf->capacity = capacity;
   buf->start = 0;
   buf->size = 0;
   buf->bytes = capacity ? (char *) malloc(capacity) : NULL;
+  buf->pool = NULL;
+  buf->first = NULL;
+  buf->last = NULL;
+  buf->chained = false;
   return buf;
 }
 
 void pn_buffer_free(pn_buffer_t *buf)
 {
-  if (buf) {
-    free(buf->bytes);
-    free(buf);
-  }
+  pn_free(buf);
 }
 
 size_t pn_buffer_size(pn_buffer_t *buf)
@@ -61,12 +260,159 @@ size_t pn_buffer_size(pn_buffer_t *buf)
 
 size_t pn_buffer_capacity(pn_buffer_t *buf)
 {
+  if (buf->chained) {
+    // a chain grows without moving, only the last chunk's room counts
+    return buf->size + (buf->last ? buf->pool->chunk_size - buf->last->tail : 0);
+  }
   return buf->capacity;
 }
 
 size_t pn_buffer_available(pn_buffer_t *buf)
 {
-  return buf->capacity - buf->size;
+  return pn_buffer_capacity(buf) - buf->size;
+}
+
+static size_t pni_chain_get(pn_buffer_t *buf, size_t offset, size_t size, char *dst)
+{
+  size_t n = 0;
+  for (pni_chunk_t *chunk = buf->first; chunk && n < size; chunk = chunk->next) {
+    size_t len = chunk->tail - chunk->head;
+    if (offset >= len) {
+      offset -= len;
+      continue;
+    }
+    size_t m = pn_min(len - offset, size - n);
+    memcpy(dst + n, pni_chunk_bytes(chunk) + chunk->head + offset, m);
+    n += m;
+    offset = 0;
+  }
+  return n;
+}
+
+// gather the chunks back into the ring, for callers that need the
+// bytes in one piece
+static void pni_chain_flatten(pn_buffer_t *buf)
+{
+  size_t size = buf->size;
+  if (buf->capacity < size) {
+    pni_pool_release(buf->pool, buf->bytes, buf->capacity);
+    buf->capacity = size;
+    buf->bytes = pni_pool_alloc(buf->pool, size);
+  }
+  pni_chain_get(buf, 0, size, buf->bytes);
+  pni_chain_clear(buf);
+  buf->size = size;
+}
+
+static int pni_chain_append(pn_buffer_t *buf, const char *bytes, size_t size)
+{
+  size_t chunk_size = buf->pool->chunk_size;
+  while (size) {
+    pni_chunk_t *last = buf->last;
+    if (!last || last->tail == chunk_size) {
+      last = pni_pool_get(buf->pool);
+      if (!last) return PN_ERR;
+      if (buf->last) {
+        buf->last->next = last;
+      } else {
+        buf->first = last;
+      }
+      buf->last = last;
+    }
+    size_t n = pn_min(chunk_size - last->tail, size);
+    memcpy(pni_chunk_bytes(last) + last->tail, bytes, n);
+    last->tail += n;
+    buf->size += n;
+    bytes += n;
+    size -= n;
+  }
+  return 0;
+}
+
+static void pni_chain_trim(pn_buffer_t *buf, size_t left, size_t right)
+{
+  size_t keep = buf->size - left - right;
+
+  while (left) {
+    pni_chunk_t *first = buf->first;
+    size_t n = pn_min(first->tail - first->head, left);
+    first->head += n;
+    left -= n;
+    if (first->head == first->tail) {
+      buf->first = first->next;
+      first->next = NULL;
+      pni_pool_put(buf->pool, first);
+    }
+  }
+  if (!buf->first) buf->last = NULL;
+
+  if (right) {
+    // cut the list after the chunk holding the last byte kept
+    pni_chunk_t *last = NULL;
+    pni_chunk_t *chunk = buf->first;
+    size_t rest = keep;
+    while (rest) {
+      size_t n = chunk->tail - chunk->head;
+      if (n >= rest) {
+        chunk->tail = chunk->head + rest;
+        rest = 0;
+      } else {
+        rest -= n;
+      }
+      last = chunk;
+      chunk = chunk->next;
+    }
+    if (last) {
+      last->next = NULL;
+    } else {
+      buf->first = NULL;
+    }
+    buf->last = last;
+    pni_pool_put(buf->pool, chunk);
+  }
+
+  buf->size = keep;
+}
+
+int pn_buffer_chain(pn_buffer_t *buf)
+{
+  if (!buf->pool) return PN_STATE_ERR;
+  if (buf->chained) return 0;
+  pn_bytes_t segments[2];
+  size_t count = pn_buffer_segments(buf, segments, 2);
+  buf->start = 0;
+  buf->size = 0;
+  buf->chained = true;
+  // the ring is not touched while chained, so it can be copied from
+  for (size_t i = 0; i < count; i++) {
+    int err = pni_chain_append(buf, segments[i].start, segments[i].size);
+    if (err) return err;
+  }
+  return 0;
+}
+
+bool pn_buffer_chained(pn_buffer_t *buf)
+{
+  return buf->chained;
+}
+
+void pn_buffer_set_pool(pn_buffer_t *buf, pn_buffer_pool_t *pool)
+{
+  if (buf->pool == pool) return;
+  if (buf->chained) pni_chain_flatten(buf);
+  pn_incref(pool);
+  pn_decref(buf->pool);
+  buf->pool = pool;
+}
+
+void pn_buffer_release(pn_buffer_t *buf)
+{
+  pn_buffer_clear(buf);
+  if (buf->pool) {
+    pni_pool_release(buf->pool, buf->bytes, buf->capacity);
+    buf->bytes = NULL;
+    buf->capacity = 0;
+  }
 }
 
 size_t pn_buffer_head(pn_buffer_t *buf)
@@ -125,6 +471,9 @@ size_t pn_buffer_tail_size(pn_buffer_t *buf)
 
 int pn_buffer_ensure(pn_buffer_t *buf, size_t size)
 {
+  // a chain always has room, it takes more chunks as it grows
+  if (buf->chained) return 0;
+
   size_t old_capacity = buf->capacity;
   size_t old_head = pn_buffer_head(buf);
   bool wrapped = pn_buffer_wrapped(buf);
@@ -133,7 +482,18 @@ int pn_buffer_ensure(pn_buffer_t *buf, size_t size)
     buf->capacity = 2*(buf->capacity ? buf->capacity : 16);
   }
 
-  if (buf->capacity != old_capacity) {
+  if (buf->capacity != old_capacity && buf->pool) {
+    // storage comes in classes from the pool, copy the bytes across in order
+    char *bytes = pni_pool_alloc(buf->pool, buf->capacity);
+    size_t n = wrapped ? old_capacity - old_head : buf->size;
+    if (buf->size) {
+      memcpy(bytes, buf->bytes + old_head, n);
+      memcpy(bytes + n, buf->bytes, buf->size - n);
+    }
+    pni_pool_release(buf->pool, buf->bytes, old_capacity);
+    buf->bytes = bytes;
+    buf->start = 0;
+  } else if (buf->capacity != old_capacity) {
     buf->bytes = (char *) realloc(buf->bytes, buf->capacity);
 
     if (wrapped) {
@@ -148,6 +508,10 @@ int pn_buffer_ensure(pn_buffer_t *buf, size_t size)
 
 int pn_buffer_append(pn_buffer_t *buf, const char *bytes, size_t size)
 {
+  // a pooled or chained buffer may have no storage to point at
+  if (!size) return 0;
+  if (buf->chained) return pni_chain_append(buf, bytes, size);
+
   int err = pn_buffer_ensure(buf, size);
   if (err) return err;
 
@@ -156,7 +520,7 @@ int pn_buffer_append(pn_buffer_t *buf, const char *bytes, size_t size)
   size_t n = pn_min(tail_space, size);
 
   memmove(buf->bytes + tail, bytes, n);
-  memmove(buf->bytes, bytes + n, size - n);
+  if (size > n) memmove(buf->bytes, bytes + n, size - n);
 
   buf->size += size;
 
@@ -165,6 +529,9 @@ int pn_buffer_append(pn_buffer_t *buf, const char *bytes, size_t size)
 
 int pn_buffer_prepend(pn_buffer_t *buf, const char *bytes, size_t size)
 {
+  if (!size) return 0;
+  if (buf->chained) pni_chain_flatten(buf);
+
   int err = pn_buffer_ensure(buf, size);
   if (err) return err;
 
@@ -173,7 +540,7 @@ int pn_buffer_prepend(pn_buffer_t *buf, const char *bytes, size_t size)
   size_t n = pn_min(head_space, size);
 
   memmove(buf->bytes + head - n, bytes + size - n, n);
-  memmove(buf->bytes + buf->capacity - (size - n), bytes, size - n);
+  if (size > n) memmove(buf->bytes + buf->capacity - (size - n), bytes, size - n);
 
   if (buf->start >= size) {
     buf->start -= size;
@@ -195,6 +562,8 @@ size_t pn_buffer_index(pn_buffer_t *buf, size_t index)
 
 size_t pn_buffer_get(pn_buffer_t *buf, size_t offset, size_t size, char *dst)
 {
+  if (buf->chained) return pni_chain_get(buf, offset, size, dst);
+
   size = pn_min(size, buf->size);
   size_t start = pn_buffer_index(buf, offset);
   size_t stop = pn_buffer_index(buf, offset + size);
@@ -222,6 +591,11 @@ int pn_buffer_trim(pn_buffer_t *buf, size_t left, size_t right)
 {
   if (left + right > buf->size) return PN_ARG_ERR;
 
+  if (buf->chained) {
+    pni_chain_trim(buf, left, right);
+    return 0;
+  }
+
   buf->start += left;
   if (buf->start >= buf->capacity)
     buf->start -= buf->capacity;
@@ -233,6 +607,7 @@ int pn_buffer_trim(pn_buffer_t *buf, size_t left, size_t right)
 
 void pn_buffer_clear(pn_buffer_t *buf)
 {
+  if (buf->chained) pni_chain_clear(buf);
   buf->start = 0;
   buf->size = 0;
 }
@@ -258,6 +633,7 @@ static void pn_buffer_rotate (pn_buffer_t *buf, size_t sz) {
 
 int pn_buffer_defrag(pn_buffer_t *buf)
 {
+  if (buf->chained) pni_chain_flatten(buf);
   pn_buffer_rotate(buf, buf->start);
   buf->start = 0;
   return 0;
@@ -273,11 +649,81 @@ pn_bytes_t pn_buffer_bytes(pn_buffer_t *buf)
   }
 }
 
+// the buffered bytes from offset on, in order and without
+// defragmenting, one segment per chunk of a chained buffer and at most
+// two for a ring since it wraps around at most once
+size_t pn_buffer_segments_at(pn_buffer_t *buf, size_t offset, pn_bytes_t *segments, size_t count)
+{
+  size_t n = 0;
+  if (!buf || !count || offset >= buf->size) return 0;
+
+  if (buf->chained) {
+    for (pni_chunk_t *chunk = buf->first; chunk && n < count; chunk = chunk->next) {
+      size_t len = chunk->tail - chunk->head;
+      if (offset >= len) {
+        offset -= len;
+        continue;
+      }
+      segments[n++] = pn_bytes(len - offset, pni_chunk_bytes(chunk) + chunk->head + offset);
+      offset = 0;
+    }
+    return n;
+  }
+
+  size_t head = pn_buffer_head_size(buf);
+  if (offset < head && n < count) {
+    segments[n++] = pn_bytes(head - offset, buf->bytes + pn_buffer_head(buf) + offset);
+    offset = 0;
+  } else {
+    offset -= head;
+  }
+  size_t rest = pn_buffer_tail_size(buf);
+  if (offset < rest && n < count) {
+    segments[n++] = pn_bytes(rest - offset, buf->bytes + offset);
+  }
+  return n;
+}
+
+size_t pn_buffer_segments(pn_buffer_t *buf, pn_bytes_t *segments, size_t count)
+{
+  return pn_buffer_segments_at(buf, 0, segments, count);
+}
+
+// contiguous space of at least size bytes following the buffered
+// bytes, for writing in place before pn_buffer_extend adds them
+pn_bytes_t pn_buffer_reserve(pn_buffer_t *buf, size_t size)
+{
+  if (buf->chained) pni_chain_flatten(buf);
+  pn_buffer_ensure(buf, size);
+  if (pn_buffer_tail_space(buf) < size) {
+    if (buf->size) {
+      pn_buffer_defrag(buf);
+    } else {
+      buf->start = 0;
+    }
+  }
+  return pn_bytes(pn_buffer_tail_space(buf), buf->bytes + pn_buffer_tail(buf));
+}
+
+int pn_buffer_extend(pn_buffer_t *buf, size_t size)
+{
+  if (buf->chained) pni_chain_flatten(buf);
+  if (size > pn_buffer_tail_space(buf)) return PN_ARG_ERR;
+  buf->size += size;
+  return 0;
+}
+
 int pn_buffer_print(pn_buffer_t *buf)
 {
   printf("pn_buffer(\"");
-  pn_print_data(buf->bytes + pn_buffer_head(buf), pn_buffer_head_size(buf));
-  pn_print_data(buf->bytes, pn_buffer_tail_size(buf));
+  if (buf->chained) {
+    for (pni_chunk_t *chunk = buf->first; chunk; chunk = chunk->next) {
+      pn_print_data(pni_chunk_bytes(chunk) + chunk->head, chunk->tail - chunk->head);
+    }
+  } else {
+    pn_print_data(buf->bytes + pn_buffer_head(buf), pn_buffer_head_size(buf));
+    pn_print_data(buf->bytes, pn_buffer_tail_size(buf));
+  }
   printf("\")");
   return 0;
 }
@@ -73,10 +73,43 @@ const char *pn_type_name(pn_type_t type)
   return "<UNKNOWN>";
 }
 
-static inline void pni_atom_init(pn_atom_t *atom, pn_type_t type)
-{
-  memset(atom, 0, sizeof(pn_atom_t));
-  atom->type = type;
+// widens a node back into the atom it holds
+static pn_atom_t pni_node_atom(pn_data_t *data, pni_node_t *node)
+{
+  pn_atom_t atom;
+  memset(&atom, 0, sizeof(pn_atom_t));
+  atom.type = (pn_type_t) node->type;
+  switch (node->type) {
+  case PN_BOOL: atom.u.as_bool = node->u.as_bool; break;
+  case PN_UBYTE: atom.u.as_ubyte = node->u.as_ubyte; break;
+  case PN_BYTE: atom.u.as_byte = node->u.as_byte; break;
+  case PN_USHORT: atom.u.as_ushort = node->u.as_ushort; break;
+  case PN_SHORT: atom.u.as_short = node->u.as_short; break;
+  case PN_UINT: atom.u.as_uint = node->u.as_uint; break;
+  case PN_INT: atom.u.as_int = node->u.as_int; break;
+  case PN_CHAR: atom.u.as_char = node->u.as_char; break;
+  case PN_ULONG: atom.u.as_ulong = node->u.as_ulong; break;
+  case PN_LONG: atom.u.as_long = node->u.as_long; break;
+  case PN_TIMESTAMP: atom.u.as_timestamp = node->u.as_timestamp; break;
+  case PN_FLOAT: atom.u.as_float = node->u.as_float; break;
+  case PN_DOUBLE: atom.u.as_double = node->u.as_double; break;
+  case PN_DECIMAL32: atom.u.as_decimal32 = node->u.as_decimal32; break;
+  case PN_DECIMAL64: atom.u.as_decimal64 = node->u.as_decimal64; break;
+  case PN_DECIMAL128:
+    memmove(atom.u.as_decimal128.bytes, data->base + node->u.as_bytes.offset, 16);
+    break;
+  case PN_UUID:
+    memmove(atom.u.as_uuid.bytes, data->base + node->u.as_bytes.offset, 16);
+    break;
+  case PN_BINARY:
+  case PN_STRING:
+  case PN_SYMBOL:
+    atom.u.as_bytes = pni_node_bytes(data, node);
+    break;
+  default:
+    break;
+  }
+  return atom;
 }
 
 // data
@@ -95,16 +128,16 @@ static void pn_data_finalize(void *object)
 static pn_fields_t *pni_node_fields(pn_data_t *data, pni_node_t *node)
 {
   if (!node) return NULL;
-  if (node->atom.type != PN_DESCRIBED) return NULL;
+  if (node->type != PN_DESCRIBED) return NULL;
 
   pni_node_t *descriptor = pn_data_node(data, node->down);
 
-  if (!descriptor || descriptor->atom.type != PN_ULONG) {
+  if (!descriptor || descriptor->type != PN_ULONG) {
     return NULL;
   }
 
-  if (descriptor->atom.u.as_ulong < 256) {
-    return &FIELDS[descriptor->atom.u.as_ulong];
+  if (descriptor->u.as_ulong < 256) {
+    return &FIELDS[descriptor->u.as_ulong];
   } else {
     return NULL;
   }
@@ -242,7 +275,7 @@ int pni_inspect_atom(pn_atom_t *atom, pn_string_t *str)
 int pni_inspect_enter(void *ctx, pn_data_t *data, pni_node_t *node)
 {
   pn_string_t *str = (pn_string_t *) ctx;
-  pn_atom_t *atom = (pn_atom_t *) &node->atom;
+  pn_atom_t atom = pni_node_atom(data, node);
 
   pni_node_t *parent = pn_data_node(data, node->parent);
   pn_fields_t *fields = pni_node_fields(data, parent);
@@ -253,7 +286,7 @@ int pni_inspect_enter(void *ctx, pn_data_t *data, pni_node_t *node)
   int err;
 
   if (grandfields) {
-    if (atom->type == PN_NULL) {
+    if (atom.type == PN_NULL) {
       return 0;
     }
     const char *name = grandfields->fields[index];
@@ -263,12 +296,12 @@ int pni_inspect_enter(void *ctx, pn_data_t *data, pni_node_t *node)
     }
   }
 
-  switch (atom->type) {
+  switch (atom.type) {
   case PN_DESCRIBED:
     return pn_string_addf(str, "@");
   case PN_ARRAY:
     // XXX: need to fix for described arrays
-    return pn_string_addf(str, "@%s[", pn_type_name(node->type));
+    return pn_string_addf(str, "@%s[", pn_type_name((pn_type_t) node->array_type));
   case PN_LIST:
     return pn_string_addf(str, "[");
   case PN_MAP:
@@ -279,11 +312,11 @@ int pni_inspect_enter(void *ctx, pn_data_t *data, pni_node_t *node)
       if (err) return err;
       err = pn_string_addf(str, "(");
       if (err) return err;
-      err = pni_inspect_atom(atom, str);
+      err = pni_inspect_atom(&atom, str);
       if (err) return err;
       return pn_string_addf(str, ")");
     } else {
-      return pni_inspect_atom(atom, str);
+      return pni_inspect_atom(&atom, str);
     }
   }
 }
@@ -292,7 +325,7 @@ pni_node_t *pni_next_nonnull(pn_data_t *data, pni_node_t *node)
 {
   while (node) {
     node = pn_data_node(data, node->next);
-    if (node && node->atom.type != PN_NULL) {
+    if (node && node->type != PN_NULL) {
       return node;
     }
   }
@@ -309,7 +342,7 @@ int pni_inspect_exit(void *ctx, pn_data_t *data, pni_node_t *node)
   pni_node_t *next = pn_data_node(data, node->next);
   int err;
 
-  switch (node->atom.type) {
+  switch (node->type) {
   case PN_ARRAY:
   case PN_LIST:
     err = pn_string_addf(str, "]");
@@ -323,12 +356,12 @@ int pni_inspect_exit(void *ctx, pn_data_t *data, pni_node_t *node)
     break;
   }
 
-  if (!grandfields || node->atom.type != PN_NULL) {
+  if (!grandfields || node->type != PN_NULL) {
     if (next) {
       int index = pni_node_index(data, node);
-      if (parent && parent->atom.type == PN_MAP && (index % 2) == 0) {
+      if (parent && parent->type == PN_MAP && (index % 2) == 0) {
         err = pn_string_addf(str, "=");
-      } else if (parent && parent->atom.type == PN_DESCRIBED && index == 0) {
+      } else if (parent && parent->type == PN_DESCRIBED && index == 0) {
         err = pn_string_addf(str, " ");
         if (err) return err;
       } else {
@@ -362,17 +395,41 @@ pn_data_t *pn_data(size_t capacity)
   data->size = 0;
   data->nodes = capacity ? (pni_node_t *) malloc(capacity * sizeof(pni_node_t)) : NULL;
   data->buf = pn_buffer(64);
+  data->base = pn_buffer_bytes(data->buf).start;
+  data->borrow = NULL;
+  data->borrowing = false;
+  data->generation = 0;
   data->parent = 0;
   data->current = 0;
   data->base_parent = 0;
   data->base_current = 0;
-  data->decoder = pn_decoder();
-  data->encoder = pn_encoder();
+  data->decoder = NULL;
+  data->encoder = NULL;
   data->error = pn_error();
-  data->str = pn_string(NULL);
+  data->str = NULL;
   return data;
 }
 
+// the decoder, encoder and str are only made when first needed
+
+static pn_decoder_t *pni_data_decoder(pn_data_t *data)
+{
+  if (!data->decoder) data->decoder = pn_decoder();
+  return data->decoder;
+}
+
+static pn_encoder_t *pni_data_encoder(pn_data_t *data)
+{
+  if (!data->encoder) data->encoder = pn_encoder();
+  return data->encoder;
+}
+
+static pn_string_t *pni_data_str(pn_data_t *data)
+{
+  if (!data->str) data->str = pn_string(NULL);
+  return data->str;
+}
+
 void pn_data_free(pn_data_t *data)
 {
   pn_free(data);
@@ -396,11 +453,13 @@ size_t pn_data_size(pn_data_t *data)
 void pn_data_clear(pn_data_t *data)
 {
   if (data) {
+    data->generation++;
     data->size = 0;
     data->parent = 0;
     data->current = 0;
     data->base_parent = 0;
     data->base_current = 0;
+    data->borrow = NULL;
     pn_buffer_clear(data->buf);
   }
 }
@@ -412,61 +471,35 @@ int pn_data_grow(pn_data_t *data)
   return 0;
 }
 
-ssize_t pn_data_intern(pn_data_t *data, char *start, size_t size)
+ssize_t pn_data_intern(pn_data_t *data, const char *start, size_t size)
 {
   size_t offset = pn_buffer_size(data->buf);
   int err = pn_buffer_append(data->buf, start, size);
   if (err) return err;
   err = pn_buffer_append(data->buf, "\0", 1);
   if (err) return err;
+  data->base = pn_buffer_bytes(data->buf).start;
   return offset;
 }
 
-pn_bytes_t *pn_data_bytes(pn_data_t *data, pni_node_t *node)
-{
-  switch (node->atom.type) {
-  case PN_BINARY:
-  case PN_STRING:
-  case PN_SYMBOL:
-    return &node->atom.u.as_bytes;
-  default: return NULL;
-  }
-}
-
-void pn_data_rebase(pn_data_t *data, char *base)
+// copies the bytes of a variable width, decimal128 or uuid value into
+// the data buffer and points the node at them
+static int pni_node_intern(pn_data_t *data, pni_node_t *node, const char *start, size_t size)
 {
-  for (unsigned i = 0; i < data->size; i++) {
-    pni_node_t *node = &data->nodes[i];
-    if (node->data) {
-      pn_bytes_t *bytes = pn_data_bytes(data, node);
-      bytes->start = base + node->data_offset;
-    }
+  // offsets and sizes are 32 bits wide
+  if (size >= UINT32_MAX - pn_buffer_size(data->buf)) {
+    return pn_error_format(data->error, PN_OVERFLOW, "data too large: %" PN_ZU, size);
   }
-}
-
-int pn_data_intern_node(pn_data_t *data, pni_node_t *node)
-{
-  pn_bytes_t *bytes = pn_data_bytes(data, node);
-  if (!bytes) return 0;
-  size_t oldcap = pn_buffer_capacity(data->buf);
-  ssize_t offset = pn_data_intern(data, bytes->start, bytes->size);
+  ssize_t offset = pn_data_intern(data, start, size);
   if (offset < 0) return offset;
-  node->data = true;
-  node->data_offset = offset;
-  node->data_size = bytes->size;
-  pn_bytes_t buf = pn_buffer_bytes(data->buf);
-  bytes->start = buf.start + offset;
-
-  if (pn_buffer_capacity(data->buf) != oldcap) {
-    pn_data_rebase(data, buf.start);
-  }
-
+  node->u.as_bytes.offset = offset;
+  node->u.as_bytes.size = size;
   return 0;
 }
 
 int pn_data_vfill(pn_data_t *data, const char *fmt, va_list ap)
 {
-  int err;
+  int err = 0;
   while (*fmt) {
     char code = *(fmt++);
     if (!code) return 0;
@@ -547,8 +580,8 @@ int pn_data_vfill(pn_data_t *data, const char *fmt, va_list ap)
     case 'T':
       {
         pni_node_t *parent = pn_data_node(data, data->parent);
-        if (parent->atom.type == PN_ARRAY) {
-          parent->type = (pn_type_t) va_arg(ap, int);
+        if (parent->type == PN_ARRAY) {
+          parent->array_type = (pn_type_t) va_arg(ap, int);
         } else {
           return pn_error_format(data->error, PN_ERR, "naked type");
         }
@@ -638,10 +671,10 @@ int pn_data_vfill(pn_data_t *data, const char *fmt, va_list ap)
 
     pni_node_t *parent = pn_data_node(data, data->parent);
     while (parent) {
-      if (parent->atom.type == PN_DESCRIBED && parent->children == 2) {
+      if (parent->type == PN_DESCRIBED && parent->children == 2) {
         pn_data_exit(data);
         parent = pn_data_node(data, data->parent);
-      } else if (parent->atom.type == PN_NULL && parent->children == 1) {
+      } else if (parent->type == PN_NULL && parent->children == 1) {
         pn_data_exit(data);
         pni_node_t *current = pn_data_node(data, data->current);
         current->down = 0;
@@ -676,7 +709,7 @@ static bool pn_scan_next(pn_data_t *data, pn_type_t *type, bool suspend)
     return true;
   } else {
     pni_node_t *parent = pn_data_node(data, data->parent);
-    if (parent && parent->atom.type == PN_DESCRIBED) {
+    if (parent && parent->type == PN_DESCRIBED) {
       pn_data_exit(data);
       return pn_scan_next(data, type, suspend);
     } else {
@@ -1028,7 +1061,7 @@ int pn_data_vscan(pn_data_t *data, const char *fmt, va_list ap)
         if (!suspend) {
           size_t old = pn_data_size(dst);
           pni_node_t *next = pn_data_peek(data);
-          if (next && next->atom.type != PN_NULL) {
+          if (next && next->type != PN_NULL) {
             pn_data_narrow(data);
             int err = pn_data_appendn(dst, data, 1);
             pn_data_widen(data);
@@ -1066,9 +1099,697 @@ int pn_data_scan(pn_data_t *data, const char *fmt, ...)
   return err;
 }
 
+// format programs
+//
+// A pn_program_t holds a format compiled into one op per code, with
+// everything that only depends on the format worked out up front: what
+// a '?' applies to, whether an '@' array is described, the element
+// type of '*', which fill ops can complete a described value or a null
+// and, for scanning, how much of the format a missing value suspends.
+
+typedef struct {
+  char code;      // the format code
+  char arg;       // fill: '*' element code, 'D' for a described '@', 'T' before a '['
+  bool optional;  // scan: the code followed a '?'
+  bool exit;      // fill: the op may complete a 'D' or '?'
+  uint32_t skip;  // scan: ops after this one suspended when it is not found
+} pni_op_t;
+
+struct pn_program_t {
+  const char *fmt;
+  pni_op_t *fill;
+  size_t fill_size;
+  pni_op_t *scan;
+  size_t scan_size;
+};
+
+static size_t pni_compile_fill(const char *fmt, pni_op_t *ops)
+{
+  size_t size = 0;
+  for (size_t i = 0; fmt[i]; i++) {
+    pni_op_t *op = &ops[size++];
+    op->code = fmt[i];
+    op->arg = 0;
+    op->optional = false;
+    op->exit = true;
+    op->skip = 0;
+    switch (op->code) {
+    case '@':
+      // the code after the next one decides, as it does for pn_data_fill
+      if (fmt[i + 1] && fmt[i + 2] == 'D') {
+        op->arg = 'D';
+        i++;
+      }
+      break;
+    case '[':
+      if (i > 0 && fmt[i - 1] == 'T') op->arg = 'T';
+      break;
+    case '*':
+      op->arg = fmt[i + 1];
+      // without an element code this fails, nothing after it is reached
+      if (!op->arg) return size;
+      i++;
+      break;
+    }
+  }
+  return size;
+}
+
+// Clear exit on the fill ops that cannot leave a described value or a
+// null complete. Only values and closed containers complete anything,
+// and only when they are the second value of a 'D', the value of a
+// '?', or at the top where the data may have been left inside one. A
+// format that does not nest properly, or uses '*', keeps every check.
+static void pni_compile_exits(pni_op_t *ops, size_t size)
+{
+  typedef struct {
+    char code;
+    int values;
+  } pni_scope_t;
+  pni_scope_t *scopes = (pni_scope_t *) malloc(pn_max(size, 1) * sizeof(pni_scope_t));
+  size_t depth = 0;
+
+  for (size_t i = 0; i < size; i++) {
+    pni_op_t *op = &ops[i];
+    bool complete = false;
+    switch (op->code) {
+    case 'D':
+    case '?':
+    case '{':
+    case '@':
+      scopes[depth].code = op->code;
+      scopes[depth++].values = 0;
+      break;
+    case '[':
+      if (op->arg != 'T') {
+        scopes[depth].code = op->code;
+        scopes[depth++].values = 0;
+      }
+      break;
+    case 'T':
+      break;
+    case ']':
+    case '}':
+      if (!depth || scopes[depth - 1].code == 'D' || scopes[depth - 1].code == '?') {
+        free(scopes);
+        return;
+      }
+      depth--;
+      complete = true;
+      break;
+    case 'n': case 'o': case 'B': case 'b': case 'H': case 'h': case 'I': case 'i':
+    case 'L': case 'l': case 't': case 'f': case 'd': case 'z': case 'S': case 's':
+    case 'C':
+      complete = true;
+      break;
+    default:
+      free(scopes);
+      return;
+    }
+
+    op->exit = false;
+    while (complete) {
+      if (!depth) {
+        op->exit = true;
+        break;
+      }
+      pni_scope_t *scope = &scopes[depth - 1];
+      if (scope->code == '?' || (scope->code == 'D' && ++scope->values == 2)) {
+        op->exit = true;
+        depth--;
+      } else {
+        break;
+      }
+    }
+  }
+
+  free(scopes);
+}
+
+static size_t pni_compile_scan(const char *fmt, pni_op_t *ops)
+{
+  size_t size = 0;
+  for (size_t i = 0; fmt[i]; i++) {
+    pni_op_t *op = &ops[size++];
+    op->optional = fmt[i] == '?' && fmt[i + 1] && fmt[i + 1] != '?';
+    if (op->optional) i++;
+    op->code = fmt[i];
+    op->arg = 0;
+    op->exit = false;
+    op->skip = 0;
+    // a '?' that is left is an error, nothing after it is reached
+    if (op->code == '?') break;
+  }
+  return size;
+}
+
+// The number of ops after ops[0] that pn_data_scan suspends when
+// ops[0] is not found: the next two values for a 'D' or '@', the rest
+// of the list for a '[', with the count restarted by any '{' inside.
+static size_t pni_scan_skip(const pni_op_t *ops, size_t size)
+{
+  int count;
+  int level = 0;
+  int count_level = level;
+  if (ops[0].code == '[') {
+    count = 1;
+    level++;
+  } else {
+    count = 2;
+  }
+
+  for (size_t i = 1; i < size; i++) {
+    switch (ops[i].code) {
+    case '[':
+      level++;
+      break;
+    case '{':
+      count = 1;
+      count_level = level;
+      level++;
+      break;
+    case ']':
+    case '}':
+      level--;
+      if (level == count_level) count--;
+      break;
+    default:
+      if (level == count_level) count--;
+      break;
+    }
+    if (!count) return i;
+  }
+
+  return size - 1;
+}
+
+static void pn_program_finalize(void *object)
+{
+  pn_program_t *program = (pn_program_t *) object;
+  free(program->fill);
+  free(program->scan);
+}
+
+#define pn_program_initialize NULL
+#define pn_program_hashcode NULL
+#define pn_program_compare NULL
+#define pn_program_inspect NULL
+
+pn_program_t *pn_program(const char *fmt)
+{
+  static pn_class_t clazz = PN_CLASS(pn_program);
+  pn_program_t *program = (pn_program_t *) pn_new(sizeof(pn_program_t), &clazz);
+  size_t len = pn_max(strlen(fmt), 1);
+
+  program->fmt = fmt;
+  program->fill = (pni_op_t *) malloc(len * sizeof(pni_op_t));
+  program->fill_size = pni_compile_fill(fmt, program->fill);
+  pni_compile_exits(program->fill, program->fill_size);
+
+  program->scan = (pni_op_t *) malloc(len * sizeof(pni_op_t));
+  program->scan_size = pni_compile_scan(fmt, program->scan);
+  for (size_t i = 0; i < program->scan_size; i++) {
+    pni_op_t *op = &program->scan[i];
+    if (op->code == 'D' || op->code == '@' || op->code == '[') {
+      op->skip = pni_scan_skip(op, program->scan_size - i);
+    }
+  }
+
+  return program;
+}
+
+void pn_program_free(pn_program_t *program)
+{
+  pn_free(program);
+}
+
+// step out of the described values and nulls the last put completed
+static void pni_fill_exit(pn_data_t *data)
+{
+  pni_node_t *parent = pn_data_node(data, data->parent);
+  while (parent) {
+    if (parent->type == PN_DESCRIBED && parent->children == 2) {
+      pn_data_exit(data);
+      parent = pn_data_node(data, data->parent);
+    } else if (parent->type == PN_NULL && parent->children == 1) {
+      pn_data_exit(data);
+      pni_node_t *current = pn_data_node(data, data->current);
+      current->down = 0;
+      current->children = 0;
+      parent = pn_data_node(data, data->parent);
+    } else {
+      break;
+    }
+  }
+}
+
+int pn_data_vfill_program(pn_data_t *data, pn_program_t *program, va_list ap)
+{
+  int err = 0;
+  for (size_t i = 0; i < program->fill_size; i++) {
+    const pni_op_t *op = &program->fill[i];
+
+    switch (op->code) {
+    case 'n':
+      err = pn_data_put_null(data);
+      break;
+    case 'o':
+      err = pn_data_put_bool(data, va_arg(ap, int));
+      break;
+    case 'B':
+      err = pn_data_put_ubyte(data, va_arg(ap, unsigned int));
+      break;
+    case 'b':
+      err = pn_data_put_byte(data, va_arg(ap, int));
+      break;
+    case 'H':
+      err = pn_data_put_ushort(data, va_arg(ap, unsigned int));
+      break;
+    case 'h':
+      err = pn_data_put_short(data, va_arg(ap, int));
+      break;
+    case 'I':
+      err = pn_data_put_uint(data, va_arg(ap, uint32_t));
+      break;
+    case 'i':
+      err = pn_data_put_int(data, va_arg(ap, uint32_t));
+      break;
+    case 'L':
+      err = pn_data_put_ulong(data, va_arg(ap, uint64_t));
+      break;
+    case 'l':
+      err = pn_data_put_long(data, va_arg(ap, int64_t));
+      break;
+    case 't':
+      err = pn_data_put_timestamp(data, va_arg(ap, pn_timestamp_t));
+      break;
+    case 'f':
+      err = pn_data_put_float(data, va_arg(ap, double));
+      break;
+    case 'd':
+      err = pn_data_put_double(data, va_arg(ap, double));
+      break;
+    case 'z':
+      {
+        size_t size = va_arg(ap, size_t);
+        char *start = va_arg(ap, char *);
+        err = start ? pn_data_put_binary(data, pn_bytes(size, start)) : pn_data_put_null(data);
+      }
+      break;
+    case 'S':
+    case 's':
+      {
+        char *start = va_arg(ap, char *);
+        if (!start) {
+          err = pn_data_put_null(data);
+        } else if (op->code == 'S') {
+          err = pn_data_put_string(data, pn_bytes(strlen(start), start));
+        } else {
+          err = pn_data_put_symbol(data, pn_bytes(strlen(start), start));
+        }
+      }
+      break;
+    case 'D':
+      err = pn_data_put_described(data);
+      pn_data_enter(data);
+      break;
+    case 'T':
+      {
+        pni_node_t *parent = pn_data_node(data, data->parent);
+        if (parent->type == PN_ARRAY) {
+          parent->array_type = (pn_type_t) va_arg(ap, int);
+        } else {
+          return pn_error_format(data->error, PN_ERR, "naked type");
+        }
+      }
+      break;
+    case '@':
+      err = pn_data_put_array(data, op->arg == 'D', (pn_type_t) 0);
+      pn_data_enter(data);
+      break;
+    case '[':
+      if (op->arg != 'T') {
+        err = pn_data_put_list(data);
+        if (err) return err;
+        pn_data_enter(data);
+      }
+      break;
+    case '{':
+      err = pn_data_put_map(data);
+      if (err) return err;
+      pn_data_enter(data);
+      break;
+    case '}':
+    case ']':
+      if (!pn_data_exit(data))
+        return pn_error_format(data->error, PN_ERR, "exit failed");
+      break;
+    case '?':
+      if (!va_arg(ap, int)) {
+        err = pn_data_put_null(data);
+        if (err) return err;
+        pn_data_enter(data);
+      }
+      break;
+    case '*':
+      {
+        int count = va_arg(ap, int);
+        void *ptr = va_arg(ap, void *);
+        if (op->arg != 's') {
+          fprintf(stderr, "unrecognized * code: 0x%.2X '%c'\n", op->code, op->code);
+          return PN_ARG_ERR;
+        }
+        char **sptr = (char **) ptr;
+        for (int i = 0; i < count; i++) {
+          err = pn_data_fill(data, "s", *(sptr++));
+          if (err) return err;
+        }
+      }
+      break;
+    case 'C':
+      {
+        pn_data_t *src = va_arg(ap, pn_data_t *);
+        if (src && pn_data_size(src) > 0) {
+          err = pn_data_appendn(data, src, 1);
+        } else {
+          err = pn_data_put_null(data);
+        }
+      }
+      break;
+    default:
+      fprintf(stderr, "unrecognized fill code: 0x%.2X '%c'\n", op->code, op->code);
+      return PN_ARG_ERR;
+    }
+
+    if (err) return err;
+
+    if (op->exit) pni_fill_exit(data);
+  }
+
+  return 0;
+}
+
+int pn_data_fill_program(pn_data_t *data, pn_program_t *program, ...)
+{
+  va_list ap;
+  va_start(ap, program);
+  int err = pn_data_vfill_program(data, program, ap);
+  va_end(ap);
+  return err;
+}
+
+// the node of the next value scanned if it is of the given type
+static inline pni_node_t *pni_scan_type(pn_data_t *data, bool suspend, pn_type_t type)
+{
+  pn_type_t next;
+  if (pn_scan_next(data, &next, suspend) && next == type) {
+    return pn_data_node(data, data->current);
+  } else {
+    return NULL;
+  }
+}
+
+int pn_data_vscan_program(pn_data_t *data, pn_program_t *program, va_list ap)
+{
+  pn_data_rewind(data);
+  bool at = false;
+  size_t suspended = 0;
+
+  for (size_t i = 0; i < program->scan_size; i++) {
+    const pni_op_t *op = &program->scan[i];
+    bool *scanarg = op->optional ? va_arg(ap, bool *) : NULL;
+    bool suspend = suspended > 0;
+    if (suspend) suspended--;
+    bool scanned;
+    pn_type_t type;
+
+    switch (op->code) {
+    case 'n':
+      scanned = pni_scan_type(data, suspend, PN_NULL) != NULL;
+      break;
+    case 'o':
+      {
+        bool *value = va_arg(ap, bool *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_BOOL);
+        scanned = node != NULL;
+        *value = node ? node->u.as_bool : 0;
+      }
+      break;
+    case 'B':
+      {
+        uint8_t *value = va_arg(ap, uint8_t *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_UBYTE);
+        scanned = node != NULL;
+        *value = node ? node->u.as_ubyte : 0;
+      }
+      break;
+    case 'b':
+      {
+        int8_t *value = va_arg(ap, int8_t *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_BYTE);
+        scanned = node != NULL;
+        *value = node ? node->u.as_byte : 0;
+      }
+      break;
+    case 'H':
+      {
+        uint16_t *value = va_arg(ap, uint16_t *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_USHORT);
+        scanned = node != NULL;
+        *value = node ? node->u.as_ushort : 0;
+      }
+      break;
+    case 'h':
+      {
+        int16_t *value = va_arg(ap, int16_t *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_SHORT);
+        scanned = node != NULL;
+        *value = node ? node->u.as_short : 0;
+      }
+      break;
+    case 'I':
+      {
+        uint32_t *value = va_arg(ap, uint32_t *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_UINT);
+        scanned = node != NULL;
+        *value = node ? node->u.as_uint : 0;
+      }
+      break;
+    case 'i':
+      {
+        int32_t *value = va_arg(ap, int32_t *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_INT);
+        scanned = node != NULL;
+        *value = node ? node->u.as_int : 0;
+      }
+      break;
+    case 'c':
+      {
+        pn_char_t *value = va_arg(ap, pn_char_t *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_CHAR);
+        scanned = node != NULL;
+        *value = node ? node->u.as_char : 0;
+      }
+      break;
+    case 'L':
+      {
+        uint64_t *value = va_arg(ap, uint64_t *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_ULONG);
+        scanned = node != NULL;
+        *value = node ? node->u.as_ulong : 0;
+      }
+      break;
+    case 'l':
+      {
+        int64_t *value = va_arg(ap, int64_t *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_LONG);
+        scanned = node != NULL;
+        *value = node ? node->u.as_long : 0;
+      }
+      break;
+    case 't':
+      {
+        pn_timestamp_t *value = va_arg(ap, pn_timestamp_t *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_TIMESTAMP);
+        scanned = node != NULL;
+        *value = node ? node->u.as_timestamp : 0;
+      }
+      break;
+    case 'f':
+      {
+        float *value = va_arg(ap, float *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_FLOAT);
+        scanned = node != NULL;
+        *value = node ? node->u.as_float : 0;
+      }
+      break;
+    case 'd':
+      {
+        double *value = va_arg(ap, double *);
+        pni_node_t *node = pni_scan_type(data, suspend, PN_DOUBLE);
+        scanned = node != NULL;
+        *value = node ? node->u.as_double : 0;
+      }
+      break;
+    case 'z':
+    case 'S':
+    case 's':
+      {
+        pn_bytes_t *bytes = va_arg(ap, pn_bytes_t *);
+        pn_type_t wanted = op->code == 'z' ? PN_BINARY : (op->code == 'S' ? PN_STRING : PN_SYMBOL);
+        pni_node_t *node = pni_scan_type(data, suspend, wanted);
+        scanned = node != NULL;
+        *bytes = node ? pni_node_bytes(data, node) : pn_bytes(0, NULL);
+      }
+      break;
+    case 'D':
+      scanned = pni_scan_type(data, suspend, PN_DESCRIBED) != NULL;
+      if (scanned) {
+        pn_data_enter(data);
+      } else if (!suspend) {
+        suspended = op->skip;
+      }
+      break;
+    case '@':
+      scanned = pni_scan_type(data, suspend, PN_ARRAY) != NULL;
+      if (scanned) {
+        pn_data_enter(data);
+        at = true;
+      } else if (!suspend) {
+        suspended = op->skip;
+      }
+      break;
+    case '[':
+      if (at) {
+        scanned = true;
+        at = false;
+      } else {
+        scanned = pni_scan_type(data, suspend, PN_LIST) != NULL;
+        if (scanned) {
+          pn_data_enter(data);
+        } else if (!suspend) {
+          suspended = op->skip;
+        }
+      }
+      break;
+    case '{':
+      // a missing map does not suspend the scan
+      scanned = pni_scan_type(data, suspend, PN_MAP) != NULL;
+      if (scanned) pn_data_enter(data);
+      break;
+    case ']':
+    case '}':
+      scanned = false;
+      if (!suspend && !pn_data_exit(data))
+        return pn_error_format(data->error, PN_ERR, "exit failed");
+      break;
+    case '.':
+      scanned = pn_scan_next(data, &type, suspend);
+      break;
+    case '?':
+      return pn_error_format(data->error, PN_ARG_ERR, "codes must follow a ?");
+    case 'C':
+      {
+        pn_data_t *dst = va_arg(ap, pn_data_t *);
+        scanned = false;
+        if (!suspend) {
+          size_t old = pn_data_size(dst);
+          pni_node_t *next = pn_data_peek(data);
+          if (next && next->type != PN_NULL) {
+            pn_data_narrow(data);
+            int err = pn_data_appendn(dst, data, 1);
+            pn_data_widen(data);
+            if (err) return err;
+            scanned = pn_data_size(dst) > old;
+          }
+          pn_data_next(data);
+        }
+      }
+      break;
+    default:
+      return pn_error_format(data->error, PN_ARG_ERR, "unrecognized scan code: 0x%.2X '%c'",
+                             op->code, op->code);
+    }
+
+    if (scanarg) *scanarg = scanned;
+  }
+
+  return 0;
+}
+
+int pn_data_scan_program(pn_data_t *data, pn_program_t *program, ...)
+{
+  va_list ap;
+  va_start(ap, program);
+  int err = pn_data_vscan_program(data, program, ap);
+  va_end(ap);
+  return err;
+}
+
+// Formats compiled for pni_data_fill_cached and pni_data_scan_cached,
+// shared by every pn_data_t and kept by address until the process
+// exits.  Threads may race to add the same format, and the one that
+// loses frees its copy.  Formats beyond PNI_PROGRAMS are interpreted.
+#define PNI_PROGRAMS (256)
+
+static pn_program_t *volatile pni_programs[PNI_PROGRAMS];
+
+static pn_program_t *pni_data_program(const char *fmt)
+{
+  size_t slot = (uintptr_t) fmt % PNI_PROGRAMS;
+  for (size_t probes = 0; probes < PNI_PROGRAMS; ) {
+    pn_program_t *program = pni_programs[slot];
+    if (program && program->fmt == fmt) {
+      return program;
+    } else if (!program) {
+      program = pn_program(fmt);
+      if (pn_i_atomic_cas(&pni_programs[slot], NULL, program)) {
+        return program;
+      }
+      // another thread took the entry first, look at it again
+      pn_program_free(program);
+    } else {
+      slot = (slot + 1) % PNI_PROGRAMS;
+      probes++;
+    }
+  }
+
+  return NULL;
+}
+
+int pni_data_vfill_cached(pn_data_t *data, const char *fmt, va_list ap)
+{
+  pn_program_t *program = pni_data_program(fmt);
+  return program ? pn_data_vfill_program(data, program, ap) : pn_data_vfill(data, fmt, ap);
+}
+
+int pni_data_fill_cached(pn_data_t *data, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  int err = pni_data_vfill_cached(data, fmt, ap);
+  va_end(ap);
+  return err;
+}
+
+int pni_data_vscan_cached(pn_data_t *data, const char *fmt, va_list ap)
+{
+  pn_program_t *program = pni_data_program(fmt);
+  return program ? pn_data_vscan_program(data, program, ap) : pn_data_vscan(data, fmt, ap);
+}
+
+int pni_data_scan_cached(pn_data_t *data, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  int err = pni_data_vscan_cached(data, fmt, ap);
+  va_end(ap);
+  return err;
+}
+
 static int pni_data_inspectify(pn_data_t *data)
 {
-  int err = pn_string_set(data->str, "");
+  int err = pn_string_set(pni_data_str(data), "");
   if (err) return err;
   return pn_data_inspect(data, data->str);
 }
@@ -1097,6 +1818,7 @@ int pn_data_format(pn_data_t *data, char *bytes, size_t *size)
 int pn_data_resize(pn_data_t *data, size_t size)
 {
   if (!data || size > data->capacity) return PN_ARG_ERR;
+  data->generation++;
   data->size = size;
   return 0;
 }
@@ -1141,12 +1863,14 @@ pni_node_t *pn_data_current(pn_data_t *data)
 
 void pn_data_narrow(pn_data_t *data)
 {
+  data->generation++;
   data->base_parent = data->parent;
   data->base_current = data->current;
 }
 
 void pn_data_widen(pn_data_t *data)
 {
+  data->generation++;
   data->base_parent = 0;
   data->base_current = 0;
 }
@@ -1271,7 +1995,7 @@ pn_type_t pn_data_type(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
   if (node) {
-    return node->atom.type;
+    return (pn_type_t) node->type;
   } else {
     return (pn_type_t) -1;
   }
@@ -1281,7 +2005,7 @@ pn_type_t pni_data_parent_type(pn_data_t *data)
 {
   pni_node_t *node = pn_data_node(data, data->parent);
   if (node) {
-    return node->atom.type;
+    return (pn_type_t) node->type;
   } else {
     return (pn_type_t) -1;
   }
@@ -1352,12 +2076,13 @@ void pn_data_dump(pn_data_t *data)
   for (unsigned i = 0; i < data->size; i++)
   {
     pni_node_t *node = &data->nodes[i];
-    pn_string_set(data->str, "");
-    pni_inspect_atom((pn_atom_t *) &node->atom, data->str);
-    printf("Node %i: prev=%" PN_ZI ", next=%" PN_ZI ", parent=%" PN_ZI ", down=%" PN_ZI 
-           ", children=%" PN_ZI ", type=%s (%s)\n",
-           i + 1, node->prev, node->next, node->parent, node->down, node->children,
-           pn_type_name(node->atom.type), pn_string_get(data->str));
+    pn_atom_t atom = pni_node_atom(data, node);
+    pn_string_set(pni_data_str(data), "");
+    pni_inspect_atom(&atom, data->str);
+    printf("Node %i: prev=%u, next=%u, parent=%u, down=%u, children=%u, type=%s (%s)\n",
+           i + 1, (unsigned) node->prev, (unsigned) node->next, (unsigned) node->parent,
+           (unsigned) node->down, (unsigned) node->children,
+           pn_type_name((pn_type_t) node->type), pn_string_get(data->str));
   }
 }
 
@@ -1366,6 +2091,7 @@ pni_node_t *pn_data_add(pn_data_t *data)
   pni_node_t *current = pn_data_current(data);
   pni_node_t *parent = pn_data_node(data, data->parent);
   pni_node_t *node;
+  data->generation++;
 
   if (current) {
     if (current->next) {
@@ -1407,237 +2133,303 @@ pni_node_t *pn_data_add(pn_data_t *data)
 
   node->down = 0;
   node->children = 0;
-  node->data = false;
-  node->data_offset = 0;
-  node->data_size = 0;
+  node->described = false;
+  node->borrowed = false;
+  memset(&node->u, 0, sizeof(node->u));
   data->current = pn_data_id(data, node);
   return node;
 }
 
 ssize_t pn_data_encode(pn_data_t *data, char *bytes, size_t size)
 {
-  return pn_encoder_encode(data->encoder, data, bytes, size);
+  return pn_encoder_encode(pni_data_encoder(data), data, bytes, size);
+}
+
+ssize_t pn_data_encoded_size(pn_data_t *data)
+{
+  return pn_encoder_size(pni_data_encoder(data), data);
 }
 
 ssize_t pn_data_decode(pn_data_t *data, const char *bytes, size_t size)
 {
-  return pn_decoder_decode(data->decoder, bytes, size, data);
+  return pn_decoder_decode(pni_data_decoder(data), bytes, size, data);
+}
+
+ssize_t pn_data_decode_borrowed(pn_data_t *data, const char *bytes, size_t size)
+{
+  // offsets into bytes are 32 bits wide
+  if (size >= UINT32_MAX) {
+    return pn_data_decode(data, bytes, size);
+  }
+
+  // nodes can only borrow from one input at a time
+  if (data->borrow && data->borrow != bytes) {
+    int err = pn_data_intern_all(data);
+    if (err) return err;
+  }
+
+  data->borrow = bytes;
+  data->borrowing = true;
+  ssize_t result = pn_decoder_decode(pni_data_decoder(data), bytes, size, data);
+  data->borrowing = false;
+  return result;
+}
+
+int pn_data_intern_all(pn_data_t *data)
+{
+  for (size_t i = 0; i < data->size; i++) {
+    pni_node_t *node = &data->nodes[i];
+    if (node->borrowed) {
+      pn_bytes_t bytes = pni_node_bytes(data, node);
+      node->borrowed = false;
+      int err = pni_node_intern(data, node, bytes.start, bytes.size);
+      if (err) return err;
+    }
+  }
+  data->borrow = NULL;
+  return 0;
 }
 
 int pn_data_put_list(pn_data_t *data)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_LIST;
+  node->type = PN_LIST;
   return 0;
 }
 
 int pn_data_put_map(pn_data_t *data)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_MAP;
+  node->type = PN_MAP;
   return 0;
 }
 
 int pn_data_put_array(pn_data_t *data, bool described, pn_type_t type)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_ARRAY;
+  node->type = PN_ARRAY;
   node->described = described;
-  node->type = type;
+  node->array_type = type;
   return 0;
 }
 
 void pni_data_set_array_type(pn_data_t *data, pn_type_t type)
 {
   pni_node_t *array = pn_data_current(data);
-  array->type = type;
+  array->array_type = type;
 }
 
 int pn_data_put_described(pn_data_t *data)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_DESCRIBED;
+  node->type = PN_DESCRIBED;
   return 0;
 }
 
 int pn_data_put_null(pn_data_t *data)
 {
   pni_node_t *node = pn_data_add(data);
-  pni_atom_init(&node->atom, PN_NULL);
+  node->type = PN_NULL;
   return 0;
 }
 
 int pn_data_put_bool(pn_data_t *data, bool b)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_BOOL;
-  node->atom.u.as_bool = b;
+  node->type = PN_BOOL;
+  node->u.as_bool = b;
   return 0;
 }
 
 int pn_data_put_ubyte(pn_data_t *data, uint8_t ub)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_UBYTE;
-  node->atom.u.as_ubyte = ub;
+  node->type = PN_UBYTE;
+  node->u.as_ubyte = ub;
   return 0;
 }
 
 int pn_data_put_byte(pn_data_t *data, int8_t b)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_BYTE;
-  node->atom.u.as_byte = b;
+  node->type = PN_BYTE;
+  node->u.as_byte = b;
   return 0;
 }
 
 int pn_data_put_ushort(pn_data_t *data, uint16_t us)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_USHORT;
-  node->atom.u.as_ushort = us;
+  node->type = PN_USHORT;
+  node->u.as_ushort = us;
   return 0;
 }
 
 int pn_data_put_short(pn_data_t *data, int16_t s)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_SHORT;
-  node->atom.u.as_short = s;
+  node->type = PN_SHORT;
+  node->u.as_short = s;
   return 0;
 }
 
 int pn_data_put_uint(pn_data_t *data, uint32_t ui)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_UINT;
-  node->atom.u.as_uint = ui;
+  node->type = PN_UINT;
+  node->u.as_uint = ui;
   return 0;
 }
 
 int pn_data_put_int(pn_data_t *data, int32_t i)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_INT;
-  node->atom.u.as_int = i;
+  node->type = PN_INT;
+  node->u.as_int = i;
   return 0;
 }
 
 int pn_data_put_char(pn_data_t *data, pn_char_t c)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_CHAR;
-  node->atom.u.as_char = c;
+  node->type = PN_CHAR;
+  node->u.as_char = c;
   return 0;
 }
 
 int pn_data_put_ulong(pn_data_t *data, uint64_t ul)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_ULONG;
-  node->atom.u.as_ulong = ul;
+  node->type = PN_ULONG;
+  node->u.as_ulong = ul;
   return 0;
 }
 
 int pn_data_put_long(pn_data_t *data, int64_t l)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_LONG;
-  node->atom.u.as_long = l;
+  node->type = PN_LONG;
+  node->u.as_long = l;
   return 0;
 }
 
 int pn_data_put_timestamp(pn_data_t *data, pn_timestamp_t t)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_TIMESTAMP;
-  node->atom.u.as_timestamp = t;
+  node->type = PN_TIMESTAMP;
+  node->u.as_timestamp = t;
   return 0;
 }
 
 int pn_data_put_float(pn_data_t *data, float f)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_FLOAT;
-  node->atom.u.as_float = f;
+  node->type = PN_FLOAT;
+  node->u.as_float = f;
   return 0;
 }
 
 int pn_data_put_double(pn_data_t *data, double d)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_DOUBLE;
-  node->atom.u.as_double = d;
+  node->type = PN_DOUBLE;
+  node->u.as_double = d;
   return 0;
 }
 
 int pn_data_put_decimal32(pn_data_t *data, pn_decimal32_t d)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_DECIMAL32;
-  node->atom.u.as_decimal32 = d;
+  node->type = PN_DECIMAL32;
+  node->u.as_decimal32 = d;
   return 0;
 }
 
 int pn_data_put_decimal64(pn_data_t *data, pn_decimal64_t d)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_DECIMAL64;
-  node->atom.u.as_decimal64 = d;
+  node->type = PN_DECIMAL64;
+  node->u.as_decimal64 = d;
   return 0;
 }
 
 int pn_data_put_decimal128(pn_data_t *data, pn_decimal128_t d)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_DECIMAL128;
-  memmove(node->atom.u.as_decimal128.bytes, d.bytes, 16);
-  return 0;
+  node->type = PN_DECIMAL128;
+  return pni_node_intern(data, node, (const char *) d.bytes, 16);
 }
 
 int pn_data_put_uuid(pn_data_t *data, pn_uuid_t u)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_UUID;
-  memmove(node->atom.u.as_uuid.bytes, u.bytes, 16);
-  return 0;
+  node->type = PN_UUID;
+  return pni_node_intern(data, node, (const char *) u.bytes, 16);
 }
 
-int pn_data_put_binary(pn_data_t *data, pn_bytes_t bytes)
+// binaries, strings and symbols, which the decoder may leave in its input
+static int pni_data_put_bytes(pn_data_t *data, pn_type_t type, pn_bytes_t bytes)
 {
   pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_BINARY;
-  node->atom.u.as_bytes = bytes;
-  return pn_data_intern_node(data, node);
+  node->type = type;
+  if (data->borrowing) {
+    node->borrowed = true;
+    node->u.as_bytes.offset = bytes.start - data->borrow;
+    node->u.as_bytes.size = bytes.size;
+    return 0;
+  }
+  return pni_node_intern(data, node, bytes.start, bytes.size);
+}
+
+int pn_data_put_binary(pn_data_t *data, pn_bytes_t bytes)
+{
+  return pni_data_put_bytes(data, PN_BINARY, bytes);
 }
 
 int pn_data_put_string(pn_data_t *data, pn_bytes_t string)
 {
-  pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_STRING;
-  node->atom.u.as_bytes = string;
-  return pn_data_intern_node(data, node);
+  return pni_data_put_bytes(data, PN_STRING, string);
 }
 
 int pn_data_put_symbol(pn_data_t *data, pn_bytes_t symbol)
 {
-  pni_node_t *node = pn_data_add(data);
-  node->atom.type = PN_SYMBOL;
-  node->atom.u.as_bytes = symbol;
-  return pn_data_intern_node(data, node);
+  return pni_data_put_bytes(data, PN_SYMBOL, symbol);
 }
 
 int pn_data_put_atom(pn_data_t *data, pn_atom_t atom)
 {
-  pni_node_t *node = pn_data_add(data);
-  node->atom = atom;
-  return pn_data_intern_node(data, node);
+  switch (atom.type) {
+  case PN_NULL: return pn_data_put_null(data);
+  case PN_BOOL: return pn_data_put_bool(data, atom.u.as_bool);
+  case PN_UBYTE: return pn_data_put_ubyte(data, atom.u.as_ubyte);
+  case PN_BYTE: return pn_data_put_byte(data, atom.u.as_byte);
+  case PN_USHORT: return pn_data_put_ushort(data, atom.u.as_ushort);
+  case PN_SHORT: return pn_data_put_short(data, atom.u.as_short);
+  case PN_UINT: return pn_data_put_uint(data, atom.u.as_uint);
+  case PN_INT: return pn_data_put_int(data, atom.u.as_int);
+  case PN_CHAR: return pn_data_put_char(data, atom.u.as_char);
+  case PN_ULONG: return pn_data_put_ulong(data, atom.u.as_ulong);
+  case PN_LONG: return pn_data_put_long(data, atom.u.as_long);
+  case PN_TIMESTAMP: return pn_data_put_timestamp(data, atom.u.as_timestamp);
+  case PN_FLOAT: return pn_data_put_float(data, atom.u.as_float);
+  case PN_DOUBLE: return pn_data_put_double(data, atom.u.as_double);
+  case PN_DECIMAL32: return pn_data_put_decimal32(data, atom.u.as_decimal32);
+  case PN_DECIMAL64: return pn_data_put_decimal64(data, atom.u.as_decimal64);
+  case PN_DECIMAL128: return pn_data_put_decimal128(data, atom.u.as_decimal128);
+  case PN_UUID: return pn_data_put_uuid(data, atom.u.as_uuid);
+  case PN_BINARY: return pn_data_put_binary(data, atom.u.as_bytes);
+  case PN_STRING: return pn_data_put_string(data, atom.u.as_bytes);
+  case PN_SYMBOL: return pn_data_put_symbol(data, atom.u.as_bytes);
+  default:
+    return pn_error_format(data->error, PN_ARG_ERR, "not an atom: %s",
+                           pn_type_name(atom.type));
+  }
 }
 
 size_t pn_data_get_list(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_LIST) {
+  if (node && node->type == PN_LIST) {
     return node->children;
   } else {
     return 0;
@@ -1647,7 +2439,7 @@ size_t pn_data_get_list(pn_data_t *data)
 size_t pn_data_get_map(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_MAP) {
+  if (node && node->type == PN_MAP) {
     return node->children;
   } else {
     return 0;
@@ -1657,7 +2449,7 @@ size_t pn_data_get_map(pn_data_t *data)
 size_t pn_data_get_array(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_ARRAY) {
+  if (node && node->type == PN_ARRAY) {
     if (node->described) {
       return node->children - 1;
     } else {
@@ -1671,7 +2463,7 @@ size_t pn_data_get_array(pn_data_t *data)
 bool pn_data_is_array_described(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_ARRAY) {
+  if (node && node->type == PN_ARRAY) {
     return node->described;
   } else {
     return false;
@@ -1681,8 +2473,8 @@ bool pn_data_is_array_described(pn_data_t *data)
 pn_type_t pn_data_get_array_type(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_ARRAY) {
-    return node->type;
+  if (node && node->type == PN_ARRAY) {
+    return (pn_type_t) node->array_type;
   } else {
     return (pn_type_t) -1;
   }
@@ -1691,20 +2483,20 @@ pn_type_t pn_data_get_array_type(pn_data_t *data)
 bool pn_data_is_described(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  return node && node->atom.type == PN_DESCRIBED;
+  return node && node->type == PN_DESCRIBED;
 }
 
 bool pn_data_is_null(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  return node && node->atom.type == PN_NULL;
+  return node && node->type == PN_NULL;
 }
 
 bool pn_data_get_bool(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_BOOL) {
-    return node->atom.u.as_bool;
+  if (node && node->type == PN_BOOL) {
+    return node->u.as_bool;
   } else {
     return false;
   }
@@ -1713,8 +2505,8 @@ bool pn_data_get_bool(pn_data_t *data)
 uint8_t pn_data_get_ubyte(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_UBYTE) {
-    return node->atom.u.as_ubyte;
+  if (node && node->type == PN_UBYTE) {
+    return node->u.as_ubyte;
   } else {
     return 0;
   }
@@ -1723,8 +2515,8 @@ uint8_t pn_data_get_ubyte(pn_data_t *data)
 int8_t pn_data_get_byte(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_BYTE) {
-    return node->atom.u.as_byte;
+  if (node && node->type == PN_BYTE) {
+    return node->u.as_byte;
   } else {
     return 0;
   }
@@ -1733,8 +2525,8 @@ int8_t pn_data_get_byte(pn_data_t *data)
 uint16_t pn_data_get_ushort(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_USHORT) {
-    return node->atom.u.as_ushort;
+  if (node && node->type == PN_USHORT) {
+    return node->u.as_ushort;
   } else {
     return 0;
   }
@@ -1743,8 +2535,8 @@ uint16_t pn_data_get_ushort(pn_data_t *data)
 int16_t pn_data_get_short(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_SHORT) {
-    return node->atom.u.as_short;
+  if (node && node->type == PN_SHORT) {
+    return node->u.as_short;
   } else {
     return 0;
   }
@@ -1753,8 +2545,8 @@ int16_t pn_data_get_short(pn_data_t *data)
 uint32_t pn_data_get_uint(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_UINT) {
-    return node->atom.u.as_uint;
+  if (node && node->type == PN_UINT) {
+    return node->u.as_uint;
   } else {
     return 0;
   }
@@ -1763,8 +2555,8 @@ uint32_t pn_data_get_uint(pn_data_t *data)
 int32_t pn_data_get_int(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_INT) {
-    return node->atom.u.as_int;
+  if (node && node->type == PN_INT) {
+    return node->u.as_int;
   } else {
     return 0;
   }
@@ -1773,8 +2565,8 @@ int32_t pn_data_get_int(pn_data_t *data)
 pn_char_t pn_data_get_char(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_CHAR) {
-    return node->atom.u.as_char;
+  if (node && node->type == PN_CHAR) {
+    return node->u.as_char;
   } else {
     return 0;
   }
@@ -1783,8 +2575,8 @@ pn_char_t pn_data_get_char(pn_data_t *data)
 uint64_t pn_data_get_ulong(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_ULONG) {
-    return node->atom.u.as_ulong;
+  if (node && node->type == PN_ULONG) {
+    return node->u.as_ulong;
   } else {
     return 0;
   }
@@ -1793,8 +2585,8 @@ uint64_t pn_data_get_ulong(pn_data_t *data)
 int64_t pn_data_get_long(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_LONG) {
-    return node->atom.u.as_long;
+  if (node && node->type == PN_LONG) {
+    return node->u.as_long;
   } else {
     return 0;
   }
@@ -1803,8 +2595,8 @@ int64_t pn_data_get_long(pn_data_t *data)
 pn_timestamp_t pn_data_get_timestamp(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_TIMESTAMP) {
-    return node->atom.u.as_timestamp;
+  if (node && node->type == PN_TIMESTAMP) {
+    return node->u.as_timestamp;
   } else {
     return 0;
   }
@@ -1813,8 +2605,8 @@ pn_timestamp_t pn_data_get_timestamp(pn_data_t *data)
 float pn_data_get_float(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_FLOAT) {
-    return node->atom.u.as_float;
+  if (node && node->type == PN_FLOAT) {
+    return node->u.as_float;
   } else {
     return 0;
   }
@@ -1823,8 +2615,8 @@ float pn_data_get_float(pn_data_t *data)
 double pn_data_get_double(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_DOUBLE) {
-    return node->atom.u.as_double;
+  if (node && node->type == PN_DOUBLE) {
+    return node->u.as_double;
   } else {
     return 0;
   }
@@ -1833,8 +2625,8 @@ double pn_data_get_double(pn_data_t *data)
 pn_decimal32_t pn_data_get_decimal32(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_DECIMAL32) {
-    return node->atom.u.as_decimal32;
+  if (node && node->type == PN_DECIMAL32) {
+    return node->u.as_decimal32;
   } else {
     return 0;
   }
@@ -1843,8 +2635,8 @@ pn_decimal32_t pn_data_get_decimal32(pn_data_t *data)
 pn_decimal64_t pn_data_get_decimal64(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_DECIMAL64) {
-    return node->atom.u.as_decimal64;
+  if (node && node->type == PN_DECIMAL64) {
+    return node->u.as_decimal64;
   } else {
     return 0;
   }
@@ -1853,8 +2645,10 @@ pn_decimal64_t pn_data_get_decimal64(pn_data_t *data)
 pn_decimal128_t pn_data_get_decimal128(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_DECIMAL128) {
-    return node->atom.u.as_decimal128;
+  if (node && node->type == PN_DECIMAL128) {
+    pn_decimal128_t d;
+    memmove(d.bytes, data->base + node->u.as_bytes.offset, 16);
+    return d;
   } else {
     pn_decimal128_t t = {{0}};
     return t;
@@ -1864,8 +2658,10 @@ pn_decimal128_t pn_data_get_decimal128(pn_data_t *data)
 pn_uuid_t pn_data_get_uuid(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_UUID) {
-    return node->atom.u.as_uuid;
+  if (node && node->type == PN_UUID) {
+    pn_uuid_t u;
+    memmove(u.bytes, data->base + node->u.as_bytes.offset, 16);
+    return u;
   } else {
     pn_uuid_t t = {{0}};
     return t;
@@ -1875,8 +2671,8 @@ pn_uuid_t pn_data_get_uuid(pn_data_t *data)
 pn_bytes_t pn_data_get_binary(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_BINARY) {
-    return node->atom.u.as_bytes;
+  if (node && node->type == PN_BINARY) {
+    return pni_node_bytes(data, node);
   } else {
     pn_bytes_t t = {0};
     return t;
@@ -1886,8 +2682,8 @@ pn_bytes_t pn_data_get_binary(pn_data_t *data)
 pn_bytes_t pn_data_get_string(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_STRING) {
-    return node->atom.u.as_bytes;
+  if (node && node->type == PN_STRING) {
+    return pni_node_bytes(data, node);
   } else {
     pn_bytes_t t = {0};
     return t;
@@ -1897,8 +2693,8 @@ pn_bytes_t pn_data_get_string(pn_data_t *data)
 pn_bytes_t pn_data_get_symbol(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && node->atom.type == PN_SYMBOL) {
-    return node->atom.u.as_bytes;
+  if (node && node->type == PN_SYMBOL) {
+    return pni_node_bytes(data, node);
   } else {
     pn_bytes_t t = {0};
     return t;
@@ -1908,10 +2704,10 @@ pn_bytes_t pn_data_get_symbol(pn_data_t *data)
 pn_bytes_t pn_data_get_bytes(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
-  if (node && (node->atom.type == PN_BINARY ||
-               node->atom.type == PN_STRING ||
-               node->atom.type == PN_SYMBOL)) {
-    return node->atom.u.as_bytes;
+  if (node && (node->type == PN_BINARY ||
+               node->type == PN_STRING ||
+               node->type == PN_SYMBOL)) {
+    return pni_node_bytes(data, node);
   } else {
     pn_bytes_t t = {0};
     return t;
@@ -1922,7 +2718,7 @@ pn_atom_t pn_data_get_atom(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
   if (node) {
-    return *((pn_atom_t *) &node->atom);
+    return pni_node_atom(data, node);
   } else {
     pn_atom_t t = {PN_NULL};
     return t;
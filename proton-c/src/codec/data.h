@@ -23,43 +23,93 @@
  */
 
 #include <proton/buffer.h>
+#include <proton/object.h>
+#include <stdarg.h>
 
 #include "decoder.h"
 #include "encoder.h"
 
+typedef uint32_t pni_nid_t;
+
+// A node is kept to 32 bytes so that large maps and lists stay dense.
+// Values wider than eight bytes - binaries, strings, symbols,
+// decimal128s and uuids - live in the data's buffer, or for a borrowed
+// decode in the input, see pni_node_bytes.
 typedef struct {
-  size_t next;
-  size_t prev;
-  size_t down;
-  size_t parent;
-  size_t children;
-  pn_atom_t atom;
+  pni_nid_t next;
+  pni_nid_t prev;
+  pni_nid_t down;
+  pni_nid_t parent;
+  union {
+    bool as_bool;
+    uint8_t as_ubyte;
+    int8_t as_byte;
+    uint16_t as_ushort;
+    int16_t as_short;
+    uint32_t as_uint;
+    int32_t as_int;
+    pn_char_t as_char;
+    uint64_t as_ulong;
+    int64_t as_long;
+    pn_timestamp_t as_timestamp;
+    float as_float;
+    double as_double;
+    pn_decimal32_t as_decimal32;
+    pn_decimal64_t as_decimal64;
+    struct {
+      uint32_t offset;
+      uint32_t size;
+    } as_bytes;
+    size_t start;  // containers, where the encoder left their size
+  } u;
+  uint32_t children;
+  uint8_t type;  // pn_type_t
   // for arrays
+  uint8_t array_type;
   bool described;
-  pn_type_t type;
-  bool data;
-  size_t data_offset;
-  size_t data_size;
-  char *start;
-  bool small;
+  bool borrowed;  // as_bytes is an offset into data->borrow
 } pni_node_t;
 
 struct pn_data_t {
   size_t capacity;
   size_t size;
   pni_node_t *nodes;
-  pn_buffer_t *buf;
+  pn_buffer_t *buf;  // interned bytes of the nodes
+  char *base;        // start of buf, kept up to date as it grows
+  const char *borrow;  // input of pn_data_decode_borrowed, if any node uses it
+  bool borrowing;      // inside pn_data_decode_borrowed
+  uint32_t generation;  // moves on with every change to the nodes or narrowing
   size_t parent;
   size_t current;
   size_t base_parent;
   size_t base_current;
-  pn_decoder_t *decoder;
+  pn_decoder_t *decoder;  // NULL until first used, as are encoder and str
   pn_encoder_t *encoder;
   pn_error_t *error;
   pn_string_t *str;
 };
 
 pni_node_t *pn_data_node(pn_data_t *data, size_t nd);
+
+static inline pn_bytes_t pni_node_bytes(pn_data_t *data, pni_node_t *node)
+{
+  const char *base = node->borrowed ? data->borrow : data->base;
+  pn_bytes_t bytes = {node->u.as_bytes.size, (char *) base + node->u.as_bytes.offset};
+  return bytes;
+}
+
+// lets the holder of data notice changes made through other pointers
+static inline uint32_t pni_data_generation(pn_data_t *data)
+{
+  return data ? data->generation : 0;
+}
+
+// pn_data_fill and pn_data_scan with fmt compiled on first use and
+// kept by its address for every pn_data_t, fmt must be a string literal
+int pni_data_vfill_cached(pn_data_t *data, const char *fmt, va_list ap);
+int pni_data_fill_cached(pn_data_t *data, const char *fmt, ...);
+int pni_data_vscan_cached(pn_data_t *data, const char *fmt, va_list ap);
+int pni_data_scan_cached(pn_data_t *data, const char *fmt, ...);
 int pni_data_traverse(pn_data_t *data,
                       int (*enter)(void *ctx, pn_data_t *data, pni_node_t *node),
                       int (*exit)(void *ctx, pn_data_t *data, pni_node_t *node),
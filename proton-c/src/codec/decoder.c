@@ -492,3 +492,243 @@ ssize_t pn_decoder_decode(pn_decoder_t *decoder, const char *src, size_t size, p
 
   return decoder->position - decoder->input;
 }
+
+ssize_t pni_decoder_size(const char *src, size_t size, uint64_t *descriptor)
+{
+  pn_decoder_t decoder = {src, size, src, NULL};
+  // a described value stands for its descriptor and the value itself
+  size_t values = 1;
+
+  while (values) {
+    if (!pn_decoder_remaining(&decoder)) return PN_UNDERFLOW;
+    uint8_t code = pn_decoder_readf8(&decoder);
+    if (code == PNE_DESCRIPTOR) {
+      values++;
+      continue;
+    }
+
+    size_t width;
+    switch (code & 0xF0) {
+    case 0x40: width = 0; break;
+    case 0x50: width = 1; break;
+    case 0x60: width = 2; break;
+    case 0x70: width = 4; break;
+    case 0x80: width = 8; break;
+    case 0x90: width = 16; break;
+    case 0xA0:
+    case 0xC0:
+    case 0xE0:
+      if (!pn_decoder_remaining(&decoder)) return PN_UNDERFLOW;
+      width = pn_decoder_readf8(&decoder);
+      break;
+    case 0xB0:
+    case 0xD0:
+    case 0xF0:
+      if (pn_decoder_remaining(&decoder) < 4) return PN_UNDERFLOW;
+      width = pn_decoder_readf32(&decoder);
+      break;
+    default:
+      return PN_ARG_ERR;
+    }
+
+    if (pn_decoder_remaining(&decoder) < width) return PN_UNDERFLOW;
+    decoder.position += width;
+    values--;
+  }
+
+  ssize_t used = decoder.position - decoder.input;
+  if (descriptor) {
+    *descriptor = 0;
+    if ((uint8_t) src[0] == PNE_DESCRIPTOR) {
+      decoder.position = src + 2;
+      switch ((uint8_t) src[1]) {
+      case PNE_SMALLULONG:
+        *descriptor = pn_decoder_readf8(&decoder);
+        break;
+      case PNE_ULONG:
+        *descriptor = pn_decoder_readf64(&decoder);
+        break;
+      }
+    }
+  }
+
+  return used;
+}
+
+// reads a value that is neither described nor compound
+static int pni_decoder_atom(pn_decoder_t *decoder, uint8_t code, pn_atom_t *atom)
+{
+  conv_t conv;
+  size_t size;
+
+  switch (code)
+  {
+  case PNE_NULL:
+    atom->type = PN_NULL;
+    return 0;
+  case PNE_TRUE:
+  case PNE_FALSE:
+    atom->type = PN_BOOL;
+    atom->u.as_bool = code == PNE_TRUE;
+    return 0;
+  case PNE_UINT0:
+    atom->type = PN_UINT;
+    atom->u.as_uint = 0;
+    return 0;
+  case PNE_ULONG0:
+    atom->type = PN_ULONG;
+    atom->u.as_ulong = 0;
+    return 0;
+  case PNE_BOOLEAN:
+  case PNE_UBYTE:
+  case PNE_BYTE:
+  case PNE_SMALLUINT:
+  case PNE_SMALLINT:
+  case PNE_SMALLULONG:
+  case PNE_SMALLLONG:
+    if (!pn_decoder_remaining(decoder)) return PN_UNDERFLOW;
+    {
+      uint8_t value = pn_decoder_readf8(decoder);
+      switch (code)
+      {
+      case PNE_BOOLEAN: atom->u.as_bool = value != 0; break;
+      case PNE_UBYTE: atom->u.as_ubyte = value; break;
+      case PNE_BYTE: atom->u.as_byte = value; break;
+      case PNE_SMALLUINT: atom->u.as_uint = value; break;
+      case PNE_SMALLINT: atom->u.as_int = (int8_t) value; break;
+      case PNE_SMALLULONG: atom->u.as_ulong = value; break;
+      case PNE_SMALLLONG: atom->u.as_long = (int8_t) value; break;
+      }
+    }
+    break;
+  case PNE_USHORT:
+  case PNE_SHORT:
+    if (pn_decoder_remaining(decoder) < 2) return PN_UNDERFLOW;
+    if (code == PNE_USHORT) {
+      atom->u.as_ushort = pn_decoder_readf16(decoder);
+    } else {
+      atom->u.as_short = pn_decoder_readf16(decoder);
+    }
+    break;
+  case PNE_UINT:
+  case PNE_INT:
+  case PNE_UTF32:
+  case PNE_FLOAT:
+  case PNE_DECIMAL32:
+    if (pn_decoder_remaining(decoder) < 4) return PN_UNDERFLOW;
+    conv.i = pn_decoder_readf32(decoder);
+    switch (code)
+    {
+    case PNE_UINT: atom->u.as_uint = conv.i; break;
+    case PNE_INT: atom->u.as_int = conv.i; break;
+    case PNE_UTF32: atom->u.as_char = conv.i; break;
+    // XXX: this assumes the platform uses IEEE floats
+    case PNE_FLOAT: atom->u.as_float = conv.f; break;
+    case PNE_DECIMAL32: atom->u.as_decimal32 = conv.i; break;
+    }
+    break;
+  case PNE_ULONG:
+  case PNE_LONG:
+  case PNE_MS64:
+  case PNE_DOUBLE:
+  case PNE_DECIMAL64:
+    if (pn_decoder_remaining(decoder) < 8) return PN_UNDERFLOW;
+    conv.l = pn_decoder_readf64(decoder);
+    switch (code)
+    {
+    case PNE_ULONG: atom->u.as_ulong = conv.l; break;
+    case PNE_LONG: atom->u.as_long = conv.l; break;
+    case PNE_MS64: atom->u.as_timestamp = conv.l; break;
+    // XXX: this assumes the platform uses IEEE floats
+    case PNE_DOUBLE: atom->u.as_double = conv.d; break;
+    case PNE_DECIMAL64: atom->u.as_decimal64 = conv.l; break;
+    }
+    break;
+  case PNE_DECIMAL128:
+  case PNE_UUID:
+    if (pn_decoder_remaining(decoder) < 16) return PN_UNDERFLOW;
+    if (code == PNE_UUID) {
+      pn_decoder_readf128(decoder, &atom->u.as_uuid);
+    } else {
+      pn_decoder_readf128(decoder, &atom->u.as_decimal128);
+    }
+    break;
+  case PNE_VBIN8:
+  case PNE_STR8_UTF8:
+  case PNE_SYM8:
+    if (!pn_decoder_remaining(decoder)) return PN_UNDERFLOW;
+    size = pn_decoder_readf8(decoder);
+    if (pn_decoder_remaining(decoder) < size) return PN_UNDERFLOW;
+    atom->u.as_bytes = pn_bytes(size, (char *) decoder->position);
+    decoder->position += size;
+    break;
+  case PNE_VBIN32:
+  case PNE_STR32_UTF8:
+  case PNE_SYM32:
+    if (pn_decoder_remaining(decoder) < 4) return PN_UNDERFLOW;
+    size = pn_decoder_readf32(decoder);
+    if (pn_decoder_remaining(decoder) < size) return PN_UNDERFLOW;
+    atom->u.as_bytes = pn_bytes(size, (char *) decoder->position);
+    decoder->position += size;
+    break;
+  default:
+    return PN_ARG_ERR;
+  }
+
+  atom->type = pn_code2type(code);
+  return 0;
+}
+
+int pni_list_reader_start(pni_list_reader_t *reader, const char *src, size_t size)
+{
+  pn_decoder_t decoder = {src, size, src, NULL};
+
+  if (pn_decoder_remaining(&decoder) < 2) return PN_UNDERFLOW;
+  if (pn_decoder_readf8(&decoder) != PNE_DESCRIPTOR) return PN_ARG_ERR;
+  pn_atom_t descriptor;
+  int err = pni_decoder_atom(&decoder, pn_decoder_readf8(&decoder), &descriptor);
+  if (err) return err;
+  if (descriptor.type != PN_ULONG) return PN_ARG_ERR;
+
+  if (!pn_decoder_remaining(&decoder)) return PN_UNDERFLOW;
+  switch (pn_decoder_readf8(&decoder))
+  {
+  case PNE_LIST0:
+    reader->count = 0;
+    break;
+  case PNE_LIST8:
+    if (pn_decoder_remaining(&decoder) < 2) return PN_UNDERFLOW;
+    pn_decoder_readf8(&decoder);
+    reader->count = pn_decoder_readf8(&decoder);
+    break;
+  case PNE_LIST32:
+    if (pn_decoder_remaining(&decoder) < 8) return PN_UNDERFLOW;
+    pn_decoder_readf32(&decoder);
+    reader->count = pn_decoder_readf32(&decoder);
+    break;
+  default:
+    return PN_ARG_ERR;
+  }
+
+  reader->position = decoder.position;
+  reader->end = src + size;
+  return 0;
+}
+
+int pni_list_reader_next(pni_list_reader_t *reader, pn_atom_t *atom)
+{
+  if (!reader->count) {
+    atom->type = PN_NULL;
+    return 0;
+  }
+
+  pn_decoder_t decoder = {reader->position, reader->end - reader->position,
+                          reader->position, NULL};
+  if (!pn_decoder_remaining(&decoder)) return PN_UNDERFLOW;
+  int err = pni_decoder_atom(&decoder, pn_decoder_readf8(&decoder), atom);
+  if (err) return err;
+
+  reader->position = decoder.position;
+  reader->count--;
+  return 0;
+}
@@ -27,4 +27,27 @@ typedef struct pn_decoder_t pn_decoder_t;
 pn_decoder_t *pn_decoder(void);
 ssize_t pn_decoder_decode(pn_decoder_t *decoder, const char *src, size_t size, pn_data_t *dst);
 
+// The size of the encoded value at the start of src, found from its
+// constructors and sizes without decoding it.  If the value is
+// described by a ulong, *descriptor is set to it, otherwise to zero.
+ssize_t pni_decoder_size(const char *src, size_t size, uint64_t *descriptor);
+
+// Reads the fields of a described list, such as a message section,
+// straight from its encoding rather than through a pn_data_t.
+typedef struct {
+  const char *position;
+  const char *end;
+  size_t count;  // fields left in the list
+} pni_list_reader_t;
+
+// Starts reading the list described by a ulong at src.  PN_ARG_ERR is
+// returned if src holds anything else.
+int pni_list_reader_start(pni_list_reader_t *reader, const char *src, size_t size);
+
+// Reads the next field into *atom, which is null once the list runs
+// out.  The bytes of strings, symbols and binaries refer into src.
+// Fields that are described or compound are not read, and PN_ARG_ERR
+// is returned for them.
+int pni_list_reader_next(pni_list_reader_t *reader, pn_atom_t *atom);
+
 #endif /* decoder.h */
@@ -96,45 +96,45 @@ static uint8_t pn_type2code(pn_encoder_t *encoder, pn_type_t type)
 
 static uint8_t pn_node2code(pn_encoder_t *encoder, pni_node_t *node)
 {
-  switch (node->atom.type) {
+  switch (node->type) {
   case PN_ULONG:
-    if (node->atom.u.as_ulong < 256) {
+    if (node->u.as_ulong < 256) {
       return PNE_SMALLULONG;
     } else {
       return PNE_ULONG;
     }
   case PN_UINT:
-    if (node->atom.u.as_uint < 256) {
+    if (node->u.as_uint < 256) {
       return PNE_SMALLUINT;
     } else {
       return PNE_UINT;
     }
   case PN_BOOL:
-    if (node->atom.u.as_bool) {
+    if (node->u.as_bool) {
       return PNE_TRUE;
     } else {
       return PNE_FALSE;
     }
   case PN_STRING:
-    if (node->atom.u.as_bytes.size < 256) {
+    if (node->u.as_bytes.size < 256) {
       return PNE_STR8_UTF8;
     } else {
       return PNE_STR32_UTF8;
     }
   case PN_SYMBOL:
-    if (node->atom.u.as_bytes.size < 256) {
+    if (node->u.as_bytes.size < 256) {
       return PNE_SYM8;
     } else {
       return PNE_SYM32;
     }
   case PN_BINARY:
-    if (node->atom.u.as_bytes.size < 256) {
+    if (node->u.as_bytes.size < 256) {
       return PNE_VBIN8;
     } else {
       return PNE_VBIN32;
     }
   default:
-    return pn_type2code(encoder, node->atom.type);
+    return pn_type2code(encoder, (pn_type_t) node->type);
   }
 }
 
@@ -235,7 +235,7 @@ static inline int pn_encoder_writev32(pn_encoder_t *encoder, const pn_bytes_t *v
 
 /* True if node is an element of an array - not the descriptor. */
 static bool pn_is_in_array(pn_data_t *data, pni_node_t *parent, pni_node_t *node) {
-  return (parent && parent->atom.type == PN_ARRAY) /* In array */
+  return (parent && parent->type == PN_ARRAY) /* In array */
     && !(parent->described && !node->prev); /* Not the descriptor */
 }
 
@@ -255,24 +255,31 @@ typedef union {
   double d;
 } conv_t;
 
+/** The encoding used for node, and whether the code is written before it. */
+static uint8_t pni_encoder_code(pn_encoder_t *encoder, pn_data_t *data, pni_node_t *node,
+                                bool *write_code)
+{
+  pni_node_t *parent = pn_data_node(data, node->parent);
+  /** In an array we don't write the code before each element, only the first. */
+  if (pn_is_in_array(data, parent, node)) {
+    *write_code = pn_is_first_in_array(data, parent, node);
+    return pn_type2code(encoder, (pn_type_t) parent->array_type);
+  } else {
+    *write_code = true;
+    return pn_node2code(encoder, node);
+  }
+}
+
 static int pni_encoder_enter(void *ctx, pn_data_t *data, pni_node_t *node)
 {
   pn_encoder_t *encoder = (pn_encoder_t *) ctx;
-  pni_node_t *parent = pn_data_node(data, node->parent);
   int err;
-  pn_atom_t *atom = &node->atom;
-  uint8_t code;
+  bool write_code;
+  uint8_t code = pni_encoder_code(encoder, data, node, &write_code);
   conv_t c;
+  pn_bytes_t bytes;
 
-  /** In an array we don't write the code before each element, only the first. */
-  if (pn_is_in_array(data, parent, node)) {
-    code = pn_type2code(encoder, parent->type);
-    if (pn_is_first_in_array(data, parent, node)) {
-      err = pn_encoder_writef8(encoder, code);
-      if (err) return err;
-    }
-  } else {
-    code = pn_node2code(encoder, node);
+  if (write_code) {
     err = pn_encoder_writef8(encoder, code);
     if (err) return err;
   }
@@ -282,36 +289,39 @@ static int pni_encoder_enter(void *ctx, pn_data_t *data, pni_node_t *node)
   case PNE_NULL:
   case PNE_TRUE:
   case PNE_FALSE: return 0;
-  case PNE_BOOLEAN: return pn_encoder_writef8(encoder, atom->u.as_bool);
-  case PNE_UBYTE: return pn_encoder_writef8(encoder, atom->u.as_ubyte);
-  case PNE_BYTE: return pn_encoder_writef8(encoder, atom->u.as_byte);
-  case PNE_USHORT: return pn_encoder_writef16(encoder, atom->u.as_ushort);
-  case PNE_SHORT: return pn_encoder_writef16(encoder, atom->u.as_short);
+  case PNE_BOOLEAN: return pn_encoder_writef8(encoder, node->u.as_bool);
+  case PNE_UBYTE: return pn_encoder_writef8(encoder, node->u.as_ubyte);
+  case PNE_BYTE: return pn_encoder_writef8(encoder, node->u.as_byte);
+  case PNE_USHORT: return pn_encoder_writef16(encoder, node->u.as_ushort);
+  case PNE_SHORT: return pn_encoder_writef16(encoder, node->u.as_short);
   case PNE_UINT0: return 0;
-  case PNE_SMALLUINT: return pn_encoder_writef8(encoder, atom->u.as_uint);
-  case PNE_UINT: return pn_encoder_writef32(encoder, atom->u.as_uint);
-  case PNE_SMALLINT: return pn_encoder_writef8(encoder, atom->u.as_int);
-  case PNE_INT: return pn_encoder_writef32(encoder, atom->u.as_int);
-  case PNE_UTF32: return pn_encoder_writef32(encoder, atom->u.as_char);
-  case PNE_ULONG: return pn_encoder_writef64(encoder, atom->u.as_ulong);
-  case PNE_SMALLULONG: return pn_encoder_writef8(encoder, atom->u.as_ulong);
-  case PNE_LONG: return pn_encoder_writef64(encoder, atom->u.as_long);
-  case PNE_MS64: return pn_encoder_writef64(encoder, atom->u.as_timestamp);
-  case PNE_FLOAT: c.f = atom->u.as_float; return pn_encoder_writef32(encoder, c.i);
-  case PNE_DOUBLE: c.d = atom->u.as_double; return pn_encoder_writef64(encoder, c.l);
-  case PNE_DECIMAL32: return pn_encoder_writef32(encoder, atom->u.as_decimal32);
-  case PNE_DECIMAL64: return pn_encoder_writef64(encoder, atom->u.as_decimal64);
-  case PNE_DECIMAL128: return pn_encoder_writef128(encoder, atom->u.as_decimal128.bytes);
-  case PNE_UUID: return pn_encoder_writef128(encoder, atom->u.as_uuid.bytes);
-  case PNE_VBIN8: return pn_encoder_writev8(encoder, &atom->u.as_bytes);
-  case PNE_VBIN32: return pn_encoder_writev32(encoder, &atom->u.as_bytes);
-  case PNE_STR8_UTF8: return pn_encoder_writev8(encoder, &atom->u.as_bytes);
-  case PNE_STR32_UTF8: return pn_encoder_writev32(encoder, &atom->u.as_bytes);
-  case PNE_SYM8: return pn_encoder_writev8(encoder, &atom->u.as_bytes);
-  case PNE_SYM32: return pn_encoder_writev32(encoder, &atom->u.as_bytes);
+  case PNE_SMALLUINT: return pn_encoder_writef8(encoder, node->u.as_uint);
+  case PNE_UINT: return pn_encoder_writef32(encoder, node->u.as_uint);
+  case PNE_SMALLINT: return pn_encoder_writef8(encoder, node->u.as_int);
+  case PNE_INT: return pn_encoder_writef32(encoder, node->u.as_int);
+  case PNE_UTF32: return pn_encoder_writef32(encoder, node->u.as_char);
+  case PNE_ULONG: return pn_encoder_writef64(encoder, node->u.as_ulong);
+  case PNE_SMALLULONG: return pn_encoder_writef8(encoder, node->u.as_ulong);
+  case PNE_LONG: return pn_encoder_writef64(encoder, node->u.as_long);
+  case PNE_MS64: return pn_encoder_writef64(encoder, node->u.as_timestamp);
+  case PNE_FLOAT: c.f = node->u.as_float; return pn_encoder_writef32(encoder, c.i);
+  case PNE_DOUBLE: c.d = node->u.as_double; return pn_encoder_writef64(encoder, c.l);
+  case PNE_DECIMAL32: return pn_encoder_writef32(encoder, node->u.as_decimal32);
+  case PNE_DECIMAL64: return pn_encoder_writef64(encoder, node->u.as_decimal64);
+  case PNE_DECIMAL128: return pn_encoder_writef128(encoder, data->base + node->u.as_bytes.offset);
+  case PNE_UUID: return pn_encoder_writef128(encoder, data->base + node->u.as_bytes.offset);
+  case PNE_VBIN8:
+  case PNE_STR8_UTF8:
+  case PNE_SYM8:
+    bytes = pni_node_bytes(data, node);
+    return pn_encoder_writev8(encoder, &bytes);
+  case PNE_VBIN32:
+  case PNE_STR32_UTF8:
+  case PNE_SYM32:
+    bytes = pni_node_bytes(data, node);
+    return pn_encoder_writev32(encoder, &bytes);
   case PNE_ARRAY32:
-    node->start = encoder->position;
-    node->small = false;
+    node->u.start = encoder->position - encoder->output;
     // we'll backfill the size on exit
     if (pn_encoder_remaining(encoder) < 4) return PN_OVERFLOW;
     encoder->position += 4;
@@ -326,8 +336,7 @@ static int pni_encoder_enter(void *ctx, pn_data_t *data, pni_node_t *node)
     return 0;
   case PNE_LIST32:
   case PNE_MAP32:
-    node->start = encoder->position;
-    node->small = false;
+    node->u.start = encoder->position - encoder->output;
     // we'll backfill the size later
     if (pn_encoder_remaining(encoder) < 4) return PN_OVERFLOW;
     encoder->position += 4;
@@ -345,26 +354,19 @@ static int pni_encoder_exit(void *ctx, pn_data_t *data, pni_node_t *node)
   char *pos;
   int err;
 
-  switch (node->atom.type) {
+  switch (node->type) {
   case PN_ARRAY:
     if ((node->described && node->children == 1) ||
         (!node->described && node->children == 0)) {
-      int err = pn_encoder_writef8(encoder, pn_type2code(encoder, node->type));
+      int err = pn_encoder_writef8(encoder, pn_type2code(encoder, (pn_type_t) node->array_type));
       if (err) return err;
     }
   case PN_LIST:
   case PN_MAP:
+    // backfill size
     pos = encoder->position;
-    encoder->position = node->start;
-    if (node->small) {
-      // backfill size
-      size_t size = pos - node->start - 1;
-      err = pn_encoder_writef8(encoder, size);
-    } else {
-      // backfill size
-      size_t size = pos - node->start - 4;
-      err = pn_encoder_writef32(encoder, size);
-    }
+    encoder->position = encoder->output + node->u.start;
+    err = pn_encoder_writef32(encoder, pos - encoder->position - 4);
     encoder->position = pos;
     return err;
   default:
@@ -383,3 +385,86 @@ ssize_t pn_encoder_encode(pn_encoder_t *encoder, pn_data_t *src, char *dst, size
 
   return size - pn_encoder_remaining(encoder);
 }
+
+// The size pass mirrors pni_encoder_enter and pni_encoder_exit, adding
+// up what they would write rather than writing it.  Lists and maps are
+// always encoded with 32 bit sizes, so no node depends on the size of
+// its children.
+
+// bytes written after the code of a value with the given encoding
+static ssize_t pni_encoder_width(pn_data_t *data, pni_node_t *node, uint8_t code)
+{
+  switch (code) {
+  case PNE_DESCRIPTOR:
+  case PNE_NULL:
+  case PNE_TRUE:
+  case PNE_FALSE:
+  case PNE_UINT0: return 0;
+  case PNE_BOOLEAN:
+  case PNE_UBYTE:
+  case PNE_BYTE:
+  case PNE_SMALLUINT:
+  case PNE_SMALLINT:
+  case PNE_SMALLULONG: return 1;
+  case PNE_USHORT:
+  case PNE_SHORT: return 2;
+  case PNE_UINT:
+  case PNE_INT:
+  case PNE_UTF32:
+  case PNE_FLOAT:
+  case PNE_DECIMAL32: return 4;
+  case PNE_ULONG:
+  case PNE_LONG:
+  case PNE_MS64:
+  case PNE_DOUBLE:
+  case PNE_DECIMAL64: return 8;
+  case PNE_DECIMAL128:
+  case PNE_UUID: return 16;
+  case PNE_VBIN8:
+  case PNE_STR8_UTF8:
+  case PNE_SYM8: return 1 + node->u.as_bytes.size;
+  case PNE_VBIN32:
+  case PNE_STR32_UTF8:
+  case PNE_SYM32: return 4 + node->u.as_bytes.size;
+  case PNE_ARRAY32: return 8 + (node->described ? 1 : 0);
+  case PNE_LIST32:
+  case PNE_MAP32: return 8;
+  default:
+    return pn_error_format(data->error, PN_ERR, "unrecognized encoding: %u", code);
+  }
+}
+
+static int pni_encoder_size_enter(void *ctx, pn_data_t *data, pni_node_t *node)
+{
+  pn_encoder_t *encoder = (pn_encoder_t *) ctx;
+  bool write_code;
+  uint8_t code = pni_encoder_code(encoder, data, node, &write_code);
+  ssize_t width = pni_encoder_width(data, node, code);
+  if (width < 0) return width;
+  encoder->size += (write_code ? 1 : 0) + width;
+  return 0;
+}
+
+static int pni_encoder_size_exit(void *ctx, pn_data_t *data, pni_node_t *node)
+{
+  pn_encoder_t *encoder = (pn_encoder_t *) ctx;
+  if (node->type == PN_ARRAY &&
+      ((node->described && node->children == 1) ||
+       (!node->described && node->children == 0))) {
+    // an empty array still carries the code of its elements
+    encoder->size++;
+  }
+  return 0;
+}
+
+ssize_t pn_encoder_size(pn_encoder_t *encoder, pn_data_t *src)
+{
+  encoder->output = NULL;
+  encoder->position = NULL;
+  encoder->size = 0;
+
+  int err = pni_data_traverse(src, pni_encoder_size_enter, pni_encoder_size_exit, encoder);
+  if (err) return err;
+
+  return encoder->size;
+}
@@ -26,5 +26,6 @@ typedef struct pn_encoder_t pn_encoder_t;
 
 pn_encoder_t *pn_encoder(void);
 ssize_t pn_encoder_encode(pn_encoder_t *encoder, pn_data_t *src, char *dst, size_t size);
+ssize_t pn_encoder_size(pn_encoder_t *encoder, pn_data_t *src);
 
 #endif /* encoder.h */
@@ -19,6 +19,7 @@
  *
  */
 
+#include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -27,7 +28,9 @@
 #include <proton/buffer.h>
 #include "dispatcher.h"
 #include "protocol.h"
+#include "encodings.h"
 #include "../util.h"
+#include "../codec/data.h"
 #include "../platform_fmt.h"
 
 pn_dispatcher_t *pn_dispatcher(uint8_t frame_type, pn_transport_t *transport)
@@ -46,15 +49,17 @@ pn_dispatcher_t *pn_dispatcher(uint8_t frame_type, pn_transport_t *transport)
   disp->channel = 0;
   disp->code = 0;
   disp->args = pn_data(16);
+  disp->fast = false;
   disp->payload = NULL;
   disp->size = 0;
 
   disp->output_args = pn_data(16);
+  disp->output_shared = NULL;
   disp->frame = pn_buffer( 4*1024 );
-  // XXX
-  disp->capacity = 4*1024;
-  disp->output = (char *) malloc(disp->capacity);
   disp->available = 0;
+  disp->chunk_head = NULL;
+  disp->chunk_tail = NULL;
+  disp->spare = NULL;
 
   disp->halt = false;
   disp->batch = true;
@@ -71,12 +76,163 @@ void pn_dispatcher_free(pn_dispatcher_t *disp)
     pn_data_free(disp->args);
     pn_data_free(disp->output_args);
     pn_buffer_free(disp->frame);
-    free(disp->output);
+    while (disp->chunk_head) {
+      pn_output_chunk_t *chunk = disp->chunk_head;
+      LL_POP(disp, chunk, pn_output_chunk_t);
+      pn_decref(chunk->shared);
+      free(chunk);
+    }
+    free(disp->spare);
     pn_free(disp->scratch);
     free(disp);
   }
 }
 
+// output queue
+
+static pn_output_chunk_t *pni_output_chunk(size_t capacity)
+{
+  pn_output_chunk_t *chunk = (pn_output_chunk_t *) malloc(sizeof(pn_output_chunk_t) + capacity);
+  if (!chunk) return NULL;
+  chunk->chunk_next = NULL;
+  chunk->chunk_prev = NULL;
+  chunk->capacity = capacity;
+  chunk->head = 0;
+  chunk->tail = 0;
+  chunk->bytes = (char *) (chunk + 1);
+  chunk->reference = false;
+  chunk->shared = NULL;
+  return chunk;
+}
+
+// contiguous room for size bytes at the end of the queue
+static char *pni_output_reserve(pn_dispatcher_t *disp, size_t size)
+{
+  pn_output_chunk_t *tail = disp->chunk_tail;
+  if (tail && tail->capacity - tail->tail >= size) {
+    return tail->bytes + tail->tail;
+  }
+
+  pn_output_chunk_t *chunk;
+  if (disp->spare && disp->spare->capacity >= size) {
+    chunk = disp->spare;
+    disp->spare = NULL;
+  } else {
+    chunk = pni_output_chunk(pn_max(size, PN_OUTPUT_CHUNK));
+    if (!chunk) return NULL;
+  }
+
+  LL_ADD(disp, chunk, chunk);
+  return chunk->bytes;
+}
+
+static void pni_output_commit(pn_dispatcher_t *disp, size_t size)
+{
+  disp->chunk_tail->tail += size;
+  disp->available += size;
+}
+
+static void pni_output_release(pn_dispatcher_t *disp, pn_output_chunk_t *chunk)
+{
+  LL_REMOVE(disp, chunk, chunk);
+  chunk->chunk_next = NULL;
+  chunk->chunk_prev = NULL;
+  chunk->head = 0;
+  chunk->tail = 0;
+  pn_decref(chunk->shared);
+  chunk->shared = NULL;
+  // keep one ordinary sized chunk around for the next burst
+  if (!disp->spare && !chunk->reference && chunk->capacity == PN_OUTPUT_CHUNK) {
+    disp->spare = chunk;
+  } else {
+    free(chunk);
+  }
+}
+
+// append an encoded frame to the output queue
+static ssize_t pni_output_frame(pn_dispatcher_t *disp, pn_frame_t frame)
+{
+  size_t size = AMQP_HEADER_SIZE + frame.ex_size + frame.size;
+  char *bytes = pni_output_reserve(disp, size);
+  if (!bytes) return PN_ERR;
+  size_t n = pn_write_frame(bytes, size, frame);
+  disp->output_frames_ct += 1;
+  if (disp->trace & PN_TRACE_RAW) {
+    pn_string_set(disp->scratch, "RAW: \"");
+    pn_quote(disp->scratch, bytes, n);
+    pn_string_addf(disp->scratch, "\"");
+    pn_transport_log(disp->transport, pn_string_get(disp->scratch));
+  }
+  pni_output_commit(disp, n);
+  return n;
+}
+
+static inline void pni_write32(char *bytes, uint32_t value)
+{
+  bytes[0] = 0xFF & (value >> 24);
+  bytes[1] = 0xFF & (value >> 16);
+  bytes[2] = 0xFF & (value >>  8);
+  bytes[3] = 0xFF & (value      );
+}
+
+// append a frame whose payload is referenced rather than copied, frame
+// holds everything up to the payload
+static ssize_t pni_output_reference(pn_dispatcher_t *disp, pn_frame_t frame,
+                                    const char *payload, size_t size)
+{
+  pn_output_chunk_t *chunk = pni_output_chunk(0);
+  if (!chunk) return PN_ERR;
+  size_t hsize = AMQP_HEADER_SIZE + frame.ex_size + frame.size;
+  char *bytes = pni_output_reserve(disp, hsize);
+  if (!bytes) {
+    free(chunk);
+    return PN_ERR;
+  }
+  size_t n = pn_write_frame(bytes, hsize, frame);
+  // the frame size covers the payload that follows in the next chunk
+  pni_write32(bytes, n + size);
+  disp->output_frames_ct += 1;
+  if (disp->trace & PN_TRACE_RAW) {
+    pn_string_set(disp->scratch, "RAW: \"");
+    pn_quote(disp->scratch, bytes, n);
+    pn_quote(disp->scratch, payload, size);
+    pn_string_addf(disp->scratch, "\"");
+    pn_transport_log(disp->transport, pn_string_get(disp->scratch));
+  }
+  pni_output_commit(disp, n);
+
+  chunk->bytes = (char *) payload;
+  chunk->capacity = size;
+  chunk->tail = size;
+  chunk->reference = true;
+  chunk->shared = disp->output_shared;
+  pn_incref(chunk->shared);
+  LL_ADD(disp, chunk, chunk);
+  disp->available += size;
+  return n + size;
+}
+
+// discard size bytes from the front of the queue
+static void pni_output_consume(pn_dispatcher_t *disp, size_t size)
+{
+  disp->available -= size;
+  while (size && disp->chunk_head) {
+    pn_output_chunk_t *chunk = disp->chunk_head;
+    size_t count = pn_min(size, chunk->tail - chunk->head);
+    chunk->head += count;
+    size -= count;
+    if (chunk->head == chunk->tail) {
+      if (chunk == disp->chunk_tail && !chunk->reference) {
+        // the queue is empty, rewind rather than give the chunk up
+        chunk->head = 0;
+        chunk->tail = 0;
+        break;
+      }
+      pni_output_release(disp, chunk);
+    }
+  }
+}
+
 void pn_dispatcher_action(pn_dispatcher_t *disp, uint8_t code,
                           pn_action_t *action)
 {
@@ -103,6 +259,310 @@ static void pn_do_trace(pn_dispatcher_t *disp, uint16_t ch, pn_dir_t dir,
   }
 }
 
+// Decoding of the transfer, flow and disposition performatives
+// straight from the frame bytes. Fields are interpreted exactly as the
+// pn_scan_args format the action would otherwise use, anything the
+// reader does not expect makes pn_dispatch_frame fall back to the
+// generic decoder.
+
+typedef struct {
+  const char *pos;
+  const char *end;
+  uint32_t count;  // list elements not read yet
+} pni_reader_t;
+
+// a value of a type the fast path does not look at
+#define PNI_OTHER ((pn_type_t) 0)
+
+static inline bool pni_read8(pni_reader_t *r, uint8_t *value)
+{
+  if (r->end - r->pos < 1) return false;
+  *value = (uint8_t) r->pos[0];
+  r->pos += 1;
+  return true;
+}
+
+static inline bool pni_read32(pni_reader_t *r, uint32_t *value)
+{
+  if (r->end - r->pos < 4) return false;
+  const uint8_t *p = (const uint8_t *) r->pos;
+  *value = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+  r->pos += 4;
+  return true;
+}
+
+static inline bool pni_read64(pni_reader_t *r, uint64_t *value)
+{
+  uint32_t hi, lo;
+  if (!pni_read32(r, &hi) || !pni_read32(r, &lo)) return false;
+  *value = ((uint64_t) hi << 32) | lo;
+  return true;
+}
+
+static inline bool pni_skip(pni_reader_t *r, size_t size)
+{
+  if ((size_t) (r->end - r->pos) < size) return false;
+  r->pos += size;
+  return true;
+}
+
+// skip the body of a value, the width follows from the constructor
+static bool pni_skip_value(pni_reader_t *r, uint8_t code)
+{
+  uint8_t size8;
+  uint32_t size32;
+  if (code == PNE_DESCRIPTOR) {
+    return pni_read8(r, &code) && pni_skip_value(r, code) &&
+      pni_read8(r, &code) && pni_skip_value(r, code);
+  }
+  switch (code & 0xF0) {
+  case 0x40: return true;
+  case 0x50: return pni_skip(r, 1);
+  case 0x60: return pni_skip(r, 2);
+  case 0x70: return pni_skip(r, 4);
+  case 0x80: return pni_skip(r, 8);
+  case 0x90: return pni_skip(r, 16);
+  case 0xA0:
+  case 0xC0:
+  case 0xE0: return pni_read8(r, &size8) && pni_skip(r, size8);
+  case 0xB0:
+  case 0xD0:
+  case 0xF0: return pni_read32(r, &size32) && pni_skip(r, size32);
+  default: return false;
+  }
+}
+
+// the next list element, elements missing from the end read as null
+static bool pni_read_field(pni_reader_t *r, pn_atom_t *atom)
+{
+  if (!r->count) {
+    atom->type = PN_NULL;
+    return true;
+  }
+  r->count--;
+
+  uint8_t code, size8;
+  uint32_t size32;
+  if (!pni_read8(r, &code)) return false;
+  switch (code) {
+  case PNE_NULL:
+    atom->type = PN_NULL;
+    return true;
+  case PNE_TRUE:
+  case PNE_FALSE:
+    atom->type = PN_BOOL;
+    atom->u.as_bool = code == PNE_TRUE;
+    return true;
+  case PNE_BOOLEAN:
+    atom->type = PN_BOOL;
+    if (!pni_read8(r, &size8)) return false;
+    atom->u.as_bool = size8;
+    return true;
+  case PNE_UINT0:
+    atom->type = PN_UINT;
+    atom->u.as_uint = 0;
+    return true;
+  case PNE_SMALLUINT:
+    atom->type = PN_UINT;
+    if (!pni_read8(r, &size8)) return false;
+    atom->u.as_uint = size8;
+    return true;
+  case PNE_UINT:
+    atom->type = PN_UINT;
+    return pni_read32(r, &atom->u.as_uint);
+  case PNE_ULONG0:
+    atom->type = PN_ULONG;
+    atom->u.as_ulong = 0;
+    return true;
+  case PNE_SMALLULONG:
+    atom->type = PN_ULONG;
+    if (!pni_read8(r, &size8)) return false;
+    atom->u.as_ulong = size8;
+    return true;
+  case PNE_ULONG:
+    atom->type = PN_ULONG;
+    return pni_read64(r, &atom->u.as_ulong);
+  case PNE_VBIN8:
+  case PNE_VBIN32:
+    atom->type = PN_BINARY;
+    if (code == PNE_VBIN8) {
+      if (!pni_read8(r, &size8)) return false;
+      size32 = size8;
+    } else if (!pni_read32(r, &size32)) {
+      return false;
+    }
+    atom->u.as_bytes = pn_bytes(size32, (char *) r->pos);
+    return pni_skip(r, size32);
+  default:
+    atom->type = PNI_OTHER;
+    return pni_skip_value(r, code);
+  }
+}
+
+// I and ?I
+static inline bool pni_read_uint(pni_reader_t *r, bool *present, uint32_t *value)
+{
+  pn_atom_t atom;
+  if (!pni_read_field(r, &atom)) return false;
+  *present = atom.type == PN_UINT;
+  *value = *present ? atom.u.as_uint : 0;
+  return true;
+}
+
+// o
+static inline bool pni_read_bool(pni_reader_t *r, bool *value)
+{
+  pn_atom_t atom;
+  if (!pni_read_field(r, &atom)) return false;
+  *value = atom.type == PN_BOOL ? atom.u.as_bool : false;
+  return true;
+}
+
+// z
+static inline bool pni_read_binary(pni_reader_t *r, pn_bytes_t *value)
+{
+  pn_atom_t atom;
+  if (!pni_read_field(r, &atom)) return false;
+  *value = atom.type == PN_BINARY ? atom.u.as_bytes : pn_bytes(0, NULL);
+  return true;
+}
+
+// .
+static inline bool pni_skip_field(pni_reader_t *r)
+{
+  pn_atom_t atom;
+  return pni_read_field(r, &atom);
+}
+
+// D?LC for the delivery states that carry no fields, anything else is
+// left to the generic path
+static bool pni_read_state(pni_reader_t *r, bool *type_init, uint64_t *type)
+{
+  *type_init = false;
+  if (!r->count) return true;
+
+  uint8_t code, size8;
+  uint32_t size32, count;
+  if (!pni_read8(r, &code)) return false;
+  if (code == PNE_NULL) {
+    r->count--;
+    return true;
+  }
+  if (code != PNE_DESCRIPTOR) return false;
+  pn_atom_t descriptor;
+  r->count = 1;  // read the descriptor as if it were a field
+  if (!pni_read_field(r, &descriptor) || descriptor.type != PN_ULONG) return false;
+
+  if (!pni_read8(r, &code)) return false;
+  switch (code) {
+  case PNE_LIST0:
+    count = 0;
+    break;
+  case PNE_LIST8:
+    if (!pni_read8(r, &size8) || !pni_read8(r, &size8)) return false;
+    count = size8;
+    break;
+  case PNE_LIST32:
+    if (!pni_read32(r, &size32) || !pni_read32(r, &count)) return false;
+    break;
+  default:
+    return false;
+  }
+  if (count) return false;
+
+  *type_init = true;
+  *type = descriptor.u.as_ulong;
+  r->count = 0;  // the state is the last field scanned
+  return true;
+}
+
+static bool pni_read_transfer(pni_reader_t *r, pn_transfer_fields_t *f)
+{
+  bool present;
+  return pni_read_uint(r, &present, &f->handle) &&
+    pni_read_uint(r, &f->id_present, (uint32_t *) &f->id) &&
+    pni_read_binary(r, &f->tag) &&
+    pni_skip_field(r) &&
+    pni_read_bool(r, &f->settled) &&
+    pni_read_bool(r, &f->more);
+}
+
+static bool pni_read_flow(pni_reader_t *r, pn_flow_fields_t *f)
+{
+  bool present;
+  return pni_read_uint(r, &f->inext_init, (uint32_t *) &f->inext) &&
+    pni_read_uint(r, &present, &f->iwin) &&
+    pni_read_uint(r, &present, (uint32_t *) &f->onext) &&
+    pni_read_uint(r, &present, &f->owin) &&
+    pni_read_uint(r, &f->handle_init, &f->handle) &&
+    pni_read_uint(r, &f->dcount_init, (uint32_t *) &f->delivery_count) &&
+    pni_read_uint(r, &present, &f->link_credit) &&
+    pni_skip_field(r) &&
+    pni_read_bool(r, &f->drain);
+}
+
+static bool pni_read_disposition(pni_reader_t *r, pn_disposition_fields_t *f)
+{
+  bool present;
+  return pni_read_bool(r, &f->role) &&
+    pni_read_uint(r, &present, (uint32_t *) &f->first) &&
+    pni_read_uint(r, &f->last_init, (uint32_t *) &f->last) &&
+    pni_read_bool(r, &f->settled) &&
+    pni_read_state(r, &f->type_init, &f->type);
+}
+
+// decode the performative into disp->fields if possible, returns its
+// encoded size or 0 when the generic decoder is needed
+static size_t pni_fast_decode(pn_dispatcher_t *disp, const char *bytes, size_t size)
+{
+  if (size < 4 || bytes[0] != PNE_DESCRIPTOR || (uint8_t) bytes[1] != PNE_SMALLULONG) {
+    return 0;
+  }
+  uint8_t code = (uint8_t) bytes[2];
+  if (code != TRANSFER && code != FLOW && code != DISPOSITION) return 0;
+
+  pni_reader_t r = {bytes + 3, bytes + size, 0};
+  uint8_t list, size8, count8;
+  uint32_t size32;
+  if (!pni_read8(&r, &list)) return 0;
+  switch (list) {
+  case PNE_LIST0:
+    size32 = 0;
+    break;
+  case PNE_LIST8:
+    if (!pni_read8(&r, &size8) || !size8 || !pni_read8(&r, &count8)) return 0;
+    size32 = size8 - 1;
+    r.count = count8;
+    break;
+  case PNE_LIST32:
+    if (!pni_read32(&r, &size32) || size32 < 4 || !pni_read32(&r, &r.count)) return 0;
+    size32 -= 4;
+    break;
+  default:
+    return 0;
+  }
+  if ((size_t) (r.end - r.pos) < size32) return 0;
+  r.end = r.pos + size32;
+  size_t performative = r.end - bytes;
+
+  bool ok;
+  switch (code) {
+  case TRANSFER:
+    ok = pni_read_transfer(&r, &disp->fields.transfer);
+    break;
+  case FLOW:
+    ok = pni_read_flow(&r, &disp->fields.flow);
+    break;
+  default:
+    ok = pni_read_disposition(&r, &disp->fields.disposition);
+    break;
+  }
+  if (!ok) return 0;
+
+  disp->code = code;
+  return performative;
+}
+
 int pn_dispatch_frame(pn_dispatcher_t *disp, pn_frame_t frame)
 {
   if (frame.size == 0) { // ignore null frames
@@ -111,13 +571,35 @@ int pn_dispatch_frame(pn_dispatcher_t *disp, pn_frame_t frame)
     return 0;
   }
 
-  ssize_t dsize = pn_data_decode(disp->args, frame.payload, frame.size);
+  // frame tracing shows args, so it always takes the generic path
+  size_t psize = (disp->trace & PN_TRACE_FRM) ? 0 : pni_fast_decode(disp, frame.payload, frame.size);
+  if (psize) {
+    disp->channel = frame.channel;
+    disp->size = frame.size - psize;
+    if (disp->size)
+      disp->payload = frame.payload + psize;
+    disp->fast = true;
+
+    int err = disp->actions[disp->code](disp);
+
+    disp->fast = false;
+    disp->channel = 0;
+    disp->code = 0;
+    disp->size = 0;
+    disp->payload = NULL;
+    return err;
+  }
+
+  // the frame outlives the action and args are cleared after it, so
+  // args may refer to the frame rather than copy out of it
+  ssize_t dsize = pn_data_decode_borrowed(disp->args, frame.payload, frame.size);
   if (dsize < 0) {
     pn_string_format(disp->scratch,
                      "Error decoding frame: %s %s\n", pn_code(dsize),
                      pn_error_text(pn_data_error(disp->args)));
     pn_quote(disp->scratch, frame.payload, frame.size);
     pn_transport_log(disp->transport, pn_string_get(disp->scratch));
+    pn_data_clear(disp->args);
     return dsize;
   }
 
@@ -125,13 +607,15 @@ int pn_dispatch_frame(pn_dispatcher_t *disp, pn_frame_t frame)
   // XXX: assuming numeric
   uint64_t lcode;
   bool scanned;
-  int e = pn_data_scan(disp->args, "D?L.", &scanned, &lcode);
+  int e = pni_data_scan_cached(disp->args, "D?L.", &scanned, &lcode);
   if (e) {
     pn_transport_log(disp->transport, "Scan error");
+    pn_data_clear(disp->args);
     return e;
   }
   if (!scanned) {
     pn_transport_log(disp->transport, "Error dispatching frame");
+    pn_data_clear(disp->args);
     return PN_ERR;
   }
   uint8_t code = lcode;
@@ -182,7 +666,7 @@ int pn_scan_args(pn_dispatcher_t *disp, const char *fmt, ...)
 {
   va_list ap;
   va_start(ap, fmt);
-  int err = pn_data_vscan(disp->args, fmt, ap);
+  int err = pni_data_vscan_cached(disp->args, fmt, ap);
   va_end(ap);
   if (err) printf("scan error: %s\n", fmt);
   return err;
@@ -194,12 +678,241 @@ void pn_set_payload(pn_dispatcher_t *disp, const char *data, size_t size)
   disp->output_size = size;
 }
 
+void pn_set_payload_shared(pn_dispatcher_t *disp, const char *data, size_t size,
+                           void *shared)
+{
+  pn_set_payload(disp, data, size);
+  disp->output_shared = shared;
+}
+
+// Hand coded encoders for the performatives sent with every message.
+// Each produces exactly the bytes pn_data_encode produces for the
+// pn_data_fill format noted above it, without building a pn_data_t.
+
+// room needed by the hand coded performatives, besides the tag
+#define PNI_PERFORMATIVE_MAX (64)
+
+static inline char *pni_encode8(char *bytes, uint8_t value)
+{
+  bytes[0] = value;
+  return bytes + 1;
+}
+
+static inline char *pni_encode32(char *bytes, uint32_t value)
+{
+  bytes[0] = 0xFF & (value >> 24);
+  bytes[1] = 0xFF & (value >> 16);
+  bytes[2] = 0xFF & (value >>  8);
+  bytes[3] = 0xFF & (value      );
+  return bytes + 4;
+}
+
+static inline char *pni_encode_null(char *bytes)
+{
+  bytes = pni_encode8(bytes, PNE_NULL);
+  return bytes;
+}
+
+static inline char *pni_encode_bool(char *bytes, bool value)
+{
+  bytes = pni_encode8(bytes, value ? PNE_TRUE : PNE_FALSE);
+  return bytes;
+}
+
+static inline char *pni_encode_uint(char *bytes, uint32_t value)
+{
+  if (value < 256) {
+    bytes = pni_encode8(bytes, PNE_SMALLUINT);
+    bytes = pni_encode8(bytes, value);
+    return bytes;
+  } else {
+    bytes = pni_encode8(bytes, PNE_UINT);
+    return pni_encode32(bytes, value);
+  }
+}
+
+static inline char *pni_encode_ulong(char *bytes, uint64_t value)
+{
+  if (value < 256) {
+    bytes = pni_encode8(bytes, PNE_SMALLULONG);
+    bytes = pni_encode8(bytes, value);
+    return bytes;
+  } else {
+    bytes = pni_encode8(bytes, PNE_ULONG);
+    bytes = pni_encode32(bytes, value >> 32);
+    return pni_encode32(bytes, value);
+  }
+}
+
+static inline char *pni_encode_binary(char *bytes, const pn_bytes_t *value)
+{
+  if (!value->start) return pni_encode_null(bytes);
+  if (value->size < 256) {
+    bytes = pni_encode8(bytes, PNE_VBIN8);
+    bytes = pni_encode8(bytes, value->size);
+  } else {
+    bytes = pni_encode8(bytes, PNE_VBIN32);
+    bytes = pni_encode32(bytes, value->size);
+  }
+  memmove(bytes, value->start, value->size);
+  return bytes + value->size;
+}
+
+// descriptor and list header, the list size and count are filled in
+// by pni_encode_list_end
+static inline char *pni_encode_list_start(char *bytes, uint64_t code, char **list)
+{
+  bytes = pni_encode8(bytes, PNE_DESCRIPTOR);
+  bytes = pni_encode_ulong(bytes, code);
+  *list = bytes;
+  bytes = pni_encode8(bytes, PNE_LIST32);
+  return bytes + 8;
+}
+
+static inline char *pni_encode_list_end(char *list, char *end, uint32_t count)
+{
+  pni_encode32(list + 1, end - list - 5);
+  pni_encode32(list + 5, count);
+  return end;
+}
+
+// DL[IIzIoo]
+static size_t pni_encode_transfer(char *bytes, uint32_t handle, pn_sequence_t id,
+                                  const pn_bytes_t *tag, uint32_t message_format,
+                                  bool settled, bool more)
+{
+  char *list;
+  char *p = pni_encode_list_start(bytes, TRANSFER, &list);
+  p = pni_encode_uint(p, handle);
+  p = pni_encode_uint(p, id);
+  p = pni_encode_binary(p, tag);
+  p = pni_encode_uint(p, message_format);
+  p = pni_encode_bool(p, settled);
+  p = pni_encode_bool(p, more);
+  return pni_encode_list_end(list, p, 6) - bytes;
+}
+
+// DL[?IIII?I?I?In?o]
+static size_t pni_encode_flow(char *bytes, bool echo_id, pn_sequence_t next_incoming_id,
+                              uint32_t incoming_window, pn_sequence_t next_outgoing_id,
+                              uint32_t outgoing_window, bool linkq, uint32_t handle,
+                              pn_sequence_t delivery_count, pn_sequence_t link_credit,
+                              bool drain)
+{
+  char *list;
+  char *p = pni_encode_list_start(bytes, FLOW, &list);
+  p = echo_id ? pni_encode_uint(p, next_incoming_id) : pni_encode_null(p);
+  p = pni_encode_uint(p, incoming_window);
+  p = pni_encode_uint(p, next_outgoing_id);
+  p = pni_encode_uint(p, outgoing_window);
+  if (linkq) {
+    p = pni_encode_uint(p, handle);
+    p = pni_encode_uint(p, delivery_count);
+    p = pni_encode_uint(p, link_credit);
+    p = pni_encode_null(p);
+    p = pni_encode_bool(p, drain);
+  } else {
+    for (int i = 0; i < 5; i++) {
+      p = pni_encode_null(p);
+    }
+  }
+  return pni_encode_list_end(list, p, 9) - bytes;
+}
+
+// DL[oIIo?DL[]]
+static size_t pni_encode_disposition(char *bytes, bool role, pn_sequence_t first,
+                                     pn_sequence_t last, bool settled, uint64_t code)
+{
+  char *list;
+  char *p = pni_encode_list_start(bytes, DISPOSITION, &list);
+  p = pni_encode_bool(p, role);
+  p = pni_encode_uint(p, first);
+  p = pni_encode_uint(p, last);
+  p = pni_encode_bool(p, settled);
+  if (code) {
+    char *state;
+    p = pni_encode_list_start(p, code, &state);
+    p = pni_encode_list_end(state, p, 0);
+  } else {
+    p = pni_encode_null(p);
+  }
+  return pni_encode_list_end(list, p, 5) - bytes;
+}
+
+// room for an encoded performative at the start of the frame buffer
+static char *pni_frame_reserve(pn_dispatcher_t *disp, size_t size)
+{
+  pn_buffer_clear(disp->frame);
+  if (pn_buffer_available(disp->frame) < size) {
+    int err = pn_buffer_ensure(disp->frame, size);
+    if (err) return NULL;
+  }
+  return pn_buffer_bytes(disp->frame).start;
+}
+
+// queue a frame holding just the performative encoded in the frame buffer
+static int pni_post_performative(pn_dispatcher_t *disp, uint16_t ch, size_t size)
+{
+  pn_frame_t frame = {disp->frame_type};
+  frame.channel = ch;
+  frame.payload = pn_buffer_bytes(disp->frame).start;
+  frame.size = size;
+  ssize_t n = pni_output_frame(disp, frame);
+  if (n < 0) {
+    pn_transport_logf(disp->transport, "error posting frame: %s", pn_code(n));
+    return PN_ERR;
+  }
+  return 0;
+}
+
+int pn_post_flow_frame(pn_dispatcher_t *disp, uint16_t ch,
+                       bool echo_id, pn_sequence_t next_incoming_id,
+                       uint32_t incoming_window, pn_sequence_t next_outgoing_id,
+                       uint32_t outgoing_window, bool linkq, uint32_t handle,
+                       pn_sequence_t delivery_count, pn_sequence_t link_credit,
+                       bool drain)
+{
+  if (disp->trace & PN_TRACE_FRM) {
+    pn_data_clear(disp->output_args);
+    pni_data_fill_cached(disp->output_args, "DL[?IIII?I?I?In?o]", FLOW,
+                         echo_id, next_incoming_id, incoming_window,
+                         next_outgoing_id, outgoing_window,
+                         linkq, handle, linkq, delivery_count,
+                         linkq, link_credit, linkq, drain);
+    pn_do_trace(disp, ch, OUT, disp->output_args, NULL, 0);
+  }
+
+  char *bytes = pni_frame_reserve(disp, PNI_PERFORMATIVE_MAX);
+  if (!bytes) return PN_ERR;
+  size_t size = pni_encode_flow(bytes, echo_id, next_incoming_id, incoming_window,
+                                next_outgoing_id, outgoing_window, linkq, handle,
+                                delivery_count, link_credit, drain);
+  return pni_post_performative(disp, ch, size);
+}
+
+int pn_post_disposition_frame(pn_dispatcher_t *disp, uint16_t ch, bool role,
+                              pn_sequence_t first, pn_sequence_t last,
+                              bool settled, uint64_t code)
+{
+  if (disp->trace & PN_TRACE_FRM) {
+    pn_data_clear(disp->output_args);
+    pni_data_fill_cached(disp->output_args, "DL[oIIo?DL[]]", DISPOSITION,
+                         role, first, last, settled, (bool)code, code);
+    pn_do_trace(disp, ch, OUT, disp->output_args, NULL, 0);
+  }
+
+  char *bytes = pni_frame_reserve(disp, PNI_PERFORMATIVE_MAX);
+  if (!bytes) return PN_ERR;
+  size_t size = pni_encode_disposition(bytes, role, first, last, settled, code);
+  return pni_post_performative(disp, ch, size);
+}
+
 int pn_post_frame(pn_dispatcher_t *disp, uint16_t ch, const char *fmt, ...)
 {
   va_list ap;
   va_start(ap, fmt);
   pn_data_clear(disp->output_args);
-  int err = pn_data_vfill(disp->output_args, fmt, ap);
+  int err = pni_data_vfill_cached(disp->output_args, fmt, ap);
   va_end(ap);
   if (err) {
     pn_transport_logf(disp->transport,
@@ -216,11 +929,15 @@ int pn_post_frame(pn_dispatcher_t *disp, uint16_t ch, const char *fmt, ...)
   buf.size = pn_buffer_available( disp->frame );
 
   ssize_t wr = pn_data_encode( disp->output_args, buf.start, buf.size );
-  if (wr < 0) {
-    if (wr == PN_OVERFLOW) {
-      pn_buffer_ensure( disp->frame, pn_buffer_available( disp->frame ) * 2 );
+  if (wr == PN_OVERFLOW) {
+    // size the frame exactly rather than growing it step by step
+    wr = pn_data_encoded_size( disp->output_args );
+    if (wr >= 0) {
+      pn_buffer_ensure( disp->frame, wr );
       goto encode_performatives;
     }
+  }
+  if (wr < 0) {
     pn_transport_logf(disp->transport,
                       "error posting frame: %s", pn_code(wr));
     return PN_ERR;
@@ -230,34 +947,44 @@ int pn_post_frame(pn_dispatcher_t *disp, uint16_t ch, const char *fmt, ...)
   frame.channel = ch;
   frame.payload = buf.start;
   frame.size = wr;
-  size_t n;
-  while (!(n = pn_write_frame(disp->output + disp->available,
-                              disp->capacity - disp->available, frame))) {
-    disp->capacity *= 2;
-    disp->output = (char *) realloc(disp->output, disp->capacity);
-  }
-  disp->output_frames_ct += 1;
-  if (disp->trace & PN_TRACE_RAW) {
-    pn_string_set(disp->scratch, "RAW: \"");
-    pn_quote(disp->scratch, disp->output + disp->available, n);
-    pn_string_addf(disp->scratch, "\"");
-    pn_transport_log(disp->transport, pn_string_get(disp->scratch));
+  ssize_t n = pni_output_frame(disp, frame);
+  if (n < 0) {
+    pn_transport_logf(disp->transport, "error posting frame: %s", pn_code(n));
+    return PN_ERR;
   }
-  disp->available += n;
 
   return 0;
 }
 
 ssize_t pn_dispatcher_output(pn_dispatcher_t *disp, char *bytes, size_t size)
 {
-  int n = disp->available < size ? disp->available : size;
-  memmove(bytes, disp->output, n);
-  memmove(disp->output, disp->output + n, disp->available - n);
-  disp->available -= n;
-  // XXX: need to check for errors
+  size_t n = 0;
+  for (pn_output_chunk_t *chunk = disp->chunk_head; chunk && n < size; chunk = chunk->chunk_next) {
+    size_t count = pn_min(size - n, chunk->tail - chunk->head);
+    memcpy(bytes + n, chunk->bytes + chunk->head, count);
+    n += count;
+  }
+  pni_output_consume(disp, n);
   return n;
 }
 
+size_t pn_dispatcher_segments(pn_dispatcher_t *disp, pn_bytes_t *segments, size_t count)
+{
+  size_t n = 0;
+  for (pn_output_chunk_t *chunk = disp->chunk_head; chunk && n < count; chunk = chunk->chunk_next) {
+    if (chunk->tail > chunk->head) {
+      segments[n++] = pn_bytes(chunk->tail - chunk->head, chunk->bytes + chunk->head);
+    }
+  }
+  return n;
+}
+
+void pn_dispatcher_pop(pn_dispatcher_t *disp, size_t size)
+{
+  assert(size <= disp->available);
+  pni_output_consume(disp, size);
+}
+
 
 int pn_post_transfer_frame(pn_dispatcher_t *disp, uint16_t ch,
                            uint32_t handle,
@@ -271,38 +998,29 @@ int pn_post_transfer_frame(pn_dispatcher_t *disp, uint16_t ch,
   bool more_flag = more;
   int framecount = 0;
 
-  // create preformatives, assuming 'more' flag need not change
-
- compute_performatives:
-  pn_data_clear(disp->output_args);
-  int err = pn_data_fill(disp->output_args, "DL[IIzIoo]", TRANSFER,
-                         handle, id, tag->size, tag->start,
-                         message_format,
-                         settled, more_flag);
-  if (err) {
-    pn_transport_logf(disp->transport,
-                      "error posting transfer frame: %s: %s", pn_code(err),
-                      pn_error_text(pn_data_error(disp->output_args)));
-    return PN_ERR;
-  }
-
   do { // send as many frames as possible without changing the 'more' flag...
 
   encode_performatives:
-    pn_buffer_clear( disp->frame );
-    pn_bytes_t buf = pn_buffer_bytes( disp->frame );
-    buf.size = pn_buffer_available( disp->frame );
-
-    ssize_t wr = pn_data_encode(disp->output_args, buf.start, buf.size);
-    if (wr < 0) {
-      if (wr == PN_OVERFLOW) {
-        pn_buffer_ensure( disp->frame, pn_buffer_available( disp->frame ) * 2 );
-        goto encode_performatives;
-      }
-      pn_transport_logf(disp->transport, "error posting frame: %s", pn_code(wr));
-      return PN_ERR;
+    if (disp->trace & PN_TRACE_FRM) {
+      pn_data_clear(disp->output_args);
+      pni_data_fill_cached(disp->output_args, "DL[IIzIoo]", TRANSFER,
+                           handle, id, tag->size, tag->start,
+                           message_format,
+                           settled, more_flag);
+    }
+
+    pn_bytes_t buf;
+    buf.start = pni_frame_reserve(disp, PNI_PERFORMATIVE_MAX + tag->size);
+    if (!buf.start) {
+      pn_transport_logf(disp->transport, "error posting frame: %s", pn_code(PN_ERR));
+      framecount = PN_ERR;
+      goto done;
     }
-    buf.size = wr;
+    buf.size = pni_encode_transfer(buf.start, handle, id, tag, message_format,
+                                   settled, more_flag);
+    // commit the performative, so that growing the frame for the payload
+    // keeps it
+    pn_buffer_extend(disp->frame, buf.size);
 
     // check if we need to break up the outbound frame
     size_t available = disp->output_size;
@@ -311,50 +1029,54 @@ int pn_post_transfer_frame(pn_dispatcher_t *disp, uint16_t ch,
         available = disp->remote_max_frame - 8 - buf.size;
         if (more_flag == false) {
           more_flag = true;
-          goto compute_performatives;  // deal with flag change
+          goto encode_performatives;  // deal with flag change
         }
       } else if (more_flag == true && more == false) {
         // caller has no more, and this is the last frame
         more_flag = false;
-        goto compute_performatives;
+        goto encode_performatives;
       }
     }
 
-    if (pn_buffer_available( disp->frame ) < (available + buf.size)) {
-      // not enough room for payload - try again...
-      pn_buffer_ensure( disp->frame, available + buf.size );
-      goto encode_performatives;
+    bool reference = disp->output_shared &&
+      available >= PN_OUTPUT_REFERENCE;
+    // the payload is NULL when there is none
+    if (!reference && available) {
+      int err = pn_buffer_append(disp->frame, disp->output_payload, available);
+      if (err) {
+        pn_transport_logf(disp->transport, "error posting frame: %s", pn_code(err));
+        framecount = PN_ERR;
+        goto done;
+      }
+      buf.start = pn_buffer_bytes( disp->frame ).start;
     }
 
     pn_do_trace(disp, ch, OUT, disp->output_args, disp->output_payload, available);
 
-    memmove( buf.start + buf.size, disp->output_payload, available);
-    disp->output_payload += available;
-    disp->output_size -= available;
-    buf.size += available;
-
     pn_frame_t frame = {disp->frame_type};
     frame.channel = ch;
     frame.payload = buf.start;
-    frame.size = buf.size;
 
-    size_t n;
-    while (!(n = pn_write_frame(disp->output + disp->available,
-                                disp->capacity - disp->available, frame))) {
-      disp->capacity *= 2;
-      disp->output = (char *) realloc(disp->output, disp->capacity);
+    ssize_t n;
+    if (reference) {
+      frame.size = buf.size;
+      n = pni_output_reference(disp, frame, disp->output_payload, available);
+    } else {
+      frame.size = buf.size + available;
+      n = pni_output_frame(disp, frame);
     }
-    disp->output_frames_ct += 1;
-    framecount++;
-    if (disp->trace & PN_TRACE_RAW) {
-      pn_string_set(disp->scratch, "RAW: \"");
-      pn_quote(disp->scratch, disp->output + disp->available, n);
-      pn_string_addf(disp->scratch, "\"");
-      pn_transport_log(disp->transport, pn_string_get(disp->scratch));
+    if (n < 0) {
+      pn_transport_logf(disp->transport, "error posting frame: %s", pn_code(n));
+      framecount = PN_ERR;
+      goto done;
     }
-    disp->available += n;
+    disp->output_payload += available;
+    disp->output_size -= available;
+    framecount++;
   } while (disp->output_size > 0 && framecount < frame_limit);
 
+ done:
   disp->output_payload = NULL;
+  disp->output_shared = NULL;
   return framecount;
 }
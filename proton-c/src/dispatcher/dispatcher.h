@@ -35,6 +35,65 @@ typedef int (pn_action_t)(pn_dispatcher_t *disp);
 
 #define SCRATCH (1024)
 #define CODEC_LIMIT (1024)
+#define PN_OUTPUT_CHUNK (4*1024)
+#define PN_OUTPUT_REFERENCE (16*1024)
+
+// Encoded frames waiting to be written are queued in a list of chunks.
+// Frames are never split across chunks and output is drained by
+// advancing the head offset of the first chunk, so queued bytes are
+// never moved.  Transfer payloads of at least PN_OUTPUT_REFERENCE
+// bytes are not copied: the frame header goes into an ordinary chunk
+// and is followed by a reference chunk pointing into the payload
+// buffer.  Only payloads held by a reference counted object are
+// referenced, and each reference chunk holds a reference to it.
+typedef struct pn_output_chunk_t pn_output_chunk_t;
+
+struct pn_output_chunk_t {
+  pn_output_chunk_t *chunk_next;
+  pn_output_chunk_t *chunk_prev;
+  size_t capacity;
+  size_t head;   // first byte not yet output
+  size_t tail;   // end of queued bytes
+  char *bytes;
+  bool reference;       // bytes point into a payload buffer
+  void *shared;         // shared payload released with this chunk
+};
+
+// Fields of the performatives received with every message, decoded
+// straight from the frame bytes when they use ordinary encodings. The
+// actions read these rather than scanning args when fast is set.
+typedef struct {
+  uint32_t handle;
+  bool id_present;
+  pn_sequence_t id;
+  pn_bytes_t tag;
+  bool settled;
+  bool more;
+} pn_transfer_fields_t;
+
+typedef struct {
+  bool inext_init;
+  pn_sequence_t inext;
+  uint32_t iwin;
+  pn_sequence_t onext;
+  uint32_t owin;
+  bool handle_init;
+  uint32_t handle;
+  bool dcount_init;
+  pn_sequence_t delivery_count;
+  uint32_t link_credit;
+  bool drain;
+} pn_flow_fields_t;
+
+typedef struct {
+  bool role;
+  pn_sequence_t first;
+  bool last_init;
+  pn_sequence_t last;
+  bool settled;
+  bool type_init;  // the state is always an empty list
+  uint64_t type;
+} pn_disposition_fields_t;
 
 struct pn_dispatcher_t {
   pn_action_t *actions[256];
@@ -45,16 +104,24 @@ struct pn_dispatcher_t {
   uint16_t channel;
   uint8_t code;
   pn_data_t *args;
+  bool fast;  // args is empty, see pn_transfer_fields_t
+  union {
+    pn_transfer_fields_t transfer;
+    pn_flow_fields_t flow;
+    pn_disposition_fields_t disposition;
+  } fields;
   const char *payload;
   size_t size;
   pn_data_t *output_args;
   const char *output_payload;
   size_t output_size;
+  void *output_shared;  // holds output_payload, see pn_set_payload_shared
   size_t remote_max_frame;
   pn_buffer_t *frame;  // frame under construction
-  size_t capacity;
   size_t available; /* number of raw bytes pending output */
-  char *output;
+  pn_output_chunk_t *chunk_head;
+  pn_output_chunk_t *chunk_tail;
+  pn_output_chunk_t *spare;  // drained chunk kept for reuse
   pn_transport_t *transport;
   bool halt;
   bool batch;
@@ -67,11 +134,29 @@ pn_dispatcher_t *pn_dispatcher(uint8_t frame_type, pn_transport_t *transport);
 void pn_dispatcher_free(pn_dispatcher_t *disp);
 void pn_dispatcher_action(pn_dispatcher_t *disp, uint8_t code,
                           pn_action_t *action);
+// fmt is compiled once and cached by address, so it must be a string
+// literal, see pni_data_fill_cached
 int pn_scan_args(pn_dispatcher_t *disp, const char *fmt, ...);
 void pn_set_payload(pn_dispatcher_t *disp, const char *data, size_t size);
+// Like pn_set_payload for data that lies in the reference counted
+// object shared.  Large transfer payloads are referenced in place, each
+// reference holding a reference to shared until it has been output.
+void pn_set_payload_shared(pn_dispatcher_t *disp, const char *data, size_t size,
+                           void *shared);
 int pn_post_frame(pn_dispatcher_t *disp, uint16_t ch, const char *fmt, ...);
 ssize_t pn_dispatcher_input(pn_dispatcher_t *disp, const char *bytes, size_t available);
 ssize_t pn_dispatcher_output(pn_dispatcher_t *disp, char *bytes, size_t size);
+size_t pn_dispatcher_segments(pn_dispatcher_t *disp, pn_bytes_t *segments, size_t count);
+void pn_dispatcher_pop(pn_dispatcher_t *disp, size_t size);
+int pn_post_flow_frame(pn_dispatcher_t *disp, uint16_t ch,
+                       bool echo_id, pn_sequence_t next_incoming_id,
+                       uint32_t incoming_window, pn_sequence_t next_outgoing_id,
+                       uint32_t outgoing_window, bool linkq, uint32_t handle,
+                       pn_sequence_t delivery_count, pn_sequence_t link_credit,
+                       bool drain);
+int pn_post_disposition_frame(pn_dispatcher_t *disp, uint16_t ch, bool role,
+                              pn_sequence_t first, pn_sequence_t last,
+                              bool settled, uint64_t code);
 int pn_post_transfer_frame(pn_dispatcher_t *disp,
                            uint16_t local_channel,
                            uint32_t handle,
@@ -59,11 +59,37 @@ typedef struct {
   bool init;
 } pn_delivery_state_t;
 
+// Delivery ids are allocated contiguously, so the deliveries of a
+// session direction are kept in a ring of slots indexed by id.  The
+// ring spans the ids from lwm, the oldest one it holds, up to next, and
+// doubles when that span outgrows it, up to PN_DELIVERY_MAP_MAX slots.
+// A full ring moves the delivery at lwm to a hash, so that deliveries
+// left unsettled cannot keep lwm from moving on.  The map holds a
+// reference to each delivery in it.  Ids are unsigned here so that
+// they wrap around like the serial numbers they are.
+#define PN_DELIVERY_MAP_MAX (4096)
+
 typedef struct {
-  pn_sequence_t next;
-  pn_hash_t *deliveries;
+  pn_delivery_t **slots;
+  size_t capacity;  // a power of two, zero until the first push
+  uint32_t lwm;
+  uint32_t next;
+  pn_hash_t *behind;  // created for the first delivery to fall behind lwm
 } pn_delivery_map_t;
 
+// Channels and handles are small numbers picked by the endpoint that
+// uses them, so the sessions and links they name are kept in an array
+// indexed by alias.  Aliases from PN_ALIAS_DIRECT up go to a hash, so a
+// peer using huge handle values cannot make the array huge.  The map
+// holds a reference to each object in it.
+#define PN_ALIAS_DIRECT (4096)
+
+typedef struct {
+  void **slots;
+  uint32_t capacity;
+  pn_hash_t *sparse;  // created for the first alias beyond the array
+} pn_alias_map_t;
+
 typedef struct {
   // XXX: stop using negative numbers
   uint32_t local_handle;
@@ -84,8 +110,8 @@ typedef struct {
   pn_sequence_t remote_incoming_window;
   pn_sequence_t outgoing_transfer_count;
   pn_sequence_t outgoing_window;
-  pn_hash_t *local_handles;
-  pn_hash_t *remote_handles;
+  pn_alias_map_t local_handles;
+  pn_alias_map_t remote_handles;
 
   uint64_t disp_code;
   bool disp_settled;
@@ -130,6 +156,7 @@ struct pn_transport_t {
   pn_data_t *remote_desired_capabilities;
   pn_data_t *remote_properties;
   pn_data_t *disp_data;
+  pn_data_t *scratch_data;  // remote values on their way to lazy members
   //#define PN_DEFAULT_MAX_FRAME_SIZE (16*1024)
 #define PN_DEFAULT_MAX_FRAME_SIZE (0)  /* for now, allow unlimited size */
   uint32_t   local_max_frame;
@@ -153,8 +180,8 @@ struct pn_transport_t {
   uint64_t last_bytes_output;
 
   pn_error_t *error;
-  pn_hash_t *local_channels;
-  pn_hash_t *remote_channels;
+  pn_alias_map_t local_channels;
+  pn_alias_map_t remote_channels;
   pn_string_t *scratch;
 
   /* statistics */
@@ -195,6 +222,7 @@ struct pn_connection_t {
   pn_data_t *properties;
   void *context;
   pn_collector_t *collector;
+  pn_buffer_pool_t *buffer_pool;  // storage for the buffers of deliveries
 };
 
 struct pn_session_t {
@@ -264,6 +292,10 @@ struct pn_disposition_t {
   bool settled;
 };
 
+// a delivery whose received bytes outgrow this is held in chunks of
+// this size, so that further transfers never move what has arrived
+#define PN_DELIVERY_CHUNK (64*1024)
+
 struct pn_delivery_t {
   pn_link_t *link;  // reference counted
   pn_buffer_t *tag;
@@ -282,11 +314,19 @@ struct pn_delivery_t {
   pn_delivery_t *tpwork_prev;
   bool tpwork;
   pn_buffer_t *bytes;
+  pn_payload_t *payload;  // shared data sent in place of bytes, or NULL
+  size_t payload_sent;    // how much of payload has been posted
   bool done;
   void *context;
   pn_delivery_state_t state;
 };
 
+struct pn_payload_t {
+  size_t size;
+  char *bytes;  // follows the struct in the same allocation, or lies in owner
+  pn_buffer_t *owner;  // delivery bytes taken over by pni_delivery_share
+};
+
 #define PN_SET_LOCAL(OLD, NEW)                                          \
   (OLD) = ((OLD) & PN_REMOTE_MASK) | (NEW)
 
@@ -302,6 +342,12 @@ ssize_t pn_io_layer_input_passthru(pn_io_layer_t *, const char *, size_t );
 ssize_t pn_io_layer_output_passthru(pn_io_layer_t *, char *, size_t );
 pn_timestamp_t pn_io_layer_tick_passthru(pn_io_layer_t *, pn_timestamp_t);
 
+// Conditions, terminus properties, capabilities, outcomes and filters,
+// and disposition data and annotations are usually empty, so they are
+// NULL until something is stored in them.  The public accessors
+// allocate on first use, internal readers treat NULL as empty.
+pn_data_t *pn_lazy_data(pn_data_t **data);
+pn_string_t *pn_lazy_string(pn_string_t **string);
 void pn_condition_init(pn_condition_t *condition);
 void pn_condition_tini(pn_condition_t *condition);
 void pn_modified(pn_connection_t *connection, pn_endpoint_t *endpoint, bool emit);
@@ -310,5 +356,14 @@ void pn_clear_tpwork(pn_delivery_t *delivery);
 void pn_work_update(pn_connection_t *connection, pn_delivery_t *delivery);
 void pn_clear_modified(pn_connection_t *connection, pn_endpoint_t *endpoint);
 void pn_connection_unbound(pn_connection_t *conn);
+// Like pn_link_send with the contents of *bytes.  When the current
+// delivery holds nothing yet the two buffers are swapped rather than
+// copied.  Either way *bytes is left empty and still owned by the caller.
+ssize_t pn_link_send_buffer(pn_link_t *sender, pn_buffer_t **bytes);
+// drops the delivery's reference to its shared payload, if it has one
+void pn_delivery_release_payload(pn_delivery_t *delivery);
+// turns the delivery's own bytes into its shared payload without
+// copying them, so that they can be referenced in place until output
+int pni_delivery_share(pn_delivery_t *delivery);
 
 #endif /* engine-internal.h */
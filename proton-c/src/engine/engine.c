@@ -196,11 +196,29 @@ pn_transport_t *pn_connection_transport(pn_connection_t *connection)
   return connection->transport;
 }
 
+pn_buffer_pool_t *pn_connection_buffer_pool(pn_connection_t *connection)
+{
+  assert(connection);
+  return connection->buffer_pool;
+}
+
+pn_data_t *pn_lazy_data(pn_data_t **data)
+{
+  if (!*data) *data = pn_data(16);
+  return *data;
+}
+
+pn_string_t *pn_lazy_string(pn_string_t **string)
+{
+  if (!*string) *string = pn_string(NULL);
+  return *string;
+}
+
 void pn_condition_init(pn_condition_t *condition)
 {
-  condition->name = pn_string(NULL);
-  condition->description = pn_string(NULL);
-  condition->info = pn_data(16);
+  condition->name = NULL;
+  condition->description = NULL;
+  condition->info = NULL;
 }
 
 void pn_condition_tini(pn_condition_t *condition)
@@ -368,6 +386,7 @@ static void pn_connection_finalize(void *object)
   pn_free(conn->offered_capabilities);
   pn_free(conn->desired_capabilities);
   pn_free(conn->properties);
+  pn_buffer_pool_free(conn->buffer_pool);
   pn_endpoint_tini(&conn->endpoint);
 }
 
@@ -402,6 +421,7 @@ pn_connection_t *pn_connection()
   conn->desired_capabilities = pn_data(16);
   conn->properties = pn_data(16);
   conn->collector = NULL;
+  conn->buffer_pool = pn_buffer_pool(PN_DELIVERY_CHUNK);
 
   return conn;
 }
@@ -699,8 +719,8 @@ static void pn_session_finalize(void *object)
   pn_endpoint_tini(&session->endpoint);
   pn_delivery_map_free(&session->state.incoming);
   pn_delivery_map_free(&session->state.outgoing);
-  pn_free(session->state.local_handles);
-  pn_free(session->state.remote_handles);
+  pn_alias_map_free(&session->state.local_handles);
+  pn_alias_map_free(&session->state.remote_handles);
   pn_decref(session->connection);
 }
 
@@ -732,8 +752,8 @@ pn_session_t *pn_session(pn_connection_t *conn)
   ssn->state.remote_channel = (uint16_t)-1;
   pn_delivery_map_init(&ssn->state.incoming, 0);
   pn_delivery_map_init(&ssn->state.outgoing, 0);
-  ssn->state.local_handles = pn_hash(0, 0.75, PN_REFCOUNT);
-  ssn->state.remote_handles = pn_hash(0, 0.75, PN_REFCOUNT);
+  pn_alias_map_init(&ssn->state.local_handles);
+  pn_alias_map_init(&ssn->state.remote_handles);
   // end transport state
 
   return ssn;
@@ -783,10 +803,10 @@ void pn_terminus_init(pn_terminus_t *terminus, pn_terminus_type_t type)
   terminus->timeout = 0;
   terminus->dynamic = false;
   terminus->distribution_mode = PN_DIST_MODE_UNSPECIFIED;
-  terminus->properties = pn_data(16);
-  terminus->capabilities = pn_data(16);
-  terminus->outcomes = pn_data(16);
-  terminus->filter = pn_data(16);
+  terminus->properties = NULL;
+  terminus->capabilities = NULL;
+  terminus->outcomes = NULL;
+  terminus->filter = NULL;
 }
 
 static void pn_link_finalize(void *object)
@@ -943,22 +963,22 @@ int pn_terminus_set_dynamic(pn_terminus_t *terminus, bool dynamic)
 
 pn_data_t *pn_terminus_properties(pn_terminus_t *terminus)
 {
-  return terminus ? terminus->properties : NULL;
+  return terminus ? pn_lazy_data(&terminus->properties) : NULL;
 }
 
 pn_data_t *pn_terminus_capabilities(pn_terminus_t *terminus)
 {
-  return terminus ? terminus->capabilities : NULL;
+  return terminus ? pn_lazy_data(&terminus->capabilities) : NULL;
 }
 
 pn_data_t *pn_terminus_outcomes(pn_terminus_t *terminus)
 {
-  return terminus ? terminus->outcomes : NULL;
+  return terminus ? pn_lazy_data(&terminus->outcomes) : NULL;
 }
 
 pn_data_t *pn_terminus_filter(pn_terminus_t *terminus)
 {
-  return terminus ? terminus->filter : NULL;
+  return terminus ? pn_lazy_data(&terminus->filter) : NULL;
 }
 
 pn_distribution_mode_t pn_terminus_get_distribution_mode(const pn_terminus_t *terminus)
@@ -973,6 +993,18 @@ int pn_terminus_set_distribution_mode(pn_terminus_t *terminus, pn_distribution_m
   return 0;
 }
 
+// copies src, which may not have been allocated, into *dst without
+// allocating *dst when there is nothing to copy
+static int pn_lazy_copy(pn_data_t **dst, pn_data_t *src)
+{
+  if (src && pn_data_size(src)) {
+    return pn_data_copy(pn_lazy_data(dst), src);
+  } else if (*dst) {
+    pn_data_clear(*dst);
+  }
+  return 0;
+}
+
 int pn_terminus_copy(pn_terminus_t *terminus, pn_terminus_t *src)
 {
   if (!terminus || !src) {
@@ -987,13 +1019,13 @@ int pn_terminus_copy(pn_terminus_t *terminus, pn_terminus_t *src)
   terminus->timeout = src->timeout;
   terminus->dynamic = src->dynamic;
   terminus->distribution_mode = src->distribution_mode;
-  err = pn_data_copy(terminus->properties, src->properties);
+  err = pn_lazy_copy(&terminus->properties, src->properties);
   if (err) return err;
-  err = pn_data_copy(terminus->capabilities, src->capabilities);
+  err = pn_lazy_copy(&terminus->capabilities, src->capabilities);
   if (err) return err;
-  err = pn_data_copy(terminus->outcomes, src->outcomes);
+  err = pn_lazy_copy(&terminus->outcomes, src->outcomes);
   if (err) return err;
-  err = pn_data_copy(terminus->filter, src->filter);
+  err = pn_lazy_copy(&terminus->filter, src->filter);
   if (err) return err;
   return 0;
 }
@@ -1055,6 +1087,7 @@ static void pn_delivery_finalize(void *object)
   assert(!delivery->state.init);  // no longer in session delivery map
   pn_buffer_free(delivery->tag);
   pn_buffer_free(delivery->bytes);
+  pn_delivery_release_payload(delivery);
   pn_disposition_finalize(&delivery->local);
   pn_disposition_finalize(&delivery->remote);
   pn_decref(delivery->link);
@@ -1062,8 +1095,8 @@ static void pn_delivery_finalize(void *object)
 
 static void pn_disposition_init(pn_disposition_t *ds)
 {
-  ds->data = pn_data(16);
-  ds->annotations = pn_data(16);
+  ds->data = NULL;
+  ds->annotations = NULL;
   pn_condition_init(&ds->condition);
 }
 
@@ -1075,8 +1108,8 @@ static void pn_disposition_clear(pn_disposition_t *ds)
   ds->failed = false;
   ds->undeliverable = false;
   ds->settled = false;
-  pn_data_clear(ds->data);
-  pn_data_clear(ds->annotations);
+  if (ds->data) pn_data_clear(ds->data);
+  if (ds->annotations) pn_data_clear(ds->annotations);
   pn_condition_clear(&ds->condition);
 }
 
@@ -1096,8 +1129,13 @@ pn_delivery_t *pn_delivery(pn_link_t *link, pn_delivery_tag_t tag)
     if (!delivery) return NULL;
     delivery->link = link;
     pn_incref(delivery->link);  // keep link until finalized
-    delivery->tag = pn_buffer(16);
-    delivery->bytes = pn_buffer(64);
+    // storage comes from the connection's pool and goes back on settle
+    pn_buffer_pool_t *pool = link->session->connection->buffer_pool;
+    delivery->tag = pn_buffer(0);
+    pn_buffer_set_pool(delivery->tag, pool);
+    delivery->bytes = pn_buffer(0);
+    pn_buffer_set_pool(delivery->bytes, pool);
+    delivery->payload = NULL;
     pn_disposition_init(&delivery->local);
     pn_disposition_init(&delivery->remote);
   } else {
@@ -1144,7 +1182,7 @@ bool pn_delivery_buffered(pn_delivery_t *delivery)
     if (state->sent) {
       return false;
     } else {
-      return delivery->done || (pn_buffer_size(delivery->bytes) > 0);
+      return delivery->done || (pn_delivery_pending(delivery) > 0);
     }
   } else {
     return false;
@@ -1214,7 +1252,7 @@ uint64_t pn_disposition_type(pn_disposition_t *disposition)
 pn_data_t *pn_disposition_data(pn_disposition_t *disposition)
 {
   assert(disposition);
-  return disposition->data;
+  return pn_lazy_data(&disposition->data);
 }
 
 uint32_t pn_disposition_get_section_number(pn_disposition_t *disposition)
@@ -1268,7 +1306,7 @@ void pn_disposition_set_undeliverable(pn_disposition_t *disposition, bool undeli
 pn_data_t *pn_disposition_annotations(pn_disposition_t *disposition)
 {
   assert(disposition);
-  return disposition->annotations;
+  return pn_lazy_data(&disposition->annotations);
 }
 
 pn_condition_t *pn_disposition_condition(pn_disposition_t *disposition)
@@ -1407,8 +1445,9 @@ void pn_real_settle(pn_delivery_t *delivery)
                       ? &link->session->state.outgoing
                       : &link->session->state.incoming,
                       delivery);
-  pn_buffer_clear(delivery->tag);
-  pn_buffer_clear(delivery->bytes);
+  pn_buffer_release(delivery->tag);
+  pn_buffer_release(delivery->bytes);
+  pn_delivery_release_payload(delivery);
   delivery->settled = true;
   if (link->endpoint.freed) {
     pn_decref(delivery);
@@ -1438,16 +1477,148 @@ void pn_link_offered(pn_link_t *sender, int credit)
   sender->available = credit;
 }
 
+static void pn_payload_finalize(void *object)
+{
+  pn_payload_t *payload = (pn_payload_t *) object;
+  pn_buffer_free(payload->owner);
+}
+
+#define pn_payload_initialize NULL
+#define pn_payload_hashcode NULL
+#define pn_payload_compare NULL
+#define pn_payload_inspect NULL
+
+// room for size bytes follows the payload
+static pn_payload_t *pni_payload(size_t size)
+{
+  static pn_class_t clazz = PN_CLASS(pn_payload);
+  pn_payload_t *payload = (pn_payload_t *) pn_new(sizeof(pn_payload_t) + size, &clazz);
+  if (!payload) return NULL;
+  payload->size = size;
+  payload->bytes = (char *) (payload + 1);
+  payload->owner = NULL;
+  return payload;
+}
+
+pn_payload_t *pn_payload(const char *bytes, size_t size)
+{
+  pn_payload_t *payload = pni_payload(size);
+  if (!payload) return NULL;
+  memcpy(payload->bytes, bytes, size);
+  return payload;
+}
+
+pn_bytes_t pn_payload_bytes(pn_payload_t *payload)
+{
+  assert(payload);
+  return pn_bytes(payload->size, payload->bytes);
+}
+
+void pn_payload_free(pn_payload_t *payload)
+{
+  pn_decref(payload);
+}
+
+void pn_delivery_release_payload(pn_delivery_t *delivery)
+{
+  pn_decref(delivery->payload);
+  delivery->payload = NULL;
+}
+
+int pni_delivery_share(pn_delivery_t *delivery)
+{
+  if (delivery->payload || !pn_buffer_size(delivery->bytes)) return 0;
+  pn_payload_t *payload = pni_payload(0);
+  if (!payload) return PN_ERR;
+  pn_buffer_t *bytes = pn_buffer(0);
+  if (!bytes) {
+    pn_decref(payload);
+    return PN_ERR;
+  }
+  pn_buffer_set_pool(bytes, delivery->link->session->connection->buffer_pool);
+  // the payload keeps the buffer, and with it the pool, until the
+  // output queue is done with it
+  pn_bytes_t shared = pn_buffer_bytes(delivery->bytes);
+  payload->size = shared.size;
+  payload->bytes = (char *) shared.start;
+  payload->owner = delivery->bytes;
+  delivery->bytes = bytes;
+  delivery->payload = payload;
+  delivery->payload_sent = 0;
+  return 0;
+}
+
+// copies the unsent part of a shared payload into the delivery's own
+// bytes, so that more can be added after it
+static void pni_delivery_unshare(pn_delivery_t *delivery)
+{
+  pn_payload_t *payload = delivery->payload;
+  if (payload) {
+    pn_buffer_append(delivery->bytes, payload->bytes + delivery->payload_sent,
+                     payload->size - delivery->payload_sent);
+    pn_delivery_release_payload(delivery);
+  }
+}
+
 ssize_t pn_link_send(pn_link_t *sender, const char *bytes, size_t n)
 {
   pn_delivery_t *current = pn_link_current(sender);
   if (!current) return PN_EOS;
+  pni_delivery_unshare(current);
   pn_buffer_append(current->bytes, bytes, n);
   sender->session->outgoing_bytes += n;
   pn_add_tpwork(current);
   return n;
 }
 
+ssize_t pn_link_send_payload(pn_link_t *sender, pn_payload_t *payload)
+{
+  assert(payload);
+  pn_delivery_t *current = pn_link_current(sender);
+  if (!current) return PN_EOS;
+  if (pn_delivery_pending(current)) {
+    return pn_link_send(sender, payload->bytes, payload->size);
+  }
+  pn_incref(payload);
+  current->payload = payload;
+  current->payload_sent = 0;
+  sender->session->outgoing_bytes += payload->size;
+  pn_add_tpwork(current);
+  return payload->size;
+}
+
+ssize_t pn_link_send_buffer(pn_link_t *sender, pn_buffer_t **bytes)
+{
+  pn_delivery_t *current = pn_link_current(sender);
+  if (!current) return PN_EOS;
+  pni_delivery_unshare(current);
+  size_t n = pn_buffer_size(*bytes);
+  if (pn_buffer_size(current->bytes)) {
+    pn_bytes_t segments[2];
+    size_t offset = 0;
+    while (offset < n) {
+      size_t count = pn_buffer_segments_at(*bytes, offset, segments, 2);
+      for (size_t i = 0; i < count; i++) {
+        pn_buffer_append(current->bytes, segments[i].start, segments[i].size);
+        offset += segments[i].size;
+      }
+    }
+    pn_buffer_clear(*bytes);
+  } else {
+    pn_buffer_t *empty = current->bytes;
+    pn_buffer_clear(empty);
+    // settling gave the storage back, take enough for another message
+    // like this one so the caller does not have to grow it
+    pn_buffer_ensure(empty, pn_buffer_capacity(*bytes));
+    current->bytes = *bytes;
+    pn_buffer_set_pool(current->bytes, sender->session->connection->buffer_pool);
+    *bytes = empty;
+  }
+  sender->session->outgoing_bytes += n;
+  pn_add_tpwork(current);
+  return n;
+}
+
 int pn_link_drained(pn_link_t *link)
 {
   assert(link);
@@ -1468,6 +1639,17 @@ int pn_link_drained(pn_link_t *link)
   return drained;
 }
 
+// drop received bytes from the front of a delivery, reopening the
+// session window if it had closed
+static void pni_link_consume(pn_link_t *receiver, pn_delivery_t *delivery, size_t size)
+{
+  pn_buffer_trim(delivery->bytes, size, 0);
+  receiver->session->incoming_bytes -= size;
+  if (!receiver->session->state.incoming_window) {
+    pn_add_tpwork(delivery);
+  }
+}
+
 ssize_t pn_link_recv(pn_link_t *receiver, char *bytes, size_t n)
 {
   if (!receiver) return PN_ARG_ERR;
@@ -1475,12 +1657,8 @@ ssize_t pn_link_recv(pn_link_t *receiver, char *bytes, size_t n)
   pn_delivery_t *delivery = receiver->current;
   if (delivery) {
     size_t size = pn_buffer_get(delivery->bytes, 0, n, bytes);
-    pn_buffer_trim(delivery->bytes, size, 0);
     if (size) {
-      receiver->session->incoming_bytes -= size;
-      if (!receiver->session->state.incoming_window) {
-        pn_add_tpwork(delivery);
-      }
+      pni_link_consume(receiver, delivery, size);
       return size;
     } else {
       return delivery->done ? PN_EOS : 0;
@@ -1490,6 +1668,35 @@ ssize_t pn_link_recv(pn_link_t *receiver, char *bytes, size_t n)
   }
 }
 
+ssize_t pn_link_recv_segments(pn_link_t *receiver, pn_bytes_t *segments, size_t count)
+{
+  if (!receiver) return PN_ARG_ERR;
+
+  pn_delivery_t *delivery = receiver->current;
+  if (delivery) {
+    size_t n = pn_buffer_segments(delivery->bytes, segments, count);
+    if (!n && delivery->done && !pn_buffer_size(delivery->bytes)) {
+      return PN_EOS;
+    }
+    return n;
+  } else {
+    return PN_STATE_ERR;
+  }
+}
+
+int pn_link_consume(pn_link_t *receiver, size_t size)
+{
+  if (!receiver) return PN_ARG_ERR;
+
+  pn_delivery_t *delivery = receiver->current;
+  if (!delivery) return PN_STATE_ERR;
+  if (size > pn_buffer_size(delivery->bytes)) return PN_UNDERFLOW;
+  if (size) {
+    pni_link_consume(receiver, delivery, size);
+  }
+  return 0;
+}
+
 void pn_link_flow(pn_link_t *receiver, int credit)
 {
   assert(receiver);
@@ -1601,6 +1808,9 @@ bool pn_delivery_readable(pn_delivery_t *delivery)
 
 size_t pn_delivery_pending(pn_delivery_t *delivery)
 {
+  if (delivery->payload) {
+    return delivery->payload->size - delivery->payload_sent;
+  }
   return pn_buffer_size(delivery->bytes);
 }
 
@@ -1648,45 +1858,47 @@ pn_condition_t *pn_link_remote_condition(pn_link_t *link)
 
 bool pn_condition_is_set(pn_condition_t *condition)
 {
-  return condition && pn_string_get(condition->name);
+  return condition && condition->name && pn_string_get(condition->name);
 }
 
 void pn_condition_clear(pn_condition_t *condition)
 {
   assert(condition);
-  pn_string_clear(condition->name);
-  pn_string_clear(condition->description);
-  pn_data_clear(condition->info);
+  if (condition->name) pn_string_clear(condition->name);
+  if (condition->description) pn_string_clear(condition->description);
+  if (condition->info) pn_data_clear(condition->info);
 }
 
 const char *pn_condition_get_name(pn_condition_t *condition)
 {
   assert(condition);
-  return pn_string_get(condition->name);
+  return condition->name ? pn_string_get(condition->name) : NULL;
 }
 
 int pn_condition_set_name(pn_condition_t *condition, const char *name)
 {
   assert(condition);
-  return pn_string_set(condition->name, name);
+  if (!name && !condition->name) return 0;
+  return pn_string_set(pn_lazy_string(&condition->name), name);
 }
 
 const char *pn_condition_get_description(pn_condition_t *condition)
 {
   assert(condition);
-  return pn_string_get(condition->description);
+  return condition->description ? pn_string_get(condition->description) : NULL;
 }
 
 int pn_condition_set_description(pn_condition_t *condition, const char *description)
 {
   assert(condition);
-  return pn_string_set(condition->description, description);
+  if (!description && !condition->description) return 0;
+  return pn_string_set(pn_lazy_string(&condition->description), description);
 }
 
 pn_data_t *pn_condition_info(pn_condition_t *condition)
 {
   assert(condition);
-  return condition->info;
+  return pn_lazy_data(&condition->info);
 }
 
 bool pn_condition_is_redirect(pn_condition_t *condition)
@@ -1697,7 +1909,8 @@ bool pn_condition_is_redirect(pn_condition_t *condition)
 
 const char *pn_condition_redirect_host(pn_condition_t *condition)
 {
-  pn_data_t *data = pn_condition_info(condition);
+  pn_data_t *data = condition->info;
+  if (!data) return NULL;
   pn_data_rewind(data);
   pn_data_next(data);
   pn_data_enter(data);
@@ -1709,7 +1922,8 @@ const char *pn_condition_redirect_host(pn_condition_t *condition)
 
 int pn_condition_redirect_port(pn_condition_t *condition)
 {
-  pn_data_t *data = pn_condition_info(condition);
+  pn_data_t *data = condition->info;
+  if (!data) return 0;
   pn_data_rewind(data);
   pn_data_next(data);
   pn_data_enter(data);
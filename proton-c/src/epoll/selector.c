@@ -0,0 +1,446 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/selector.h>
+#include <proton/error.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+#include "../platform.h"
+#include "../selectable.h"
+#include "../util.h"
+
+/*
+ * A selector backed by epoll. Each registered selectable owns a slot,
+ * the slot number is both the selectable's index and the epoll user
+ * data. Interest is only pushed to the kernel when it changes, and
+ * deadlines are kept in a binary min-heap of slots, so select and
+ * next do work proportional to the number of ready selectables rather
+ * than the number registered.
+ */
+
+typedef struct {
+  pn_selectable_t *selectable;
+  pn_socket_t fd;
+  int events;        // interest registered with epoll
+  int ready;         // PN_READABLE|PN_WRITABLE|PN_EXPIRED from the last select
+  pn_timestamp_t deadline;
+  int heap;          // position in the deadline heap, -1 if no deadline
+  int next_free;
+  bool failed;       // epoll_ctl failed, retried by the next select
+} pni_slot_t;
+
+struct pn_selector_t {
+  int epfd;
+  pni_slot_t *slots;
+  size_t capacity;
+  size_t size;
+  int free_slot;
+  int *heap;
+  size_t heap_size;
+  int *ready;
+  size_t ready_size;
+  size_t current;
+  struct epoll_event *events;
+  size_t failed;     // slots whose epoll_ctl failed
+  pn_error_t *error;
+};
+
+void pn_selector_initialize(void *obj)
+{
+  pn_selector_t *selector = (pn_selector_t *) obj;
+  selector->slots = NULL;
+  selector->capacity = 0;
+  selector->size = 0;
+  selector->free_slot = -1;
+  selector->heap = NULL;
+  selector->heap_size = 0;
+  selector->ready = NULL;
+  selector->ready_size = 0;
+  selector->current = 0;
+  selector->events = NULL;
+  selector->failed = 0;
+  selector->error = pn_error();
+  selector->epfd = epoll_create(16);
+  if (selector->epfd == -1) {
+    pn_i_error_from_errno(selector->error, "epoll_create");
+  }
+}
+
+void pn_selector_finalize(void *obj)
+{
+  pn_selector_t *selector = (pn_selector_t *) obj;
+  if (selector->epfd != -1) close(selector->epfd);
+  free(selector->slots);
+  free(selector->heap);
+  free(selector->ready);
+  free(selector->events);
+  pn_error_free(selector->error);
+}
+
+#define pn_selector_hashcode NULL
+#define pn_selector_compare NULL
+#define pn_selector_inspect NULL
+
+pn_selector_t *pn_selector(void)
+{
+  static pn_class_t clazz = PN_CLASS(pn_selector);
+  pn_selector_t *selector = (pn_selector_t *) pn_new(sizeof(pn_selector_t), &clazz);
+  return selector;
+}
+
+// deadline heap
+
+static void pni_heap_place(pn_selector_t *selector, size_t pos, int slot)
+{
+  selector->heap[pos] = slot;
+  selector->slots[slot].heap = pos;
+}
+
+static pn_timestamp_t pni_heap_deadline(pn_selector_t *selector, size_t pos)
+{
+  return selector->slots[selector->heap[pos]].deadline;
+}
+
+static void pni_heap_up(pn_selector_t *selector, size_t pos)
+{
+  int slot = selector->heap[pos];
+  pn_timestamp_t deadline = selector->slots[slot].deadline;
+  while (pos > 0) {
+    size_t parent = (pos - 1)/2;
+    if (pni_heap_deadline(selector, parent) <= deadline) break;
+    pni_heap_place(selector, pos, selector->heap[parent]);
+    pos = parent;
+  }
+  pni_heap_place(selector, pos, slot);
+}
+
+static void pni_heap_down(pn_selector_t *selector, size_t pos)
+{
+  int slot = selector->heap[pos];
+  pn_timestamp_t deadline = selector->slots[slot].deadline;
+  while (true) {
+    size_t child = 2*pos + 1;
+    if (child >= selector->heap_size) break;
+    if (child + 1 < selector->heap_size &&
+        pni_heap_deadline(selector, child + 1) < pni_heap_deadline(selector, child)) {
+      child++;
+    }
+    if (deadline <= pni_heap_deadline(selector, child)) break;
+    pni_heap_place(selector, pos, selector->heap[child]);
+    pos = child;
+  }
+  pni_heap_place(selector, pos, slot);
+}
+
+static void pni_heap_remove(pn_selector_t *selector, int slot)
+{
+  int pos = selector->slots[slot].heap;
+  if (pos < 0) return;
+  selector->slots[slot].heap = -1;
+  int last = selector->heap[--selector->heap_size];
+  if (last != slot) {
+    pni_heap_place(selector, pos, last);
+    pni_heap_up(selector, pos);
+    pni_heap_down(selector, selector->slots[last].heap);
+  }
+}
+
+static void pni_set_deadline(pn_selector_t *selector, int slot, pn_timestamp_t deadline)
+{
+  pni_slot_t *s = &selector->slots[slot];
+  if (s->deadline == deadline) return;
+  if (!deadline) {
+    pni_heap_remove(selector, slot);
+    s->deadline = 0;
+  } else if (s->heap < 0) {
+    s->deadline = deadline;
+    pni_heap_place(selector, selector->heap_size++, slot);
+    pni_heap_up(selector, s->heap);
+  } else {
+    bool earlier = deadline < s->deadline;
+    s->deadline = deadline;
+    if (earlier) {
+      pni_heap_up(selector, s->heap);
+    } else {
+      pni_heap_down(selector, s->heap);
+    }
+  }
+}
+
+// ready list
+
+static void pni_mark_ready(pn_selector_t *selector, int slot, int events)
+{
+  pni_slot_t *s = &selector->slots[slot];
+  if (!s->ready) {
+    selector->ready[selector->ready_size++] = slot;
+  }
+  s->ready |= events;
+}
+
+// visits only the part of the heap that has expired
+static void pni_heap_expired(pn_selector_t *selector, size_t pos, pn_timestamp_t now)
+{
+  if (pos >= selector->heap_size || pni_heap_deadline(selector, pos) > now) return;
+  pni_mark_ready(selector, selector->heap[pos], PN_EXPIRED);
+  pni_heap_expired(selector, 2*pos + 1, now);
+  pni_heap_expired(selector, 2*pos + 2, now);
+}
+
+static int pni_interest(pn_selectable_t *selectable)
+{
+  int events = 0;
+  if (pn_selectable_capacity(selectable) > 0) {
+    events |= EPOLLIN;
+  }
+  if (pn_selectable_pending(selectable) > 0) {
+    events |= EPOLLOUT;
+  }
+  return events;
+}
+
+static void pni_epoll_ctl(pn_selector_t *selector, int op, int slot)
+{
+  pni_slot_t *s = &selector->slots[slot];
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = s->events;
+  ev.data.u32 = slot;
+  int result = epoll_ctl(selector->epfd, op, s->fd, &ev);
+  if (result == -1 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+    // the descriptor was closed (and so dropped by epoll) and reused
+    result = epoll_ctl(selector->epfd, EPOLL_CTL_ADD, s->fd, &ev);
+  }
+  if (result == -1 && op == EPOLL_CTL_DEL && (errno == ENOENT || errno == EBADF)) {
+    // already gone, closing a descriptor removes it from the epoll set
+    result = 0;
+  }
+  // a failure belongs to the selectable rather than the selector, so it
+  // is left for the next select to deal with
+  bool failed = result == -1 && op != EPOLL_CTL_DEL;
+  if (failed != s->failed) {
+    s->failed = failed;
+    if (failed) {
+      selector->failed++;
+    } else {
+      selector->failed--;
+    }
+  }
+}
+
+// retry the registrations that have failed, the owners of those that
+// fail again find out why from their recv or send, returns how many
+static int pni_retry_failed(pn_selector_t *selector)
+{
+  int count = 0;
+  for (size_t slot = 0; selector->failed && slot < selector->size; slot++) {
+    pni_slot_t *s = &selector->slots[slot];
+    if (!s->selectable || !s->failed) continue;
+    pni_epoll_ctl(selector, EPOLL_CTL_MOD, slot);
+    if (!s->failed) continue;
+    if (s->events & EPOLLIN) {
+      pni_mark_ready(selector, slot, PN_READABLE);
+      count++;
+    } else if (s->events & EPOLLOUT) {
+      pni_mark_ready(selector, slot, PN_WRITABLE);
+      count++;
+    }
+  }
+  return count;
+}
+
+void pn_selector_add(pn_selector_t *selector, pn_selectable_t *selectable)
+{
+  assert(selector);
+  assert(selectable);
+  assert(pni_selectable_get_index(selectable) < 0);
+
+  if (pni_selectable_get_index(selectable) < 0) {
+    int slot;
+    if (selector->free_slot >= 0) {
+      slot = selector->free_slot;
+      selector->free_slot = selector->slots[slot].next_free;
+    } else {
+      if (selector->capacity == selector->size) {
+        selector->capacity = selector->capacity ? 2*selector->capacity : 16;
+        selector->slots = (pni_slot_t *) realloc(selector->slots, selector->capacity*sizeof(pni_slot_t));
+        selector->heap = (int *) realloc(selector->heap, selector->capacity*sizeof(int));
+        selector->ready = (int *) realloc(selector->ready, selector->capacity*sizeof(int));
+        selector->events = (struct epoll_event *) realloc(selector->events, selector->capacity*sizeof(struct epoll_event));
+      }
+      slot = selector->size++;
+    }
+
+    pni_slot_t *s = &selector->slots[slot];
+    s->selectable = selectable;
+    s->fd = pn_selectable_fd(selectable);
+    s->events = pni_interest(selectable);
+    s->ready = 0;
+    s->deadline = 0;
+    s->heap = -1;
+    s->next_free = -1;
+    s->failed = false;
+    pni_selectable_set_index(selectable, slot);
+    pni_epoll_ctl(selector, EPOLL_CTL_ADD, slot);
+  }
+
+  pn_selector_update(selector, selectable);
+}
+
+void pn_selector_update(pn_selector_t *selector, pn_selectable_t *selectable)
+{
+  int slot = pni_selectable_get_index(selectable);
+  assert(slot >= 0);
+  pni_slot_t *s = &selector->slots[slot];
+
+  pn_socket_t fd = pn_selectable_fd(selectable);
+  int events = pni_interest(selectable);
+  if (fd != s->fd) {
+    pni_epoll_ctl(selector, EPOLL_CTL_DEL, slot);
+    s->fd = fd;
+    s->events = events;
+    pni_epoll_ctl(selector, EPOLL_CTL_ADD, slot);
+  } else if (events != s->events) {
+    s->events = events;
+    pni_epoll_ctl(selector, EPOLL_CTL_MOD, slot);
+  }
+
+  pni_set_deadline(selector, slot, pn_selectable_deadline(selectable));
+}
+
+void pn_selector_remove(pn_selector_t *selector, pn_selectable_t *selectable)
+{
+  assert(selector);
+  assert(selectable);
+
+  int slot = pni_selectable_get_index(selectable);
+  assert(slot >= 0);
+  pni_slot_t *s = &selector->slots[slot];
+
+  pni_epoll_ctl(selector, EPOLL_CTL_DEL, slot);
+  pni_heap_remove(selector, slot);
+
+  // the slot may be reused before the current results are consumed
+  if (s->ready) {
+    for (size_t i = selector->current; i < selector->ready_size; i++) {
+      if (selector->ready[i] == slot) selector->ready[i] = -1;
+    }
+  }
+
+  s->selectable = NULL;
+  s->ready = 0;
+  s->deadline = 0;
+  s->next_free = selector->free_slot;
+  selector->free_slot = slot;
+
+  pni_selectable_set_index(selectable, -1);
+}
+
+int pn_selector_select(pn_selector_t *selector, int timeout)
+{
+  assert(selector);
+
+  if (selector->epfd == -1) {
+    return pn_error_code(selector->error);
+  }
+
+  if (timeout && selector->heap_size) {
+    pn_timestamp_t deadline = pni_heap_deadline(selector, 0);
+    pn_timestamp_t now = pn_i_now();
+    int64_t delta = deadline - now;
+    if (delta < 0) {
+      timeout = 0;
+    } else if (timeout < 0 || delta < timeout) {
+      timeout = delta > INT_MAX ? INT_MAX : (int) delta;
+    }
+  }
+
+  // forget the previous results
+  for (size_t i = 0; i < selector->ready_size; i++) {
+    int slot = selector->ready[i];
+    if (slot >= 0) selector->slots[slot].ready = 0;
+  }
+  selector->ready_size = 0;
+  selector->current = 0;
+
+  pn_error_clear(selector->error);
+  if (pni_retry_failed(selector)) {
+    timeout = 0;
+  }
+
+  int maxevents = selector->capacity ? selector->capacity : 1;
+  struct epoll_event dummy;
+  int result = epoll_wait(selector->epfd, selector->events ? selector->events : &dummy,
+                          maxevents, timeout);
+  if (result == -1) {
+    pn_i_error_from_errno(selector->error, "epoll_wait");
+  } else {
+    for (int i = 0; i < result; i++) {
+      struct epoll_event *ev = &selector->events[i];
+      int slot = ev->data.u32;
+      pni_slot_t *s = &selector->slots[slot];
+      int events = 0;
+      if (ev->events & EPOLLIN) {
+        events |= PN_READABLE;
+      }
+      if (ev->events & EPOLLOUT) {
+        events |= PN_WRITABLE;
+      }
+      // let the selectable find the error or hangup via recv or send
+      if (!events && (ev->events & (EPOLLERR | EPOLLHUP))) {
+        if (s->events & EPOLLIN) {
+          events |= PN_READABLE;
+        } else if (s->events & EPOLLOUT) {
+          events |= PN_WRITABLE;
+        }
+      }
+      if (events) {
+        pni_mark_ready(selector, slot, events);
+      }
+    }
+    pni_heap_expired(selector, 0, pn_i_now());
+  }
+
+  return pn_error_code(selector->error);
+}
+
+pn_selectable_t *pn_selector_next(pn_selector_t *selector, int *events)
+{
+  while (selector->current < selector->ready_size) {
+    int slot = selector->ready[selector->current++];
+    if (slot < 0) continue;
+    pni_slot_t *s = &selector->slots[slot];
+    *events = s->ready;
+    return s->selectable;
+  }
+  return NULL;
+}
+
+void pn_selector_free(pn_selector_t *selector)
+{
+  assert(selector);
+  pn_free(selector);
+}
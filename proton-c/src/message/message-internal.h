@@ -0,0 +1,31 @@
+#ifndef _PROTON_MESSAGE_INTERNAL_H
+#define _PROTON_MESSAGE_INTERNAL_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/buffer.h>
+#include <proton/message.h>
+
+// Encodes msg onto the end of buf, growing buf as needed.
+int pni_message_encode_buffer(pn_message_t *msg, pn_buffer_t *buf);
+
+#endif /* message-internal.h */
@@ -28,8 +28,11 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <ctype.h>
 #include "protocol.h"
 #include "../util.h"
+#include "../codec/data.h"
+#include "message-internal.h"
 #include "../platform_fmt.h"
 
 ssize_t pn_message_data(char *dst, size_t available, const char *src, size_t size)
@@ -48,6 +51,51 @@ ssize_t pn_message_data(char *dst, size_t available, const char *src, size_t siz
 
 // message
 
+// The sections of a message, in the order they are encoded.
+typedef enum {
+  PNI_HEADER,
+  PNI_INSTRUCTIONS,
+  PNI_ANNOTATIONS,
+  PNI_PROPERTIES,
+  PNI_APPLICATION_PROPERTIES,
+  PNI_BODY,
+  PNI_FOOTER,
+  PNI_SECTIONS
+} pni_section_t;
+
+#define PNI_SECTION(S) (1 << (S))
+
+// The string valued properties, which are kept in the message's arena.
+typedef enum {
+  PNI_USER_ID,
+  PNI_ADDRESS,
+  PNI_SUBJECT,
+  PNI_REPLY_TO,
+  PNI_CONTENT_TYPE,
+  PNI_CONTENT_ENCODING,
+  PNI_GROUP_ID,
+  PNI_REPLY_TO_GROUP_ID,
+  PNI_FIELDS
+} pni_field_id_t;
+
+// A value in the arena, null terminated.  The room it was given is
+// reused by a later value that fits.
+typedef struct {
+  char *value;
+  uint32_t size;
+  uint32_t capacity;  // zero if the field has no room in the arena
+  bool set;
+} pni_field_t;
+
+// The arena starts out inline in the message, and continues in blocks
+// chained from the newest.  Values never move, so the pointers the
+// getters return stay good until the same field is set again.
+typedef struct pni_arena_block_t {
+  struct pni_arena_block_t *prev;
+} pni_arena_block_t;
+
+#define PNI_ARENA_INLINE (128)
+
 struct pn_message_t {
   bool durable;
   uint8_t priority;
@@ -55,42 +103,48 @@ struct pn_message_t {
   bool first_acquirer;
   uint32_t delivery_count;
   pn_data_t *id;
-  pn_string_t *user_id;
-  pn_string_t *address;
-  pn_string_t *subject;
-  pn_string_t *reply_to;
   pn_data_t *correlation_id;
-  pn_string_t *content_type;
-  pn_string_t *content_encoding;
   pn_timestamp_t expiry_time;
   pn_timestamp_t creation_time;
-  pn_string_t *group_id;
   pn_sequence_t group_sequence;
-  pn_string_t *reply_to_group_id;
+  pni_field_t fields[PNI_FIELDS];
 
   bool inferred;
+  // the pn_data_t members are NULL until first used
   pn_data_t *data;
   pn_data_t *instructions;
   pn_data_t *annotations;
   pn_data_t *properties;
   pn_data_t *body;
 
+  // A decoded message keeps its encoded bytes and where each section
+  // lies in them.  A lazy message decodes a section on first use, and
+  // sections that have not been modified are copied back out rather
+  // than encoded again.
+  bool lazy;
+  pn_buffer_t *encoded;  // NULL until the first decode
+  size_t offsets[PNI_SECTIONS];
+  size_t sizes[PNI_SECTIONS];  // zero for a section not present
+  uint8_t pending;  // sections not decoded yet
+  uint8_t dirty;    // sections that may no longer match their bytes
+  uint32_t generations[PNI_SECTIONS];  // of the members, as last read
+
   pn_format_t format;
   pn_parser_t *parser;
   pn_error_t *error;
+
+  // The values of the string fields.  Clearing the message frees all but
+  // the newest block of the arena, which is kept for the next values.
+  char *arena;  // where new values go
+  size_t arena_size;
+  size_t arena_capacity;
+  pni_arena_block_t *blocks;  // NULL while the arena is inline
+  char arena_inline[PNI_ARENA_INLINE];
 };
 
 void pn_message_finalize(void *obj)
 {
   pn_message_t *msg = (pn_message_t *) obj;
-  pn_free(msg->user_id);
-  pn_free(msg->address);
-  pn_free(msg->subject);
-  pn_free(msg->reply_to);
-  pn_free(msg->content_type);
-  pn_free(msg->content_encoding);
-  pn_free(msg->group_id);
-  pn_free(msg->reply_to_group_id);
   pn_data_free(msg->id);
   pn_data_free(msg->correlation_id);
   pn_data_free(msg->data);
@@ -98,22 +152,184 @@ void pn_message_finalize(void *obj)
   pn_data_free(msg->annotations);
   pn_data_free(msg->properties);
   pn_data_free(msg->body);
+  pn_buffer_free(msg->encoded);
   pn_parser_free(msg->parser);
   pn_error_free(msg->error);
+  while (msg->blocks) {
+    pni_arena_block_t *block = msg->blocks;
+    msg->blocks = block->prev;
+    free(block);
+  }
+}
+
+static pn_data_t *pni_message_data(pn_data_t **data)
+{
+  if (!*data) *data = pn_data(16);
+  return *data;
+}
+
+static const char *pni_field_get(pn_message_t *msg, pni_field_id_t id)
+{
+  pni_field_t *field = &msg->fields[id];
+  return field->set ? field->value : NULL;
+}
+
+// starts a new block with room for a value of size bytes
+static int pni_arena_grow(pn_message_t *msg, size_t size)
+{
+  if (size >= UINT32_MAX) return PN_OVERFLOW;
+  size_t capacity = 2*msg->arena_capacity;
+  while (capacity < size + 1) capacity *= 2;
+
+  pni_arena_block_t *block = (pni_arena_block_t *) malloc(sizeof(pni_arena_block_t) + capacity);
+  assert(block);
+  block->prev = msg->blocks;
+  msg->blocks = block;
+  msg->arena = (char *) (block + 1);
+  msg->arena_size = 0;
+  msg->arena_capacity = capacity;
+  return 0;
+}
+
+// frees the blocks before the newest, and empties that one
+static void pni_arena_clear(pn_message_t *msg)
+{
+  if (msg->blocks) {
+    pni_arena_block_t *block = msg->blocks->prev;
+    msg->blocks->prev = NULL;
+    while (block) {
+      pni_arena_block_t *prev = block->prev;
+      free(block);
+      block = prev;
+    }
+  }
+  msg->arena_size = 0;
+}
+
+// sets a field to size bytes from start, or unsets it if start is NULL
+static int pni_field_set(pn_message_t *msg, pni_field_id_t id, const char *start, size_t size)
+{
+  pni_field_t *field = &msg->fields[id];
+  if (!start) {
+    field->set = false;
+    field->size = 0;
+    return 0;
+  }
+
+  if (size + 1 > field->capacity) {
+    // a value that keeps growing gets twice the room each time, as
+    // the room it leaves behind is not reused before the next clear
+    size_t capacity = pn_max(size + 1, 2*(size_t) field->capacity);
+    if (capacity > msg->arena_capacity - msg->arena_size) {
+      int err = pni_arena_grow(msg, capacity - 1);
+      if (err) return err;
+    }
+    field->value = msg->arena + msg->arena_size;
+    field->capacity = capacity;
+    msg->arena_size += capacity;
+  }
+
+  memmove(field->value, start, size);
+  field->value[size] = '\0';
+  field->size = size;
+  field->set = true;
+  return 0;
+}
+
+static int pni_field_inspect(pn_message_t *msg, pni_field_id_t id, pn_string_t *dst)
+{
+  const char *value = pni_field_get(msg, id);
+  int err = pn_string_addf(dst, "\"");
+  if (err) return err;
+
+  for (uint32_t i = 0; i < msg->fields[id].size; i++) {
+    uint8_t c = value[i];
+    if (isprint(c)) {
+      err = pn_string_addf(dst, "%c", c);
+    } else {
+      err = pn_string_addf(dst, "\\x%.2x", c);
+    }
+    if (err) return err;
+  }
+
+  return pn_string_addf(dst, "\"");
+}
+
+static int pni_message_decode_sections(pn_message_t *msg, const char *bytes, size_t size);
+
+// The pn_data_t members a section is kept in.  They can be modified
+// through pointers handed out before the message was decoded, so a
+// section is also taken to be modified if their generations have moved
+// on since it was read.
+static uint32_t pni_section_generation(pn_message_t *msg, pni_section_t section)
+{
+  switch (section) {
+  case PNI_INSTRUCTIONS: return pni_data_generation(msg->instructions);
+  case PNI_ANNOTATIONS: return pni_data_generation(msg->annotations);
+  case PNI_PROPERTIES:
+    return pni_data_generation(msg->id) + pni_data_generation(msg->correlation_id);
+  case PNI_APPLICATION_PROPERTIES: return pni_data_generation(msg->properties);
+  case PNI_BODY: return pni_data_generation(msg->body);
+  default: return 0;
+  }
+}
+
+// whether there are members of the section that may have been handed out
+static bool pni_section_held(pn_message_t *msg, pni_section_t section)
+{
+  switch (section) {
+  case PNI_INSTRUCTIONS: return msg->instructions;
+  case PNI_ANNOTATIONS: return msg->annotations;
+  case PNI_PROPERTIES: return msg->id || msg->correlation_id;
+  case PNI_APPLICATION_PROPERTIES: return msg->properties;
+  case PNI_BODY: return msg->body;
+  default: return false;
+  }
+}
+
+// decodes a section of a lazy message on first use
+static int pni_section_read(pn_message_t *msg, pni_section_t section)
+{
+  if (msg->pending & PNI_SECTION(section)) {
+    msg->pending &= ~PNI_SECTION(section);
+    pn_bytes_t bytes = pn_buffer_bytes(msg->encoded);
+    int err = pni_message_decode_sections(msg, bytes.start + msg->offsets[section],
+                                          msg->sizes[section]);
+    msg->generations[section] = pni_section_generation(msg, section);
+    return err;
+  }
+  return 0;
+}
+
+// a section that is about to be modified, or handed out where it may be
+static int pni_section_modify(pn_message_t *msg, pni_section_t section)
+{
+  msg->dirty |= PNI_SECTION(section);
+  return pni_section_read(msg, section);
+}
+
+static int pni_message_read_all(pn_message_t *msg)
+{
+  for (int section = 0; section < PNI_SECTIONS; section++) {
+    int err = pni_section_read(msg, (pni_section_t) section);
+    if (err) return err;
+  }
+  return 0;
 }
 
 int pn_message_inspect(void *obj, pn_string_t *dst)
 {
   pn_message_t *msg = (pn_message_t *) obj;
+  pni_message_read_all(msg);
   int err = pn_string_addf(dst, "Message{");
   if (err) return err;
 
   bool comma = false;
 
-  if (pn_string_get(msg->address)) {
+  if (pni_field_get(msg, PNI_ADDRESS)) {
     err = pn_string_addf(dst, "address=");
     if (err) return err;
-    err = pn_inspect(msg->address, dst);
+    err = pni_field_inspect(msg, PNI_ADDRESS, dst);
     if (err) return err;
     err = pn_string_addf(dst, ", ");
     if (err) return err;
@@ -160,30 +376,30 @@ int pn_message_inspect(void *obj, pn_string_t *dst)
     comma = true;
   }
 
-  if (pn_string_get(msg->user_id)) {
+  if (pni_field_get(msg, PNI_USER_ID)) {
     err = pn_string_addf(dst, "user_id=");
     if (err) return err;
-    err = pn_inspect(msg->user_id, dst);
+    err = pni_field_inspect(msg, PNI_USER_ID, dst);
     if (err) return err;
     err = pn_string_addf(dst, ", ");
     if (err) return err;
     comma = true;
   }
 
-  if (pn_string_get(msg->subject)) {
+  if (pni_field_get(msg, PNI_SUBJECT)) {
     err = pn_string_addf(dst, "subject=");
     if (err) return err;
-    err = pn_inspect(msg->subject, dst);
+    err = pni_field_inspect(msg, PNI_SUBJECT, dst);
     if (err) return err;
     err = pn_string_addf(dst, ", ");
     if (err) return err;
     comma = true;
   }
 
-  if (pn_string_get(msg->reply_to)) {
+  if (pni_field_get(msg, PNI_REPLY_TO)) {
     err = pn_string_addf(dst, "reply_to=");
     if (err) return err;
-    err = pn_inspect(msg->reply_to, dst);
+    err = pni_field_inspect(msg, PNI_REPLY_TO, dst);
     if (err) return err;
     err = pn_string_addf(dst, ", ");
     if (err) return err;
@@ -200,20 +416,20 @@ int pn_message_inspect(void *obj, pn_string_t *dst)
     comma = true;
   }
 
-  if (pn_string_get(msg->content_type)) {
+  if (pni_field_get(msg, PNI_CONTENT_TYPE)) {
     err = pn_string_addf(dst, "content_type=");
     if (err) return err;
-    err = pn_inspect(msg->content_type, dst);
+    err = pni_field_inspect(msg, PNI_CONTENT_TYPE, dst);
     if (err) return err;
     err = pn_string_addf(dst, ", ");
     if (err) return err;
     comma = true;
   }
 
-  if (pn_string_get(msg->content_encoding)) {
+  if (pni_field_get(msg, PNI_CONTENT_ENCODING)) {
     err = pn_string_addf(dst, "content_encoding=");
     if (err) return err;
-    err = pn_inspect(msg->content_encoding, dst);
+    err = pni_field_inspect(msg, PNI_CONTENT_ENCODING, dst);
     if (err) return err;
     err = pn_string_addf(dst, ", ");
     if (err) return err;
@@ -232,10 +448,10 @@ int pn_message_inspect(void *obj, pn_string_t *dst)
     comma = true;
   }
 
-  if (pn_string_get(msg->group_id)) {
+  if (pni_field_get(msg, PNI_GROUP_ID)) {
     err = pn_string_addf(dst, "group_id=");
     if (err) return err;
-    err = pn_inspect(msg->group_id, dst);
+    err = pni_field_inspect(msg, PNI_GROUP_ID, dst);
     if (err) return err;
     err = pn_string_addf(dst, ", ");
     if (err) return err;
@@ -248,10 +464,10 @@ int pn_message_inspect(void *obj, pn_string_t *dst)
     comma = true;
   }
 
-  if (pn_string_get(msg->reply_to_group_id)) {
+  if (pni_field_get(msg, PNI_REPLY_TO_GROUP_ID)) {
     err = pn_string_addf(dst, "reply_to_group_id=");
     if (err) return err;
-    err = pn_inspect(msg->reply_to_group_id, dst);
+    err = pni_field_inspect(msg, PNI_REPLY_TO_GROUP_ID, dst);
     if (err) return err;
     err = pn_string_addf(dst, ", ");
     if (err) return err;
@@ -325,30 +541,35 @@ pn_message_t *pn_message()
   msg->ttl = 0;
   msg->first_acquirer = false;
   msg->delivery_count = 0;
-  msg->id = pn_data(1);
-  msg->user_id = pn_string(NULL);
-  msg->address = pn_string(NULL);
-  msg->subject = pn_string(NULL);
-  msg->reply_to = pn_string(NULL);
-  msg->correlation_id = pn_data(1);
-  msg->content_type = pn_string(NULL);
-  msg->content_encoding = pn_string(NULL);
+  msg->id = NULL;
+  msg->correlation_id = NULL;
   msg->expiry_time = 0;
   msg->creation_time = 0;
-  msg->group_id = pn_string(NULL);
   msg->group_sequence = 0;
-  msg->reply_to_group_id = pn_string(NULL);
+  memset(msg->fields, 0, sizeof(msg->fields));
 
   msg->inferred = false;
-  msg->data = pn_data(16);
-  msg->instructions = pn_data(16);
-  msg->annotations = pn_data(16);
-  msg->properties = pn_data(16);
-  msg->body = pn_data(16);
+  msg->data = NULL;
+  msg->instructions = NULL;
+  msg->annotations = NULL;
+  msg->properties = NULL;
+  msg->body = NULL;
+
+  msg->lazy = false;
+  msg->encoded = NULL;
+  memset(msg->sizes, 0, sizeof(msg->sizes));
+  msg->pending = 0;
+  msg->dirty = 0;
+  memset(msg->generations, 0, sizeof(msg->generations));
 
   msg->format = PN_DATA;
   msg->parser = NULL;
   msg->error = pn_error();
+
+  msg->arena = msg->arena_inline;
+  msg->arena_size = 0;
+  msg->arena_capacity = PNI_ARENA_INLINE;
+  msg->blocks = NULL;
   return msg;
 }
 
@@ -365,24 +586,35 @@ void pn_message_clear(pn_message_t *msg)
   msg->first_acquirer = false;
   msg->delivery_count = 0;
   pn_data_clear(msg->id);
-  pn_string_clear(msg->user_id);
-  pn_string_clear(msg->address);
-  pn_string_clear(msg->subject);
-  pn_string_clear(msg->reply_to);
   pn_data_clear(msg->correlation_id);
-  pn_string_clear(msg->content_type);
-  pn_string_clear(msg->content_encoding);
   msg->expiry_time = 0;
   msg->creation_time = 0;
-  pn_string_clear(msg->group_id);
   msg->group_sequence = 0;
-  pn_string_clear(msg->reply_to_group_id);
+  memset(msg->fields, 0, sizeof(msg->fields));
+  pni_arena_clear(msg);
   msg->inferred = false;
   pn_data_clear(msg->data);
   pn_data_clear(msg->instructions);
   pn_data_clear(msg->annotations);
   pn_data_clear(msg->properties);
   pn_data_clear(msg->body);
+  if (msg->encoded) pn_buffer_clear(msg->encoded);
+  memset(msg->sizes, 0, sizeof(msg->sizes));
+  msg->pending = 0;
+  msg->dirty = 0;
+}
+
+bool pn_message_is_lazy(pn_message_t *msg)
+{
+  assert(msg);
+  return msg->lazy;
+}
+
+int pn_message_set_lazy(pn_message_t *msg, bool lazy)
+{
+  assert(msg);
+  msg->lazy = lazy;
+  return lazy ? 0 : pni_message_read_all(msg);
 }
 
 int pn_message_errno(pn_message_t *msg)
@@ -422,11 +654,13 @@ pn_parser_t *pn_message_parser(pn_message_t *msg)
 bool pn_message_is_durable(pn_message_t *msg)
 {
   assert(msg);
+  pni_section_read(msg, PNI_HEADER);
   return msg->durable;
 }
 int pn_message_set_durable(pn_message_t *msg, bool durable)
 {
   assert(msg);
+  pni_section_modify(msg, PNI_HEADER);
   msg->durable = durable;
   return 0;
 }
@@ -435,11 +669,13 @@ int pn_message_set_durable(pn_message_t *msg, bool durable)
 uint8_t pn_message_get_priority(pn_message_t *msg)
 {
   assert(msg);
+  pni_section_read(msg, PNI_HEADER);
   return msg->priority;
 }
 int pn_message_set_priority(pn_message_t *msg, uint8_t priority)
 {
   assert(msg);
+  pni_section_modify(msg, PNI_HEADER);
   msg->priority = priority;
   return 0;
 }
@@ -447,11 +683,13 @@ int pn_message_set_priority(pn_message_t *msg, uint8_t priority)
 pn_millis_t pn_message_get_ttl(pn_message_t *msg)
 {
   assert(msg);
+  pni_section_read(msg, PNI_HEADER);
   return msg->ttl;
 }
 int pn_message_set_ttl(pn_message_t *msg, pn_millis_t ttl)
 {
   assert(msg);
+  pni_section_modify(msg, PNI_HEADER);
   msg->ttl = ttl;
   return 0;
 }
@@ -459,11 +697,13 @@ int pn_message_set_ttl(pn_message_t *msg, pn_millis_t ttl)
 bool pn_message_is_first_acquirer(pn_message_t *msg)
 {
   assert(msg);
+  pni_section_read(msg, PNI_HEADER);
   return msg->first_acquirer;
 }
 int pn_message_set_first_acquirer(pn_message_t *msg, bool first)
 {
   assert(msg);
+  pni_section_modify(msg, PNI_HEADER);
   msg->first_acquirer = first;
   return 0;
 }
@@ -471,11 +711,13 @@ int pn_message_set_first_acquirer(pn_message_t *msg, bool first)
 uint32_t pn_message_get_delivery_count(pn_message_t *msg)
 {
   assert(msg);
+  pni_section_read(msg, PNI_HEADER);
   return msg->delivery_count;
 }
 int pn_message_set_delivery_count(pn_message_t *msg, uint32_t count)
 {
   assert(msg);
+  pni_section_modify(msg, PNI_HEADER);
   msg->delivery_count = count;
   return 0;
 }
@@ -483,121 +725,139 @@ int pn_message_set_delivery_count(pn_message_t *msg, uint32_t count)
 pn_data_t *pn_message_id(pn_message_t *msg)
 {
   assert(msg);
-  return msg->id;
+  pni_section_modify(msg, PNI_PROPERTIES);
+  return pni_message_data(&msg->id);
 }
 pn_atom_t pn_message_get_id(pn_message_t *msg)
 {
   assert(msg);
+  pni_section_read(msg, PNI_PROPERTIES);
+  if (!msg->id) {
+    pn_atom_t atom = {PN_NULL};
+    return atom;
+  }
   return pn_data_get_atom(msg->id);
 }
 int pn_message_set_id(pn_message_t *msg, pn_atom_t id)
 {
   assert(msg);
-  pn_data_rewind(msg->id);
+  pni_section_modify(msg, PNI_PROPERTIES);
+  pn_data_rewind(pni_message_data(&msg->id));
   return pn_data_put_atom(msg->id, id);
 }
 
-static pn_bytes_t pn_string_get_bytes(pn_string_t *string)
-{
-  return pn_bytes(pn_string_size(string), (char *) pn_string_get(string));
-}
-
-static int pn_string_set_bytes(pn_string_t *string, pn_bytes_t bytes)
-{
-  return pn_string_setn(string, bytes.start, bytes.size);
-}
-
 pn_bytes_t pn_message_get_user_id(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get_bytes(msg->user_id);
+  pni_section_read(msg, PNI_PROPERTIES);
+  return pn_bytes(msg->fields[PNI_USER_ID].size, (char *) pni_field_get(msg, PNI_USER_ID));
 }
 int pn_message_set_user_id(pn_message_t *msg, pn_bytes_t user_id)
 {
   assert(msg);
-  return pn_string_set_bytes(msg->user_id, user_id);
+  pni_section_modify(msg, PNI_PROPERTIES);
+  return pni_field_set(msg, PNI_USER_ID, user_id.start, user_id.size);
 }
 
 const char *pn_message_get_address(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->address);
+  pni_section_read(msg, PNI_PROPERTIES);
+  return pni_field_get(msg, PNI_ADDRESS);
 }
 int pn_message_set_address(pn_message_t *msg, const char *address)
 {
   assert(msg);
-  return pn_string_set(msg->address, address);
+  pni_section_modify(msg, PNI_PROPERTIES);
+  return pni_field_set(msg, PNI_ADDRESS, address, address ? strlen(address) : 0);
 }
 
 const char *pn_message_get_subject(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->subject);
+  pni_section_read(msg, PNI_PROPERTIES);
+  return pni_field_get(msg, PNI_SUBJECT);
 }
 int pn_message_set_subject(pn_message_t *msg, const char *subject)
 {
   assert(msg);
-  return pn_string_set(msg->subject, subject);
+  pni_section_modify(msg, PNI_PROPERTIES);
+  return pni_field_set(msg, PNI_SUBJECT, subject, subject ? strlen(subject) : 0);
 }
 
 const char *pn_message_get_reply_to(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->reply_to);
+  pni_section_read(msg, PNI_PROPERTIES);
+  return pni_field_get(msg, PNI_REPLY_TO);
 }
 int pn_message_set_reply_to(pn_message_t *msg, const char *reply_to)
 {
   assert(msg);
-  return pn_string_set(msg->reply_to, reply_to);
+  pni_section_modify(msg, PNI_PROPERTIES);
+  return pni_field_set(msg, PNI_REPLY_TO, reply_to, reply_to ? strlen(reply_to) : 0);
 }
 
 pn_data_t *pn_message_correlation_id(pn_message_t *msg)
 {
   assert(msg);
-  return msg->correlation_id;
+  pni_section_modify(msg, PNI_PROPERTIES);
+  return pni_message_data(&msg->correlation_id);
 }
 pn_atom_t pn_message_get_correlation_id(pn_message_t *msg)
 {
   assert(msg);
+  pni_section_read(msg, PNI_PROPERTIES);
+  if (!msg->correlation_id) {
+    pn_atom_t atom = {PN_NULL};
+    return atom;
+  }
   return pn_data_get_atom(msg->correlation_id);
 }
 int pn_message_set_correlation_id(pn_message_t *msg, pn_atom_t atom)
 {
   assert(msg);
-  pn_data_rewind(msg->correlation_id);
+  pni_section_modify(msg, PNI_PROPERTIES);
+  pn_data_rewind(pni_message_data(&msg->correlation_id));
   return pn_data_put_atom(msg->correlation_id, atom);
 }
 
 const char *pn_message_get_content_type(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->content_type);
+  pni_section_read(msg, PNI_PROPERTIES);
+  return pni_field_get(msg, PNI_CONTENT_TYPE);
 }
 int pn_message_set_content_type(pn_message_t *msg, const char *type)
 {
   assert(msg);
-  return pn_string_set(msg->content_type, type);
+  pni_section_modify(msg, PNI_PROPERTIES);
+  return pni_field_set(msg, PNI_CONTENT_TYPE, type, type ? strlen(type) : 0);
 }
 
 const char *pn_message_get_content_encoding(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->content_encoding);
+  pni_section_read(msg, PNI_PROPERTIES);
+  return pni_field_get(msg, PNI_CONTENT_ENCODING);
 }
 int pn_message_set_content_encoding(pn_message_t *msg, const char *encoding)
 {
   assert(msg);
-  return pn_string_set(msg->content_encoding, encoding);
+  pni_section_modify(msg, PNI_PROPERTIES);
+  return pni_field_set(msg, PNI_CONTENT_ENCODING, encoding, encoding ? strlen(encoding) : 0);
 }
 
 pn_timestamp_t pn_message_get_expiry_time(pn_message_t *msg)
 {
   assert(msg);
+  pni_section_read(msg, PNI_PROPERTIES);
   return msg->expiry_time;
 }
 int pn_message_set_expiry_time(pn_message_t *msg, pn_timestamp_t time)
 {
   assert(msg);
+  pni_section_modify(msg, PNI_PROPERTIES);
   msg->expiry_time = time;
   return 0;
 }
@@ -605,11 +865,13 @@ int pn_message_set_expiry_time(pn_message_t *msg, pn_timestamp_t time)
 pn_timestamp_t pn_message_get_creation_time(pn_message_t *msg)
 {
   assert(msg);
+  pni_section_read(msg, PNI_PROPERTIES);
   return msg->creation_time;
 }
 int pn_message_set_creation_time(pn_message_t *msg, pn_timestamp_t time)
 {
   assert(msg);
+  pni_section_modify(msg, PNI_PROPERTIES);
   msg->creation_time = time;
   return 0;
 }
@@ -617,22 +879,26 @@ int pn_message_set_creation_time(pn_message_t *msg, pn_timestamp_t time)
 const char *pn_message_get_group_id(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->group_id);
+  pni_section_read(msg, PNI_PROPERTIES);
+  return pni_field_get(msg, PNI_GROUP_ID);
 }
 int pn_message_set_group_id(pn_message_t *msg, const char *group_id)
 {
   assert(msg);
-  return pn_string_set(msg->group_id, group_id);
+  pni_section_modify(msg, PNI_PROPERTIES);
+  return pni_field_set(msg, PNI_GROUP_ID, group_id, group_id ? strlen(group_id) : 0);
 }
 
 pn_sequence_t pn_message_get_group_sequence(pn_message_t *msg)
 {
   assert(msg);
+  pni_section_read(msg, PNI_PROPERTIES);
   return msg->group_sequence;
 }
 int pn_message_set_group_sequence(pn_message_t *msg, pn_sequence_t n)
 {
   assert(msg);
+  pni_section_modify(msg, PNI_PROPERTIES);
   msg->group_sequence = n;
   return 0;
 }
@@ -640,30 +906,127 @@ int pn_message_set_group_sequence(pn_message_t *msg, pn_sequence_t n)
 const char *pn_message_get_reply_to_group_id(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->reply_to_group_id);
+  pni_section_read(msg, PNI_PROPERTIES);
+  return pni_field_get(msg, PNI_REPLY_TO_GROUP_ID);
 }
 int pn_message_set_reply_to_group_id(pn_message_t *msg, const char *reply_to_group_id)
 {
   assert(msg);
-  return pn_string_set(msg->reply_to_group_id, reply_to_group_id);
+  pni_section_modify(msg, PNI_PROPERTIES);
+  return pni_field_set(msg, PNI_REPLY_TO_GROUP_ID, reply_to_group_id, reply_to_group_id ? strlen(reply_to_group_id) : 0);
 }
 
-int pn_message_decode(pn_message_t *msg, const char *bytes, size_t size)
+// The header and properties sections are read straight from their
+// encoding.  A field of another type than expected reads as absent, as
+// it does for pn_data_scan, but PN_ARG_ERR is returned for described
+// or compound fields, which are left to the general decode.
+
+static int pni_read_fields(const char *bytes, size_t size, pn_atom_t *fields, int count)
 {
-  assert(msg && bytes && size);
+  pni_list_reader_t reader;
+  int err = pni_list_reader_start(&reader, bytes, size);
+  for (int i = 0; !err && i < count; i++) {
+    err = pni_list_reader_next(&reader, &fields[i]);
+  }
+  // the general decode reports any error in detail
+  return err ? PN_ARG_ERR : 0;
+}
 
-  pn_message_clear(msg);
+static pn_bytes_t pni_atom_bytes(pn_atom_t *atom, pn_type_t type)
+{
+  return atom->type == type ? atom->u.as_bytes : pn_bytes(0, NULL);
+}
+
+static int pni_message_read_header(pn_message_t *msg, const char *bytes, size_t size)
+{
+  pn_atom_t fields[5];
+  int err = pni_read_fields(bytes, size, fields, 5);
+  if (err) return err;
+
+  msg->durable = fields[0].type == PN_BOOL && fields[0].u.as_bool;
+  msg->priority = fields[1].type == PN_UBYTE ? fields[1].u.as_ubyte : 0;
+  msg->ttl = fields[2].type == PN_UINT ? fields[2].u.as_uint : 0;
+  msg->first_acquirer = fields[3].type == PN_BOOL && fields[3].u.as_bool;
+  msg->delivery_count = fields[4].type == PN_UINT ? fields[4].u.as_uint : 0;
+  return 0;
+}
+
+// an id is any value, and the pn_data_t for it is only made if needed
+static int pni_message_read_id(pn_data_t **id, pn_atom_t *atom)
+{
+  pn_data_clear(*id);
+  if (atom->type == PN_NULL) return 0;
+  return pn_data_put_atom(pni_message_data(id), *atom);
+}
+
+static int pni_message_read_properties(pn_message_t *msg, const char *bytes, size_t size)
+{
+  pn_atom_t fields[13];
+  int err = pni_read_fields(bytes, size, fields, 13);
+  if (err) return err;
 
+  err = pni_message_read_id(&msg->id, &fields[0]);
+  if (err) return pn_error_format(msg->error, err, "error setting id");
+  pn_bytes_t user_id = pni_atom_bytes(&fields[1], PN_BINARY);
+  err = pni_field_set(msg, PNI_USER_ID, user_id.start, user_id.size);
+  if (err) return pn_error_format(msg->error, err, "error setting user_id");
+  pn_bytes_t address = pni_atom_bytes(&fields[2], PN_STRING);
+  err = pni_field_set(msg, PNI_ADDRESS, address.start, address.size);
+  if (err) return pn_error_format(msg->error, err, "error setting address");
+  pn_bytes_t subject = pni_atom_bytes(&fields[3], PN_STRING);
+  err = pni_field_set(msg, PNI_SUBJECT, subject.start, subject.size);
+  if (err) return pn_error_format(msg->error, err, "error setting subject");
+  pn_bytes_t reply_to = pni_atom_bytes(&fields[4], PN_STRING);
+  err = pni_field_set(msg, PNI_REPLY_TO, reply_to.start, reply_to.size);
+  if (err) return pn_error_format(msg->error, err, "error setting reply_to");
+  err = pni_message_read_id(&msg->correlation_id, &fields[5]);
+  if (err) return pn_error_format(msg->error, err, "error setting correlation_id");
+  pn_bytes_t ctype = pni_atom_bytes(&fields[6], PN_SYMBOL);
+  err = pni_field_set(msg, PNI_CONTENT_TYPE, ctype.start, ctype.size);
+  if (err) return pn_error_format(msg->error, err, "error setting content_type");
+  pn_bytes_t cencoding = pni_atom_bytes(&fields[7], PN_SYMBOL);
+  err = pni_field_set(msg, PNI_CONTENT_ENCODING, cencoding.start, cencoding.size);
+  if (err) return pn_error_format(msg->error, err, "error setting content_encoding");
+  msg->expiry_time = fields[8].type == PN_TIMESTAMP ? fields[8].u.as_timestamp : 0;
+  msg->creation_time = fields[9].type == PN_TIMESTAMP ? fields[9].u.as_timestamp : 0;
+  pn_bytes_t group_id = pni_atom_bytes(&fields[10], PN_STRING);
+  err = pni_field_set(msg, PNI_GROUP_ID, group_id.start, group_id.size);
+  if (err) return pn_error_format(msg->error, err, "error setting group_id");
+  msg->group_sequence = fields[11].type == PN_UINT ? fields[11].u.as_uint : 0;
+  pn_bytes_t reply_to_group_id = pni_atom_bytes(&fields[12], PN_STRING);
+  err = pni_field_set(msg, PNI_REPLY_TO_GROUP_ID, reply_to_group_id.start,
+                      reply_to_group_id.size);
+  if (err) return pn_error_format(msg->error, err, "error setting reply_to_group_id");
+  return 0;
+}
+
+// decodes the sections in bytes into the fields of msg
+static int pni_message_decode_sections(pn_message_t *msg, const char *bytes, size_t size)
+{
   while (size) {
-    pn_data_clear(msg->data);
-    ssize_t used = pn_data_decode(msg->data, bytes, size);
+    uint64_t descriptor;
+    ssize_t section = pni_decoder_size(bytes, size, &descriptor);
+    if (section > 0 && (descriptor == HEADER || descriptor == PROPERTIES)) {
+      int err = descriptor == HEADER ? pni_message_read_header(msg, bytes, section)
+        : pni_message_read_properties(msg, bytes, section);
+      if (err != PN_ARG_ERR) {
+        if (err) return err;
+        size -= section;
+        bytes += section;
+        continue;
+      }
+    }
+
+    // every section is copied out of msg->data before the next
+    pn_data_clear(pni_message_data(&msg->data));
+    ssize_t used = pn_data_decode_borrowed(msg->data, bytes, size);
     if (used < 0) return pn_error_format(msg->error, used, "data error: %s",
                                          pn_data_error(msg->data));
     size -= used;
     bytes += used;
     bool scanned;
     uint64_t desc;
-    int err = pn_data_scan(msg->data, "D?L.", &scanned, &desc);
+    int err = pni_data_scan_cached(msg->data, "D?L.", &scanned, &desc);
     if (err) return pn_error_format(msg->error, err, "data error: %s",
                                     pn_data_error(msg->data));
     if (!scanned) {
@@ -677,68 +1040,67 @@ int pn_message_decode(pn_message_t *msg, const char *bytes, size_t size)
 
     switch (desc) {
     case HEADER:
-      pn_data_scan(msg->data, "D.[oBIoI]", &msg->durable, &msg->priority,
-                   &msg->ttl, &msg->first_acquirer, &msg->delivery_count);
+      pni_data_scan_cached(msg->data, "D.[oBIoI]", &msg->durable, &msg->priority,
+                           &msg->ttl, &msg->first_acquirer, &msg->delivery_count);
       break;
     case PROPERTIES:
       {
         pn_bytes_t user_id, address, subject, reply_to, ctype, cencoding,
           group_id, reply_to_group_id;
-        pn_data_clear(msg->id);
-        pn_data_clear(msg->correlation_id);
-        err = pn_data_scan(msg->data, "D.[CzSSSCssttSIS]", msg->id,
-                           &user_id, &address, &subject, &reply_to,
-                           msg->correlation_id, &ctype, &cencoding,
-                           &msg->expiry_time, &msg->creation_time, &group_id,
-                           &msg->group_sequence, &reply_to_group_id);
+        pn_data_clear(pni_message_data(&msg->id));
+        pn_data_clear(pni_message_data(&msg->correlation_id));
+        err = pni_data_scan_cached(msg->data, "D.[CzSSSCssttSIS]", msg->id,
+                                   &user_id, &address, &subject, &reply_to,
+                                   msg->correlation_id, &ctype, &cencoding,
+                                   &msg->expiry_time, &msg->creation_time, &group_id,
+                                   &msg->group_sequence, &reply_to_group_id);
         if (err) return pn_error_format(msg->error, err, "data error: %s",
                                         pn_data_error(msg->data));
-        err = pn_string_set_bytes(msg->user_id, user_id);
+        err = pni_field_set(msg, PNI_USER_ID, user_id.start, user_id.size);
         if (err) return pn_error_format(msg->error, err, "error setting user_id");
-        err = pn_string_setn(msg->address, address.start, address.size);
+        err = pni_field_set(msg, PNI_ADDRESS, address.start, address.size);
         if (err) return pn_error_format(msg->error, err, "error setting address");
-        err = pn_string_setn(msg->subject, subject.start, subject.size);
+        err = pni_field_set(msg, PNI_SUBJECT, subject.start, subject.size);
         if (err) return pn_error_format(msg->error, err, "error setting subject");
-        err = pn_string_setn(msg->reply_to, reply_to.start, reply_to.size);
+        err = pni_field_set(msg, PNI_REPLY_TO, reply_to.start, reply_to.size);
         if (err) return pn_error_format(msg->error, err, "error setting reply_to");
-        err = pn_string_setn(msg->content_type, ctype.start, ctype.size);
+        err = pni_field_set(msg, PNI_CONTENT_TYPE, ctype.start, ctype.size);
         if (err) return pn_error_format(msg->error, err, "error setting content_type");
-        err = pn_string_setn(msg->content_encoding, cencoding.start,
-                             cencoding.size);
+        err = pni_field_set(msg, PNI_CONTENT_ENCODING, cencoding.start, cencoding.size);
         if (err) return pn_error_format(msg->error, err, "error setting content_encoding");
-        err = pn_string_setn(msg->group_id, group_id.start, group_id.size);
+        err = pni_field_set(msg, PNI_GROUP_ID, group_id.start, group_id.size);
         if (err) return pn_error_format(msg->error, err, "error setting group_id");
-        err = pn_string_setn(msg->reply_to_group_id, reply_to_group_id.start,
-                             reply_to_group_id.size);
+        err = pni_field_set(msg, PNI_REPLY_TO_GROUP_ID, reply_to_group_id.start,
+                            reply_to_group_id.size);
         if (err) return pn_error_format(msg->error, err, "error setting reply_to_group_id");
       }
       break;
     case DELIVERY_ANNOTATIONS:
       pn_data_narrow(msg->data);
-      err = pn_data_copy(msg->instructions, msg->data);
+      err = pn_data_copy(pni_message_data(&msg->instructions), msg->data);
       if (err) return err;
       break;
     case MESSAGE_ANNOTATIONS:
       pn_data_narrow(msg->data);
-      err = pn_data_copy(msg->annotations, msg->data);
+      err = pn_data_copy(pni_message_data(&msg->annotations), msg->data);
       if (err) return err;
       break;
     case APPLICATION_PROPERTIES:
       pn_data_narrow(msg->data);
-      err = pn_data_copy(msg->properties, msg->data);
+      err = pn_data_copy(pni_message_data(&msg->properties), msg->data);
       if (err) return err;
       break;
     case DATA:
     case AMQP_SEQUENCE:
     case AMQP_VALUE:
       pn_data_narrow(msg->data);
-      err = pn_data_copy(msg->body, msg->data);
+      err = pn_data_copy(pni_message_data(&msg->body), msg->data);
       if (err) return err;
       break;
     case FOOTER:
       break;
     default:
-      err = pn_data_copy(msg->body, msg->data);
+      err = pn_data_copy(pni_message_data(&msg->body), msg->data);
       if (err) return err;
       break;
     }
@@ -748,120 +1110,297 @@ int pn_message_decode(pn_message_t *msg, const char *bytes, size_t size)
   return 0;
 }
 
-int pn_message_encode(pn_message_t *msg, char *bytes, size_t *size)
+static pni_section_t pni_section_of(uint64_t descriptor)
 {
-  if (!msg || !bytes || !size || !*size) return PN_ARG_ERR;
+  switch (descriptor) {
+  case HEADER: return PNI_HEADER;
+  case DELIVERY_ANNOTATIONS: return PNI_INSTRUCTIONS;
+  case MESSAGE_ANNOTATIONS: return PNI_ANNOTATIONS;
+  case PROPERTIES: return PNI_PROPERTIES;
+  case APPLICATION_PROPERTIES: return PNI_APPLICATION_PROPERTIES;
+  case FOOTER: return PNI_FOOTER;
+  default: return PNI_BODY;
+  }
+}
 
-  pn_data_clear(msg->data);
+// Finds where each section lies in bytes.  Only the body may take more
+// than one value, so *ordered is cleared for sections out of order or
+// repeated, which are not indexed.  Nothing is indexed unless every
+// section frames correctly, as the bytes are not kept otherwise.
+static int pni_message_index(pn_message_t *msg, const char *bytes, size_t size, bool *ordered)
+{
+  size_t offset = 0;
+  int last = -1;
+  uint8_t pending = 0;
+  *ordered = true;
 
-  int err = pn_data_fill(msg->data, "DL[oB?IoI]", HEADER, msg->durable,
-                         msg->priority, msg->ttl, msg->ttl, msg->first_acquirer,
-                         msg->delivery_count);
-  if (err)
-    return pn_error_format(msg->error, err, "data error: %s",
-                           pn_data_error(msg->data));
+  while (offset < size) {
+    uint64_t descriptor;
+    ssize_t used = pni_decoder_size(bytes + offset, size - offset, &descriptor);
+    if (used < 0) {
+      memset(msg->sizes, 0, sizeof(msg->sizes));
+      return pn_error_format(msg->error, used, "data error: malformed section");
+    }
+    pni_section_t section = pni_section_of(descriptor);
+    if ((int) section < last || ((int) section == last && section != PNI_BODY)) {
+      *ordered = false;
+    } else if ((int) section == last) {
+      msg->sizes[section] = offset + used - msg->offsets[section];
+    } else {
+      msg->offsets[section] = offset;
+      msg->sizes[section] = used;
+      pending |= PNI_SECTION(section);
+    }
+    last = section;
+    offset += used;
+  }
 
-  if (pn_data_size(msg->instructions)) {
-    pn_data_put_described(msg->data);
-    pn_data_enter(msg->data);
-    pn_data_put_ulong(msg->data, DELIVERY_ANNOTATIONS);
-    pn_data_rewind(msg->instructions);
-    err = pn_data_append(msg->data, msg->instructions);
-    if (err)
-      return pn_error_format(msg->error, err, "data error: %s",
-                             pn_data_error(msg->data));
-    pn_data_exit(msg->data);
+  msg->pending = pending;
+  return 0;
+}
+
+int pn_message_decode(pn_message_t *msg, const char *bytes, size_t size)
+{
+  assert(msg && bytes && size);
+
+  pn_message_clear(msg);
+
+  bool ordered;
+  int err = pni_message_index(msg, bytes, size, &ordered);
+  if (err) return err;
+  if (!ordered) {
+    // decoded as a whole, and encoded again from the fields
+    memset(msg->sizes, 0, sizeof(msg->sizes));
+    msg->pending = 0;
+    return pni_message_decode_sections(msg, bytes, size);
   }
 
-  if (pn_data_size(msg->annotations)) {
-    pn_data_put_described(msg->data);
-    pn_data_enter(msg->data);
-    pn_data_put_ulong(msg->data, MESSAGE_ANNOTATIONS);
-    pn_data_rewind(msg->annotations);
-    err = pn_data_append(msg->data, msg->annotations);
-    if (err)
-      return pn_error_format(msg->error, err, "data error: %s",
-                             pn_data_error(msg->data));
-    pn_data_exit(msg->data);
+  if (!msg->encoded) {
+    msg->encoded = pn_buffer(size);
+  }
+  err = pn_buffer_append(msg->encoded, bytes, size);
+  if (err) {
+    memset(msg->sizes, 0, sizeof(msg->sizes));
+    msg->pending = 0;
+    return err;
+  }
+
+  for (int i = 0; i < PNI_SECTIONS; i++) {
+    pni_section_t section = (pni_section_t) i;
+    msg->generations[section] = pni_section_generation(msg, section);
+    // a member that was handed out before is read now, as reading it
+    // later would lose what was written to it in between
+    if (!msg->lazy || pni_section_held(msg, section)) {
+      err = pni_section_read(msg, section);
+      if (err) return err;
+    }
+  }
+  return 0;
+}
+
+// adds a section to msg->data, ready to be encoded
+static int pni_message_fill_section(pn_message_t *msg, pni_section_t section)
+{
+  int err = 0;
+
+  switch (section) {
+  case PNI_HEADER:
+    err = pni_data_fill_cached(msg->data, "DL[oB?IoI]", HEADER, msg->durable,
+                               msg->priority, msg->ttl, msg->ttl, msg->first_acquirer,
+                               msg->delivery_count);
+    break;
+  case PNI_INSTRUCTIONS:
+    if (pn_data_size(msg->instructions)) {
+      pn_data_put_described(msg->data);
+      pn_data_enter(msg->data);
+      pn_data_put_ulong(msg->data, DELIVERY_ANNOTATIONS);
+      pn_data_rewind(msg->instructions);
+      err = pn_data_append(msg->data, msg->instructions);
+      pn_data_exit(msg->data);
+    }
+    break;
+  case PNI_ANNOTATIONS:
+    if (pn_data_size(msg->annotations)) {
+      pn_data_put_described(msg->data);
+      pn_data_enter(msg->data);
+      pn_data_put_ulong(msg->data, MESSAGE_ANNOTATIONS);
+      pn_data_rewind(msg->annotations);
+      err = pn_data_append(msg->data, msg->annotations);
+      pn_data_exit(msg->data);
+    }
+    break;
+  case PNI_PROPERTIES:
+    err = pni_data_fill_cached(msg->data, "DL[CzSSSCssttSIS]", PROPERTIES,
+                               msg->id,
+                               msg->fields[PNI_USER_ID].size,
+                               pni_field_get(msg, PNI_USER_ID),
+                               pni_field_get(msg, PNI_ADDRESS),
+                               pni_field_get(msg, PNI_SUBJECT),
+                               pni_field_get(msg, PNI_REPLY_TO),
+                               msg->correlation_id,
+                               pni_field_get(msg, PNI_CONTENT_TYPE),
+                               pni_field_get(msg, PNI_CONTENT_ENCODING),
+                               msg->expiry_time,
+                               msg->creation_time,
+                               pni_field_get(msg, PNI_GROUP_ID),
+                               msg->group_sequence,
+                               pni_field_get(msg, PNI_REPLY_TO_GROUP_ID));
+    break;
+  case PNI_APPLICATION_PROPERTIES:
+    if (pn_data_size(msg->properties)) {
+      pn_data_put_described(msg->data);
+      pn_data_enter(msg->data);
+      pn_data_put_ulong(msg->data, APPLICATION_PROPERTIES);
+      pn_data_rewind(msg->properties);
+      err = pn_data_append(msg->data, msg->properties);
+      pn_data_exit(msg->data);
+    }
+    break;
+  case PNI_BODY:
+    if (pn_data_size(msg->body)) {
+      pn_data_rewind(msg->body);
+      pn_data_next(msg->body);
+      pn_type_t body_type = pn_data_type(msg->body);
+      pn_data_rewind(msg->body);
+
+      pn_data_put_described(msg->data);
+      pn_data_enter(msg->data);
+      if (msg->inferred) {
+        switch (body_type) {
+        case PN_BINARY:
+          pn_data_put_ulong(msg->data, DATA);
+          break;
+        case PN_LIST:
+          pn_data_put_ulong(msg->data, AMQP_SEQUENCE);
+          break;
+        default:
+          pn_data_put_ulong(msg->data, AMQP_VALUE);
+          break;
+        }
+      } else {
+        pn_data_put_ulong(msg->data, AMQP_VALUE);
+      }
+      err = pn_data_append(msg->data, msg->body);
+      pn_data_exit(msg->data);
+    }
+    break;
+  default:
+    break;
   }
 
-  err = pn_data_fill(msg->data, "DL[CzSSSCssttSIS]", PROPERTIES,
-                     msg->id,
-                     pn_string_size(msg->user_id), pn_string_get(msg->user_id),
-                     pn_string_get(msg->address),
-                     pn_string_get(msg->subject),
-                     pn_string_get(msg->reply_to),
-                     msg->correlation_id,
-                     pn_string_get(msg->content_type),
-                     pn_string_get(msg->content_encoding),
-                     msg->expiry_time,
-                     msg->creation_time,
-                     pn_string_get(msg->group_id),
-                     msg->group_sequence,
-                     pn_string_get(msg->reply_to_group_id));
   if (err)
     return pn_error_format(msg->error, err, "data error: %s",
                            pn_data_error(msg->data));
+  return 0;
+}
 
-  if (pn_data_size(msg->properties)) {
-    pn_data_put_described(msg->data);
-    pn_data_enter(msg->data);
-    pn_data_put_ulong(msg->data, APPLICATION_PROPERTIES);
-    pn_data_rewind(msg->properties);
-    err = pn_data_append(msg->data, msg->properties);
-    if (err)
-      return pn_error_format(msg->error, err, "data error: %s",
-                             pn_data_error(msg->data));
-    pn_data_exit(msg->data);
-  }
+// Encoded messages go either to a fixed array or onto a buffer.
+typedef struct {
+  pn_buffer_t *buf;
+  char *bytes;
+  size_t size;
+  size_t used;
+} pni_message_output_t;
 
-  if (pn_data_size(msg->body)) {
-    pn_data_rewind(msg->body);
-    pn_data_next(msg->body);
-    pn_type_t body_type = pn_data_type(msg->body);
-    pn_data_rewind(msg->body);
+static int pni_output_bytes(pni_message_output_t *out, const char *bytes, size_t size)
+{
+  if (out->buf) return pn_buffer_append(out->buf, bytes, size);
+  if (size > out->size - out->used) return PN_OVERFLOW;
+  memmove(out->bytes + out->used, bytes, size);
+  out->used += size;
+  return 0;
+}
 
-    pn_data_put_described(msg->data);
-    pn_data_enter(msg->data);
-    if (msg->inferred) {
-      switch (body_type) {
-      case PN_BINARY:
-        pn_data_put_ulong(msg->data, DATA);
-        break;
-      case PN_LIST:
-        pn_data_put_ulong(msg->data, AMQP_SEQUENCE);
-        break;
-      default:
-        pn_data_put_ulong(msg->data, AMQP_VALUE);
-        break;
+// encodes msg->data and clears it
+static int pni_output_data(pni_message_output_t *out, pn_message_t *msg)
+{
+  ssize_t encoded;
+  if (out->buf) {
+    // a reused buffer usually has room already, otherwise it is grown
+    // to the exact size and the encode repeated once
+    pn_buffer_t *buf = out->buf;
+    pn_bytes_t space = pn_buffer_reserve(buf, pn_buffer_available(buf));
+    encoded = pn_data_encode(msg->data, space.start, space.size);
+    if (encoded == PN_OVERFLOW) {
+      encoded = pn_data_encoded_size(msg->data);
+      if (encoded >= 0) {
+        space = pn_buffer_reserve(buf, encoded);
+        encoded = pn_data_encode(msg->data, space.start, space.size);
       }
-    } else {
-      pn_data_put_ulong(msg->data, AMQP_VALUE);
     }
-    pn_data_append(msg->data, msg->body);
+    if (encoded >= 0) pn_buffer_extend(buf, encoded);
+  } else {
+    encoded = pn_data_encode(msg->data, out->bytes + out->used, out->size - out->used);
+    if (encoded == PN_OVERFLOW) return encoded;
+    if (encoded >= 0) out->used += encoded;
   }
 
-  size_t remaining = *size;
-  ssize_t encoded = pn_data_encode(msg->data, bytes, remaining);
   if (encoded < 0) {
-    if (encoded == PN_OVERFLOW) {
-      return encoded;
+    return pn_error_format(msg->error, encoded, "data error: %s",
+                           pn_data_error(msg->data));
+  }
+  pn_data_clear(msg->data);
+  return 0;
+}
+
+static int pni_message_output(pn_message_t *msg, pni_message_output_t *out)
+{
+  pn_bytes_t encoded = pn_bytes(0, NULL);
+  if (msg->encoded) encoded = pn_buffer_bytes(msg->encoded);
+
+  for (int i = 0; encoded.size && i < PNI_SECTIONS; i++) {
+    pni_section_t section = (pni_section_t) i;
+    if (msg->generations[section] != pni_section_generation(msg, section)) {
+      int err = pni_section_modify(msg, section);
+      if (err) return err;
+    }
+  }
+
+  // nothing has changed since the message was decoded
+  if (encoded.size && !msg->dirty) {
+    return pni_output_bytes(out, encoded.start, encoded.size);
+  }
+
+  pn_data_clear(pni_message_data(&msg->data));
+  for (int i = 0; i < PNI_SECTIONS; i++) {
+    pni_section_t section = (pni_section_t) i;
+    int err;
+    if (encoded.size && !(msg->dirty & PNI_SECTION(section))) {
+      // unchanged, or absent and still empty
+      if (!msg->sizes[section]) continue;
+      err = pn_data_size(msg->data) ? pni_output_data(out, msg) : 0;
+      if (err) return err;
+      err = pni_output_bytes(out, encoded.start + msg->offsets[section], msg->sizes[section]);
     } else {
-      return pn_error_format(msg->error, encoded, "data error: %s",
-                             pn_data_error(msg->data));
+      err = pni_message_fill_section(msg, section);
     }
+    if (err) return err;
   }
 
-  bytes += encoded;
-  remaining -= encoded;
+  return pni_output_data(out, msg);
+}
 
-  *size -= remaining;
+int pn_message_encode(pn_message_t *msg, char *bytes, size_t *size)
+{
+  if (!msg || !bytes || !size || !*size) return PN_ARG_ERR;
 
-  pn_data_clear(msg->data);
+  pni_message_output_t out = {NULL, bytes, *size, 0};
+  int err = pni_message_output(msg, &out);
+  if (err) return err;
 
+  *size = out.used;
   return 0;
 }
 
+int pni_message_encode_buffer(pn_message_t *msg, pn_buffer_t *buf)
+{
+  assert(msg);
+  assert(buf);
+
+  pni_message_output_t out = {buf, NULL, 0, 0};
+  return pni_message_output(msg, &out);
+}
+
 pn_format_t pn_message_get_format(pn_message_t *msg)
 {
   return msg ? msg->format : PN_AMQP;
@@ -892,8 +1431,9 @@ int pn_message_load(pn_message_t *msg, const char *data, size_t size)
 int pn_message_load_data(pn_message_t *msg, const char *data, size_t size)
 {
   if (!msg) return PN_ARG_ERR;
+  pni_section_modify(msg, PNI_BODY);
 
-  pn_data_clear(msg->body);
+  pn_data_clear(pni_message_data(&msg->body));
   int err = pn_data_fill(msg->body, "z", size, data);
   if (err) {
     return pn_error_format(msg->error, err, "data error: %s",
@@ -906,8 +1446,9 @@ int pn_message_load_data(pn_message_t *msg, const char *data, size_t size)
 int pn_message_load_text(pn_message_t *msg, const char *data, size_t size)
 {
   if (!msg) return PN_ARG_ERR;
+  pni_section_modify(msg, PNI_BODY);
 
-  pn_data_clear(msg->body);
+  pn_data_clear(pni_message_data(&msg->body));
   int err = pn_data_fill(msg->body, "S", data);
   if (err) {
     return pn_error_format(msg->error, err, "data error: %s",
@@ -920,6 +1461,7 @@ int pn_message_load_text(pn_message_t *msg, const char *data, size_t size)
 int pn_message_load_amqp(pn_message_t *msg, const char *data, size_t size)
 {
   if (!msg) return PN_ARG_ERR;
+  pni_section_modify(msg, PNI_BODY);
 
   pn_parser_t *parser = pn_message_parser(msg);
 
@@ -959,6 +1501,7 @@ int pn_message_save(pn_message_t *msg, char *data, size_t *size)
 int pn_message_save_data(pn_message_t *msg, char *data, size_t *size)
 {
   if (!msg) return PN_ARG_ERR;
+  pni_section_read(msg, PNI_BODY);
 
   if (!msg->body || pn_data_size(msg->body) == 0) {
     *size = 0;
@@ -986,6 +1529,12 @@ int pn_message_save_data(pn_message_t *msg, char *data, size_t *size)
 int pn_message_save_text(pn_message_t *msg, char *data, size_t *size)
 {
   if (!msg) return PN_ARG_ERR;
+  pni_section_read(msg, PNI_BODY);
+
+  if (!msg->body) {
+    *size = 0;
+    return 0;
+  }
 
   pn_data_rewind(msg->body);
   if (pn_data_next(msg->body)) {
@@ -1018,6 +1567,7 @@ int pn_message_save_text(pn_message_t *msg, char *data, size_t *size)
 int pn_message_save_amqp(pn_message_t *msg, char *data, size_t *size)
 {
   if (!msg) return PN_ARG_ERR;
+  pni_section_read(msg, PNI_BODY);
 
   if (!msg->body) {
     *size = 0;
@@ -1042,20 +1592,28 @@ int pn_message_save_json(pn_message_t *msg, char *data, size_t *size)
 
 pn_data_t *pn_message_instructions(pn_message_t *msg)
 {
-  return msg ? msg->instructions : NULL;
+  if (!msg) return NULL;
+  pni_section_modify(msg, PNI_INSTRUCTIONS);
+  return pni_message_data(&msg->instructions);
 }
 
 pn_data_t *pn_message_annotations(pn_message_t *msg)
 {
-  return msg ? msg->annotations : NULL;
+  if (!msg) return NULL;
+  pni_section_modify(msg, PNI_ANNOTATIONS);
+  return pni_message_data(&msg->annotations);
 }
 
 pn_data_t *pn_message_properties(pn_message_t *msg)
 {
-  return msg ? msg->properties : NULL;
+  if (!msg) return NULL;
+  pni_section_modify(msg, PNI_APPLICATION_PROPERTIES);
+  return pni_message_data(&msg->properties);
 }
 
 pn_data_t *pn_message_body(pn_message_t *msg)
 {
-  return msg ? msg->body : NULL;
+  if (!msg) return NULL;
+  pni_section_modify(msg, PNI_BODY);
+  return pni_message_data(&msg->body);
 }
@@ -38,6 +38,8 @@
 #include "transform.h"
 #include "subscription.h"
 #include "../selectable.h"
+#include "../engine/engine-internal.h"
+#include "../message/message-internal.h"
 
 typedef struct pn_link_ctx_t pn_link_ctx_t;
 
@@ -964,17 +966,31 @@ int pni_pump_in(pn_messenger_t *messenger, const char *address, pn_link_t *recei
   pn_link_ctx_t *ctx = (pn_link_ctx_t *) pn_link_get_context( receiver );
   pni_entry_set_context(entry, ctx ? ctx->subscription : NULL);
 
+  // make room for the whole message, then read until the delivery
+  // reports its end so that nothing of it is left on the link
   size_t pending = pn_delivery_pending(d);
-  int err = pn_buffer_ensure(buf, pending + 1);
+  int err = pn_buffer_ensure(buf, pending);
   if (err) return pn_error_format(messenger->error, err, "get: error growing buffer");
-  char *encoded = pn_buffer_bytes(buf).start;
-  ssize_t n = pn_link_recv(receiver, encoded, pending);
-  if (n != (ssize_t) pending) {
-    return pn_error_format(messenger->error, n,
-                           "didn't receive pending bytes: %" PN_ZI " %" PN_ZI,
-                           n, pending);
-  }
-  n = pn_link_recv(receiver, encoded + pending, 1);
+  // a large delivery comes in many segments, a chunk at a time
+  pn_bytes_t segments[16];
+  ssize_t n;
+  while ((n = pn_link_recv_segments(receiver, segments, 16)) > 0) {
+    size_t size = 0;
+    for (ssize_t i = 0; i < n; i++) {
+      pn_buffer_append(buf, segments[i].start, segments[i].size);
+      size += segments[i].size;
+    }
+    err = pn_link_consume(receiver, size);
+    if (err) return pn_error_format(messenger->error, err, "get: error consuming received bytes");
+  }
+  if (n < 0 && n != PN_EOS) {
+    return pn_error_format(messenger->error, (int) n, "get: error receiving bytes");
+  }
+  if (pn_buffer_size(buf) != pending) {
+    return pn_error_format(messenger->error, PN_ERR,
+                           "didn't receive pending bytes: %" PN_ZU " %" PN_ZU,
+                           pn_buffer_size(buf), pending);
+  }
   pn_link_advance(receiver);
 
   // account for the used credit
@@ -1009,7 +1025,6 @@ int pni_pump_in(pn_messenger_t *messenger, const char *address, pn_link_t *recei
   if (n != PN_EOS) {
     return pn_error_format(messenger->error, n, "PN_EOS expected");
   }
-  pn_buffer_append(buf, encoded, pending); // XXX
 
   return 0;
 }
@@ -1093,6 +1108,12 @@ void pn_messenger_process_connection(pn_messenger_t *messenger, pn_event_t *even
       char buf[1024];
       sprintf(buf, "%i", pn_condition_redirect_port(condition));
 
+      // the selector may track the socket itself, so re-register
+      // the selectable around the switch to the new one
+      bool registered = !messenger->passive && pn_selectable_is_registered(ctx->selectable);
+      if (registered) {
+        pn_selector_remove(messenger->selector, ctx->selectable);
+      }
       pn_close(messenger->io, pn_selectable_fd(ctx->selectable));
       pn_socket_t sock = pn_connect(messenger->io, host, buf);
       pni_selectable_set_fd(ctx->selectable, sock);
@@ -1101,6 +1122,9 @@ void pn_messenger_process_connection(pn_messenger_t *messenger, pn_event_t *even
       pn_transport_t *t = pn_transport();
       pn_transport_bind(t, conn);
       pn_transport_config(messenger, conn);
+      if (registered) {
+        pn_selector_add(messenger->selector, ctx->selectable);
+      }
     }
   }
 }
@@ -1656,11 +1680,6 @@ int pni_pump_out(pn_messenger_t *messenger, const char *address, pn_link_t *send
     return 0;
   }
 
-  pn_buffer_t *buf = pni_entry_bytes(entry);
-  pn_bytes_t bytes = pn_buffer_bytes(buf);
-  char *encoded = bytes.start;
-  size_t size = bytes.size;
-
   // XXX: proper tag
   char tag[8];
   void *ptr = &tag;
@@ -1668,7 +1687,10 @@ int pni_pump_out(pn_messenger_t *messenger, const char *address, pn_link_t *send
   *((uint64_t *) ptr) = next;
   pn_delivery_t *d = pn_delivery(sender, pn_dtag(tag, 8));
   pni_entry_set_delivery(entry, d);
-  ssize_t n = pn_link_send(sender, encoded, size);
+  // the delivery takes the encoded message over rather than copying it
+  pn_buffer_t *buf = pni_entry_bytes(entry);
+  ssize_t n = pn_link_send_buffer(sender, &buf);
+  pni_entry_set_bytes(entry, buf);
   if (n < 0) {
     pni_entry_free(entry);
     return pn_error_format(messenger->error, n, "send error: %s",
@@ -1737,41 +1759,27 @@ int pn_messenger_put(pn_messenger_t *messenger, pn_message_t *msg)
   pn_buffer_t *buf = pni_entry_bytes(entry);
 
   pni_rewrite(messenger, msg);
-  while (true) {
-    char *encoded = pn_buffer_bytes(buf).start;
-    size_t size = pn_buffer_capacity(buf);
-    int err = pn_message_encode(msg, encoded, &size);
-    if (err == PN_OVERFLOW) {
-      err = pn_buffer_ensure(buf, 2*pn_buffer_capacity(buf));
-      if (err) {
-        pni_entry_free(entry);
-        pni_restore(messenger, msg);
-        return pn_error_format(messenger->error, err, "put: error growing buffer");
-      }
-    } else if (err) {
-      pni_restore(messenger, msg);
-      return pn_error_format(messenger->error, err, "encode error: %s",
-                             pn_message_error(msg));
+  int err = pni_message_encode_buffer(msg, buf);
+  pni_restore(messenger, msg);
+  if (err) {
+    pni_entry_free(entry);
+    return pn_error_format(messenger->error, err, "encode error: %s",
+                           pn_message_error(msg));
+  }
+
+  pn_link_t *sender = pn_messenger_target(messenger, address);
+  if (!sender) {
+    err = pn_error_code(messenger->error);
+    if (err) {
+      return err;
+    } else if (messenger->connection_error) {
+      return pni_bump_out(messenger, address);
     } else {
-      pni_restore(messenger, msg);
-      pn_buffer_append(buf, encoded, size); // XXX
-      pn_link_t *sender = pn_messenger_target(messenger, address);
-      if (!sender) {
-        int err = pn_error_code(messenger->error);
-        if (err) {
-          return err;
-        } else if (messenger->connection_error) {
-          return pni_bump_out(messenger, address);
-        } else {
-          return 0;
-        }
-      } else {
-        return pni_pump_out(messenger, address, sender);
-      }
+      return 0;
     }
+  } else {
+    return pni_pump_out(messenger, address, sender);
   }
-
-  return PN_ERR;
 }
 
 pn_tracker_t pn_messenger_outgoing_tracker(pn_messenger_t *messenger)
@@ -1826,7 +1834,10 @@ int pn_messenger_settle(pn_messenger_t *messenger, pn_tracker_t tracker, int fla
 // true if all pending output has been sent to peer
 bool pn_messenger_sent(pn_messenger_t *messenger)
 {
-  int total = pni_store_size(messenger->outgoing);
+  // deliveries still waiting on the peer are counted by the store as
+  // their state changes, so only the links need visiting here
+  int total = pni_store_size(messenger->outgoing) +
+    pni_store_awaiting(messenger->outgoing);
 
   for (size_t i = 0; i < pn_list_size(messenger->connections); i++)
   {
@@ -1843,14 +1854,6 @@ bool pn_messenger_sent(pn_messenger_t *messenger)
     while (link) {
       if (pn_link_is_sender(link)) {
         total += pn_link_queued(link);
-
-        pn_delivery_t *d = pn_unsettled_head(link);
-        while (d) {
-          if (!pn_delivery_remote_state(d) && !pn_delivery_settled(d)) {
-            total++;
-          }
-          d = pn_unsettled_next(d);
-        }
       }
       link = pn_link_next(link, PN_LOCAL_ACTIVE);
     }
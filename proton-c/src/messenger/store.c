@@ -35,7 +35,12 @@ typedef struct pni_stream_t pni_stream_t;
 
 struct pni_store_t {
   size_t size;
+  size_t awaiting;  // entries whose delivery is awaiting the peer
   pni_stream_t *streams;
+  pn_map_t *addresses;  // pn_string_t address -> pni_stream_t
+  pn_string_t *key;     // scratch key for lookups
+  pni_stream_t *last;   // most recently looked up stream
+  pn_buffer_t *spare;   // bytes of the last freed entry, for reuse
   pni_entry_t *store_head;
   pni_entry_t *store_tail;
   int window;
@@ -46,7 +51,7 @@ struct pni_store_t {
 
 struct pni_stream_t {
   pni_store_t *store;
-  char address[1024]; // XXX
+  pn_string_t *address;
   pni_entry_t *stream_head;
   pni_entry_t *stream_tail;
   pni_stream_t *next;
@@ -64,6 +69,7 @@ struct pni_entry_t {
   pn_buffer_t *bytes;
   pn_delivery_t *delivery;
   void *context;
+  bool awaiting;
 };
 
 void pni_entry_finalize(void *object)
@@ -83,6 +89,7 @@ pni_store_t *pni_store()
   if (!store) return NULL;
 
   store->size = 0;
+  store->awaiting = 0;
   store->streams = NULL;
   store->store_head = NULL;
   store->store_tail = NULL;
@@ -90,6 +97,10 @@ pni_store_t *pni_store()
   store->lwm = 0;
   store->hwm = 0;
   store->tracked = pn_hash(0, 0.75, PN_REFCOUNT);
+  store->addresses = pn_map(0, 0.75, PN_REFCOUNT_KEY);
+  store->key = pn_string(NULL);
+  store->last = NULL;
+  store->spare = NULL;
 
   return store;
 }
@@ -100,37 +111,44 @@ size_t pni_store_size(pni_store_t *store)
   return store->size;
 }
 
+size_t pni_store_awaiting(pni_store_t *store)
+{
+  assert(store);
+  return store->awaiting;
+}
+
 pni_stream_t *pni_stream(pni_store_t *store, const char *address, bool create)
 {
   assert(store);
   assert(address);
-  // XXX
-  if (strlen(address) >= 1024) return NULL;
 
-  pni_stream_t *prev = NULL;
-  pni_stream_t *stream = store->streams;
-  while (stream) {
-    if (!strcmp(stream->address, address)) {
-      return stream;
-    }
-    prev = stream;
-    stream = stream->next;
+  // consecutive puts usually go to the same address
+  if (store->last && !strcmp(pn_string_get(store->last->address), address)) {
+    return store->last;
   }
 
-  if (create) {
-    stream = (pni_stream_t *) malloc(sizeof(pni_stream_t));
-    stream->store = store;
-    strcpy(stream->address, address);
-    stream->stream_head = NULL;
-    stream->stream_tail = NULL;
-    stream->next = NULL;
+  int err = pn_string_set(store->key, address);
+  if (err) return NULL;
+  pni_stream_t *stream = (pni_stream_t *) pn_map_get(store->addresses, store->key);
+  if (stream || !create) {
+    if (stream) store->last = stream;
+    return stream;
+  }
 
-    if (prev) {
-      prev->next = stream;
-    } else {
-      store->streams = stream;
-    }
+  stream = (pni_stream_t *) malloc(sizeof(pni_stream_t));
+  if (!stream) return NULL;
+  stream->address = pn_string(address);
+  if (!stream->address || pn_map_put(store->addresses, stream->address, stream)) {
+    pn_free(stream->address);
+    free(stream);
+    return NULL;
   }
+  stream->store = store;
+  stream->stream_head = NULL;
+  stream->stream_tail = NULL;
+  stream->next = store->streams;
+  store->streams = stream;
+  store->last = stream;
 
   return stream;
 }
@@ -156,7 +174,12 @@ void pni_entry_free(pni_entry_t *entry)
   LL_REMOVE(store, store, entry);
   entry->free = true;
 
-  pn_buffer_free(entry->bytes);
+  if (store->spare) {
+    pn_buffer_free(entry->bytes);
+  } else {
+    pn_buffer_clear(entry->bytes);
+    store->spare = entry->bytes;
+  }
   entry->bytes = NULL;
   pn_decref(entry);
   store->size--;
@@ -169,6 +192,7 @@ void pni_stream_free(pni_stream_t *stream)
   while ((entry = LL_HEAD(stream, stream))) {
     pni_entry_free(entry);
   }
+  pn_free(stream->address);
   free(stream);
 }
 
@@ -176,12 +200,15 @@ void pni_store_free(pni_store_t *store)
 {
   if (!store) return;
   pn_free(store->tracked);
+  pn_free(store->addresses);
+  pn_free(store->key);
   pni_stream_t *stream = store->streams;
   while (stream) {
     pni_stream_t *next = stream->next;
     pni_stream_free(stream);
     stream = next;
   }
+  pn_buffer_free(store->spare);
   free(store);
 }
 
@@ -219,7 +246,13 @@ pni_entry_t *pni_store_put(pni_store_t *store, const char *address)
   entry->store_next = NULL;
   entry->store_prev = NULL;
   entry->delivery = NULL;
-  entry->bytes = pn_buffer(64);
+  entry->awaiting = false;
+  if (store->spare) {
+    entry->bytes = store->spare;
+    store->spare = NULL;
+  } else {
+    entry->bytes = pn_buffer(64);
+  }
   entry->status = PN_STATUS_UNKNOWN;
   LL_ADD(stream, stream, entry);
   LL_ADD(store, store, entry);
@@ -245,6 +278,12 @@ pn_buffer_t *pni_entry_bytes(pni_entry_t *entry)
   return entry->bytes;
 }
 
+void pni_entry_set_bytes(pni_entry_t *entry, pn_buffer_t *bytes)
+{
+  assert(entry);
+  entry->bytes = bytes;
+}
+
 pn_status_t pni_entry_get_status(pni_entry_t *entry)
 {
   assert(entry);
@@ -315,6 +354,16 @@ void pni_entry_updated(pni_entry_t *entry)
 {
   assert(entry);
   pn_delivery_t *d = entry->delivery;
+  bool awaiting = d && !pn_delivery_remote_state(d) && !pn_delivery_settled(d);
+  if (awaiting != entry->awaiting) {
+    pni_store_t *store = entry->stream->store;
+    if (awaiting) {
+      store->awaiting++;
+    } else {
+      store->awaiting--;
+    }
+    entry->awaiting = awaiting;
+  }
   if (d) {
     if (pn_delivery_remote_state(d)) {
       entry->status = disp2status(pn_delivery_remote_state(d));
@@ -411,6 +460,7 @@ int pni_store_update(pni_store_t *store, pn_sequence_t id, pn_status_t status,
       }
       if (settle) {
         if (d) {
+          pni_entry_set_delivery(e, NULL);
           pn_delivery_settle(d);
         }
         pn_hash_del(store->tracked, e->id);
@@ -30,10 +30,16 @@ typedef struct pni_entry_t pni_entry_t;
 pni_store_t *pni_store(void);
 void pni_store_free(pni_store_t *store);
 size_t pni_store_size(pni_store_t *store);
+// number of entries holding a delivery that the peer has neither
+// settled nor given a state, kept up to date by pni_entry_updated
+size_t pni_store_awaiting(pni_store_t *store);
 pni_entry_t *pni_store_put(pni_store_t *store, const char *address);
 pni_entry_t *pni_store_get(pni_store_t *store, const char *address);
 
 pn_buffer_t *pni_entry_bytes(pni_entry_t *entry);
+// the entry takes bytes over, the caller becomes responsible for the
+// buffer it held before
+void pni_entry_set_bytes(pni_entry_t *entry, pn_buffer_t *bytes);
 pn_status_t pni_entry_get_status(pni_entry_t *entry);
 void pni_entry_set_status(pni_entry_t *entry, pn_status_t status);
 pn_delivery_t *pni_entry_get_delivery(pni_entry_t *entry);
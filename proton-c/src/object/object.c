@@ -31,14 +31,324 @@
 typedef struct {
   pn_class_t *clazz;
   int refcount;
+  uint32_t size;  // as passed to pn_new
 } pni_head_t;
 
 #define pni_head(PTR) \
   (((pni_head_t *) (PTR)) - 1)
 
+// Object memory
+//
+// Blocks of up to PNI_BUCKETS*PNI_BUCKET_SIZE bytes are rounded up to
+// a size bucket, and freed blocks are kept on a free list per bucket
+// for the next object of that size. The free lists are thread local,
+// so objects can be created and freed on several threads without
+// locking; a block freed on another thread than the one that created
+// it simply moves to that thread's cache. Each thread keeps at most
+// PNI_CACHE_LIMIT bytes, anything more goes back to malloc, as does all
+// a thread has kept once it exits.
+//
+// Every class gets an entry in pni_classes when its first object is
+// created, and each thread counts the live objects and bytes of every
+// class it creates or frees. pn_class_stats adds up the counts of all
+// threads, including those that have exited. Entry 0 counts objects
+// without a class, and those of any classes beyond PNI_CLASSES.
+
+#define PNI_BUCKET_SIZE (16)
+#define PNI_BUCKETS (32)
+#define PNI_CACHE_LIMIT (256*1024)
+#define PNI_CLASSES (256)
+
+#if defined(__GNUC__)
+#define PNI_THREAD_CACHES
+#define PNI_THREAD_LOCAL __thread
+#define pni_counter_load(PTR) __atomic_load_n((PTR), __ATOMIC_RELAXED)
+#define pni_counter_add(PTR, N) __atomic_store_n((PTR), *(PTR) + (N), __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+#include <windows.h>
+#define PNI_THREAD_CACHES
+#define PNI_THREAD_LOCAL __declspec(thread)
+#define pni_counter_load(PTR) (*(volatile size_t *) (PTR))
+#define pni_counter_add(PTR, N) (*(volatile size_t *) (PTR) += (N))
+#else
+// without thread local storage all threads share one cache, so there
+// is no pooling and the counts are not exact when objects are used
+// from more than one thread
+#undef USE_OBJECT_POOL
+#define PNI_THREAD_LOCAL
+#define pni_counter_load(PTR) (*(PTR))
+#define pni_counter_add(PTR, N) (*(PTR) += (N))
+#endif
+
+typedef struct pni_block_t {
+  struct pni_block_t *next;
+} pni_block_t;
+
+// The counts are only changed by the thread that owns the cache, and
+// read by pn_class_stats from any thread.
+typedef struct pni_cache_t {
+  struct pni_cache_t *next;  // in pni_caches
+  pni_block_t *free[PNI_BUCKETS + 1];
+  size_t bytes;  // in the free lists
+  // per class, these wrap when objects are freed on another thread
+  size_t live[PNI_CLASSES];
+  size_t allocated[PNI_CLASSES];
+} pni_cache_t;
+
+static pn_class_t *volatile pni_classes[PNI_CLASSES];
+// the caches of the threads that are running, and the counts of those
+// that have exited, both guarded by pni_caches_lock
+static pni_cache_t *pni_caches;
+static size_t pni_exited_live[PNI_CLASSES];
+static size_t pni_exited_allocated[PNI_CLASSES];
+static PNI_THREAD_LOCAL pni_cache_t *pni_cache;
+
+static void pni_cache_drain(pni_cache_t *cache)
+{
+  for (size_t i = 0; i <= PNI_BUCKETS; i++) {
+    while (cache->free[i]) {
+      pni_block_t *block = cache->free[i];
+      cache->free[i] = block->next;
+      free(block);
+    }
+  }
+  cache->bytes = 0;
+}
+
+#ifdef PNI_THREAD_CACHES
+
+static void pni_caches_lock(void);
+static void pni_caches_unlock(void);
+
+// Called on a thread that is exiting. Its blocks go back to malloc and
+// its counts to the totals of exited threads, then its cache is freed.
+// An object the thread makes or frees after this gets it a new cache.
+static void pni_cache_exit(pni_cache_t *cache)
+{
+  pni_cache_drain(cache);
+  pni_caches_lock();
+  for (size_t i = 0; i < PNI_CLASSES; i++) {
+    pni_exited_live[i] += cache->live[i];
+    pni_exited_allocated[i] += cache->allocated[i];
+  }
+  pni_cache_t **link = &pni_caches;
+  while (*link != cache) link = &(*link)->next;
+  *link = cache->next;
+  pni_caches_unlock();
+
+  if (pni_cache == cache) pni_cache = NULL;
+  free(cache);
+}
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+
+#include <windows.h>
+
+static SRWLOCK pni_caches_srwlock = SRWLOCK_INIT;
+static volatile DWORD pni_cache_key = FLS_OUT_OF_INDEXES;
+
+static void pni_caches_lock(void)
+{
+  AcquireSRWLockExclusive(&pni_caches_srwlock);
+}
+
+static void pni_caches_unlock(void)
+{
+  ReleaseSRWLockExclusive(&pni_caches_srwlock);
+}
+
+static void WINAPI pni_thread_exit(void *cache)
+{
+  if (cache) pni_cache_exit((pni_cache_t *) cache);
+}
+
+static void pni_cache_register(pni_cache_t *cache)
+{
+  if (pni_cache_key == FLS_OUT_OF_INDEXES) {
+    DWORD key = FlsAlloc(pni_thread_exit);
+    if (InterlockedCompareExchange((LONG volatile *) &pni_cache_key, key,
+                                   FLS_OUT_OF_INDEXES) != FLS_OUT_OF_INDEXES) {
+      FlsFree(key);
+    }
+  }
+  FlsSetValue(pni_cache_key, cache);
+}
+
+#else
+
+#include <pthread.h>
+
+static pthread_mutex_t pni_caches_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t pni_cache_key;
+static pthread_once_t pni_cache_once = PTHREAD_ONCE_INIT;
+
+static void pni_caches_lock(void)
+{
+  pthread_mutex_lock(&pni_caches_mutex);
+}
+
+static void pni_caches_unlock(void)
+{
+  pthread_mutex_unlock(&pni_caches_mutex);
+}
+
+static void pni_thread_exit(void *cache)
+{
+  pni_cache_exit((pni_cache_t *) cache);
+}
+
+static void pni_cache_key_create(void)
+{
+  pthread_key_create(&pni_cache_key, pni_thread_exit);
+}
+
+static void pni_cache_register(pni_cache_t *cache)
+{
+  pthread_once(&pni_cache_once, pni_cache_key_create);
+  pthread_setspecific(pni_cache_key, cache);
+}
+
+#endif
+
+#else
+
+#define pni_caches_lock()
+#define pni_caches_unlock()
+#define pni_cache_register(CACHE)
+
+#endif
+
+static pni_cache_t *pni_thread_cache(void)
+{
+  pni_cache_t *cache = pni_cache;
+  if (!cache) {
+    cache = (pni_cache_t *) calloc(1, sizeof(pni_cache_t));
+    pni_caches_lock();
+    cache->next = pni_caches;
+    pni_caches = cache;
+    pni_caches_unlock();
+    pni_cache = cache;
+    pni_cache_register(cache);
+  }
+  return cache;
+}
+
+static size_t pni_class_slot(pn_class_t *clazz)
+{
+  if (!clazz) return 0;
+
+  size_t slot = ((uintptr_t) clazz / sizeof(void *)) % (PNI_CLASSES - 1) + 1;
+  for (size_t probes = 0; probes < PNI_CLASSES - 1; ) {
+    pn_class_t *current = pni_classes[slot];
+    if (current == clazz) {
+      return slot;
+    } else if (!current) {
+      if (pn_i_atomic_cas(&pni_classes[slot], NULL, clazz)) {
+        return slot;
+      }
+      // another thread took the entry first, look at it again
+    } else {
+      slot = slot % (PNI_CLASSES - 1) + 1;
+      probes++;
+    }
+  }
+
+  return 0;
+}
+
+#ifdef USE_OBJECT_POOL
+
+// the bucket for a block of the given size, 0 if it is not pooled
+static inline size_t pni_bucket(size_t size)
+{
+  size_t bucket = (size + PNI_BUCKET_SIZE - 1) / PNI_BUCKET_SIZE;
+  return bucket > PNI_BUCKETS ? 0 : bucket;
+}
+
+static pni_head_t *pni_allocate(pni_cache_t *cache, size_t size)
+{
+  size_t bucket = pni_bucket(size);
+  if (!bucket) {
+    return (pni_head_t *) malloc(size);
+  }
+
+  pni_block_t *block = cache->free[bucket];
+  if (block) {
+    cache->free[bucket] = block->next;
+    cache->bytes -= bucket*PNI_BUCKET_SIZE;
+    return (pni_head_t *) block;
+  } else {
+    return (pni_head_t *) malloc(bucket*PNI_BUCKET_SIZE);
+  }
+}
+
+static void pni_release(pni_cache_t *cache, pni_head_t *head)
+{
+  size_t bucket = pni_bucket(sizeof(pni_head_t) + head->size);
+  size_t size = bucket*PNI_BUCKET_SIZE;
+  if (bucket && cache->bytes + size <= PNI_CACHE_LIMIT) {
+    pni_block_t *block = (pni_block_t *) head;
+    block->next = cache->free[bucket];
+    cache->free[bucket] = block;
+    cache->bytes += size;
+  } else {
+    free(head);
+  }
+}
+
+#else
+
+static pni_head_t *pni_allocate(pni_cache_t *cache, size_t size)
+{
+  return (pni_head_t *) malloc(size);
+}
+
+static void pni_release(pni_cache_t *cache, pni_head_t *head)
+{
+  free(head);
+}
+
+#endif
+
+void pn_object_cache_free(void)
+{
+  pni_cache_t *cache = pni_cache;
+  if (cache) pni_cache_drain(cache);
+}
+
+size_t pn_class_stats(pn_class_stats_t *stats, size_t count)
+{
+  size_t classes = 0;
+  for (size_t i = 0; i < PNI_CLASSES; i++) {
+    pn_class_t *clazz = pni_classes[i];
+    pni_caches_lock();
+    size_t live = pni_exited_live[i];
+    size_t bytes = pni_exited_allocated[i];
+    for (pni_cache_t *cache = pni_caches; cache; cache = cache->next) {
+      live += pni_counter_load(&cache->live[i]);
+      bytes += pni_counter_load(&cache->allocated[i]);
+    }
+    pni_caches_unlock();
+    // objects without a class are only reported while there are some
+    if (i ? !clazz : !live) continue;
+    if (classes < count) {
+      stats[classes].name = clazz ? clazz->name : NULL;
+      stats[classes].live = live;
+      stats[classes].bytes = bytes;
+    }
+    classes++;
+  }
+  return classes;
+}
+
 void *pn_new(size_t size, pn_class_t *clazz)
 {
-  pni_head_t *head = (pni_head_t *) malloc(sizeof(pni_head_t) + size);
+  pni_cache_t *cache = pni_thread_cache();
+  pni_head_t *head = pni_allocate(cache, sizeof(pni_head_t) + size);
+  size_t slot = pni_class_slot(clazz);
+  pni_counter_add(&cache->live[slot], 1);
+  pni_counter_add(&cache->allocated[slot], size);
+  head->size = size;
   void *object = head + 1;
   pn_initialize(object, clazz);
   return object;
@@ -70,7 +380,11 @@ void pn_decref(void *object)
     head->refcount--;
     if (!head->refcount) {
       pn_finalize(object);
-      free(head);
+      pni_cache_t *cache = pni_thread_cache();
+      size_t slot = pni_class_slot(head->clazz);
+      pni_counter_add(&cache->live[slot], -1);
+      pni_counter_add(&cache->allocated[slot], -(size_t) head->size);
+      pni_release(cache, head);
     }
   }
 }
@@ -364,22 +678,26 @@ pn_list_t *pn_list(size_t capacity, int options)
   return list;
 }
 
-#define PNI_ENTRY_FREE (0)
-#define PNI_ENTRY_LINK (1)
-#define PNI_ENTRY_TAIL (2)
+// Maps use open addressing with Robin Hood hashing: an entry never
+// sits further from its home slot than the entries it had to pass to
+// get there, so a lookup stops as soon as it meets an entry closer to
+// its own home than the key would be. Deleting shifts the rest of the
+// run back one slot instead of leaving a tombstone, which means a
+// delete can move a later entry into the slot just emptied.
 
 typedef struct {
   void *key;
   void *value;
-  size_t next;
-  uint8_t state;
+  uintptr_t hashcode;
+  size_t probe;  // one more than the distance from the home slot, 0 if free
 } pni_entry_t;
 
 struct pn_map_t {
   pni_entry_t *entries;
-  size_t capacity;
-  size_t addressable;
+  size_t capacity;   // always a power of two
+  size_t threshold;  // the table grows when the size passes this
   size_t size;
+  int shift;         // 64 - log2(capacity), see pni_map_home
   float load_factor;
   uintptr_t (*hashcode)(void *key);
   bool (*equals)(void *a, void *b);
@@ -393,7 +711,7 @@ static void pn_map_finalize(void *object)
 
   if (map->count_keys || map->count_values) {
     for (size_t i = 0; i < map->capacity; i++) {
-      if (map->entries[i].state != PNI_ENTRY_FREE) {
+      if (map->entries[i].probe) {
         if (map->count_keys) pn_decref(map->entries[i].key);
         if (map->count_values) pn_decref(map->entries[i].value);
       }
@@ -410,7 +728,7 @@ static uintptr_t pn_map_hashcode(void *object)
   uintptr_t hashcode = 0;
 
   for (size_t i = 0; i < map->capacity; i++) {
-    if (map->entries[i].state != PNI_ENTRY_FREE) {
+    if (map->entries[i].probe) {
       void *key = map->entries[i].key;
       void *value = map->entries[i].value;
       hashcode += pn_hashcode(key) ^ pn_hashcode(value);
@@ -420,15 +738,19 @@ static uintptr_t pn_map_hashcode(void *object)
   return hashcode;
 }
 
-static void pni_map_allocate(pn_map_t *map)
+static void pni_map_allocate(pn_map_t *map, size_t capacity)
 {
-  map->entries = (pni_entry_t *) malloc(map->capacity * sizeof (pni_entry_t));
-  for (size_t i = 0; i < map->capacity; i++) {
-    map->entries[i].key = NULL;
-    map->entries[i].value = NULL;
-    map->entries[i].next = 0;
-    map->entries[i].state = PNI_ENTRY_FREE;
+  map->capacity = capacity;
+  map->shift = 64;
+  while (capacity > 1) {
+    capacity >>= 1;
+    map->shift--;
   }
+  // keep at least one slot free so that probing always terminates
+  map->threshold = (size_t) (map->capacity * map->load_factor);
+  if (map->threshold >= map->capacity) map->threshold = map->capacity - 1;
+  if (!map->threshold) map->threshold = 1;
+  map->entries = (pni_entry_t *) calloc(map->capacity, sizeof (pni_entry_t));
   map->size = 0;
 }
 
@@ -466,15 +788,14 @@ pn_map_t *pn_map(size_t capacity, float load_factor, int options)
   static pn_class_t clazz = PN_CLASS(pn_map);
 
   pn_map_t *map = (pn_map_t *) pn_new(sizeof(pn_map_t), &clazz);
-  map->capacity = capacity ? capacity : 16;
-  map->addressable = (size_t) (map->capacity * 0.86);
-  if (!map->addressable) map->addressable = map->capacity;
+  size_t pow2 = 2;
+  while (pow2 < (capacity ? capacity : 16)) pow2 *= 2;
   map->load_factor = load_factor;
   map->hashcode = pn_hashcode;
   map->equals = pn_equals;
   map->count_keys = (options & PN_REFCOUNT) || (options & PN_REFCOUNT_KEY);
   map->count_values = (options & PN_REFCOUNT) || (options & PN_REFCOUNT_VALUE);
-  pni_map_allocate(map);
+  pni_map_allocate(map, pow2);
   return map;
 }
 
@@ -484,156 +805,135 @@ size_t pn_map_size(pn_map_t *map)
   return map->size;
 }
 
-static float pni_map_load(pn_map_t *map)
+// Fibonacci hashing, so that keys differing only in their high bits,
+// such as aligned pointers, still spread over the whole table
+static inline size_t pni_map_home(pn_map_t *map, uintptr_t hashcode)
 {
-  return ((float) map->size) / ((float) map->addressable);
+  return (size_t) (((uint64_t) hashcode * UINT64_C(0x9E3779B97F4A7C15)) >> map->shift);
 }
 
-static bool pni_map_ensure(pn_map_t *map, size_t capacity)
+// add an entry for a key known not to be present
+static void pni_map_insert(pn_map_t *map, void *key, uintptr_t hashcode, void *value)
 {
-  float load = pni_map_load(map);
-  if (capacity <= map->capacity && load < map->load_factor) {
-    return false;
-  }
-
-  size_t oldcap = map->capacity;
+  size_t mask = map->capacity - 1;
+  size_t idx = pni_map_home(map, hashcode);
+  pni_entry_t entry = {key, value, hashcode, 1};
 
-  while (map->capacity < capacity || pni_map_load(map) > map->load_factor) {
-    map->capacity *= 2;
-    map->addressable = (size_t) (0.86 * map->capacity);
+  while (map->entries[idx].probe) {
+    pni_entry_t *slot = &map->entries[idx];
+    if (slot->probe < entry.probe) {
+      // the new entry is further from home, it takes the slot and the
+      // entry it displaces carries on looking
+      pni_entry_t displaced = *slot;
+      *slot = entry;
+      entry = displaced;
+    }
+    idx = (idx + 1) & mask;
+    entry.probe++;
   }
 
+  map->entries[idx] = entry;
+  map->size++;
+}
+
+static void pni_map_grow(pn_map_t *map)
+{
   pni_entry_t *entries = map->entries;
-  pni_map_allocate(map);
+  size_t oldcap = map->capacity;
+
+  pni_map_allocate(map, 2*oldcap);
 
   for (size_t i = 0; i < oldcap; i++) {
-    if (entries[i].state != PNI_ENTRY_FREE) {
-      void *key = entries[i].key;
-      void *value = entries[i].value;
-      pn_map_put(map, key, value);
-      if (map->count_keys) pn_decref(key);
-      if (map->count_values) pn_decref(value);
+    if (entries[i].probe) {
+      pni_map_insert(map, entries[i].key, entries[i].hashcode, entries[i].value);
     }
   }
 
   free(entries);
-  return true;
 }
 
-static pni_entry_t *pni_map_entry(pn_map_t *map, void *key, pni_entry_t **pprev, bool create)
+static pni_entry_t *pni_map_entry(pn_map_t *map, void *key, uintptr_t hashcode)
 {
-  uintptr_t hashcode = map->hashcode(key);
-
-  pni_entry_t *entry = &map->entries[hashcode % map->addressable];
-  pni_entry_t *prev = NULL;
+  size_t mask = map->capacity - 1;
+  size_t idx = pni_map_home(map, hashcode);
 
-  if (entry->state == PNI_ENTRY_FREE) {
-    if (create) {
-      entry->state = PNI_ENTRY_TAIL;
-      entry->key = key;
-      if (map->count_keys) pn_incref(key);
-      map->size++;
-      return entry;
-    } else {
+  for (size_t probe = 1; ; probe++) {
+    pni_entry_t *entry = &map->entries[idx];
+    // a free slot, or an entry closer to home than the key would be,
+    // means the key is not present
+    if (entry->probe < probe) {
       return NULL;
     }
-  }
-
-  while (true) {
-    if (map->equals(entry->key, key)) {
-      if (pprev) *pprev = prev;
+    if (entry->hashcode == hashcode &&
+        (entry->key == key || map->equals(entry->key, key))) {
       return entry;
     }
-
-    if (entry->state == PNI_ENTRY_TAIL) {
-      break;
-    } else {
-      prev = entry;
-      entry = &map->entries[entry->next];
-    }
-  }
-
-  if (create) {
-    if (pni_map_ensure(map, map->size + 1)) {
-      // if we had to grow the table we need to start over
-      return pni_map_entry(map, key, pprev, create);
-    }
-
-    size_t empty = 0;
-    for (size_t i = 0; i < map->capacity; i++) {
-      size_t idx = map->capacity - i - 1;
-      if (map->entries[idx].state == PNI_ENTRY_FREE) {
-        empty = idx;
-        break;
-      }
-    }
-    entry->next = empty;
-    entry->state = PNI_ENTRY_LINK;
-    map->entries[empty].state = PNI_ENTRY_TAIL;
-    map->entries[empty].key = key;
-    if (map->count_keys) pn_incref(key);
-    if (pprev) *pprev = entry;
-    map->size++;
-    return &map->entries[empty];
-  } else {
-    return NULL;
+    idx = (idx + 1) & mask;
   }
 }
 
 int pn_map_put(pn_map_t *map, void *key, void *value)
 {
   assert(map);
-  pni_entry_t *entry = pni_map_entry(map, key, NULL, true);
-  if (map->count_values) pn_decref(entry->value);
-  entry->value = value;
+  uintptr_t hashcode = map->hashcode(key);
   if (map->count_values) pn_incref(value);
+  pni_entry_t *entry = pni_map_entry(map, key, hashcode);
+  if (entry) {
+    if (map->count_values) pn_decref(entry->value);
+    entry->value = value;
+  } else {
+    if (map->size >= map->threshold) {
+      pni_map_grow(map);
+    }
+    if (map->count_keys) pn_incref(key);
+    pni_map_insert(map, key, hashcode, value);
+  }
   return 0;
 }
 
 void *pn_map_get(pn_map_t *map, void *key)
 {
   assert(map);
-  pni_entry_t *entry = pni_map_entry(map, key, NULL, false);
+  pni_entry_t *entry = pni_map_entry(map, key, map->hashcode(key));
   return entry ? entry->value : NULL;
 }
 
 void pn_map_del(pn_map_t *map, void *key)
 {
   assert(map);
-  pni_entry_t *prev = NULL;
-  pni_entry_t *entry = pni_map_entry(map, key, &prev, false);
-  if (entry) {
-    if (prev) {
-      prev->next = entry->next;
-      prev->state = entry->state;
-    }
-    entry->state = PNI_ENTRY_FREE;
-    entry->next = 0;
-    if (map->count_keys) pn_decref(entry->key);
-    entry->key = NULL;
-    if (map->count_values) pn_decref(entry->value);
-    entry->value = NULL;
-    map->size--;
+  pni_entry_t *entry = pni_map_entry(map, key, map->hashcode(key));
+  if (!entry) return;
+
+  void *dkey = entry->key;
+  void *dvalue = entry->value;
+
+  size_t mask = map->capacity - 1;
+  size_t idx = entry - map->entries;
+  while (true) {
+    size_t next = (idx + 1) & mask;
+    if (map->entries[next].probe <= 1) break;
+    map->entries[idx] = map->entries[next];
+    map->entries[idx].probe--;
+    idx = next;
   }
+  memset(&map->entries[idx], 0, sizeof(pni_entry_t));
+  map->size--;
+
+  // released last, the finalizers may use the map
+  if (map->count_keys) pn_decref(dkey);
+  if (map->count_values) pn_decref(dvalue);
 }
 
 pn_handle_t pn_map_head(pn_map_t *map)
 {
   assert(map);
-  for (size_t i = 0; i < map->capacity; i++)
-  {
-    if (map->entries[i].state != PNI_ENTRY_FREE) {
-      return i + 1;
-    }
-  }
-
-  return 0;
+  return pn_map_next(map, 0);
 }
 
 pn_handle_t pn_map_next(pn_map_t *map, pn_handle_t entry)
 {
   for (size_t i = entry; i < map->capacity; i++) {
-    if (map->entries[i].state != PNI_ENTRY_FREE) {
+    if (map->entries[i].probe) {
       return i + 1;
     }
   }
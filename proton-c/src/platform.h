@@ -88,6 +88,23 @@ int pn_i_vsnprintf(char *buf, size_t count, const char *fmt, va_list ap);
 #define va_copy(d,s) ((d) = (s))
 #endif
 
+/** Compare and swap a pointer.
+ *
+ * Sets *PTR to NEW if it is OLD and tells whether it did, as one atomic
+ * step on the compilers that provide one.
+ *
+ * @internal
+ */
+#if defined(__GNUC__)
+#define pn_i_atomic_cas(PTR, OLD, NEW) __sync_bool_compare_and_swap((PTR), (OLD), (NEW))
+#elif defined(_MSC_VER)
+#include <windows.h>
+#define pn_i_atomic_cas(PTR, OLD, NEW) \
+  (InterlockedCompareExchangePointer((PVOID volatile *) (PTR), (NEW), (OLD)) == (OLD))
+#else
+#define pn_i_atomic_cas(PTR, OLD, NEW) (*(PTR) == (OLD) ? (*(PTR) = (NEW), true) : false)
+#endif
+
 #ifdef __cplusplus
 }
 #endif
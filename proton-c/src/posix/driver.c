@@ -22,14 +22,19 @@
 #include <assert.h>
 #include <poll.h>
 #include <stdio.h>
+#include <string.h>
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #include <proton/driver.h>
 #include <proton/driver_extras.h>
@@ -48,6 +53,16 @@
 #define PN_SEL_RD (0x0001)
 #define PN_SEL_WR (0x0002)
 
+// most output segments handed to a single sendmsg()
+#define PN_SEND_SEGMENTS (16)
+
+// what an epoll registration refers to; the first member of both
+// pn_listener_t and pn_connector_t so event data can be dispatched
+typedef enum {
+  PN_DRIVER_LISTENER,
+  PN_DRIVER_CONNECTOR
+} pn_driver_kind_t;
+
 struct pn_driver_t {
   pn_error_t *error;
   pn_io_t *io;
@@ -66,9 +81,22 @@ struct pn_driver_t {
   int ctrl[2]; //pipe for updating selectable status
   pn_trace_t trace;
   pn_timestamp_t wakeup;
+  // epoll backend, unused (epfd == -1) when falling back to poll
+  int epfd;
+#ifdef USE_EPOLL
+  struct epoll_event *events;
+  int nevents;
+#endif
+  pn_connector_t *ready_head;
+  pn_connector_t *ready_tail;
+  pn_connector_t *timed_head;
+  pn_connector_t *timed_tail;
+  pn_connector_t *closed_head;
+  pn_connector_t *closed_tail;
 };
 
 struct pn_listener_t {
+  pn_driver_kind_t kind;
   pn_driver_t *driver;
   pn_listener_t *listener_next;
   pn_listener_t *listener_prev;
@@ -82,9 +110,20 @@ struct pn_listener_t {
 #define PN_NAME_MAX (256)
 
 struct pn_connector_t {
+  pn_driver_kind_t kind;
   pn_driver_t *driver;
   pn_connector_t *connector_next;
   pn_connector_t *connector_prev;
+  // epoll backend bookkeeping
+  pn_connector_t *ready_next;
+  pn_connector_t *ready_prev;
+  pn_connector_t *timed_next;
+  pn_connector_t *timed_prev;
+  pn_connector_t *closed_next;
+  pn_connector_t *closed_prev;
+  bool ready;
+  bool timed;
+  int events;
   char name[PN_NAME_MAX];
   int idx;
   bool pending_tick;
@@ -106,6 +145,59 @@ struct pn_connector_t {
 
 /* Impls */
 
+// epoll
+
+#ifdef USE_EPOLL
+
+static int pni_epoll_events(int status)
+{
+  return (status & PN_SEL_RD ? EPOLLIN : 0) | (status & PN_SEL_WR ? EPOLLOUT : 0);
+}
+
+static void pni_epoll_ctl(pn_driver_t *d, int op, int fd, int events, void *ptr)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = ptr;
+  if (epoll_ctl(d->epfd, op, fd, &ev) == -1 && (d->trace & PN_TRACE_DRV))
+    perror("epoll_ctl");
+}
+
+// drop any already collected events for a listener or connector that
+// is going away between pn_driver_wait_2 and pn_driver_wait_3
+static void pni_epoll_forget(pn_driver_t *d, void *ptr)
+{
+  for (int i = 0; i < d->nevents; i++) {
+    if (d->events[i].data.ptr == ptr) d->events[i].data.ptr = NULL;
+  }
+}
+
+#endif
+
+// push interest and timer changes for a connector to the epoll set,
+// epoll_ctl is only called when the status has actually changed
+static void pni_connector_update(pn_connector_t *c)
+{
+#ifdef USE_EPOLL
+  pn_driver_t *d = c->driver;
+  if (!d || d->epfd == -1 || c->closed) return;
+
+  if (c->status != c->events) {
+    pni_epoll_ctl(d, EPOLL_CTL_MOD, c->fd, pni_epoll_events(c->status), c);
+    c->events = c->status;
+  }
+
+  if (c->wakeup && !c->timed) {
+    LL_ADD(d, timed, c);
+    c->timed = true;
+  } else if (!c->wakeup && c->timed) {
+    LL_REMOVE(d, timed, c);
+    c->timed = false;
+  }
+#endif
+}
+
 // listener
 
 static void pn_driver_add_listener(pn_driver_t *d, pn_listener_t *l)
@@ -114,6 +206,11 @@ static void pn_driver_add_listener(pn_driver_t *d, pn_listener_t *l)
   LL_ADD(d, listener, l);
   l->driver = d;
   d->listener_count++;
+#ifdef USE_EPOLL
+  if (d->epfd != -1) {
+    pni_epoll_ctl(d, EPOLL_CTL_ADD, l->fd, EPOLLIN, l);
+  }
+#endif
 }
 
 static void pn_driver_remove_listener(pn_driver_t *d, pn_listener_t *l)
@@ -124,6 +221,13 @@ static void pn_driver_remove_listener(pn_driver_t *d, pn_listener_t *l)
     d->listener_next = l->listener_next;
   }
 
+#ifdef USE_EPOLL
+  if (d->epfd != -1) {
+    if (!l->closed) pni_epoll_ctl(d, EPOLL_CTL_DEL, l->fd, 0, NULL);
+    pni_epoll_forget(d, l);
+  }
+#endif
+
   LL_REMOVE(d, listener, l);
   l->driver = NULL;
   d->listener_count--;
@@ -153,6 +257,7 @@ pn_listener_t *pn_listener_fd(pn_driver_t *driver, int fd, void *context)
 
   pn_listener_t *l = (pn_listener_t *) malloc(sizeof(pn_listener_t));
   if (!l) return NULL;
+  l->kind = PN_DRIVER_LISTENER;
   l->driver = driver;
   l->listener_next = NULL;
   l->listener_prev = NULL;
@@ -219,6 +324,11 @@ void pn_listener_close(pn_listener_t *l)
   if (!l) return;
   if (l->closed) return;
 
+#ifdef USE_EPOLL
+  if (l->driver && l->driver->epfd != -1)
+    pni_epoll_ctl(l->driver, EPOLL_CTL_DEL, l->fd, 0, NULL);
+#endif
+
   if (close(l->fd) == -1)
     perror("close");
   l->closed = true;
@@ -240,6 +350,12 @@ static void pn_driver_add_connector(pn_driver_t *d, pn_connector_t *c)
   LL_ADD(d, connector, c);
   c->driver = d;
   d->connector_count++;
+#ifdef USE_EPOLL
+  if (d->epfd != -1) {
+    pni_epoll_ctl(d, EPOLL_CTL_ADD, c->fd, pni_epoll_events(c->status), c);
+    c->events = c->status;
+  }
+#endif
 }
 
 static void pn_driver_remove_connector(pn_driver_t *d, pn_connector_t *c)
@@ -247,9 +363,22 @@ static void pn_driver_remove_connector(pn_driver_t *d, pn_connector_t *c)
   if (!c->driver) return;
 
   if (c == d->connector_next) {
-    d->connector_next = c->connector_next;
+    // with epoll the cursor walks the ready list rather than all connectors
+    d->connector_next = d->epfd == -1 ? c->connector_next : c->ready_next;
   }
 
+#ifdef USE_EPOLL
+  if (d->epfd != -1) {
+    if (!c->closed) pni_epoll_ctl(d, EPOLL_CTL_DEL, c->fd, 0, NULL);
+    pni_epoll_forget(d, c);
+    if (c->ready) LL_REMOVE(d, ready, c);
+    if (c->timed) LL_REMOVE(d, timed, c);
+    if (c->closed) LL_REMOVE(d, closed, c);
+    c->ready = false;
+    c->timed = false;
+  }
+#endif
+
   LL_REMOVE(d, connector, c);
   c->driver = NULL;
   d->connector_count--;
@@ -278,9 +407,19 @@ pn_connector_t *pn_connector_fd(pn_driver_t *driver, int fd, void *context)
 
   pn_connector_t *c = (pn_connector_t *) malloc(sizeof(pn_connector_t));
   if (!c) return NULL;
+  c->kind = PN_DRIVER_CONNECTOR;
   c->driver = driver;
   c->connector_next = NULL;
   c->connector_prev = NULL;
+  c->ready_next = NULL;
+  c->ready_prev = NULL;
+  c->timed_next = NULL;
+  c->timed_prev = NULL;
+  c->closed_next = NULL;
+  c->closed_prev = NULL;
+  c->ready = false;
+  c->timed = false;
+  c->events = 0;
   c->pending_tick = false;
   c->pending_read = false;
   c->pending_write = false;
@@ -385,6 +524,18 @@ void pn_connector_close(pn_connector_t *ctor)
   // XXX: should probably signal engine and callback here
   if (!ctor) return;
 
+#ifdef USE_EPOLL
+  pn_driver_t *d = ctor->driver;
+  if (d && d->epfd != -1 && !ctor->closed) {
+    pni_epoll_ctl(d, EPOLL_CTL_DEL, ctor->fd, 0, NULL);
+    if (ctor->timed) {
+      LL_REMOVE(d, timed, ctor);
+      ctor->timed = false;
+    }
+    LL_ADD(d, closed, ctor);
+  }
+#endif
+
   ctor->status = 0;
   if (close(ctor->fd) == -1)
     perror("close");
@@ -420,6 +571,8 @@ void pn_connector_activate(pn_connector_t *ctor, pn_activate_criteria_t crit)
         ctor->status |= PN_SEL_RD;
         break;
     }
+
+    pni_connector_update(ctor);
 }
 
 
@@ -441,6 +594,8 @@ bool pn_connector_activated(pn_connector_t *ctor, pn_activate_criteria_t crit)
         break;
     }
 
+    pni_connector_update(ctor);
+
     return result;
 }
 
@@ -450,6 +605,25 @@ static pn_timestamp_t pn_connector_tick(pn_connector_t *ctor, pn_timestamp_t now
   return pn_transport_tick(ctor->transport, now);
 }
 
+// gather write of the transport's pending output
+static ssize_t pni_connector_send(pn_connector_t *c, pn_bytes_t *segments, size_t count)
+{
+  struct iovec iov[PN_SEND_SEGMENTS];
+  for (size_t i = 0; i < count; i++) {
+    iov[i].iov_base = (void *) segments[i].start;
+    iov[i].iov_len = segments[i].size;
+  }
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+#ifdef MSG_NOSIGNAL
+  return sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+#else
+  return sendmsg(c->fd, &msg, 0);
+#endif
+}
+
 void pn_connector_process(pn_connector_t *c)
 {
   if (c) {
@@ -504,12 +678,13 @@ void pn_connector_process(pn_connector_t *c)
     /// Socket write
     ///
     if (!c->output_done) {
-      ssize_t pending = pn_transport_pending(transport);
+      pn_bytes_t segments[PN_SEND_SEGMENTS];
+      ssize_t pending = pn_transport_head_segments(transport, segments, PN_SEND_SEGMENTS);
       if (pending > 0) {
         c->status |= PN_SEL_WR;
         if (c->pending_write) {
           c->pending_write = false;
-          ssize_t n = pn_send(c->driver->io, c->fd, pn_transport_head(transport), pending);
+          ssize_t n = pni_connector_send(c, segments, pending);
           if (n < 0) {
             // XXX
             if (errno != EAGAIN) {
@@ -537,6 +712,8 @@ void pn_connector_process(pn_connector_t *c)
         fprintf(stderr, "Closed %s\n", c->name);
       }
       pn_connector_close(c);
+    } else {
+      pni_connector_update(c);
     }
   }
 }
@@ -567,12 +744,35 @@ pn_driver_t *pn_driver()
               (pn_env_bool("PN_TRACE_FRM") ? PN_TRACE_FRM : PN_TRACE_OFF) |
               (pn_env_bool("PN_TRACE_DRV") ? PN_TRACE_DRV : PN_TRACE_OFF));
   d->wakeup = 0;
+  d->epfd = -1;
+#ifdef USE_EPOLL
+  d->events = NULL;
+  d->nevents = 0;
+#endif
+  d->ready_head = NULL;
+  d->ready_tail = NULL;
+  d->timed_head = NULL;
+  d->timed_tail = NULL;
+  d->closed_head = NULL;
+  d->closed_tail = NULL;
 
   // XXX
   if (pipe(d->ctrl)) {
     perror("Can't create control pipe");
   }
 
+#ifdef USE_EPOLL
+  // PN_DRIVER_POLL forces the portable poll() loop, e.g. for comparison
+  if (!pn_env_bool("PN_DRIVER_POLL")) {
+    d->epfd = epoll_create(16);
+    if (d->epfd == -1) {
+      perror("epoll_create");
+    } else {
+      pni_epoll_ctl(d, EPOLL_CTL_ADD, d->ctrl[0], EPOLLIN, d);
+    }
+  }
+#endif
+
   return d;
 }
 
@@ -601,6 +801,10 @@ void pn_driver_free(pn_driver_t *d)
     pn_connector_free(d->connector_head);
   while (d->listener_head)
     pn_listener_free(d->listener_head);
+#ifdef USE_EPOLL
+  if (d->epfd != -1) close(d->epfd);
+  free(d->events);
+#endif
   free(d->fds);
   pn_error_free(d->error);
   pn_io_free(d->io);
@@ -662,8 +866,118 @@ static void pn_driver_rebuild(pn_driver_t *d)
   }
 }
 
+#ifdef USE_EPOLL
+
+static void pn_driver_prepare(pn_driver_t *d)
+{
+  size_t size = d->listener_count + d->connector_count;
+  while (d->capacity < size + 1) {
+    d->capacity = d->capacity ? 2*d->capacity : 16;
+    d->events = (struct epoll_event *) realloc(d->events, d->capacity*sizeof(struct epoll_event));
+  }
+
+  d->nevents = 0;
+  d->wakeup = 0;
+  for (pn_connector_t *c = d->timed_head; c; c = c->timed_next) {
+    d->wakeup = pn_timestamp_min(d->wakeup, c->wakeup);
+  }
+}
+
+static void pn_driver_ready(pn_driver_t *d, pn_connector_t *c)
+{
+  if (!c->ready) {
+    LL_ADD(d, ready, c);
+    c->ready = true;
+  }
+}
+
+static int pn_driver_wait_3_epoll(pn_driver_t *d)
+{
+  bool woken = false;
+
+  // only the connectors handed out last time can have stale flags
+  while (d->ready_head) {
+    pn_connector_t *c = d->ready_head;
+    c->pending_read = false;
+    c->pending_write = false;
+    c->pending_tick = false;
+    c->ready = false;
+    LL_POP(d, ready, pn_connector_t);
+  }
+
+  for (pn_listener_t *l = d->listener_head; l; l = l->listener_next) {
+    l->pending = false;
+  }
+
+  for (int i = 0; i < d->nevents; i++) {
+    struct epoll_event *ev = &d->events[i];
+    if (!ev->data.ptr) continue;
+
+    if (ev->data.ptr == d) {
+      woken = true;
+      //clear the pipe
+      char buffer[512];
+      while (read(d->ctrl[0], buffer, 512) == 512);
+      continue;
+    }
+
+    if (*((pn_driver_kind_t *) ev->data.ptr) == PN_DRIVER_LISTENER) {
+      pn_listener_t *l = (pn_listener_t *) ev->data.ptr;
+      l->pending = ev->events & EPOLLIN;
+      continue;
+    }
+
+    pn_connector_t *c = (pn_connector_t *) ev->data.ptr;
+    if (c->closed) continue;
+    c->pending_read = ev->events & EPOLLIN;
+    c->pending_write = ev->events & EPOLLOUT;
+    if (ev->events & EPOLLERR) {
+      pn_connector_close(c);
+    } else if (ev->events & EPOLLHUP) {
+      if (c->trace & (PN_TRACE_FRM | PN_TRACE_RAW | PN_TRACE_DRV)) {
+        fprintf(stderr, "hangup on connector %s\n", c->name);
+      }
+      // as with poll(), find out what happened through recv() or send()
+      if (c->events & PN_SEL_RD)
+        c->pending_read = true;
+      else if (c->events & PN_SEL_WR)
+        c->pending_write = true;
+    }
+    if (c->pending_read || c->pending_write) {
+      pn_driver_ready(d, c);
+    }
+  }
+  d->nevents = 0;
+
+  pn_timestamp_t now = pn_i_now();
+  for (pn_connector_t *c = d->timed_head; c; c = c->timed_next) {
+    if (c->wakeup <= now) {
+      c->pending_tick = true;
+      pn_driver_ready(d, c);
+    }
+  }
+
+  // closed connectors are reported until they are freed
+  for (pn_connector_t *c = d->closed_head; c; c = c->closed_next) {
+    pn_driver_ready(d, c);
+  }
+
+  d->listener_next = d->listener_head;
+  d->connector_next = d->ready_head;
+
+  return woken ? PN_INTR : 0;
+}
+
+#endif
+
 void pn_driver_wait_1(pn_driver_t *d)
 {
+#ifdef USE_EPOLL
+  if (d->epfd != -1) {
+    pn_driver_prepare(d);
+    return;
+  }
+#endif
   pn_driver_rebuild(d);
 }
 
@@ -676,6 +990,18 @@ int pn_driver_wait_2(pn_driver_t *d, int timeout)
     else
       timeout = (timeout < 0) ? d->wakeup-now : pn_min(timeout, d->wakeup - now);
   }
+#ifdef USE_EPOLL
+  if (d->epfd != -1) {
+    int result = epoll_wait(d->epfd, d->events, d->capacity, d->closed_count > 0 ? 0 : timeout);
+    if (result == -1) {
+      pn_i_error_from_errno(d->error, "epoll_wait");
+      d->nevents = 0;
+    } else {
+      d->nevents = result;
+    }
+    return result;
+  }
+#endif
   int result = poll(d->fds, d->nfds, d->closed_count > 0 ? 0 : timeout);
   if (result == -1)
     pn_i_error_from_errno(d->error, "poll");
@@ -684,6 +1010,9 @@ int pn_driver_wait_2(pn_driver_t *d, int timeout)
 
 int pn_driver_wait_3(pn_driver_t *d)
 {
+#ifdef USE_EPOLL
+  if (d->epfd != -1) return pn_driver_wait_3_epoll(d);
+#endif
   bool woken = false;
   if (d->fds[0].revents & POLLIN) {
     woken = true;
@@ -777,6 +1106,13 @@ pn_listener_t *pn_driver_listener(pn_driver_t *d) {
 pn_connector_t *pn_driver_connector(pn_driver_t *d) {
   if (!d) return NULL;
 
+  if (d->epfd != -1) {
+    // everything on the ready list has something to do
+    pn_connector_t *c = d->connector_next;
+    if (c) d->connector_next = c->ready_next;
+    return c;
+  }
+
   while (d->connector_next) {
     pn_connector_t *c = d->connector_next;
     d->connector_next = c->connector_next;
@@ -0,0 +1,326 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <proton/codec.h>
+#include <proton/object.h>
+#include "../codec/data.h"
+
+#define assert(E) ((E) ? 0 : (abort(), 0))
+
+#define ATTACH ((uint64_t) 0x12)
+#define ERROR ((uint64_t) 0x1d)
+
+static const char *ATTACH_FILL = "DL[SIonn?DL[S]?DL[S]nnI]";
+static const char *ATTACH_SCAN = "D.[SIo..D.[S]?D.[S]..I]";
+
+static void fill_attach(pn_data_t *data, pn_program_t *program, int i)
+{
+  pn_data_clear(data);
+  int err;
+  if (program) {
+    err = pn_data_fill_program(data, program, ATTACH, "link", i, i % 2 == 0,
+                               true, ATTACH, "source", i % 3 == 0, ATTACH, "target", i);
+  } else {
+    err = pn_data_fill(data, ATTACH_FILL, ATTACH, "link", i, i % 2 == 0,
+                       true, ATTACH, "source", i % 3 == 0, ATTACH, "target", i);
+  }
+  assert(!err);
+}
+
+static void test_program_fill(void)
+{
+  pn_program_t *program = pn_program(ATTACH_FILL);
+  pn_data_t *expected = pn_data(0);
+  pn_data_t *actual = pn_data(0);
+  char ebuf[256], abuf[256];
+
+  // the same program is reused for every fill
+  for (int i = 0; i < 6; i++) {
+    fill_attach(expected, NULL, i);
+    fill_attach(actual, program, i);
+    ssize_t esize = pn_data_encode(expected, ebuf, sizeof(ebuf));
+    ssize_t asize = pn_data_encode(actual, abuf, sizeof(abuf));
+    assert(esize > 0 && esize == asize);
+    assert(!memcmp(ebuf, abuf, esize));
+  }
+
+  pn_data_free(actual);
+  pn_data_free(expected);
+  pn_program_free(program);
+}
+
+static void test_program_scan(void)
+{
+  pn_program_t *fill = pn_program(ATTACH_FILL);
+  pn_program_t *scan = pn_program(ATTACH_SCAN);
+  pn_data_t *data = pn_data(0);
+
+  for (int i = 0; i < 6; i++) {
+    fill_attach(data, fill, i);
+    pn_bytes_t name, source, target;
+    uint32_t handle, max;
+    bool role, target_set;
+    int err = pn_data_scan_program(data, scan, &name, &handle, &role, &source,
+                                   &target_set, &target, &max);
+    assert(!err);
+    assert(name.size == 4 && !memcmp(name.start, "link", 4));
+    assert(handle == (uint32_t) i && max == (uint32_t) i);
+    assert(role == (i % 2 == 0));
+    assert(source.size == 6 && !memcmp(source.start, "source", 6));
+    // a missing target suspends the scan for the whole described value
+    assert(target_set == (i % 3 == 0));
+    assert(target_set ? target.size == 6 : target.size == 0 && !target.start);
+  }
+
+  pn_data_free(data);
+  pn_program_free(scan);
+  pn_program_free(fill);
+}
+
+static void test_program_errors(void)
+{
+  pn_data_t *data = pn_data(0);
+  pn_program_t *program = pn_program("D.[?");
+  bool scanned;
+  assert(!pn_data_fill(data, "DL[]", ERROR));
+  assert(pn_data_scan_program(data, program, &scanned) == PN_ARG_ERR);
+  pn_program_free(program);
+
+  program = pn_program("D.[x]");
+  assert(pn_data_scan_program(data, program) == PN_ARG_ERR);
+  pn_program_free(program);
+
+  pn_data_free(data);
+}
+
+static size_t live_programs(void)
+{
+  pn_class_stats_t stats[64];
+  size_t classes = pn_class_stats(stats, 64);
+  for (size_t i = 0; i < classes && i < 64; i++) {
+    if (stats[i].name && !strcmp(stats[i].name, "pn_program")) return stats[i].live;
+  }
+  return 0;
+}
+
+// a format is compiled once for every pn_data_t that uses it
+static void test_program_cache(void)
+{
+  static const char *fmt = "DL[SIo]";
+  pn_data_t *data = pn_data(0);
+  assert(!pni_data_fill_cached(data, fmt, ATTACH, "link", 7, true));
+  size_t programs = live_programs();
+  assert(programs > 0);
+
+  for (int i = 0; i < 10; i++) {
+    pn_data_t *other = pn_data(0);
+    assert(!pni_data_fill_cached(other, fmt, ATTACH, "link", i, false));
+    pn_data_rewind(other);
+    pn_bytes_t name;
+    uint32_t handle;
+    bool role;
+    assert(!pni_data_scan_cached(other, "D.[SIo]", &name, &handle, &role));
+    assert(handle == (uint32_t) i && !role);
+    pn_data_free(other);
+  }
+  assert(live_programs() == programs + 1);
+
+  pn_data_free(data);
+}
+
+static void test_encoded_size(void)
+{
+  pn_data_t *data = pn_data(0);
+  static char big[300];
+  memset(big, 'b', sizeof(big));
+  pn_uuid_t u;
+  memset(u.bytes, 0, sizeof(u.bytes));
+
+  int err = pn_data_fill(data, "DL[SIonn?DL[S]?DL[S]nnI]", ATTACH, "link", 1, true,
+                         true, ATTACH, "source", false, ATTACH, "target", 7);
+  assert(!err);
+  pn_data_put_map(data);
+  pn_data_enter(data);
+  pn_data_put_symbol(data, pn_bytes(sizeof(big), big));
+  pn_data_put_binary(data, pn_bytes(sizeof(big), big));
+  pn_data_put_string(data, pn_bytes(3, big));
+  pn_data_put_ulong(data, 1ULL << 40);
+  pn_data_put_uint(data, 0);
+  pn_data_put_uint(data, 300);
+  pn_data_put_bool(data, false);
+  pn_data_put_uuid(data, u);
+  pn_data_put_double(data, 1.5);
+  pn_data_put_timestamp(data, 12345);
+  pn_data_exit(data);
+  pn_data_put_array(data, false, PN_SYMBOL);
+  pn_data_enter(data);
+  pn_data_put_symbol(data, pn_bytes(3, big));
+  pn_data_put_symbol(data, pn_bytes(sizeof(big), big));
+  pn_data_exit(data);
+  pn_data_put_array(data, true, PN_INT);
+  pn_data_enter(data);
+  pn_data_put_ulong(data, 5);
+  pn_data_exit(data);
+  pn_data_put_list(data);
+
+  static char buf[2048];
+  ssize_t size = pn_data_encode(data, buf, sizeof(buf));
+  assert(size > 0);
+  assert(pn_data_encoded_size(data) == size);
+  // exactly enough room, and one byte short
+  assert(pn_data_encode(data, buf, size) == size);
+  assert(pn_data_encode(data, buf, size - 1) == PN_OVERFLOW);
+
+  pn_data_clear(data);
+  assert(pn_data_encoded_size(data) == 0);
+  pn_data_free(data);
+}
+
+// uuids, decimal128s and strings are kept in the data's buffer, which
+// moves as it grows
+static void test_wide_values(void)
+{
+  pn_data_t *data = pn_data(0);
+  pn_uuid_t uuid;
+  pn_decimal128_t dec;
+  for (int i = 0; i < 16; i++) {
+    uuid.bytes[i] = i;
+    dec.bytes[i] = 16 - i;
+  }
+
+  char key[32];
+  pn_data_put_map(data);
+  pn_data_enter(data);
+  for (int i = 0; i < 1000; i++) {
+    snprintf(key, sizeof(key), "key-%d", i);
+    pn_data_put_string(data, pn_bytes(strlen(key), key));
+    if (i % 2) {
+      pn_data_put_uuid(data, uuid);
+    } else {
+      pn_data_put_decimal128(data, dec);
+    }
+  }
+  pn_data_exit(data);
+  pn_atom_t atom = {PN_UUID};
+  atom.u.as_uuid = uuid;
+  assert(pn_data_put_atom(data, atom) == 0);
+
+  ssize_t size = pn_data_encoded_size(data);
+  char *buf = (char *) malloc(size);
+  assert(pn_data_encode(data, buf, size) == size);
+  pn_data_t *decoded = pn_data(0);
+  // one value per decode
+  ssize_t map = pn_data_decode(decoded, buf, size);
+  assert(map > 0 && map < size);
+  assert(pn_data_decode(decoded, buf + map, size - map) == size - map);
+  free(buf);
+
+  pn_data_rewind(decoded);
+  assert(pn_data_next(decoded));
+  assert(pn_data_get_map(decoded) == 2000);
+  pn_data_enter(decoded);
+  for (int i = 0; i < 1000; i++) {
+    snprintf(key, sizeof(key), "key-%d", i);
+    assert(pn_data_next(decoded));
+    pn_bytes_t str = pn_data_get_string(decoded);
+    assert(str.size == strlen(key) && !memcmp(str.start, key, str.size));
+    assert(pn_data_next(decoded));
+    if (i % 2) {
+      assert(!memcmp(pn_data_get_uuid(decoded).bytes, uuid.bytes, 16));
+    } else {
+      assert(!memcmp(pn_data_get_decimal128(decoded).bytes, dec.bytes, 16));
+    }
+  }
+  pn_data_exit(decoded);
+  assert(pn_data_next(decoded));
+  atom = pn_data_get_atom(decoded);
+  assert(atom.type == PN_UUID && !memcmp(atom.u.as_uuid.bytes, uuid.bytes, 16));
+
+  pn_data_free(decoded);
+  pn_data_free(data);
+}
+
+static void test_decode_borrowed(void)
+{
+  pn_data_t *data = pn_data(0);
+  char value[] = "a string value";
+  pn_data_put_list(data);
+  pn_data_enter(data);
+  pn_data_put_string(data, pn_bytes(strlen(value), value));
+  pn_data_put_symbol(data, pn_bytes(strlen(value), value));
+  pn_data_put_ulong(data, 42);
+  pn_data_exit(data);
+  char first[128], second[128];
+  ssize_t size = pn_data_encode(data, first, sizeof(first));
+  assert(size > 0);
+  memcpy(second, first, size);
+
+  // decoded values point into the input
+  pn_data_clear(data);
+  assert(pn_data_decode_borrowed(data, first, size) == size);
+  pn_data_rewind(data);
+  assert(pn_data_next(data) && pn_data_enter(data) && pn_data_next(data));
+  pn_bytes_t str = pn_data_get_string(data);
+  assert(str.start > first && str.start < first + size);
+  assert(str.size == strlen(value) && !memcmp(str.start, value, str.size));
+
+  // a second input makes the first one be copied in
+  pn_data_exit(data);
+  assert(pn_data_decode_borrowed(data, second, size) == size);
+  memset(first, 0, sizeof(first));
+  pn_data_rewind(data);
+  assert(pn_data_next(data) && pn_data_enter(data) && pn_data_next(data));
+  assert(pn_data_next(data));
+  str = pn_data_get_symbol(data);
+  assert(str.size == strlen(value) && !memcmp(str.start, value, str.size));
+
+  // and after interning nothing refers to either input
+  assert(pn_data_intern_all(data) == 0);
+  memset(second, 0, sizeof(second));
+  char out[256];
+  ssize_t twice = pn_data_encode(data, out, sizeof(out));
+  assert(twice == 2*size);
+  pn_data_t *check = pn_data(0);
+  assert(pn_data_decode(check, out + size, size) == size);
+  pn_data_rewind(check);
+  assert(pn_data_next(check) && pn_data_enter(check) && pn_data_next(check));
+  str = pn_data_get_string(check);
+  assert(str.size == strlen(value) && !memcmp(str.start, value, str.size));
+
+  pn_data_free(check);
+  pn_data_free(data);
+}
+
+int main(int argc, char **argv)
+{
+  test_program_fill();
+  test_program_scan();
+  test_program_errors();
+  test_program_cache();
+  test_encoded_size();
+  test_wide_values();
+  test_decode_borrowed();
+  return 0;
+}
@@ -24,6 +24,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <proton/engine.h>
+#include <proton/framing.h>
+#include <proton/object.h>
+#include "../engine/engine-internal.h"
 
 // never remove 'assert()'
 #undef NDEBUG
@@ -47,6 +50,26 @@ static int xfer(pn_transport_t *src, pn_transport_t *dest)
     return 0;
 }
 
+// push data from one transport to another a segment at a time, at
+// most limit bytes from each segment
+static int xfer_segments(pn_transport_t *src, pn_transport_t *dest, size_t limit)
+{
+    pn_bytes_t segments[8];
+    ssize_t count = pn_transport_head_segments(src, segments, 8);
+    int total = 0;
+    for (ssize_t i = 0; i < count; i++) {
+        ssize_t in = pn_transport_capacity(dest);
+        if (in <= 0) break;
+        size_t n = segments[i].size < limit ? segments[i].size : limit;
+        if (n > (size_t) in) n = (size_t) in;
+        pn_transport_push(dest, segments[i].start, n);
+        total += (int) n;
+        if (n < segments[i].size) break;
+    }
+    pn_transport_pop(src, (size_t) total);
+    return total;
+}
+
 // transfer all available data between two transports
 static int pump(pn_transport_t *t1, pn_transport_t *t2)
 {
@@ -118,6 +141,54 @@ static void test_setup(pn_connection_t *c1, pn_transport_t *t1,
     assert(rx && pn_link_is_receiver(rx));
 }
 
+// two connections, each bound to its own transport, with the session
+// and link from test_setup between them
+typedef struct {
+    pn_connection_t *c1, *c2;
+    pn_transport_t *t1, *t2;
+    pn_link_t *tx, *rx;
+} pair_t;
+
+// max_frame limits the frames t2 accepts, zero leaves the default
+static void pair_open(pair_t *pair, uint32_t max_frame)
+{
+    pair->c1 = pn_connection();
+    pair->t1 = pn_transport();
+    pn_transport_bind(pair->t1, pair->c1);
+
+    pair->c2 = pn_connection();
+    pair->t2 = pn_transport();
+    if (max_frame) pn_transport_set_max_frame(pair->t2, max_frame);
+    pn_transport_bind(pair->t2, pair->c2);
+
+    test_setup(pair->c1, pair->t1,
+               pair->c2, pair->t2);
+
+    pair->tx = pn_link_head(pair->c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pair->rx = pn_link_head(pair->c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(pair->tx && pair->rx);
+}
+
+// run both connections until neither has anything more to say
+static void pair_pump(pair_t *pair)
+{
+    while (pump(pair->t1, pair->t2)) {
+        process_endpoints(pair->c1);
+        process_endpoints(pair->c2);
+    }
+}
+
+static void pair_close(pair_t *pair)
+{
+    pn_transport_unbind(pair->t1);
+    pn_transport_free(pair->t1);
+    pn_connection_free(pair->c1);
+
+    pn_transport_unbind(pair->t2);
+    pn_transport_free(pair->t2);
+    pn_connection_free(pair->c2);
+}
+
 // test that free'ing the connection should free all contained
 // resources (session, links, deliveries)
 int test_free_connection(int argc, char **argv)
@@ -291,12 +362,785 @@ int test_free_link(int argc, char **argv)
     return 0;
 }
 
+// test that links still attached when their connection is unbound and
+// freed are released along with it
+int test_free_attached(int argc, char **argv)
+{
+    fprintf(stdout, "test_free_attached\n");
+    pair_t pair;
+    pair_open(&pair, 0);
+
+    pn_link_flow(pair.rx, 10);
+    pn_delivery(pair.tx, pn_dtag("tag-1", 6));
+    pn_link_send(pair.tx, "ABC", 4);
+    pn_link_advance(pair.tx);
+    pair_pump(&pair);
+    assert(pn_link_current(pair.rx));
+
+    pn_link_t *tx = (pn_link_t *) pn_incref(pair.tx);
+    pn_link_t *rx = (pn_link_t *) pn_incref(pair.rx);
+    pair_close(&pair);
+    assert(pn_refcount(tx) == 1);
+    assert(pn_refcount(rx) == 1);
+    pn_decref(tx);
+    pn_decref(rx);
+
+    return 0;
+}
+
+// test that large payloads handed out as separate output segments
+// arrive intact, including when the segments are written piecemeal and
+// mixed with ordinary contiguous output
+int test_segmented_output(int argc, char **argv)
+{
+    fprintf(stdout, "test_segmented_output\n");
+    pair_t pair;
+    pair_open(&pair, 40000);
+    pn_link_flow(pair.rx, 10);
+    pair_pump(&pair);
+
+    const size_t size = 100000;
+    char *payload = (char *) malloc(size);
+    char *received = (char *) malloc(size);
+    for (size_t i = 0; i < size; i++) payload[i] = (char) (i % 251);
+
+    for (int m = 0; m < 3; m++) {
+        char tag[8];
+        snprintf(tag, sizeof(tag), "tag-%d", m);
+        pn_delivery_t *d = pn_delivery(pair.tx, pn_dtag(tag, strlen(tag)));
+        assert(pn_link_send(pair.tx, payload, size) == (ssize_t) size);
+        pn_link_advance(pair.tx);
+        (void) d;
+
+        // odd messages go out in small pieces to split reference segments
+        size_t limit = (m % 2) ? 1000 : size;
+        while (xfer_segments(pair.t1, pair.t2, limit) + xfer(pair.t2, pair.t1)) {
+            // switch to contiguous output part way through
+            if (m == 2) while (xfer(pair.t1, pair.t2)) ;
+        }
+
+        pn_delivery_t *r = pn_link_current(pair.rx);
+        assert(r && !pn_delivery_partial(r));
+        assert(pn_delivery_pending(r) == size);
+        assert(pn_link_recv(pair.rx, received, size) == (ssize_t) size);
+        assert(memcmp(payload, received, size) == 0);
+        pn_link_advance(pair.rx);
+    }
+
+    free(payload);
+    free(received);
+
+    pair_close(&pair);
+
+    return 0;
+}
+
+// test that a large delivery is referenced in place rather than copied,
+// and arrives intact when more is added while part of it is queued
+int test_streamed_reference(int argc, char **argv)
+{
+    fprintf(stdout, "test_streamed_reference\n");
+    pair_t pair;
+    pair_open(&pair, 20000);
+    // a window of two frames leaves most of the delivery unsent per pass
+    pn_session_set_incoming_capacity(pn_link_session(pair.rx), 40000);
+    pn_link_flow(pair.rx, 1);
+    pair_pump(&pair);
+
+    const size_t size = 100000;
+    char *payload = (char *) malloc(2*size);
+    char *received = (char *) malloc(2*size);
+    for (size_t i = 0; i < 2*size; i++) payload[i] = (char) (i % 251);
+
+    pn_delivery_t *d = pn_delivery(pair.tx, pn_dtag("tag", 3));
+    assert(pn_link_send(pair.tx, payload, size) == (ssize_t) size);
+    assert(pn_transport_pending(pair.t1) > 0);
+    assert(d->payload && pn_buffer_size(d->bytes) == 0);
+    assert(pn_delivery_pending(d) > 0 && pn_delivery_pending(d) < size);
+
+    // the unsent part is copied back out, the queued part stays shared
+    pn_payload_t *shared = d->payload;
+    pn_incref(shared);
+    assert(pn_link_send(pair.tx, payload + size, size) == (ssize_t) size);
+    assert(!d->payload && pn_refcount(shared) > 1);
+    pn_link_advance(pair.tx);
+
+    size_t got = 0;
+    while (got < 2*size) {
+        pair_pump(&pair);
+        ssize_t n = pn_link_recv(pair.rx, received + got, 2*size - got);
+        assert(n > 0);
+        got += n;
+    }
+    assert(memcmp(payload, received, 2*size) == 0);
+    assert(pn_refcount(shared) == 1);
+    pn_decref(shared);
+
+    free(payload);
+    free(received);
+
+    pair_close(&pair);
+
+    return 0;
+}
+
+// test that received data can be read in place and consumed
+int test_recv_segments(int argc, char **argv)
+{
+    fprintf(stdout, "test_recv_segments\n");
+    pair_t pair;
+    pair_open(&pair, 0);
+    pn_bytes_t segments[2];
+    assert(pn_link_recv_segments(pair.rx, segments, 2) == PN_STATE_ERR);
+
+    pn_link_flow(pair.rx, 10);
+    pn_delivery(pair.tx, pn_dtag("tag-1", 6));
+    pair_pump(&pair);
+
+    // a delivery that arrives in two parts
+    pn_link_send(pair.tx, "ABCDEF", 6);
+    pump(pair.t1, pair.t2);
+    pn_delivery_t *d = pn_link_current(pair.rx);
+    assert(d && pn_delivery_partial(d));
+    assert(pn_link_recv_segments(pair.rx, segments, 2) == 1);
+    assert(segments[0].size == 6 && !memcmp(segments[0].start, "ABCDEF", 6));
+    assert(pn_link_consume(pair.rx, 7) == PN_UNDERFLOW);
+    assert(pn_link_consume(pair.rx, 4) == 0);
+    assert(pn_delivery_pending(d) == 2);
+
+    pn_link_send(pair.tx, "GHI", 3);
+    pn_link_advance(pair.tx);
+    pump(pair.t1, pair.t2);
+    assert(!pn_delivery_partial(d));
+
+    char data[8];
+    size_t size = 0;
+    ssize_t n = pn_link_recv_segments(pair.rx, segments, 2);
+    assert(n > 0);
+    for (ssize_t i = 0; i < n; i++) {
+        memcpy(data + size, segments[i].start, segments[i].size);
+        size += segments[i].size;
+    }
+    assert(size == 5 && !memcmp(data, "EFGHI", 5));
+    assert(pn_link_consume(pair.rx, size) == 0);
+    assert(pn_link_recv_segments(pair.rx, segments, 2) == PN_EOS);
+    assert(pn_link_recv(pair.rx, data, sizeof(data)) == PN_EOS);
+
+    pair_close(&pair);
+
+    return 0;
+}
+
+// test that a large delivery arriving in many frames is held in
+// chunks, and reads back the same however it is taken apart
+int test_large_delivery(int argc, char **argv)
+{
+    fprintf(stdout, "test_large_delivery\n");
+    pair_t pair;
+    pair_open(&pair, 10000);
+
+    const size_t size = 300000;
+    char *data = (char *) malloc(size);
+    char *received = (char *) malloc(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (char) (i % 251);
+    }
+
+    pn_link_flow(pair.rx, 1);
+    pn_delivery(pair.tx, pn_dtag("tag-1", 6));
+    for (size_t offset = 0; offset < size; offset += 30000) {
+        pn_link_send(pair.tx, data + offset, 30000);
+        pair_pump(&pair);
+    }
+    pn_link_advance(pair.tx);
+    pair_pump(&pair);
+
+    pn_delivery_t *d = pn_link_current(pair.rx);
+    assert(d && !pn_delivery_partial(d));
+    assert(pn_delivery_pending(d) == size);
+
+    // one segment per chunk, fewer when asked for fewer
+    pn_bytes_t segments[8];
+    assert(pn_link_recv_segments(pair.rx, segments, 2) == 2);
+    ssize_t n = pn_link_recv_segments(pair.rx, segments, 8);
+    assert(n > 2);
+    size_t total = 0;
+    for (ssize_t i = 0; i < n; i++) {
+        assert(!memcmp(segments[i].start, data + total, segments[i].size));
+        total += segments[i].size;
+    }
+    assert(total == size);
+
+    // consume across a chunk boundary, then copy out the rest
+    size_t part = segments[0].size + 10;
+    assert(pn_link_consume(pair.rx, part) == 0);
+    assert(pn_link_recv_segments(pair.rx, segments, 8) == n - 1);
+    assert(segments[0].start[0] == data[part]);
+    assert(pn_link_recv(pair.rx, received, 1000) == 1000);
+    assert(pn_link_recv(pair.rx, received + 1000, size) == (ssize_t) (size - part - 1000));
+    assert(!memcmp(received, data + part, size - part));
+    assert(pn_link_recv(pair.rx, received, size) == PN_EOS);
+    pn_delivery_settle(d);
+
+    free(data);
+    free(received);
+
+    pair_close(&pair);
+
+    return 0;
+}
+
+typedef struct {
+    char *bytes;
+    size_t size;
+} capture_t;
+
+// like xfer, but also keeps a copy of everything transferred
+static int xfer_capture(pn_transport_t *src, pn_transport_t *dest, capture_t *capture)
+{
+    ssize_t out = pn_transport_pending(src);
+    if (out > 0) {
+        ssize_t in = pn_transport_capacity(dest);
+        if (in > 0) {
+            size_t count = (size_t)((out < in) ? out : in);
+            capture->bytes = (char *) realloc(capture->bytes, capture->size + count);
+            memcpy(capture->bytes + capture->size, pn_transport_head(src), count);
+            capture->size += count;
+            pn_transport_push(dest, pn_transport_head(src), count);
+            pn_transport_pop(src, count);
+            return (int)count;
+        }
+    }
+    return 0;
+}
+
+// check every performative in a stream of frames is encoded exactly as
+// pn_data_encode would encode it, returns a bit per descriptor seen
+static uint64_t check_performatives(const capture_t *capture)
+{
+    pn_data_t *data = pn_data(16);
+    char encoded[1024];
+    uint64_t seen = 0;
+    const char *bytes = capture->bytes;
+    size_t size = capture->size;
+    while (size) {
+        pn_frame_t frame;
+        size_t n = pn_read_frame(&frame, bytes, size);
+        assert(n);
+        if (frame.size) {
+            pn_data_clear(data);
+            ssize_t dsize = pn_data_decode(data, frame.payload, frame.size);
+            assert(dsize > 0);
+            ssize_t esize = pn_data_encode(data, encoded, sizeof(encoded));
+            assert(esize == dsize);
+            assert(!memcmp(encoded, frame.payload, dsize));
+
+            pn_data_rewind(data);
+            pn_data_next(data);
+            pn_data_enter(data);
+            pn_data_next(data);
+            seen |= (uint64_t) 1 << pn_data_get_ulong(data);
+        }
+        bytes += n;
+        size -= n;
+    }
+    pn_data_free(data);
+    return seen;
+}
+
+// test that the transfer, flow and disposition frames match the
+// generic encoding for a mix of small and large values
+int test_performative_encoding(int argc, char **argv)
+{
+    fprintf(stdout, "test_performative_encoding\n");
+    pair_t pair;
+    pair_open(&pair, 1024);
+
+    capture_t out = {NULL, 0};
+    capture_t in = {NULL, 0};
+    pn_link_flow(pair.rx, 400);
+    while (xfer_capture(pair.t1, pair.t2, &out) + xfer_capture(pair.t2, pair.t1, &in)) ;
+
+    char tag[300];
+    memset(tag, 'x', sizeof(tag));
+    char payload[3000];
+    memset(payload, 'p', sizeof(payload));
+    for (int i = 0; i < 300; i++) {
+        size_t tsize = (i == 7) ? sizeof(tag) : (size_t) (i % 4);
+        pn_delivery_t *d = pn_delivery(pair.tx, pn_dtag(tag, tsize));
+        if (i % 3 == 0) pn_delivery_settle(d);
+        // some deliveries span several frames
+        pn_link_send(pair.tx, payload, (i % 50 == 0) ? sizeof(payload) : 10);
+        pn_link_advance(pair.tx);
+        while (xfer_capture(pair.t1, pair.t2, &out) + xfer_capture(pair.t2, pair.t1, &in)) ;
+
+        pn_delivery_t *r = pn_link_current(pair.rx);
+        assert(r && !pn_delivery_partial(r));
+        pn_link_advance(pair.rx);
+        pn_delivery_update(r, (i % 5) ? PN_ACCEPTED : PN_RELEASED);
+        if (i % 2) pn_delivery_settle(r);
+    }
+    pn_link_drain(pair.rx, 0);
+    while (xfer_capture(pair.t1, pair.t2, &out) + xfer_capture(pair.t2, pair.t1, &in)) ;
+
+    uint64_t seen = check_performatives(&out) | check_performatives(&in);
+    assert(seen & ((uint64_t) 1 << 0x13)); // flow
+    assert(seen & ((uint64_t) 1 << 0x14)); // transfer
+    assert(seen & ((uint64_t) 1 << 0x15)); // disposition
+
+    free(out.bytes);
+    free(in.bytes);
+
+    pair_close(&pair);
+
+    return 0;
+}
+
+
+int test_inbound_decoding(int argc, char **argv)
+{
+    fprintf(stdout, "test_inbound_decoding\n");
+    pair_t pair;
+    pair_open(&pair, 0);
+
+    pn_link_flow(pair.rx, 100);
+    pump(pair.t1, pair.t2);
+    assert(pn_link_credit(pair.tx) == 100);
+
+    pn_delivery_t *sent[40];
+    char tag[8];
+    char payload[64];
+    for (int i = 0; i < 40; i++) {
+        int tsize = sprintf(tag, "t%d", i);
+        sent[i] = pn_delivery(pair.tx, pn_dtag(tag, tsize));
+        int psize = sprintf(payload, "payload %d", i);
+        pn_link_send(pair.tx, payload, psize);
+        pn_link_advance(pair.tx);
+    }
+    pump(pair.t1, pair.t2);
+    assert(pn_link_credit(pair.tx) == 60);
+    assert(pn_link_queued(pair.rx) == 40);
+
+    // accepted and released states are handled without the generic
+    // decoder, rejected and modified ones carry fields and are not
+    for (int i = 0; i < 40; i++) {
+        pn_delivery_t *r = pn_link_current(pair.rx);
+        assert(r);
+        pn_delivery_tag_t dtag = pn_delivery_tag(r);
+        int tsize = sprintf(tag, "t%d", i);
+        assert(dtag.size == (size_t) tsize && !memcmp(dtag.bytes, tag, tsize));
+        int psize = sprintf(payload, "payload %d", i);
+        char buf[64];
+        assert(pn_link_recv(pair.rx, buf, sizeof(buf)) == psize);
+        assert(!memcmp(buf, payload, psize));
+        pn_link_advance(pair.rx);
+
+        switch (i % 4) {
+        case 0:
+            pn_delivery_update(r, PN_ACCEPTED);
+            break;
+        case 1:
+            pn_delivery_update(r, PN_RELEASED);
+            break;
+        case 2:
+            pn_condition_set_name(pn_disposition_condition(pn_delivery_local(r)), "test:rejected");
+            pn_delivery_update(r, PN_REJECTED);
+            break;
+        default:
+            pn_disposition_set_failed(pn_delivery_local(r), true);
+            pn_delivery_update(r, PN_MODIFIED);
+            break;
+        }
+        if (i % 2) pn_delivery_settle(r);
+    }
+    pn_link_flow(pair.rx, 10);
+    pump(pair.t1, pair.t2);
+    assert(pn_link_credit(pair.tx) == 70);
+
+    for (int i = 0; i < 40; i++) {
+        pn_delivery_t *d = sent[i];
+        static const uint64_t states[] = {PN_ACCEPTED, PN_RELEASED, PN_REJECTED, PN_MODIFIED};
+        assert(pn_delivery_remote_state(d) == states[i % 4]);
+        assert(pn_delivery_settled(d) == (i % 2 == 1));
+        pn_disposition_t *remote = pn_delivery_remote(d);
+        if (i % 4 == 2) {
+            assert(!strcmp(pn_condition_get_name(pn_disposition_condition(remote)), "test:rejected"));
+        } else {
+            assert(!pn_condition_is_set(pn_disposition_condition(remote)));
+        }
+        assert(pn_disposition_is_failed(remote) == (i % 4 == 3));
+    }
+
+    pair_close(&pair);
+
+    return 0;
+}
+
+// terminus fields, condition info and disposition annotations are
+// allocated only when used, check that they still travel and that
+// absent ones read as empty
+int test_lazy_members(int argc, char **argv)
+{
+    fprintf(stdout, "test_lazy_members\n");
+    pair_t pair;
+    pair_open(&pair, 0);
+    pn_session_t *s1 = pn_link_session(pair.tx);
+    pn_link_t *plain = pair.rx;
+    assert(pn_data_size(pn_terminus_filter(pn_link_remote_source(plain))) == 0);
+    assert(pn_data_size(pn_terminus_capabilities(pn_link_remote_target(plain))) == 0);
+
+    pn_link_t *tx = pn_sender(s1, "decorated");
+    pn_terminus_t *src = pn_link_source(tx);
+    pn_data_fill(pn_terminus_filter(src), "{sS}", "selector", "a = 1");
+    pn_data_fill(pn_terminus_capabilities(src), "s", "queue");
+    pn_data_fill(pn_terminus_capabilities(pn_link_target(tx)), "s", "topic");
+    pn_link_open(tx);
+    pair_pump(&pair);
+
+    pn_link_t *rx = pn_link_head(pair.c2, PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE);
+    while (rx && strcmp(pn_link_name(rx), "decorated")) {
+        rx = pn_link_next(rx, PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE);
+    }
+    assert(rx);
+    pn_data_t *filter = pn_terminus_filter(pn_link_remote_source(rx));
+    assert(pn_data_next(filter) && pn_data_type(filter) == PN_MAP);
+    pn_data_t *caps = pn_terminus_capabilities(pn_link_remote_source(rx));
+    assert(pn_data_next(caps) && !memcmp(pn_data_get_symbol(caps).start, "queue", 5));
+    caps = pn_terminus_capabilities(pn_link_remote_target(rx));
+    assert(pn_data_next(caps) && !memcmp(pn_data_get_symbol(caps).start, "topic", 5));
+    assert(pn_data_size(pn_terminus_outcomes(pn_link_remote_source(rx))) == 0);
+    assert(pn_data_size(pn_terminus_properties(pn_link_remote_target(rx))) == 0);
+
+    pn_link_flow(rx, 2);
+    pump(pair.t1, pair.t2);
+    pn_delivery_t *sent[2];
+    for (int i = 0; i < 2; i++) {
+        sent[i] = pn_delivery(tx, pn_dtag(i ? "b" : "a", 1));
+        pn_link_send(tx, "x", 1);
+        pn_link_advance(tx);
+    }
+    pump(pair.t1, pair.t2);
+
+    pn_delivery_t *r = pn_link_current(rx);
+    pn_condition_t *cond = pn_disposition_condition(pn_delivery_local(r));
+    pn_condition_set_name(cond, "test:rejected");
+    pn_condition_set_description(cond, "not wanted");
+    pn_data_put_int(pn_condition_info(cond), 7);
+    pn_delivery_update(r, PN_REJECTED);
+    pn_link_advance(rx);
+    r = pn_link_current(rx);
+    pn_data_put_map(pn_disposition_annotations(pn_delivery_local(r)));
+    pn_delivery_update(r, PN_MODIFIED);
+    pn_link_advance(rx);
+    pump(pair.t1, pair.t2);
+
+    cond = pn_disposition_condition(pn_delivery_remote(sent[0]));
+    assert(!strcmp(pn_condition_get_description(cond), "not wanted"));
+    pn_data_t *info = pn_condition_info(cond);
+    assert(pn_data_next(info) && pn_data_get_int(info) == 7);
+    pn_data_t *annotations = pn_disposition_annotations(pn_delivery_remote(sent[1]));
+    assert(pn_data_next(annotations) && pn_data_type(annotations) == PN_MAP);
+    assert(pn_data_size(pn_disposition_annotations(pn_delivery_remote(sent[0]))) == 0);
+    assert(!pn_condition_is_set(pn_disposition_condition(pn_delivery_remote(sent[1]))));
+    assert(!pn_condition_redirect_host(pn_disposition_condition(pn_delivery_remote(sent[1]))));
+
+    pn_condition_set_name(pn_link_condition(rx), "test:closed");
+    pn_link_close(rx);
+    pump(pair.t1, pair.t2);
+    cond = pn_link_remote_condition(tx);
+    assert(!strcmp(pn_condition_get_name(cond), "test:closed"));
+    assert(!pn_condition_get_description(cond));
+    assert(pn_data_size(pn_condition_info(cond)) == 0);
+
+    pair_close(&pair);
+
+    return 0;
+}
+
+// append an AMQP frame holding the performative in body, followed by
+// payload, to buf
+static size_t put_frame(char *buf, uint16_t channel, pn_data_t *body,
+                        const char *payload, size_t size)
+{
+    ssize_t n = pn_data_encode(body, buf + 8, 1024);
+    assert(n > 0);
+    if (size) memcpy(buf + 8 + n, payload, size);
+    size_t total = 8 + (size_t) n + size;
+    buf[0] = (char) (total >> 24);
+    buf[1] = (char) (total >> 16);
+    buf[2] = (char) (total >> 8);
+    buf[3] = (char) total;
+    buf[4] = 2;
+    buf[5] = 0;
+    buf[6] = (char) (channel >> 8);
+    buf[7] = (char) channel;
+    pn_data_clear(body);
+    return total;
+}
+
+// receive 40 transfers numbered from first on the given handle and
+// settle those from first + from to first + to with one disposition
+static void receive_from(uint32_t handle, uint32_t first, uint32_t from, uint32_t to)
+{
+    pn_connection_t *conn = pn_connection();
+    pn_transport_t *transport = pn_transport();
+    pn_transport_bind(transport, conn);
+    pn_connection_open(conn);
+    pn_session_t *ssn = pn_session(conn);
+    pn_session_open(ssn);
+    pn_link_t *rx = pn_receiver(ssn, "link");
+    pn_link_open(rx);
+    pn_link_flow(rx, 100);
+    // post our open, begin and attach so the peer can answer them
+    assert(pn_transport_pending(transport) > 0);
+
+    static char input[64*1024];
+    size_t size = 0;
+    memcpy(input, "AMQP\x00\x01\x00\x00", 8);
+    size += 8;
+    pn_data_t *body = pn_data(16);
+    pn_data_fill(body, "DL[S]", (uint64_t) 0x10, "peer");
+    size += put_frame(input + size, 0, body, NULL, 0);
+    pn_data_fill(body, "DL[HIII]", (uint64_t) 0x11, 0, 0, 100, 100);
+    size += put_frame(input + size, 0, body, NULL, 0);
+    pn_data_fill(body, "DL[SIonnDL[S]DL[S]nnI]", (uint64_t) 0x12, "link", handle, false,
+                 (uint64_t) 0x28, "source", (uint64_t) 0x29, "target", 0);
+    size += put_frame(input + size, 0, body, NULL, 0);
+    char tag[8];
+    for (uint32_t i = 0; i < 40; i++) {
+        int tsize = sprintf(tag, "t%u", i);
+        pn_data_fill(body, "DL[IIzIo]", (uint64_t) 0x14, handle, first + i,
+                     (size_t) tsize, tag, 0, false);
+        size += put_frame(input + size, 0, body, "x", 1);
+    }
+    pn_data_fill(body, "DL[oIIoDL[]]", (uint64_t) 0x15, false, first + from, first + to,
+                 true, (uint64_t) 0x24);
+    size += put_frame(input + size, 0, body, NULL, 0);
+    pn_data_free(body);
+
+    assert(pn_transport_push(transport, input, size) == 0);
+    assert(pn_link_queued(rx) == 40);
+    for (int i = 0; i < 40; i++) {
+        pn_delivery_t *d = pn_link_current(rx);
+        assert(d);
+        bool settled = (int32_t) (i - from) >= 0 && (int32_t) (to - i) >= 0;
+        assert(pn_delivery_settled(d) == settled);
+        assert(pn_delivery_remote_state(d) == (settled ? PN_ACCEPTED : 0));
+        pn_link_advance(rx);
+    }
+
+    pn_transport_unbind(transport);
+    pn_transport_free(transport);
+    pn_connection_free(conn);
+}
+
+// delivery ids are serial numbers, a peer may start them anywhere and
+// a disposition range may run past the sign bit or wrap around zero
+int test_delivery_id_wraparound(int argc, char **argv)
+{
+    fprintf(stdout, "test_delivery_id_wraparound\n");
+    receive_from(0, 0, 10, 29);
+    receive_from(0, 0x7FFFFFF0, 10, 29);
+    receive_from(0, 0xFFFFFFF0, 10, 29);
+    return 0;
+}
+
+// a disposition only touches the deliveries the session holds, however
+// wide its range, and one whose last id precedes its first touches none
+int test_disposition_range(int argc, char **argv)
+{
+    fprintf(stdout, "test_disposition_range\n");
+    receive_from(0, 0, 29, 10);
+    receive_from(0, 0xFFFFFFF0, 20, 0x7FFFFFFF);
+    receive_from(0, 0xFFFFFFF0, (uint32_t) -100, 9);
+    receive_from(0, 0, 0x80000000, 9);
+    return 0;
+}
+
+// a delivery left unsettled while many others come and go does not keep
+// the delivery maps growing, and can still be settled
+int test_held_delivery(int argc, char **argv)
+{
+    fprintf(stdout, "test_held_delivery\n");
+    pair_t pair;
+    pair_open(&pair, 0);
+    pn_link_flow(pair.rx, 10);
+    pair_pump(&pair);
+
+    pn_delivery_t *held = pn_delivery(pair.tx, pn_dtag("held", 4));
+    pn_link_advance(pair.tx);
+    pair_pump(&pair);
+    pn_delivery_t *rheld = pn_link_current(pair.rx);
+    assert(rheld);
+    pn_link_advance(pair.rx);
+
+    for (int i = 0; i < 3*PN_DELIVERY_MAP_MAX; i++) {
+        pn_delivery(pair.tx, pn_dtag("tag", 3));
+        pn_link_advance(pair.tx);
+        pn_link_flow(pair.rx, 1);
+        pair_pump(&pair);
+        pn_delivery_t *r = pn_link_current(pair.rx);
+        assert(r && r != rheld);
+        pn_link_advance(pair.rx);
+        pn_delivery_update(r, PN_ACCEPTED);
+        pn_delivery_settle(r);
+        pair_pump(&pair);
+        pn_delivery_settle(pn_unsettled_head(pair.tx) == held
+                           ? pn_unsettled_next(held) : pn_unsettled_head(pair.tx));
+    }
+
+    pn_session_t *s1 = pn_link_session(pair.tx);
+    pn_session_t *s2 = pn_link_session(pair.rx);
+    assert(s1->state.outgoing.capacity <= PN_DELIVERY_MAP_MAX);
+    assert(s2->state.incoming.capacity <= PN_DELIVERY_MAP_MAX);
+
+    pn_delivery_update(rheld, PN_ACCEPTED);
+    pn_delivery_settle(rheld);
+    pair_pump(&pair);
+    assert(pn_delivery_remote_state(held) == PN_ACCEPTED);
+    assert(pn_delivery_settled(held));
+    pn_delivery_settle(held);
+    pair_pump(&pair);
+    assert(!pn_unsettled_head(pair.tx));
+
+    pair_close(&pair);
+    return 0;
+}
+
+// handles are mostly small, but a peer may pick any value up to
+// handle-max
+int test_large_handle(int argc, char **argv)
+{
+    fprintf(stdout, "test_large_handle\n");
+    receive_from(5000, 0, 10, 29);
+    receive_from(0xFFFFFFF0, 0, 10, 29);
+    return 0;
+}
+
+// one payload sent on several links is shared rather than copied, and
+// released once every transfer of it has been written
+int test_shared_payload(int argc, char **argv)
+{
+    fprintf(stdout, "test_shared_payload\n");
+    enum {LINKS = 3};
+    pair_t pairs[LINKS];
+    for (int i = 0; i < LINKS; i++) {
+        pair_open(&pairs[i], 0);
+        pn_link_flow(pairs[i].rx, 10);
+        pair_pump(&pairs[i]);
+    }
+
+    // small payloads are copied into frames, large ones referenced
+    const size_t sizes[] = {100, 50000};
+    char *data = (char *) malloc(sizes[1] + 4);
+    char *received = (char *) malloc(sizes[1] + 4);
+    for (size_t i = 0; i < sizes[1]; i++) data[i] = (char) (i % 251);
+
+    for (int s = 0; s < 2; s++) {
+        size_t size = sizes[s];
+        pn_payload_t *payload = pn_payload(data, size);
+        assert(pn_payload_bytes(payload).size == size);
+        for (int i = 0; i < LINKS; i++) {
+            pn_delivery(pairs[i].tx, pn_dtag("tag", 3));
+            assert(pn_link_send_payload(pairs[i].tx, payload) == (ssize_t) size);
+            assert(pn_delivery_pending(pn_link_current(pairs[i].tx)) == size);
+        }
+        assert(pn_refcount(payload) == 1 + LINKS);
+
+        // the last link adds to the payload, which copies it
+        assert(pn_link_send(pairs[LINKS - 1].tx, "tail", 4) == 4);
+        assert(pn_refcount(payload) == LINKS);
+
+        for (int i = 0; i < LINKS; i++) {
+            pn_link_advance(pairs[i].tx);
+            pump(pairs[i].t1, pairs[i].t2);
+            size_t expected = size + (i == LINKS - 1 ? 4 : 0);
+            pn_delivery_t *r = pn_link_current(pairs[i].rx);
+            assert(r && !pn_delivery_partial(r));
+            assert(pn_delivery_pending(r) == expected);
+            assert(pn_link_recv(pairs[i].rx, received, expected) == (ssize_t) expected);
+            assert(memcmp(data, received, size) == 0);
+            pn_link_advance(pairs[i].rx);
+        }
+        assert(pn_refcount(payload) == 1);
+        pn_payload_free(payload);
+    }
+    assert(memcmp(received + sizes[1], "tail", 4) == 0);
+
+    free(data);
+    free(received);
+    for (int i = 0; i < LINKS; i++) {
+        pair_close(&pairs[i]);
+    }
+    return 0;
+}
+
+// test that settled deliveries give their buffers back to the
+// connection's pool, and later deliveries take them from there
+int test_buffer_pool(int argc, char **argv)
+{
+    fprintf(stdout, "test_buffer_pool\n");
+    pair_t pair;
+    pair_open(&pair, 0);
+    pn_buffer_pool_t *tx_pool = pn_connection_buffer_pool(pair.c1);
+    pn_buffer_pool_t *rx_pool = pn_connection_buffer_pool(pair.c2);
+    assert(tx_pool && rx_pool);
+
+    char data[1000];
+    char received[1000];
+    memset(data, 'x', sizeof(data));
+    pn_link_flow(pair.rx, 10);
+    uint64_t misses[2] = {0, 0};
+    for (int m = 0; m < 10; m++) {
+        pn_delivery_t *d = pn_delivery(pair.tx, pn_dtag("tag", 3));
+        assert(pn_link_send(pair.tx, data, sizeof(data)) == (ssize_t) sizeof(data));
+        pn_link_advance(pair.tx);
+        pair_pump(&pair);
+
+        pn_delivery_t *r = pn_link_current(pair.rx);
+        assert(r && !pn_delivery_partial(r));
+        assert(pn_link_recv(pair.rx, received, sizeof(received)) == (ssize_t) sizeof(data));
+        pn_link_advance(pair.rx);
+        pn_delivery_settle(r);
+        pn_delivery_settle(d);
+        pair_pump(&pair);
+
+        // once the first delivery has been settled nothing new is needed
+        if (m == 0) {
+            misses[0] = pn_buffer_pool_misses(tx_pool);
+            misses[1] = pn_buffer_pool_misses(rx_pool);
+            assert(misses[0] && misses[1]);
+        }
+    }
+    assert(pn_buffer_pool_misses(tx_pool) == misses[0]);
+    assert(pn_buffer_pool_misses(rx_pool) == misses[1]);
+    assert(pn_buffer_pool_hits(tx_pool) >= 9 * 2);
+    assert(pn_buffer_pool_hits(rx_pool) >= 9 * 2);
+
+    pair_close(&pair);
+
+    return 0;
+}
 
 typedef int (*test_ptr_t)(int argc, char **argv);
 
 test_ptr_t tests[] = {test_free_connection,
                       test_free_session,
                       test_free_link,
+                      test_free_attached,
+                      test_segmented_output,
+                      test_streamed_reference,
+                      test_recv_segments,
+                      test_large_delivery,
+                      test_performative_encoding,
+                      test_inbound_decoding,
+                      test_lazy_members,
+                      test_delivery_id_wraparound,
+                      test_disposition_range,
+                      test_held_delivery,
+                      test_large_handle,
+                      test_shared_payload,
+                      test_buffer_pool,
                       NULL};
 
 int main(int argc, char **argv)
@@ -25,6 +25,8 @@
 #include <string.h>
 #include <proton/error.h>
 #include <proton/message.h>
+#include <proton/buffer.h>
+#include "../message/message-internal.h"
 
 #define assert(E) ((E) ? 0 : (abort(), 0))
 
@@ -40,8 +42,321 @@ static void test_overflow_error(void)
   pn_message_free(message);
 }
 
+static void test_encode_buffer(void)
+{
+  pn_message_t *message = pn_message();
+  static char body[5000];
+  memset(body, 'x', sizeof(body));
+  pn_message_set_address(message, "amqp://example.com/queue");
+  pn_data_put_binary(pn_message_body(message), pn_bytes(sizeof(body), body));
+
+  static char expected[6000];
+  size_t size = sizeof(expected);
+  assert(pn_message_encode(message, expected, &size) == 0);
+
+  // start with the unread bytes wrapped around the end of the buffer
+  pn_buffer_t *buf = pn_buffer(16);
+  pn_buffer_append(buf, "0123456789abcd", 14);
+  pn_buffer_trim(buf, 12, 0);
+  pn_buffer_append(buf, "efgh", 4);
+
+  assert(pni_message_encode_buffer(message, buf) == 0);
+  assert(pn_buffer_size(buf) == 6 + size);
+  pn_bytes_t bytes = pn_buffer_bytes(buf);
+  assert(!memcmp(bytes.start, "cdefgh", 6));
+  assert(!memcmp(bytes.start + 6, expected, size));
+
+  pn_buffer_free(buf);
+  pn_message_free(message);
+}
+
+#define PROPERTIES ((uint64_t) 0x73)
+#define AMQP_VALUE ((uint64_t) 0x77)
+
+// a properties section with just an address, then an amqp-value body
+static size_t encode_sections(char *bytes, size_t size, bool body_first)
+{
+  pn_data_t *data = pn_data(0);
+  if (body_first) pn_data_fill(data, "DLS", AMQP_VALUE, "body");
+  pn_data_fill(data, "DL[nnS]", PROPERTIES, "queue");
+  if (!body_first) pn_data_fill(data, "DLS", AMQP_VALUE, "body");
+  ssize_t encoded = pn_data_encode(data, bytes, size);
+  assert(encoded > 0);
+  pn_data_free(data);
+  return encoded;
+}
+
+static void check_sections(pn_message_t *message, const char *subject)
+{
+  assert(!strcmp(pn_message_get_address(message), "queue"));
+  const char *actual = pn_message_get_subject(message);
+  assert(subject ? actual && !strcmp(actual, subject) : !actual);
+  pn_data_t *body = pn_message_body(message);
+  pn_data_rewind(body);
+  assert(pn_data_next(body) && pn_data_type(body) == PN_STRING);
+  assert(!memcmp(pn_data_get_string(body).start, "body", 4));
+}
+
+static void test_decode_verbatim(void)
+{
+  pn_message_t *message = pn_message();
+  pn_message_t *copy = pn_message();
+  char bytes[256], out[256];
+  size_t size = encode_sections(bytes, sizeof(bytes), false);
+
+  for (int lazy = 0; lazy < 2; lazy++) {
+    pn_message_set_lazy(message, lazy);
+    assert(pn_message_decode(message, bytes, size) == 0);
+    assert(!strcmp(pn_message_get_address(message), "queue"));
+
+    // unmodified, the message comes out as it went in, with no header
+    size_t osize = sizeof(out);
+    assert(pn_message_encode(message, out, &osize) == 0);
+    assert(osize == size && !memcmp(out, bytes, size));
+
+    // the body is copied, and the properties encoded again
+    pn_message_set_subject(message, "subject");
+    osize = sizeof(out);
+    assert(pn_message_encode(message, out, &osize) == 0);
+    assert(osize > size && !memcmp(out + osize - 9, bytes + size - 9, 9));
+    assert(pn_message_decode(copy, out, osize) == 0);
+    check_sections(copy, "subject");
+
+    // too small for the copied bytes
+    osize = size - 1;
+    assert(pn_message_decode(message, bytes, size) == 0);
+    assert(pn_message_encode(message, out, &osize) == PN_OVERFLOW);
+  }
+
+  pn_message_free(copy);
+  pn_message_free(message);
+}
+
+static void test_decode_lazy(void)
+{
+  pn_message_t *message = pn_message();
+  char bytes[256];
+  size_t size = encode_sections(bytes, sizeof(bytes), false);
+  // a body that frames correctly but does not decode
+  bytes[size - 6] = 0x4f;
+  size -= 5;
+
+  assert(pn_message_decode(message, bytes, size) != 0);
+
+  pn_message_set_lazy(message, true);
+  assert(pn_message_decode(message, bytes, size) == 0);
+  assert(!strcmp(pn_message_get_address(message), "queue"));
+  assert(pn_message_set_lazy(message, false) != 0);
+
+  // a section that does not frame leaves nothing to read later, lazy
+  // or not, and whether or not bytes were kept from before
+  size = encode_sections(bytes, sizeof(bytes), false);
+  pn_string_t *str = pn_string(NULL);
+  for (int lazy = 0; lazy < 2; lazy++) {
+    pn_message_set_lazy(message, lazy);
+    assert(pn_message_decode(message, bytes, size - 2) != 0);
+    assert(!pn_message_is_durable(message));
+    assert(!pn_message_get_address(message));
+    assert(pn_inspect(message, str) == 0);
+  }
+  pn_free(str);
+
+  // sections out of order are decoded straight away
+  size = encode_sections(bytes, sizeof(bytes), true);
+  pn_message_set_lazy(message, true);
+  assert(pn_message_decode(message, bytes, size) == 0);
+  check_sections(message, NULL);
+
+  pn_message_free(message);
+}
+
+// pn_data_t members fetched before a decode still belong to the message,
+// and what is written through them is encoded
+static void test_decode_cached_members(void)
+{
+  pn_message_t *message = pn_message();
+  char bytes[256], out[256];
+  pn_atom_t id = {PN_ULONG};
+  id.u.as_ulong = 42;
+
+  for (int lazy = 0; lazy < 2; lazy++) {
+    pn_message_set_lazy(message, lazy);
+    size_t size = encode_sections(bytes, sizeof(bytes), false);
+    pn_data_t *body = pn_message_body(message);
+    pn_data_t *mid = pn_message_id(message);
+    assert(pn_message_decode(message, bytes, size) == 0);
+
+    pn_data_clear(body);
+    pn_data_put_string(body, pn_bytes(7, (char *) "goodbye"));
+    pn_data_put_atom(mid, id);
+    size_t osize = sizeof(out);
+    assert(pn_message_encode(message, out, &osize) == 0);
+
+    pn_message_t *copy = pn_message();
+    assert(pn_message_decode(copy, out, osize) == 0);
+    assert(!strcmp(pn_message_get_address(copy), "queue"));
+    pn_atom_t atom = pn_message_get_id(copy);
+    assert(atom.type == PN_ULONG && atom.u.as_ulong == 42);
+    pn_data_t *cbody = pn_message_body(copy);
+    pn_data_rewind(cbody);
+    assert(pn_data_next(cbody) && pn_data_type(cbody) == PN_STRING);
+    assert(!memcmp(pn_data_get_string(cbody).start, "goodbye", 7));
+    pn_message_free(copy);
+  }
+
+  pn_message_free(message);
+}
+
+// string properties share one arena, which grows and is reused
+static void test_string_fields(void)
+{
+  pn_message_t *message = pn_message();
+  static char big[1000];
+  char uid[] = {'u', 0, 'd'};
+  memset(big, 'b', sizeof(big) - 1);
+
+  assert(!pn_message_get_address(message));
+  assert(!pn_message_get_user_id(message).start);
+  pn_message_set_address(message, "queue");
+  pn_message_set_subject(message, "subject");
+  pn_message_set_user_id(message, pn_bytes(3, uid));
+  const char *address = pn_message_get_address(message);
+
+  // a value that fits reuses the room of the one before
+  pn_message_set_address(message, "q");
+  assert(pn_message_get_address(message) == address);
+  pn_message_set_address(message, NULL);
+  assert(!pn_message_get_address(message));
+
+  // growing keeps the other values where they are, even one set from
+  // another
+  const char *subject = pn_message_get_subject(message);
+  pn_message_set_reply_to(message, subject);
+  pn_message_set_content_type(message, big);
+  assert(pn_message_get_subject(message) == subject);
+  pn_message_set_group_id(message, pn_message_get_content_type(message));
+  pn_message_set_content_type(message, pn_message_get_subject(message));
+  assert(pn_message_get_subject(message) == subject);
+  assert(!strcmp(subject, "subject"));
+  assert(!strcmp(pn_message_get_reply_to(message), "subject"));
+  assert(!strcmp(pn_message_get_content_type(message), "subject"));
+  assert(!strcmp(pn_message_get_group_id(message), big));
+  pn_bytes_t user_id = pn_message_get_user_id(message);
+  assert(user_id.size == 3 && !memcmp(user_id.start, uid, 3));
+
+  pn_string_t *str = pn_string(NULL);
+  pn_message_set_group_id(message, NULL);
+  assert(pn_inspect(message, str) == 0);
+  assert(strstr(pn_string_get(str), "user_id=\"u\\x00d\""));
+
+  // a value that keeps growing gets more room each time
+  for (size_t size = 1; size < sizeof(big); size++) {
+    pn_message_set_subject(message, big + sizeof(big) - 1 - size);
+  }
+  assert(!strcmp(pn_message_get_subject(message), big));
+
+  // clearing keeps the arena for the next values
+  pn_message_clear(message);
+  assert(!pn_message_get_subject(message));
+  assert(!pn_message_get_user_id(message).start);
+  pn_message_set_address(message, big);
+  assert(!strcmp(pn_message_get_address(message), big));
+
+  pn_free(str);
+  pn_message_free(message);
+}
+
+#define HEADER ((uint64_t) 0x70)
+
+// the header and properties are read without a pn_data_t where possible
+static void test_decode_properties(void)
+{
+  pn_message_t *message = pn_message();
+  pn_message_t *copy = pn_message();
+  char bytes[512];
+  char uid[] = {'u', 0, 'd'};
+  pn_atom_t id = {PN_ULONG};
+  id.u.as_ulong = 1ULL << 40;
+  pn_atom_t correlation_id = {PN_STRING};
+  correlation_id.u.as_bytes = pn_bytes(4, (char *) "corr");
+
+  pn_message_set_durable(message, true);
+  pn_message_set_priority(message, 7);
+  pn_message_set_ttl(message, 1000);
+  pn_message_set_delivery_count(message, 3);
+  pn_message_set_id(message, id);
+  pn_message_set_user_id(message, pn_bytes(3, uid));
+  pn_message_set_address(message, "queue");
+  pn_message_set_reply_to(message, "replies");
+  pn_message_set_correlation_id(message, correlation_id);
+  pn_message_set_content_type(message, "text/plain");
+  pn_message_set_creation_time(message, 1234567890123LL);
+  pn_message_set_group_id(message, "group");
+  pn_message_set_group_sequence(message, 300);
+  size_t size = sizeof(bytes);
+  assert(pn_message_encode(message, bytes, &size) == 0);
+
+  assert(pn_message_decode(copy, bytes, size) == 0);
+  assert(pn_message_is_durable(copy) && pn_message_get_priority(copy) == 7);
+  assert(pn_message_get_ttl(copy) == 1000 && !pn_message_is_first_acquirer(copy));
+  assert(pn_message_get_delivery_count(copy) == 3);
+  pn_atom_t atom = pn_message_get_id(copy);
+  assert(atom.type == PN_ULONG && atom.u.as_ulong == id.u.as_ulong);
+  pn_bytes_t user_id = pn_message_get_user_id(copy);
+  assert(user_id.size == 3 && !memcmp(user_id.start, uid, 3));
+  assert(!strcmp(pn_message_get_address(copy), "queue"));
+  assert(!pn_message_get_subject(copy));
+  assert(!strcmp(pn_message_get_reply_to(copy), "replies"));
+  atom = pn_message_get_correlation_id(copy);
+  assert(atom.type == PN_STRING && !memcmp(atom.u.as_bytes.start, "corr", 4));
+  assert(!strcmp(pn_message_get_content_type(copy), "text/plain"));
+  assert(!pn_message_get_content_encoding(copy));
+  assert(pn_message_get_expiry_time(copy) == 0);
+  assert(pn_message_get_creation_time(copy) == 1234567890123LL);
+  assert(!strcmp(pn_message_get_group_id(copy), "group"));
+  assert(pn_message_get_group_sequence(copy) == 300);
+  assert(!pn_message_get_reply_to_group_id(copy));
+
+  // a value of the wrong type reads as absent, as it does for a scan
+  pn_data_t *data = pn_data(0);
+  pn_data_fill(data, "DL[oI]DL[nns]", HEADER, true, 5, PROPERTIES, "queue");
+  size = pn_data_encode(data, bytes, sizeof(bytes));
+  assert(pn_message_decode(copy, bytes, size) == 0);
+  assert(pn_message_is_durable(copy) && pn_message_get_priority(copy) == 0);
+  assert(!pn_message_get_address(copy));
+  assert(pn_message_get_id(copy).type == PN_NULL);
+
+  // a described id is left to the general decode
+  pn_data_clear(data);
+  pn_data_fill(data, "DL[DLSnS]", PROPERTIES, (uint64_t) 42, "id", "queue");
+  size = pn_data_encode(data, bytes, sizeof(bytes));
+  assert(pn_message_decode(copy, bytes, size) == 0);
+  assert(!strcmp(pn_message_get_address(copy), "queue"));
+  pn_data_t *described = pn_message_id(copy);
+  pn_data_rewind(described);
+  assert(pn_data_next(described) && pn_data_type(described) == PN_DESCRIBED);
+
+  // as is a list that claims more fields than it holds
+  pn_data_clear(data);
+  pn_data_fill(data, "DL[nnS]", PROPERTIES, "queue");
+  size = pn_data_encode(data, bytes, sizeof(bytes));
+  assert((uint8_t) bytes[3] == 0xd0 && bytes[11] == 3);
+  bytes[11] = 4;
+  assert(pn_message_decode(copy, bytes, size) != 0);
+
+  pn_data_free(data);
+  pn_message_free(copy);
+  pn_message_free(message);
+}
+
 int main(int argc, char **argv)
 {
   test_overflow_error();
+  test_encode_buffer();
+  test_decode_verbatim();
+  test_decode_lazy();
+  test_decode_cached_members();
+  test_string_fields();
+  test_decode_properties();
   return 0;
 }
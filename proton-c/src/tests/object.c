@@ -137,6 +137,62 @@ static void test_free(void)
   pn_free(NULL);
 }
 
+#define counted_initialize NULL
+#define counted_finalize NULL
+#define counted_hashcode NULL
+#define counted_compare NULL
+#define counted_inspect NULL
+
+static bool class_stats(const char *name, pn_class_stats_t *result)
+{
+  pn_class_stats_t stats[64];
+  size_t count = pn_class_stats(stats, 64);
+  assert(count <= 64);
+  for (size_t i = 0; i < count; i++) {
+    if (stats[i].name && !strcmp(stats[i].name, name)) {
+      *result = stats[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+static void test_class_stats(void)
+{
+  static pn_class_t clazz = PN_CLASS(counted);
+  pn_class_stats_t stats;
+  assert(!class_stats("counted", &stats));
+
+  void *objects[100];
+  for (size_t i = 0; i < 100; i++) {
+    // some big enough to bypass the caches
+    objects[i] = pn_new(i % 2 ? 24 : 4096, &clazz);
+  }
+  assert(class_stats("counted", &stats));
+  assert(stats.live == 100);
+  assert(stats.bytes == 50*24 + 50*4096);
+
+  for (size_t i = 0; i < 50; i++) {
+    pn_free(objects[i]);
+  }
+  assert(class_stats("counted", &stats));
+  assert(stats.live == 50);
+  assert(stats.bytes == 25*24 + 25*4096);
+
+  // reuse the freed blocks
+  for (size_t i = 0; i < 50; i++) {
+    objects[i] = pn_new(24, &clazz);
+  }
+  for (size_t i = 0; i < 100; i++) {
+    pn_free(objects[i]);
+  }
+  assert(class_stats("counted", &stats));
+  assert(stats.live == 0);
+  assert(stats.bytes == 0);
+
+  pn_object_cache_free();
+}
+
 static uintptr_t hashcode(void *obj) { return (uintptr_t) obj; }
 
 static void test_hashcode(void)
@@ -499,6 +555,53 @@ static void test_hash(void)
   pn_decref(three);
 }
 
+static void test_hash_churn(uintptr_t stride)
+{
+  void *value = pn_new(0, NULL);
+  pn_hash_t *hash = pn_hash(0, 0.75, PN_REFCOUNT);
+  const uintptr_t n = 10000;
+
+  for (uintptr_t i = 0; i < n; i++) {
+    pn_hash_put(hash, i*stride, value);
+  }
+  assert(pn_hash_size(hash) == n);
+
+  for (uintptr_t i = 0; i < n; i += 2) {
+    pn_hash_del(hash, i*stride);
+  }
+  assert(pn_hash_size(hash) == n/2);
+
+  for (uintptr_t i = 0; i < n; i++) {
+    assert(pn_hash_get(hash, i*stride) == (i % 2 ? value : NULL));
+  }
+
+  // add the deleted keys back in the gaps the deletes left
+  for (uintptr_t i = 0; i < n; i += 2) {
+    pn_hash_put(hash, i*stride, value);
+  }
+  for (uintptr_t i = 0; i < n; i++) {
+    assert(pn_hash_get(hash, i*stride) == value);
+  }
+
+  size_t count = 0;
+  for (pn_handle_t entry = pn_hash_head(hash); entry; entry = pn_hash_next(hash, entry)) {
+    assert(pn_hash_key(hash, entry) % stride == 0);
+    count++;
+  }
+  assert(count == n);
+
+  // deleting while iterating has to revisit the deleted slot
+  pn_handle_t entry = pn_hash_head(hash);
+  while (entry) {
+    pn_hash_del(hash, pn_hash_key(hash, entry));
+    entry = pn_hash_next(hash, entry - 1);
+  }
+  assert(pn_hash_size(hash) == 0);
+
+  pn_decref(hash);
+  pn_decref(value);
+}
+
 static bool equals(const char *a, const char *b)
 {
   if (a == NULL && b == NULL) {
@@ -691,7 +794,7 @@ void test_map_inspect(void)
                 pn_string("k2"), pn_string("v2"),
                 pn_string("k3"), pn_string("v3"),
                 END);
-  test_inspect(m, "{\"k3\": \"v3\", \"k1\": \"v1\", \"k2\": \"v2\"}");
+  test_inspect(m, "{\"k1\": \"v1\", \"k3\": \"v3\", \"k2\": \"v2\"}");
   pn_free(m);
 }
 
@@ -774,6 +877,7 @@ int main(int argc, char **argv)
 
   test_finalize();
   test_free();
+  test_class_stats();
   test_hashcode();
   test_compare();
 
@@ -795,6 +899,10 @@ int main(int argc, char **argv)
 
   test_hash();
 
+  // sequential ids, and keys that only differ in their high bits
+  test_hash_churn(1);
+  test_hash_churn(4096);
+
   test_string(NULL);
   test_string("");
   test_string("this is a test");
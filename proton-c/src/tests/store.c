@@ -0,0 +1,148 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <proton/messenger.h>
+#include "../messenger/store.h"
+
+// never remove 'assert()'
+#undef NDEBUG
+#include <assert.h>
+
+#define LONG_ADDRESS (2048)
+#define ADDRESSES (1000)
+
+// test that addresses longer than any fixed sized key are told apart by
+// all of their bytes, including two that differ only in the last one
+int test_long_address(int argc, char **argv)
+{
+    fprintf(stdout, "test_long_address\n");
+    pni_store_t *store = pni_store();
+
+    char *first = (char *) malloc(LONG_ADDRESS + 1);
+    char *second = (char *) malloc(LONG_ADDRESS + 1);
+    strcpy(first, "amqp://host/");
+    memset(first + strlen(first), 'q', LONG_ADDRESS - strlen(first));
+    first[LONG_ADDRESS] = '\0';
+    strcpy(second, first);
+    second[LONG_ADDRESS - 1] = 'r';
+
+    pni_entry_t *a = pni_store_put(store, first);
+    pni_entry_t *b = pni_store_put(store, second);
+    assert(a && b);
+    assert(pni_store_size(store) == 2);
+
+    // look up through copies so that only the contents can match
+    char *copy = (char *) malloc(LONG_ADDRESS + 1);
+    strcpy(copy, first);
+    assert(pni_store_get(store, copy) == a);
+    strcpy(copy, second);
+    assert(pni_store_get(store, copy) == b);
+    copy[LONG_ADDRESS - 1] = 's';
+    assert(pni_store_get(store, copy) == NULL);
+    copy[LONG_ADDRESS / 2] = '\0';
+    assert(pni_store_get(store, copy) == NULL);
+
+    // the stream outlives its entries and takes the next put
+    pni_entry_free(a);
+    assert(pni_store_get(store, first) == NULL);
+    pni_entry_t *c = pni_store_put(store, first);
+    assert(pni_store_get(store, first) == c);
+    assert(pni_store_get(store, second) == b);
+
+    free(copy);
+    free(first);
+    free(second);
+    pni_store_free(store);
+    return 0;
+}
+
+// test that each of many distinct addresses finds its own stream again,
+// whatever order they are looked up in
+int test_many_addresses(int argc, char **argv)
+{
+    fprintf(stdout, "test_many_addresses\n");
+    pni_store_t *store = pni_store();
+    static int contexts[ADDRESSES];
+    char address[64];
+
+    for (int i = 0; i < ADDRESSES; i++) {
+        snprintf(address, sizeof(address), "amqp://host:%d/queue-%d", i % 7, i);
+        pni_entry_t *entry = pni_store_put(store, address);
+        assert(entry);
+        pni_entry_set_context(entry, &contexts[i]);
+    }
+    assert(pni_store_size(store) == ADDRESSES);
+
+    // a second entry on every other address queues behind the first
+    for (int i = 0; i < ADDRESSES; i += 2) {
+        snprintf(address, sizeof(address), "amqp://host:%d/queue-%d", i % 7, i);
+        assert(pni_store_put(store, address));
+    }
+
+    for (int i = ADDRESSES - 1; i >= 0; i--) {
+        snprintf(address, sizeof(address), "amqp://host:%d/queue-%d", i % 7, i);
+        pni_entry_t *entry = pni_store_get(store, address);
+        assert(entry && pni_entry_get_context(entry) == &contexts[i]);
+    }
+
+    // an address seen with another port is a different stream
+    assert(pni_store_get(store, "amqp://host:1/queue-0") == NULL);
+    assert(pni_store_get(store, "amqp://host:0/queue-") == NULL);
+
+    // draining every address leaves the others in place
+    for (int i = 0; i < ADDRESSES; i += 3) {
+        snprintf(address, sizeof(address), "amqp://host:%d/queue-%d", i % 7, i);
+        pni_entry_t *entry;
+        while ((entry = pni_store_get(store, address))) pni_entry_free(entry);
+    }
+    for (int i = 0; i < ADDRESSES; i++) {
+        snprintf(address, sizeof(address), "amqp://host:%d/queue-%d", i % 7, i);
+        pni_entry_t *entry = pni_store_get(store, address);
+        if (i % 3) {
+            assert(entry && pni_entry_get_context(entry) == &contexts[i]);
+        } else {
+            assert(!entry);
+        }
+    }
+
+    pni_store_free(store);
+    return 0;
+}
+
+typedef int (*test_ptr_t)(int argc, char **argv);
+
+test_ptr_t tests[] = {test_long_address,
+                      test_many_addresses,
+                      NULL};
+
+int main(int argc, char **argv)
+{
+    test_ptr_t *test = tests;
+    while (*test) {
+        int rc = (*test++)(argc, argv);
+        if (rc)
+            return rc;
+    }
+    return 0;
+}
@@ -30,6 +30,7 @@
 #include <stdio.h>
 
 #include "../engine/event.h"
+#include "../codec/data.h"
 
 #include "../sasl/sasl-internal.h"
 #include "../ssl/ssl-internal.h"
@@ -38,22 +39,151 @@
 
 static ssize_t transport_consume(pn_transport_t *transport);
 
+// channel and handle tables
+
+#define PN_ALIAS_MAP_MIN (8)
+
+void pn_alias_map_init(pn_alias_map_t *map)
+{
+  map->slots = NULL;
+  map->capacity = 0;
+  map->sparse = NULL;
+}
+
+void pn_alias_map_free(pn_alias_map_t *map)
+{
+  for (uint32_t i = 0; i < map->capacity; i++) {
+    pn_decref(map->slots[i]);
+  }
+  free(map->slots);
+  pn_free(map->sparse);
+}
+
+static void *pn_alias_map_get(pn_alias_map_t *map, uint32_t alias)
+{
+  if (alias < map->capacity) {
+    return map->slots[alias];
+  } else if (alias >= PN_ALIAS_DIRECT && map->sparse) {
+    return pn_hash_get(map->sparse, alias);
+  } else {
+    return NULL;
+  }
+}
+
+static void pn_alias_map_put(pn_alias_map_t *map, uint32_t alias, void *object)
+{
+  if (alias >= PN_ALIAS_DIRECT) {
+    if (!map->sparse) map->sparse = pn_hash(0, 0.75, PN_REFCOUNT);
+    pn_hash_put(map->sparse, alias, object);
+    return;
+  }
+
+  if (alias >= map->capacity) {
+    uint32_t capacity = map->capacity ? map->capacity : PN_ALIAS_MAP_MIN;
+    while (capacity <= alias) capacity *= 2;
+    map->slots = (void **) realloc(map->slots, capacity * sizeof(void *));
+    memset(map->slots + map->capacity, 0, (capacity - map->capacity) * sizeof(void *));
+    map->capacity = capacity;
+  }
+
+  void *old = map->slots[alias];
+  map->slots[alias] = pn_incref(object);
+  pn_decref(old);
+}
+
+// note: may free the object
+static void pn_alias_map_del(pn_alias_map_t *map, uint32_t alias)
+{
+  if (alias < map->capacity) {
+    void *old = map->slots[alias];
+    map->slots[alias] = NULL;
+    pn_decref(old);
+  } else if (alias >= PN_ALIAS_DIRECT && map->sparse) {
+    pn_hash_del(map->sparse, alias);
+  }
+}
+
+// note: may free the objects
+static void pn_alias_map_clear(pn_alias_map_t *map)
+{
+  pn_alias_map_free(map);
+  pn_alias_map_init(map);
+}
+
+// the lowest alias not in use
+static uint16_t pn_alias_map_allocate(pn_alias_map_t *map)
+{
+  for (uint32_t i = 0; i < 65536; i++) {
+    if (!pn_alias_map_get(map, i)) {
+      return i;
+    }
+  }
+
+  assert(false);
+  return 0;
+}
+
 // delivery buffers
 
+#define PN_DELIVERY_MAP_MIN (16)
+
 void pn_delivery_map_init(pn_delivery_map_t *db, pn_sequence_t next)
 {
-  db->deliveries = pn_hash(1024, 0.75, PN_REFCOUNT);
+  db->slots = NULL;
+  db->capacity = 0;
+  db->lwm = next;
   db->next = next;
+  db->behind = NULL;
 }
 
 void pn_delivery_map_free(pn_delivery_map_t *db)
 {
-  pn_free(db->deliveries);
+  for (uint32_t id = db->lwm; id != db->next; id++) {
+    pn_decref(db->slots[id & (db->capacity - 1)]);
+  }
+  free(db->slots);
+  pn_free(db->behind);
 }
 
 pn_delivery_t *pn_delivery_map_get(pn_delivery_map_t *db, pn_sequence_t id)
 {
-  return (pn_delivery_t *) pn_hash_get(db->deliveries, id);
+  // unsigned differences keep this right when ids wrap around
+  uint32_t offset = (uint32_t) id - db->lwm;
+  if (offset < db->next - db->lwm) {
+    return db->slots[(uint32_t) id & (db->capacity - 1)];
+  } else if (db->behind) {
+    return (pn_delivery_t *) pn_hash_get(db->behind, (uint32_t) id);
+  } else {
+    return NULL;
+  }
+}
+
+static void pn_delivery_map_grow(pn_delivery_map_t *db)
+{
+  size_t capacity = db->capacity ? 2*db->capacity : PN_DELIVERY_MAP_MIN;
+  pn_delivery_t **slots = (pn_delivery_t **) calloc(capacity, sizeof(pn_delivery_t *));
+  for (uint32_t id = db->lwm; id != db->next; id++) {
+    slots[id & (capacity - 1)] = db->slots[id & (db->capacity - 1)];
+  }
+  free(db->slots);
+  db->slots = slots;
+  db->capacity = capacity;
+}
+
+// moves the delivery at lwm of a full ring to the hash, and lwm on to
+// the next delivery still in the ring
+static void pn_delivery_map_spill(pn_delivery_map_t *db)
+{
+  size_t mask = db->capacity - 1;
+  pn_delivery_t *oldest = db->slots[db->lwm & mask];
+  assert(oldest);
+  if (!db->behind) db->behind = pn_hash(0, 0.75, PN_REFCOUNT);
+  pn_hash_put(db->behind, db->lwm, oldest);
+  pn_decref(oldest);
+  db->slots[db->lwm & mask] = NULL;
+  do {
+    db->lwm++;
+  } while (db->lwm != db->next && !db->slots[db->lwm & mask]);
 }
 
 static void pn_delivery_state_init(pn_delivery_state_t *ds, pn_delivery_t *delivery, pn_sequence_t id)
@@ -65,30 +195,50 @@ static void pn_delivery_state_init(pn_delivery_state_t *ds, pn_delivery_t *deliv
 
 pn_delivery_state_t *pn_delivery_map_push(pn_delivery_map_t *db, pn_delivery_t *delivery)
 {
+  if (db->next - db->lwm == db->capacity) {
+    if (db->capacity < PN_DELIVERY_MAP_MAX) {
+      pn_delivery_map_grow(db);
+    } else {
+      pn_delivery_map_spill(db);
+    }
+  }
   pn_delivery_state_t *ds = &delivery->state;
   pn_delivery_state_init(ds, delivery, db->next++);
-  pn_hash_put(db->deliveries, ds->id, delivery);
+  db->slots[(uint32_t) ds->id & (db->capacity - 1)] = (pn_delivery_t *) pn_incref(delivery);
   return ds;
 }
 
+// note: may free the delivery
 void pn_delivery_map_del(pn_delivery_map_t *db, pn_delivery_t *delivery)
 {
-  if (delivery->state.init) {
-    pn_hash_del(db->deliveries, delivery->state.id);
-  }
+  uint32_t id = delivery->state.id;
+  bool mapped = delivery->state.init && pn_delivery_map_get(db, id) == delivery;
   delivery->state.init = false;
   delivery->state.sent = false;
+  if (!mapped) return;
+
+  if (id - db->lwm < db->next - db->lwm) {
+    size_t mask = db->capacity - 1;
+    db->slots[id & mask] = NULL;
+    while (db->lwm != db->next && !db->slots[db->lwm & mask]) {
+      db->lwm++;
+    }
+    pn_decref(delivery);
+  } else {
+    pn_hash_del(db->behind, id);
+  }
 }
 
 void pn_delivery_map_clear(pn_delivery_map_t *dm)
 {
-  pn_hash_t *hash = dm->deliveries;
-  for (pn_handle_t entry = pn_hash_head(hash);
-       entry;
-       entry = pn_hash_next(hash, entry))
-  {
-    pn_delivery_t *dlv = (pn_delivery_t *) pn_hash_value(hash, entry);
-    pn_delivery_map_del(dm, dlv);
+  uint32_t next = dm->next;
+  for (uint32_t id = dm->lwm; id != next; id++) {
+    pn_delivery_t *dlv = pn_delivery_map_get(dm, id);
+    if (dlv) pn_delivery_map_del(dm, dlv);
+  }
+  while (dm->behind && pn_hash_size(dm->behind)) {
+    pn_handle_t entry = pn_hash_head(dm->behind);
+    pn_delivery_map_del(dm, (pn_delivery_t *) pn_hash_value(dm->behind, entry));
   }
 }
 
@@ -182,11 +332,12 @@ static void pn_transport_initialize(void *object)
   transport->remote_desired_capabilities = pn_data(16);
   transport->remote_properties = pn_data(16);
   transport->disp_data = pn_data(16);
+  transport->scratch_data = pn_data(16);
   transport->error = pn_error();
   pn_condition_init(&transport->remote_condition);
 
-  transport->local_channels = pn_hash(0, 0.75, PN_REFCOUNT);
-  transport->remote_channels = pn_hash(0, 0.75, PN_REFCOUNT);
+  pn_alias_map_init(&transport->local_channels);
+  pn_alias_map_init(&transport->remote_channels);
 
   transport->bytes_input = 0;
   transport->bytes_output = 0;
@@ -197,12 +348,12 @@ static void pn_transport_initialize(void *object)
 
 pn_session_t *pn_channel_state(pn_transport_t *transport, uint16_t channel)
 {
-  return (pn_session_t *) pn_hash_get(transport->remote_channels, channel);
+  return (pn_session_t *) pn_alias_map_get(&transport->remote_channels, channel);
 }
 
 static void pn_map_channel(pn_transport_t *transport, uint16_t channel, pn_session_t *session)
 {
-  pn_hash_put(transport->remote_channels, channel, session);
+  pn_alias_map_put(&transport->remote_channels, channel, session);
   session->state.remote_channel = channel;
 }
 
@@ -211,7 +362,7 @@ void pn_unmap_channel(pn_transport_t *transport, pn_session_t *ssn)
   uint16_t channel = ssn->state.remote_channel;
   ssn->state.remote_channel = -2;
   // note: may free the session:
-  pn_hash_del(transport->remote_channels, channel);
+  pn_alias_map_del(&transport->remote_channels, channel);
 }
 
 
@@ -265,10 +416,11 @@ static void pn_transport_finalize(void *object)
   pn_free(transport->remote_desired_capabilities);
   pn_free(transport->remote_properties);
   pn_free(transport->disp_data);
+  pn_free(transport->scratch_data);
   pn_error_free(transport->error);
   pn_condition_tini(&transport->remote_condition);
-  pn_free(transport->local_channels);
-  pn_free(transport->remote_channels);
+  pn_alias_map_free(&transport->local_channels);
+  pn_alias_map_free(&transport->remote_channels);
   if (transport->input_buf) free(transport->input_buf);
   if (transport->output_buf) free(transport->output_buf);
   pn_free(transport->scratch);
@@ -309,9 +461,20 @@ int pn_transport_unbind(pn_transport_t *transport)
   while (ssn) {
     pn_delivery_map_clear(&ssn->state.incoming);
     pn_delivery_map_clear(&ssn->state.outgoing);
+    // attached links hold their session, so the handles must go too or
+    // a connection freed without detaching its links is never reclaimed
+    pn_alias_map_clear(&ssn->state.local_handles);
+    pn_alias_map_clear(&ssn->state.remote_handles);
     ssn = pn_session_next(ssn, 0);
   }
 
+  pn_link_t *link = pn_link_head(conn, 0);
+  while (link) {
+    link->state.local_handle = -2;
+    link->state.remote_handle = -2;
+    link = pn_link_next(link, 0);
+  }
+
   pn_endpoint_t *endpoint = conn->endpoint_head;
   while (endpoint) {
     pn_condition_clear(&endpoint->remote_condition);
@@ -332,7 +495,7 @@ pn_error_t *pn_transport_error(pn_transport_t *transport)
 static void pn_map_handle(pn_session_t *ssn, uint32_t handle, pn_link_t *link)
 {
   link->state.remote_handle = handle;
-  pn_hash_put(ssn->state.remote_handles, handle, link);
+  pn_alias_map_put(&ssn->state.remote_handles, handle, link);
 }
 
 void pn_unmap_handle(pn_session_t *ssn, pn_link_t *link)
@@ -340,12 +503,12 @@ void pn_unmap_handle(pn_session_t *ssn, pn_link_t *link)
   uint32_t handle = link->state.remote_handle;
   link->state.remote_handle = -2;
   // may delete link:
-  pn_hash_del(ssn->state.remote_handles, handle);
+  pn_alias_map_del(&ssn->state.remote_handles, handle);
 }
 
 pn_link_t *pn_handle_state(pn_session_t *ssn, uint32_t handle)
 {
-  return (pn_link_t *) pn_hash_get(ssn->state.remote_handles, handle);
+  return (pn_link_t *) pn_alias_map_get(&ssn->state.remote_handles, handle);
 }
 
 bool pni_disposition_batchable(pn_disposition_t *disposition)
@@ -375,19 +538,19 @@ void pni_disposition_encode(pn_disposition_t *disposition, pn_data_t *data)
   case PN_RELEASED:
     return;
   case PN_REJECTED:
-    pn_data_fill(data, "[?DL[sSC]]", pn_condition_is_set(cond), ERROR,
-                 pn_condition_get_name(cond),
-                 pn_condition_get_description(cond),
-                 pn_condition_info(cond));
+    pni_data_fill_cached(data, "[?DL[sSC]]", pn_condition_is_set(cond), ERROR,
+                         pn_condition_get_name(cond),
+                         pn_condition_get_description(cond),
+                         cond->info);
     break;
   case PN_MODIFIED:
-    pn_data_fill(data, "[ooC]",
-                 disposition->failed,
-                 disposition->undeliverable,
-                 disposition->annotations);
+    pni_data_fill_cached(data, "[ooC]",
+                         disposition->failed,
+                         disposition->undeliverable,
+                         disposition->annotations);
     break;
   default:
-    pn_data_copy(data, disposition->data);
+    if (disposition->data) pn_data_copy(data, disposition->data);
     break;
   }
 }
@@ -403,7 +566,7 @@ int pn_post_close(pn_transport_t *transport, const char *condition)
   if (!condition && pn_condition_is_set(cond)) {
     condition = pn_condition_get_name(cond);
     description = pn_condition_get_description(cond);
-    info = pn_condition_info(cond);
+    info = cond->info;
   }
 
   return pn_post_frame(transport->disp, 0, "DL[?DL[sSC]]", CLOSE,
@@ -501,7 +664,7 @@ int pn_do_begin(pn_dispatcher_t *disp)
   pn_session_t *ssn;
   if (reply) {
     // XXX: what if session is NULL?
-    ssn = (pn_session_t *) pn_hash_get(transport->local_channels, remote_channel);
+    ssn = (pn_session_t *) pn_alias_map_get(&transport->local_channels, remote_channel);
   } else {
     ssn = pn_session(transport->connection);
   }
@@ -583,6 +746,37 @@ int pn_terminus_set_address_bytes(pn_terminus_t *terminus, pn_bytes_t address)
   return pn_string_setn(terminus->address, address.start, address.size);
 }
 
+// Values scanned with "?C" codes go into a list in scratch_data, see
+// pn_do_attach.  The list keeps their positions restorable while they
+// are copied out.
+static void pni_scratch_open(pn_data_t *values)
+{
+  pn_data_clear(values);
+  pn_data_put_list(values);
+  pn_data_enter(values);
+}
+
+static void pni_scratch_rewind(pn_data_t *values)
+{
+  pn_data_rewind(values);
+  pn_data_next(values);
+  pn_data_enter(values);
+}
+
+// Moves the next value of src into *dst if present is set, allocating
+// *dst only then, and otherwise leaves *dst empty.
+static int pni_move_value(pn_data_t *src, bool present, pn_data_t **dst)
+{
+  if (*dst) pn_data_clear(*dst);
+  if (!present) return 0;
+  pn_data_narrow(src);
+  int err = pn_data_appendn(pn_lazy_data(dst), src, 1);
+  pn_data_widen(src);
+  pn_data_next(src);
+  pn_data_rewind(*dst);
+  return err;
+}
+
 int pn_do_attach(pn_dispatcher_t *disp)
 {
   pn_transport_t *transport = disp->transport;
@@ -657,28 +851,28 @@ int pn_do_attach(pn_dispatcher_t *disp)
   if (rcv_settle)
     link->remote_rcv_settle_mode = rcv_settle_mode;
 
-  pn_data_clear(link->remote_source.properties);
-  pn_data_clear(link->remote_source.filter);
-  pn_data_clear(link->remote_source.outcomes);
-  pn_data_clear(link->remote_source.capabilities);
-  pn_data_clear(link->remote_target.properties);
-  pn_data_clear(link->remote_target.capabilities);
-
-  err = pn_scan_args(disp, "D.[.....D.[.....C.C.CC]D.[.....CC]",
-                     link->remote_source.properties,
-                     link->remote_source.filter,
-                     link->remote_source.outcomes,
-                     link->remote_source.capabilities,
-                     link->remote_target.properties,
-                     link->remote_target.capabilities);
+  // most attaches carry none of these, so they are scanned into
+  // scratch_data and only moved into the terminus when present
+  pn_data_t *values = transport->scratch_data;
+  bool present[6];
+  pni_scratch_open(values);
+  err = pn_scan_args(disp, "D.[.....D.[.....?C.?C.?C?C]D.[.....?C?C]",
+                     &present[0], values, &present[1], values,
+                     &present[2], values, &present[3], values,
+                     &present[4], values, &present[5], values);
   if (err) return err;
 
-  pn_data_rewind(link->remote_source.properties);
-  pn_data_rewind(link->remote_source.filter);
-  pn_data_rewind(link->remote_source.outcomes);
-  pn_data_rewind(link->remote_source.capabilities);
-  pn_data_rewind(link->remote_target.properties);
-  pn_data_rewind(link->remote_target.capabilities);
+  pn_data_t **members[6] = {&link->remote_source.properties,
+                            &link->remote_source.filter,
+                            &link->remote_source.outcomes,
+                            &link->remote_source.capabilities,
+                            &link->remote_target.properties,
+                            &link->remote_target.capabilities};
+  pni_scratch_rewind(values);
+  for (int i = 0; i < 6; i++) {
+    err = pni_move_value(values, present[i], members[i]);
+    if (err) return err;
+  }
 
   if (!is_sender) {
     link->state.delivery_count = idc;
@@ -713,9 +907,19 @@ int pn_do_transfer(pn_dispatcher_t *disp)
   pn_sequence_t id;
   bool settled;
   bool more;
-  int err = pn_scan_args(disp, "D.[I?Iz.oo]", &handle, &id_present, &id, &tag,
-                         &settled, &more);
-  if (err) return err;
+  if (disp->fast) {
+    pn_transfer_fields_t *f = &disp->fields.transfer;
+    handle = f->handle;
+    id_present = f->id_present;
+    id = f->id;
+    tag = f->tag;
+    settled = f->settled;
+    more = f->more;
+  } else {
+    int err = pn_scan_args(disp, "D.[I?Iz.oo]", &handle, &id_present, &id, &tag,
+                           &settled, &more);
+    if (err) return err;
+  }
   pn_session_t *ssn = pn_channel_state(transport, disp->channel);
 
   if (!ssn->state.incoming_window) {
@@ -730,6 +934,8 @@ int pn_do_transfer(pn_dispatcher_t *disp)
     pn_delivery_map_t *incoming = &ssn->state.incoming;
 
     if (!ssn->state.incoming_init) {
+      // the map is empty here, so it may start at any id
+      incoming->lwm = id;
       incoming->next = id;
       ssn->state.incoming_init = true;
       ssn->incoming_deliveries++;
@@ -758,6 +964,9 @@ int pn_do_transfer(pn_dispatcher_t *disp)
     }
   }
 
+  if (pn_buffer_size(delivery->bytes) + disp->size > PN_DELIVERY_CHUNK) {
+    pn_buffer_chain(delivery->bytes);
+  }
   pn_buffer_append(delivery->bytes, disp->payload, disp->size);
   ssn->incoming_bytes += disp->size;
   delivery->done = !more;
@@ -785,10 +994,25 @@ int pn_do_flow(pn_dispatcher_t *disp)
   uint32_t iwin, owin, link_credit;
   uint32_t handle;
   bool inext_init, handle_init, dcount_init, drain;
-  int err = pn_scan_args(disp, "D.[?IIII?I?II.o]", &inext_init, &inext, &iwin,
-                         &onext, &owin, &handle_init, &handle, &dcount_init,
-                         &delivery_count, &link_credit, &drain);
-  if (err) return err;
+  if (disp->fast) {
+    pn_flow_fields_t *f = &disp->fields.flow;
+    inext_init = f->inext_init;
+    inext = f->inext;
+    iwin = f->iwin;
+    onext = f->onext;
+    owin = f->owin;
+    handle_init = f->handle_init;
+    handle = f->handle;
+    dcount_init = f->dcount_init;
+    delivery_count = f->delivery_count;
+    link_credit = f->link_credit;
+    drain = f->drain;
+  } else {
+    int err = pn_scan_args(disp, "D.[?IIII?I?II.o]", &inext_init, &inext, &iwin,
+                           &onext, &owin, &handle_init, &handle, &dcount_init,
+                           &delivery_count, &link_credit, &drain);
+    if (err) return err;
+  }
 
   pn_session_t *ssn = pn_channel_state(transport, disp->channel);
 
@@ -833,20 +1057,84 @@ int pn_do_flow(pn_dispatcher_t *disp)
   return 0;
 }
 
-#define SCAN_ERROR_DEFAULT ("D.[D.[sSC]")
-#define SCAN_ERROR_DETACH ("D.[..D.[sSC]")
-#define SCAN_ERROR_DISP ("[D.[sSC]")
+#define SCAN_ERROR_DEFAULT ("D.[D.[sS?C]")
+#define SCAN_ERROR_DETACH ("D.[..D.[sS?C]")
+#define SCAN_ERROR_DISP ("[D.[sS?C]")
 
-static int pn_scan_error(pn_data_t *data, pn_condition_t *condition, const char *fmt)
+static int pn_scan_error(pn_transport_t *transport, pn_data_t *data,
+                         pn_condition_t *condition, const char *fmt)
 {
   pn_bytes_t cond;
   pn_bytes_t desc;
+  bool info;
+  pn_data_t *values = transport->scratch_data;
   pn_condition_clear(condition);
-  int err = pn_data_scan(data, fmt, &cond, &desc, condition->info);
+  pni_scratch_open(values);
+  int err = pni_data_scan_cached(data, fmt, &cond, &desc, &info, values);
   if (err) return err;
-  pn_string_setn(condition->name, cond.start, cond.size);
-  pn_string_setn(condition->description, desc.start, desc.size);
-  pn_data_rewind(condition->info);
+  if (cond.start)
+    pn_string_setn(pn_lazy_string(&condition->name), cond.start, cond.size);
+  if (desc.start)
+    pn_string_setn(pn_lazy_string(&condition->description), desc.start, desc.size);
+  pni_scratch_rewind(values);
+  return pni_move_value(values, info, &condition->info);
+}
+
+// applies a disposition the peer sent to one of the deliveries it names
+static int pn_do_remote_disposition(pn_transport_t *transport, pn_delivery_t *delivery,
+                                    bool type_init, uint64_t type, bool remote_data,
+                                    bool settled)
+{
+  int err;
+  pn_disposition_t *remote = &delivery->remote;
+  if (type_init) remote->type = type;
+  if (remote_data) {
+    switch (type) {
+    case PN_RECEIVED:
+      pn_data_rewind(transport->disp_data);
+      pn_data_next(transport->disp_data);
+      pn_data_enter(transport->disp_data);
+      if (pn_data_next(transport->disp_data))
+        remote->section_number = pn_data_get_uint(transport->disp_data);
+      if (pn_data_next(transport->disp_data))
+        remote->section_offset = pn_data_get_ulong(transport->disp_data);
+      break;
+    case PN_ACCEPTED:
+      break;
+    case PN_REJECTED:
+      err = pn_scan_error(transport, transport->disp_data, &remote->condition, SCAN_ERROR_DISP);
+      if (err) return err;
+      break;
+    case PN_RELEASED:
+      break;
+    case PN_MODIFIED:
+      pn_data_rewind(transport->disp_data);
+      pn_data_next(transport->disp_data);
+      pn_data_enter(transport->disp_data);
+      if (pn_data_next(transport->disp_data))
+        remote->failed = pn_data_get_bool(transport->disp_data);
+      if (pn_data_next(transport->disp_data))
+        remote->undeliverable = pn_data_get_bool(transport->disp_data);
+      pn_data_narrow(transport->disp_data);
+      if (remote->data) pn_data_clear(remote->data);
+      pn_data_clear(pn_lazy_data(&remote->annotations));
+      pn_data_appendn(remote->annotations, transport->disp_data, 1);
+      pn_data_rewind(remote->annotations);
+      pn_data_widen(transport->disp_data);
+      break;
+    default:
+      pn_data_copy(pn_lazy_data(&remote->data), transport->disp_data);
+      break;
+    }
+  }
+  remote->settled = settled;
+  delivery->updated = true;
+  pn_work_update(transport->connection, delivery);
+
+  pn_event_t *event = pn_collector_put(transport->connection->collector, PN_DELIVERY);
+  if (event) {
+    pn_event_init_delivery(event, delivery);
+  }
   return 0;
 }
 
@@ -857,11 +1145,25 @@ int pn_do_disposition(pn_dispatcher_t *disp)
   pn_sequence_t first, last;
   uint64_t type = 0;
   bool last_init, settled, type_init;
+  int err;
   pn_data_clear(transport->disp_data);
-  int err = pn_scan_args(disp, "D.[oI?IoD?LC]", &role, &first, &last_init,
-                         &last, &settled, &type_init, &type,
-                         transport->disp_data);
-  if (err) return err;
+  if (disp->fast) {
+    // the fast path only takes states without fields, so disp_data
+    // stays empty
+    pn_disposition_fields_t *f = &disp->fields.disposition;
+    role = f->role;
+    first = f->first;
+    last_init = f->last_init;
+    last = f->last;
+    settled = f->settled;
+    type_init = f->type_init;
+    type = f->type;
+  } else {
+    err = pn_scan_args(disp, "D.[oI?IoD?LC]", &role, &first, &last_init,
+                       &last, &settled, &type_init, &type,
+                       transport->disp_data);
+    if (err) return err;
+  }
   if (!last_init) last = first;
 
   pn_session_t *ssn = pn_channel_state(transport, disp->channel);
@@ -876,56 +1178,36 @@ int pn_do_disposition(pn_dispatcher_t *disp)
   bool remote_data = (pn_data_next(transport->disp_data) &&
                       pn_data_get_list(transport->disp_data) > 0);
 
-  for (pn_sequence_t id = first; id <= last; id++) {
+  // ids are serial numbers, so last may have wrapped around past zero,
+  // but a range where last precedes first names nothing
+  if ((int32_t) ((uint32_t) last - (uint32_t) first) < 0) return 0;
+
+  // only visit the part of the range the map can hold, however wide a
+  // range the peer sends
+  uint32_t start = (uint32_t) first;
+  uint32_t end = (uint32_t) last + 1;
+  if ((int32_t) (deliveries->lwm - start) > 0) start = deliveries->lwm;
+  if ((int32_t) (end - deliveries->next) > 0) end = deliveries->next;
+
+  for (uint32_t id = start; (int32_t) (end - id) > 0; id++) {
     pn_delivery_t *delivery = pn_delivery_map_get(deliveries, id);
-    pn_disposition_t *remote = &delivery->remote;
     if (delivery) {
-      if (type_init) remote->type = type;
-      if (remote_data) {
-        switch (type) {
-        case PN_RECEIVED:
-          pn_data_rewind(transport->disp_data);
-          pn_data_next(transport->disp_data);
-          pn_data_enter(transport->disp_data);
-          if (pn_data_next(transport->disp_data))
-            remote->section_number = pn_data_get_uint(transport->disp_data);
-          if (pn_data_next(transport->disp_data))
-            remote->section_offset = pn_data_get_ulong(transport->disp_data);
-          break;
-        case PN_ACCEPTED:
-          break;
-        case PN_REJECTED:
-          err = pn_scan_error(transport->disp_data, &remote->condition, SCAN_ERROR_DISP);
-          if (err) return err;
-          break;
-        case PN_RELEASED:
-          break;
-        case PN_MODIFIED:
-          pn_data_rewind(transport->disp_data);
-          pn_data_next(transport->disp_data);
-          pn_data_enter(transport->disp_data);
-          if (pn_data_next(transport->disp_data))
-            remote->failed = pn_data_get_bool(transport->disp_data);
-          if (pn_data_next(transport->disp_data))
-            remote->undeliverable = pn_data_get_bool(transport->disp_data);
-          pn_data_narrow(transport->disp_data);
-          pn_data_clear(remote->data);
-          pn_data_appendn(remote->annotations, transport->disp_data, 1);
-          pn_data_widen(transport->disp_data);
-          break;
-        default:
-          pn_data_copy(remote->data, transport->disp_data);
-          break;
-        }
-      }
-      remote->settled = settled;
-      delivery->updated = true;
-      pn_work_update(transport->connection, delivery);
+      err = pn_do_remote_disposition(transport, delivery, type_init, type,
+                                     remote_data, settled);
+      if (err) return err;
+    }
+  }
 
-      pn_event_t *event = pn_collector_put(transport->connection->collector, PN_DELIVERY);
-      if (event) {
-        pn_event_init_delivery(event, delivery);
-      }
+  // and the few deliveries that fell behind the ring
+  pn_hash_t *behind = deliveries->behind;
+  for (pn_handle_t entry = behind ? pn_hash_head(behind) : 0; entry;
+       entry = pn_hash_next(behind, entry)) {
+    uint32_t id = (uint32_t) pn_hash_key(behind, entry);
+    if (id - (uint32_t) first <= (uint32_t) last - (uint32_t) first) {
+      pn_delivery_t *delivery = (pn_delivery_t *) pn_hash_value(behind, entry);
+      err = pn_do_remote_disposition(transport, delivery, type_init, type,
+                                     remote_data, settled);
+      if (err) return err;
     }
   }
 
@@ -949,7 +1231,7 @@ int pn_do_detach(pn_dispatcher_t *disp)
     return pn_do_error(transport, "amqp:invalid-field", "no such handle: %u", handle);
   }
 
-  err = pn_scan_error(disp->args, &link->endpoint.remote_condition, SCAN_ERROR_DETACH);
+  err = pn_scan_error(transport, disp->args, &link->endpoint.remote_condition, SCAN_ERROR_DETACH);
   if (err) return err;
 
   if (closed)
@@ -972,7 +1254,7 @@ int pn_do_end(pn_dispatcher_t *disp)
 {
   pn_transport_t *transport = disp->transport;
   pn_session_t *ssn = pn_channel_state(transport, disp->channel);
-  int err = pn_scan_error(disp->args, &ssn->endpoint.remote_condition, SCAN_ERROR_DEFAULT);
+  int err = pn_scan_error(transport, disp->args, &ssn->endpoint.remote_condition, SCAN_ERROR_DEFAULT);
   if (err) return err;
   PN_SET_REMOTE(ssn->endpoint.state, PN_REMOTE_CLOSED);
   pn_event_t *event = pn_collector_put(transport->connection->collector,
@@ -988,7 +1270,7 @@ int pn_do_close(pn_dispatcher_t *disp)
 {
   pn_transport_t *transport = disp->transport;
   pn_connection_t *conn = transport->connection;
-  int err = pn_scan_error(disp->args, &transport->remote_condition, SCAN_ERROR_DEFAULT);
+  int err = pn_scan_error(transport, disp->args, &transport->remote_condition, SCAN_ERROR_DEFAULT);
   if (err) return err;
   transport->close_rcvd = true;
   PN_SET_REMOTE(conn->endpoint.state, PN_REMOTE_CLOSED);
@@ -1194,18 +1476,6 @@ int pn_process_conn_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
   return 0;
 }
 
-static uint16_t allocate_alias(pn_hash_t *aliases)
-{
-  for (uint32_t i = 0; i < 65536; i++) {
-    if (!pn_hash_get(aliases, i)) {
-      return i;
-    }
-  }
-
-  assert(false);
-  return 0;
-}
-
 size_t pn_session_outgoing_window(pn_session_t *ssn)
 {
   uint32_t size = ssn->connection->transport->remote_max_frame;
@@ -1238,7 +1508,7 @@ int pn_process_ssn_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
     pn_session_state_t *state = &ssn->state;
     if (!(endpoint->state & PN_LOCAL_UNINIT) && state->local_channel == (uint16_t) -1)
     {
-      uint16_t channel = allocate_alias(transport->local_channels);
+      uint16_t channel = pn_alias_map_allocate(&transport->local_channels);
       state->incoming_window = pn_session_incoming_window(ssn);
       state->outgoing_window = pn_session_outgoing_window(ssn);
       pn_post_frame(transport->disp, channel, "DL[?HIII]", BEGIN,
@@ -1247,7 +1517,7 @@ int pn_process_ssn_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
                     state->incoming_window,
                     state->outgoing_window);
       state->local_channel = channel;
-      pn_hash_put(transport->local_channels, channel, ssn);
+      pn_alias_map_put(&transport->local_channels, channel, ssn);
     }
   }
 
@@ -1281,8 +1551,8 @@ int pn_process_link_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
     if (((int16_t) ssn_state->local_channel >= 0) &&
         !(endpoint->state & PN_LOCAL_UNINIT) && state->local_handle == (uint32_t) -1)
     {
-      state->local_handle = allocate_alias(ssn_state->local_handles);
-      pn_hash_put(ssn_state->local_handles, state->local_handle, link);
+      state->local_handle = pn_alias_map_allocate(&ssn_state->local_handles);
+      pn_alias_map_put(&ssn_state->local_handles, state->local_handle, link);
       const pn_distribution_mode_t dist_mode = link->source.distribution_mode;
       int err = pn_post_frame(transport->disp, ssn_state->local_channel,
                               "DL[SIoBB?DL[SIsIoC?sCnCC]?DL[SIsIoCC]nnI]", ATTACH,
@@ -1324,15 +1594,15 @@ int pn_post_flow(pn_transport_t *transport, pn_session_t *ssn, pn_link_t *link)
   ssn->state.outgoing_window = pn_session_outgoing_window(ssn);
   bool linkq = (bool) link;
   pn_link_state_t *state = &link->state;
-  return pn_post_frame(transport->disp, ssn->state.local_channel, "DL[?IIII?I?I?In?o]", FLOW,
-                       (int16_t) ssn->state.remote_channel >= 0, ssn->state.incoming_transfer_count,
-                       ssn->state.incoming_window,
-                       ssn->state.outgoing_transfer_count,
-                       ssn->state.outgoing_window,
-                       linkq, linkq ? state->local_handle : 0,
-                       linkq, linkq ? state->delivery_count : 0,
-                       linkq, linkq ? state->link_credit : 0,
-                       linkq, linkq ? link->drain : false);
+  return pn_post_flow_frame(transport->disp, ssn->state.local_channel,
+                            (int16_t) ssn->state.remote_channel >= 0, ssn->state.incoming_transfer_count,
+                            ssn->state.incoming_window,
+                            ssn->state.outgoing_transfer_count,
+                            ssn->state.outgoing_window,
+                            linkq, linkq ? state->local_handle : 0,
+                            linkq ? state->delivery_count : 0,
+                            linkq ? state->link_credit : 0,
+                            linkq ? link->drain : false);
 }
 
 int pn_process_flow_receiver(pn_transport_t *transport, pn_endpoint_t *endpoint)
@@ -1358,9 +1628,9 @@ int pn_flush_disp(pn_transport_t *transport, pn_session_t *ssn)
   uint64_t code = ssn->state.disp_code;
   bool settled = ssn->state.disp_settled;
   if (ssn->state.disp) {
-    int err = pn_post_frame(transport->disp, ssn->state.local_channel, "DL[oIIo?DL[]]", DISPOSITION,
-                            ssn->state.disp_type, ssn->state.disp_first, ssn->state.disp_last,
-                            settled, (bool)code, code);
+    int err = pn_post_disposition_frame(transport->disp, ssn->state.local_channel,
+                                        ssn->state.disp_type, ssn->state.disp_first,
+                                        ssn->state.disp_last, settled, code);
     if (err) return err;
     ssn->state.disp_type = 0;
     ssn->state.disp_code = 0;
@@ -1432,14 +1702,25 @@ int pn_process_tpwork_sender(pn_transport_t *transport, pn_delivery_t *delivery,
   bool xfr_posted = false;
   if ((int16_t) ssn_state->local_channel >= 0 && (int32_t) link_state->local_handle >= 0) {
     pn_delivery_state_t *state = &delivery->state;
-    if (!state->sent && (delivery->done || pn_buffer_size(delivery->bytes) > 0) &&
+    if (!state->sent && (delivery->done || pn_delivery_pending(delivery) > 0) &&
         ssn_state->remote_incoming_window > 0 && link_state->link_credit > 0) {
       if (!state->init) {
         state = pn_delivery_map_push(&ssn_state->outgoing, delivery);
       }
 
-      pn_bytes_t bytes = pn_buffer_bytes(delivery->bytes);
-      pn_set_payload(transport->disp, bytes.start, bytes.size);
+      size_t size = pn_delivery_pending(delivery);
+      if (size >= PN_OUTPUT_REFERENCE) {
+        // large enough to be referenced in place rather than copied
+        int err = pni_delivery_share(delivery);
+        if (err) return err;
+      }
+      pn_payload_t *payload = delivery->payload;
+      if (payload) {
+        pn_set_payload_shared(transport->disp, payload->bytes + delivery->payload_sent,
+                              size, payload);
+      } else {
+        pn_set_payload(transport->disp, pn_buffer_bytes(delivery->bytes).start, size);
+      }
       pn_bytes_t tag = pn_buffer_bytes(delivery->tag);
       int count = pn_post_transfer_frame(transport->disp,
                                          ssn_state->local_channel,
@@ -1449,15 +1730,22 @@ int pn_process_tpwork_sender(pn_transport_t *transport, pn_delivery_t *delivery,
                                          delivery->local.settled,
                                          !delivery->done,
                                          ssn_state->remote_incoming_window);
+      int sent = size - transport->disp->output_size;
+      if (payload) {
+        delivery->payload_sent += sent;
+        if (delivery->payload_sent == payload->size) {
+          pn_delivery_release_payload(delivery);
+        }
+      } else {
+        pn_buffer_trim(delivery->bytes, sent, 0);
+      }
       if (count < 0) return count;
       xfr_posted = true;
       ssn_state->outgoing_transfer_count += count;
       ssn_state->remote_incoming_window -= count;
 
-      int sent = bytes.size - transport->disp->output_size;
-      pn_buffer_trim(delivery->bytes, sent, 0);
       link->session->outgoing_bytes -= sent;
-      if (!pn_buffer_size(delivery->bytes) && delivery->done) {
+      if (!pn_delivery_pending(delivery) && delivery->done) {
         state->sent = true;
         link_state->delivery_count++;
         link_state->link_credit--;
@@ -1595,13 +1883,13 @@ int pn_process_link_teardown(pn_transport_t *transport, pn_endpoint_t *endpoint)
       if (pn_condition_is_set(&endpoint->condition)) {
         name = pn_condition_get_name(&endpoint->condition);
         description = pn_condition_get_description(&endpoint->condition);
-        info = pn_condition_info(&endpoint->condition);
+        info = endpoint->condition.info;
       }
 
       int err = pn_post_frame(transport->disp, ssn_state->local_channel, "DL[Io?DL[sSC]]", DETACH,
                               state->local_handle, true, (bool) name, ERROR, name, description, info);
       if (err) return err;
-      pn_hash_del(ssn_state->local_handles, state->local_handle);
+      pn_alias_map_del(&ssn_state->local_handles, state->local_handle);
       state->local_handle = -2;
     }
 
@@ -1652,13 +1940,13 @@ int pn_process_ssn_teardown(pn_transport_t *transport, pn_endpoint_t *endpoint)
       if (pn_condition_is_set(&endpoint->condition)) {
         name = pn_condition_get_name(&endpoint->condition);
         description = pn_condition_get_description(&endpoint->condition);
-        info = pn_condition_info(&endpoint->condition);
+        info = endpoint->condition.info;
       }
 
       int err = pn_post_frame(transport->disp, state->local_channel, "DL[?DL[sSC]]", END,
                               (bool) name, ERROR, name, description, info);
       if (err) return err;
-      pn_hash_del(transport->local_channels, state->local_channel);
+      pn_alias_map_del(&transport->local_channels, state->local_channel);
       state->local_channel = -2;
     }
 
@@ -1749,13 +2037,10 @@ static ssize_t pn_output_write_amqp_header(pn_io_layer_t *io_layer, char *bytes,
                                 pn_output_write_amqp);
 }
 
-static ssize_t pn_output_write_amqp(pn_io_layer_t *io_layer, char *bytes, size_t size)
+// queue up frames for the current state of the connection, returns an
+// error code once no further output will be generated
+static int pni_process_amqp_output(pn_transport_t *transport)
 {
-  pn_transport_t *transport = (pn_transport_t *)io_layer->context;
-  if (!transport->connection) {
-    return 0;
-  }
-
   if (!pn_error_code(transport->error)) {
     pn_error_set(transport->error, pn_process(transport), "process error");
   }
@@ -1770,9 +2055,33 @@ static ssize_t pn_output_write_amqp(pn_io_layer_t *io_layer, char *bytes, size_t
       return PN_EOS;
   }
 
+  return 0;
+}
+
+static ssize_t pn_output_write_amqp(pn_io_layer_t *io_layer, char *bytes, size_t size)
+{
+  pn_transport_t *transport = (pn_transport_t *)io_layer->context;
+  if (!transport->connection) {
+    return 0;
+  }
+
+  int err = pni_process_amqp_output(transport);
+  if (err) return err;
+
   return pn_dispatcher_output(transport->disp, bytes, size);
 }
 
+static void pni_trace_eos(pn_transport_t *transport, ssize_t n)
+{
+  if (transport->disp->trace & (PN_TRACE_RAW | PN_TRACE_FRM)) {
+    if (n == PN_EOS)
+      pn_transport_log(transport, "  -> EOS");
+    else
+      pn_transport_logf(transport, "  -> EOS (%" PN_ZI ") %s", n,
+                        pn_error_text(transport->error));
+  }
+}
+
 // generate outbound data, return amount of pending output else error
 static ssize_t transport_produce(pn_transport_t *transport)
 {
@@ -1810,13 +2119,7 @@ static ssize_t transport_produce(pn_transport_t *transport)
     } else {
       if (transport->output_pending)
         break;   // return what is available
-      if (transport->disp->trace & (PN_TRACE_RAW | PN_TRACE_FRM)) {
-        if (n == PN_EOS)
-          pn_transport_log(transport, "  -> EOS");
-        else
-          pn_transport_logf(transport, "  -> EOS (%" PN_ZI ") %s", n,
-                            pn_error_text(transport->error));
-      }
+      pni_trace_eos(transport, n);
       return n;
     }
   }
@@ -2084,6 +2387,42 @@ const char *pn_transport_head(pn_transport_t *transport)
   return NULL;
 }
 
+// true if the frames queued by the dispatcher can be handed out as they
+// are, i.e. no layer above AMQP transforms the output
+static bool pni_output_direct(pn_transport_t *transport)
+{
+  return transport->connection &&
+    transport->io_layers[PN_IO_SSL].process_output == pn_io_layer_output_passthru &&
+    transport->io_layers[PN_IO_SASL].process_output == pn_io_layer_output_passthru &&
+    transport->io_layers[PN_IO_AMQP].process_output == pn_output_write_amqp;
+}
+
+ssize_t pn_transport_head_segments(pn_transport_t *transport, pn_bytes_t *segments, size_t count)
+{
+  assert(transport);
+  if (transport->head_closed) return PN_EOS;
+
+  if (!pni_output_direct(transport)) {
+    ssize_t pending = transport_produce(transport);
+    if (pending <= 0 || !count) return pending < 0 ? pending : 0;
+    segments[0] = pn_bytes(pending, transport->output_buf);
+    return 1;
+  }
+
+  // anything already copied out precedes the queued frames
+  int err = pni_process_amqp_output(transport);
+  size_t n = 0;
+  if (transport->output_pending && count) {
+    segments[n++] = pn_bytes(transport->output_pending, transport->output_buf);
+  }
+  n += pn_dispatcher_segments(transport->disp, segments + n, count - n);
+  if (!n && err) {
+    pni_trace_eos(transport, err);
+    return err;
+  }
+  return n;
+}
+
 int pn_transport_peek(pn_transport_t *transport, char *dst, size_t size)
 {
   assert(transport);
@@ -2107,20 +2446,26 @@ int pn_transport_peek(pn_transport_t *transport, char *dst, size_t size)
 void pn_transport_pop(pn_transport_t *transport, size_t size)
 {
   if (transport && size) {
-    assert( transport->output_pending >= size );
-    transport->output_pending -= size;
+    assert( transport->output_pending + transport->disp->available >= size );
     transport->bytes_output += size;
+    // output handed out by pn_transport_head_segments may extend into
+    // the frames still queued by the dispatcher
+    size_t buffered = pn_min(size, transport->output_pending);
+    transport->output_pending -= buffered;
     if (transport->output_pending) {
-      memmove( transport->output_buf,  &transport->output_buf[size],
+      memmove( transport->output_buf,  &transport->output_buf[buffered],
                transport->output_pending );
     }
+    if (size > buffered) {
+      pn_dispatcher_pop(transport->disp, size - buffered);
+    }
   }
 }
 
 int pn_transport_close_head(pn_transport_t *transport)
 {
   transport->head_closed = true;
-  if (transport->close_sent && transport->output_pending == 0) {
+  if (transport->close_sent && transport->output_pending == 0 && !transport->disp->available) {
     return 0;
   } else {
     return pn_error_set(transport->error, PN_ERR, "connection aborted");
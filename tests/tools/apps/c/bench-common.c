@@ -0,0 +1,109 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "bench-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+uint64_t bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+double bench_per_op(uint64_t start, uint64_t end, uint64_t ops)
+{
+  return ops ? ((double) (end - start))/ops : 0.0;
+}
+
+void bench_die(const char *file, int line, const char *message)
+{
+  fprintf(stderr, "%s:%i: %s\n", file, line, message);
+  exit(1);
+}
+
+// push data from one transport to another
+static int xfer(pn_transport_t *src, pn_transport_t *dest)
+{
+  ssize_t out = pn_transport_pending(src);
+  if (out > 0) {
+    ssize_t in = pn_transport_capacity(dest);
+    if (in > 0) {
+      size_t count = (size_t)((out < in) ? out : in);
+      pn_transport_push(dest, pn_transport_head(src), count);
+      pn_transport_pop(src, count);
+      return (int)count;
+    }
+  }
+  return 0;
+}
+
+int bench_pump(bench_link_pair_t *pair)
+{
+  int total = 0;
+  int work;
+  do {
+    work = xfer(pair->client_transport, pair->server_transport) +
+      xfer(pair->server_transport, pair->client_transport);
+    total += work;
+  } while (work);
+  return total;
+}
+
+void bench_link_pair(bench_link_pair_t *pair, int credit)
+{
+  pair->client = pn_connection();
+  pair->server = pn_connection();
+  pair->client_transport = pn_transport();
+  pair->server_transport = pn_transport();
+  pn_transport_bind(pair->client_transport, pair->client);
+  pn_transport_bind(pair->server_transport, pair->server);
+
+  pn_connection_open(pair->client);
+  pn_session_t *ssn = pn_session(pair->client);
+  pn_session_open(ssn);
+  pair->sender = pn_sender(ssn, "bench");
+  pn_link_open(pair->sender);
+  bench_pump(pair);
+
+  pn_connection_open(pair->server);
+  ssn = pn_session_head(pair->server, PN_LOCAL_UNINIT);
+  bench_check(ssn, "remote session not attached");
+  pn_session_open(ssn);
+  pair->receiver = pn_link_head(pair->server, PN_LOCAL_UNINIT);
+  bench_check(pair->receiver, "remote link not attached");
+  pn_link_open(pair->receiver);
+  pn_link_flow(pair->receiver, credit);
+  bench_pump(pair);
+  bench_check(pn_link_credit(pair->sender) == credit, "credit not granted");
+}
+
+void bench_link_pair_free(bench_link_pair_t *pair)
+{
+  pn_transport_unbind(pair->client_transport);
+  pn_transport_unbind(pair->server_transport);
+  pn_transport_free(pair->client_transport);
+  pn_transport_free(pair->server_transport);
+  pn_connection_free(pair->client);
+  pn_connection_free(pair->server);
+}
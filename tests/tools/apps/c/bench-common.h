@@ -0,0 +1,57 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H 1
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <stdint.h>
+#include "proton/engine.h"
+
+// Helpers shared by the *-bench micro benchmarks.
+
+// monotonic time in nanoseconds
+uint64_t bench_now(void);
+
+// nanoseconds per operation
+double bench_per_op(uint64_t start, uint64_t end, uint64_t ops);
+
+#define bench_check( expression, message )  \
+  { if (!(expression)) bench_die(__FILE__,__LINE__, message); }
+
+void bench_die(const char *file, int line, const char *message);
+
+// a sender and receiver attached to each other over two in-memory
+// transports, with no network in between
+typedef struct {
+  pn_connection_t *client;
+  pn_connection_t *server;
+  pn_transport_t *client_transport;
+  pn_transport_t *server_transport;
+  pn_link_t *sender;
+  pn_link_t *receiver;
+} bench_link_pair_t;
+
+// open both ends and grant the sender credit
+void bench_link_pair(bench_link_pair_t *pair, int credit);
+void bench_link_pair_free(bench_link_pair_t *pair);
+
+// move all pending output between the two transports
+int bench_pump(bench_link_pair_t *pair);
+
+#endif  /* bench-common.h */
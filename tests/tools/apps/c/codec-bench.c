@@ -0,0 +1,190 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Measures the per entry cost of filling, encoding, decoding, decoding
+ * without copying and walking pn_data_t maps as they grow, as for large application properties or
+ * annotations.  Keys are strings and values alternate between ulongs,
+ * strings and uuids.
+ */
+
+#include "bench-common.h"
+
+#include <proton/codec.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+  int max_entries;
+  int rounds;
+} Options_t;
+
+static void usage(int rc)
+{
+  printf("Usage: codec-bench [OPTIONS] \n"
+         " -n # \tLargest number of entries to measure [1000000]\n"
+         " -r # \tRounds to run, the best of which is reported [3]\n"
+         );
+  exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+  int c;
+  opterr = 0;
+
+  opts->max_entries = 1000000;
+  opts->rounds = 3;
+
+  while ((c = getopt(argc, argv, "n:r:h")) != -1) {
+    switch (c) {
+    case 'n':
+      if (sscanf(optarg, "%d", &opts->max_entries) != 1) usage(1);
+      break;
+    case 'r':
+      if (sscanf(optarg, "%d", &opts->rounds) != 1) usage(1);
+      break;
+    case 'h':
+      usage(0);
+      break;
+    default:
+      usage(1);
+    }
+  }
+}
+
+typedef struct {
+  double fill;
+  double encode;
+  double decode;
+  double borrow;
+  double walk;
+} result_t;
+
+static void fill(pn_data_t *data, int count)
+{
+  char key[32];
+  char value[] = "a string value";
+  pn_uuid_t uuid;
+  memset(uuid.bytes, 0x5a, sizeof(uuid.bytes));
+
+  pn_data_put_map(data);
+  pn_data_enter(data);
+  for (int i = 0; i < count; i++) {
+    int n = snprintf(key, sizeof(key), "key-%d", i);
+    pn_data_put_string(data, pn_bytes(n, key));
+    switch (i % 3) {
+    case 0:
+      pn_data_put_ulong(data, i);
+      break;
+    case 1:
+      pn_data_put_string(data, pn_bytes(sizeof(value) - 1, value));
+      break;
+    default:
+      pn_data_put_uuid(data, uuid);
+    }
+  }
+  pn_data_exit(data);
+}
+
+static result_t measure(int count)
+{
+  result_t result;
+  pn_data_t *data = pn_data(0);
+  pn_data_t *decoded = pn_data(0);
+  pn_data_t *borrowed = pn_data(0);
+
+  uint64_t start = bench_now();
+  fill(data, count);
+  uint64_t end = bench_now();
+  result.fill = bench_per_op(start, end, count);
+
+  ssize_t size = pn_data_encoded_size(data);
+  bench_check(size > 0, "size failed");
+  char *bytes = (char *) malloc(size);
+
+  start = bench_now();
+  bench_check(pn_data_encode(data, bytes, size) == size, "encode failed");
+  end = bench_now();
+  result.encode = bench_per_op(start, end, count);
+
+  start = bench_now();
+  bench_check(pn_data_decode(decoded, bytes, size) == size, "decode failed");
+  end = bench_now();
+  result.decode = bench_per_op(start, end, count);
+
+  start = bench_now();
+  bench_check(pn_data_decode_borrowed(borrowed, bytes, size) == size, "borrow failed");
+  end = bench_now();
+  result.borrow = bench_per_op(start, end, count);
+
+  // visit every key and value, as a lookup in the map would
+  size_t total = 0;
+  start = bench_now();
+  pn_data_rewind(decoded);
+  pn_data_next(decoded);
+  pn_data_enter(decoded);
+  while (pn_data_next(decoded)) {
+    total += pn_data_get_string(decoded).size;
+    pn_data_next(decoded);
+    total += pn_data_type(decoded);
+  }
+  pn_data_exit(decoded);
+  end = bench_now();
+  result.walk = bench_per_op(start, end, count);
+  bench_check(total > 0, "walk failed");
+
+  free(bytes);
+  pn_data_free(borrowed);
+  pn_data_free(decoded);
+  pn_data_free(data);
+  return result;
+}
+
+static void best(result_t *best, result_t result)
+{
+  if (result.fill < best->fill) best->fill = result.fill;
+  if (result.encode < best->encode) best->encode = result.encode;
+  if (result.decode < best->decode) best->decode = result.decode;
+  if (result.borrow < best->borrow) best->borrow = result.borrow;
+  if (result.walk < best->walk) best->walk = result.walk;
+}
+
+int main(int argc, char** argv)
+{
+  Options_t opts;
+  parse_options(argc, argv, &opts);
+
+  printf("%10s %10s %10s %10s %10s %10s\n", "entries",
+         "fill ns", "encode ns", "decode ns", "borrow ns", "walk ns");
+  for (int n = 1000; n <= opts.max_entries; n *= 10) {
+    result_t result = {1e9, 1e9, 1e9, 1e9, 1e9};
+    for (int i = 0; i < opts.rounds; i++) {
+      best(&result, measure(n));
+    }
+    printf("%10d %10.1f %10.1f %10.1f %10.1f %10.1f\n", n, result.fill,
+           result.encode, result.decode, result.borrow, result.walk);
+  }
+
+  return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Measures the cost of one pn_driver_wait() as the number of idle
+ * connectors grows.  Each connector is one end of a socketpair with
+ * only read interest; a single "hot" connector is made readable before
+ * every wait, so an ideal driver does the same work regardless of the
+ * number of idle connectors.  Both the epoll and the poll backends are
+ * measured (the latter by setting PN_DRIVER_POLL).
+ */
+
+#include "bench-common.h"
+#include "proton/driver.h"
+#include "proton/driver_extras.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+typedef struct {
+  int max_connectors;
+  int iterations;
+} Options_t;
+
+static void usage(int rc)
+{
+  printf("Usage: driver-bench [OPTIONS] \n"
+         " -c # \tLargest number of idle connectors to measure [10000]\n"
+         " -i # \tNumber of waits per measurement [2000]\n"
+         );
+  exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+  int c;
+  opterr = 0;
+
+  opts->max_connectors = 10000;
+  opts->iterations = 2000;
+
+  while ((c = getopt(argc, argv, "c:i:h")) != -1) {
+    switch (c) {
+    case 'c':
+      if (sscanf(optarg, "%d", &opts->max_connectors) != 1) usage(1);
+      break;
+    case 'i':
+      if (sscanf(optarg, "%d", &opts->iterations) != 1) usage(1);
+      break;
+    case 'h':
+      usage(0);
+      break;
+    default:
+      usage(1);
+    }
+  }
+}
+
+// each connector needs two descriptors, leave some slack for the driver
+static int max_supported(int wanted)
+{
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+    if (rl.rlim_cur < rl.rlim_max) {
+      rl.rlim_cur = rl.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &rl);
+      getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (rl.rlim_cur != RLIM_INFINITY && (rlim_t) (2*wanted + 32) > rl.rlim_cur) {
+      return (int) ((rl.rlim_cur - 32)/2);
+    }
+  }
+  return wanted;
+}
+
+// nanoseconds per wait with count connectors, one of which is active
+static double measure(bool use_poll, int count, int iterations)
+{
+  if (use_poll)
+    setenv("PN_DRIVER_POLL", "1", 1);
+  else
+    unsetenv("PN_DRIVER_POLL");
+
+  pn_driver_t *driver = pn_driver();
+  bench_check(driver, "pn_driver failed");
+
+  pn_connector_t **connectors = (pn_connector_t **) calloc(count, sizeof(pn_connector_t *));
+  int *peers = (int *) calloc(count, sizeof(int));
+  for (int i = 0; i < count; i++) {
+    int sv[2];
+    bench_check(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair failed");
+    connectors[i] = pn_connector_fd(driver, sv[0], NULL);
+    peers[i] = sv[1];
+    // an idle connection has nothing to write
+    pn_connector_activated(connectors[i], PN_CONNECTOR_WRITABLE);
+  }
+
+  pn_connector_t *hot = connectors[count/2];
+  int hot_peer = peers[count/2];
+  char byte;
+
+  uint64_t start = bench_now();
+  for (int i = 0; i < iterations; i++) {
+    bench_check(write(hot_peer, "x", 1) == 1, "write failed");
+    bench_check(pn_driver_wait(driver, -1) == 0, "pn_driver_wait failed");
+    int ready = 0;
+    pn_connector_t *c;
+    while ((c = pn_driver_connector(driver))) {
+      bench_check(c == hot, "idle connector reported ready");
+      bench_check(read(pn_connector_get_fd(c), &byte, 1) == 1, "read failed");
+      ready++;
+    }
+    bench_check(ready == 1, "active connector not reported");
+  }
+  uint64_t end = bench_now();
+
+  for (int i = 0; i < count; i++) {
+    pn_connector_close(connectors[i]);
+    close(peers[i]);
+  }
+  pn_driver_free(driver);
+  free(connectors);
+  free(peers);
+
+  return bench_per_op(start, end, iterations);
+}
+
+int main(int argc, char** argv)
+{
+  Options_t opts;
+  parse_options(argc, argv, &opts);
+
+  int max = max_supported(opts.max_connectors);
+  if (max < opts.max_connectors) {
+    fprintf(stderr, "descriptor limit allows only %d connectors\n", max);
+  }
+
+  printf("%12s %16s %16s\n", "connectors", "poll ns/wait", "epoll ns/wait");
+  for (int count = 1; count <= max; count *= 10) {
+    double p = measure(true, count, opts.iterations);
+    double e = measure(false, count, opts.iterations);
+    printf("%12d %16.0f %16.0f\n", count, p, e);
+  }
+
+  return 0;
+}
@@ -0,0 +1,349 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Measures the cost of the frames sent for every message.  The first
+ * table is the generic pn_data_fill()/pn_data_encode() and
+ * pn_data_decode()/pn_data_scan() cost of each hot performative, which
+ * the engine no longer pays in either direction.  The second compares
+ * pn_data_fill()/pn_data_scan() with their compiled pn_program_t forms
+ * for the formats the transport uses.  The third is the per message
+ * cost of small transfers through a pair of in-memory transports,
+ * including the flow and disposition frames they cause.
+ */
+
+#include "bench-common.h"
+#include "proton/codec.h"
+#include "proton/delivery.h"
+#include "proton/disposition.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+  int count;
+  int batch;
+  int msg_size;
+} Options_t;
+
+static void usage(int rc)
+{
+  printf("Usage: frame-bench [OPTIONS] \n"
+         " -c # \tNumber of messages per measurement [200000]\n"
+         " -w # \tCredit granted, messages in flight at once [100]\n"
+         " -b # \tSize of each message in bytes [16]\n"
+         );
+  exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+  int c;
+  opterr = 0;
+
+  opts->count = 200000;
+  opts->batch = 100;
+  opts->msg_size = 16;
+
+  while ((c = getopt(argc, argv, "c:w:b:h")) != -1) {
+    switch (c) {
+    case 'c':
+      if (sscanf(optarg, "%d", &opts->count) != 1) usage(1);
+      break;
+    case 'w':
+      if (sscanf(optarg, "%d", &opts->batch) != 1) usage(1);
+      break;
+    case 'b':
+      if (sscanf(optarg, "%d", &opts->msg_size) != 1) usage(1);
+      break;
+    case 'h':
+      usage(0);
+      break;
+    default:
+      usage(1);
+    }
+  }
+}
+
+// descriptor codes, see the AMQP 1.0 transport section
+#define OPEN ((uint64_t) 16)
+#define ATTACH ((uint64_t) 18)
+#define FLOW ((uint64_t) 19)
+#define TRANSFER ((uint64_t) 20)
+#define DISPOSITION ((uint64_t) 21)
+#define SOURCE ((uint64_t) 40)
+#define TARGET ((uint64_t) 41)
+
+static ssize_t encode_generic(pn_data_t *data, const char *name, int i, char *buf, size_t size)
+{
+  pn_bytes_t tag = pn_bytes(4, (char *) "1234");
+  pn_data_clear(data);
+  if (!strcmp(name, "transfer")) {
+    pn_data_fill(data, "DL[IIzIoo]", TRANSFER, 0, i, tag.size, tag.start, 0, false, false);
+  } else if (!strcmp(name, "flow")) {
+    pn_data_fill(data, "DL[?IIII?I?I?In?o]", FLOW, true, i, 2147483647, i, 2147483647,
+                 true, 0, true, i, true, 100, true, false);
+  } else {
+    pn_data_fill(data, "DL[oIIo?DL[]]", DISPOSITION, true, i, i, true, true, PN_ACCEPTED);
+  }
+  ssize_t n = pn_data_encode(data, buf, size);
+  bench_check(n > 0, "encode failed");
+  return n;
+}
+
+// nanoseconds per fill and encode of the generic performatives
+static double measure_generic(const char *name, int count)
+{
+  pn_data_t *data = pn_data(16);
+  char buf[256];
+  uint64_t start = bench_now();
+  for (int i = 0; i < count; i++) {
+    encode_generic(data, name, i, buf, sizeof(buf));
+  }
+  uint64_t end = bench_now();
+  pn_data_free(data);
+  return bench_per_op(start, end, count);
+}
+
+// nanoseconds per generic decode and scan, with the formats the
+// transport used for inbound frames
+static double measure_decode(const char *name, int count)
+{
+  pn_data_t *data = pn_data(16);
+  char buf[256];
+  ssize_t size = encode_generic(data, name, 12345, buf, sizeof(buf));
+  uint32_t u[8];
+  bool b[8];
+  pn_sequence_t seq[4];
+  uint64_t type;
+  pn_bytes_t tag;
+  uint64_t start = bench_now();
+  for (int i = 0; i < count; i++) {
+    pn_data_clear(data);
+    bench_check(pn_data_decode(data, buf, size) == size, "decode failed");
+    pn_data_rewind(data);
+    int err;
+    if (!strcmp(name, "transfer")) {
+      err = pn_data_scan(data, "D.[I?Iz.oo]", &u[0], &b[0], &seq[0], &tag, &b[1], &b[2]);
+    } else if (!strcmp(name, "flow")) {
+      err = pn_data_scan(data, "D.[?IIII?I?II.o]", &b[0], &seq[0], &u[0], &seq[1], &u[1],
+                         &b[1], &u[2], &b[2], &seq[2], &u[3], &b[3]);
+    } else {
+      err = pn_data_scan(data, "D.[oI?IoD?L.]", &b[0], &seq[0], &b[1], &seq[1], &b[2],
+                         &b[3], &type);
+    }
+    bench_check(!err, "scan failed");
+  }
+  uint64_t end = bench_now();
+  pn_data_free(data);
+  return bench_per_op(start, end, count);
+}
+
+// the fill and scan formats of the transport for one performative
+typedef struct {
+  const char *name;
+  const char *fill;
+  const char *scan;
+} format_t;
+
+static const format_t formats[] = {
+  {"open", "DL[SS?I?H?InnCCC]", "D.[?S?SIHI..CCC]"},
+  {"attach", "DL[SIoBB?DL[SIsIoC?sCnCC]?DL[SIsIoCC]nnI]", "D.[SIo?B?BD.[SIsIo.s]D.[SIsIo]..I]"},
+  {"transfer", "DL[IIzIoo]", "D.[I?Iz.oo]"},
+  {"disposition", "DL[oIIo?DL[]]", "D.[oI?IoD?LC]"}
+};
+
+static int fill_format(pn_data_t *data, int which, const char *fmt, pn_program_t *program, int i)
+{
+  pn_data_clear(data);
+  switch (which) {
+  case 0:
+    return program ?
+      pn_data_fill_program(data, program, OPEN, "container", "host", true, 65536, true, 65535,
+                           false, 0, NULL, NULL, NULL) :
+      pn_data_fill(data, fmt, OPEN, "container", "host", true, 65536, true, 65535,
+                   false, 0, NULL, NULL, NULL);
+  case 1:
+    return program ?
+      pn_data_fill_program(data, program, ATTACH, "link", i, false, 0, 0,
+                           true, SOURCE, "queue", 0, "session-end", 0, false, NULL, false, NULL, NULL, NULL, NULL,
+                           true, TARGET, "queue", 0, "session-end", 0, false, NULL, NULL, 0) :
+      pn_data_fill(data, fmt, ATTACH, "link", i, false, 0, 0,
+                   true, SOURCE, "queue", 0, "session-end", 0, false, NULL, false, NULL, NULL, NULL, NULL,
+                   true, TARGET, "queue", 0, "session-end", 0, false, NULL, NULL, 0);
+  case 2:
+    return program ?
+      pn_data_fill_program(data, program, TRANSFER, 0, i, (size_t) 4, "1234", 0, false, false) :
+      pn_data_fill(data, fmt, TRANSFER, 0, i, (size_t) 4, "1234", 0, false, false);
+  default:
+    return program ?
+      pn_data_fill_program(data, program, DISPOSITION, true, i, i, true, true, PN_ACCEPTED) :
+      pn_data_fill(data, fmt, DISPOSITION, true, i, i, true, true, PN_ACCEPTED);
+  }
+}
+
+static int scan_format(pn_data_t *data, int which, const char *fmt, pn_program_t *program,
+                       pn_data_t *copy)
+{
+  pn_bytes_t s[8];
+  uint32_t u[4];
+  uint16_t h;
+  uint8_t ub[2];
+  bool b[4];
+  uint64_t type;
+  pn_data_clear(copy);
+  switch (which) {
+  case 0:
+    return program ?
+      pn_data_scan_program(data, program, &b[0], &s[0], &b[1], &s[1], &u[0], &h, &u[1], copy, copy, copy) :
+      pn_data_scan(data, fmt, &b[0], &s[0], &b[1], &s[1], &u[0], &h, &u[1], copy, copy, copy);
+  case 1:
+    return program ?
+      pn_data_scan_program(data, program, &s[0], &u[0], &b[0], &b[1], &ub[0], &b[2], &ub[1],
+                           &s[1], &u[1], &s[2], &u[2], &b[3], &s[3],
+                           &s[4], &u[3], &s[5], &u[3], &b[3], &u[3]) :
+      pn_data_scan(data, fmt, &s[0], &u[0], &b[0], &b[1], &ub[0], &b[2], &ub[1],
+                   &s[1], &u[1], &s[2], &u[2], &b[3], &s[3],
+                   &s[4], &u[3], &s[5], &u[3], &b[3], &u[3]);
+  case 2:
+    return program ?
+      pn_data_scan_program(data, program, &u[0], &b[0], &u[1], &s[0], &b[1], &b[2]) :
+      pn_data_scan(data, fmt, &u[0], &b[0], &u[1], &s[0], &b[1], &b[2]);
+  default:
+    return program ?
+      pn_data_scan_program(data, program, &b[0], &u[0], &b[1], &u[1], &b[2], &b[3], &type, copy) :
+      pn_data_scan(data, fmt, &b[0], &u[0], &b[1], &u[1], &b[2], &b[3], &type, copy);
+  }
+}
+
+// nanoseconds per fill and scan of one format, from its string or
+// compiled program
+static void measure_format(int which, int count, double *fill, double *fill_program,
+                           double *scan, double *scan_program)
+{
+  const format_t *format = &formats[which];
+  pn_program_t *fp = pn_program(format->fill);
+  pn_program_t *sp = pn_program(format->scan);
+  pn_data_t *data = pn_data(16);
+  pn_data_t *copy = pn_data(16);
+
+  for (int pass = 0; pass < 2; pass++) {
+    pn_program_t *program = pass ? fp : NULL;
+    uint64_t start = bench_now();
+    for (int i = 0; i < count; i++) {
+      bench_check(!fill_format(data, which, format->fill, program, i), "fill failed");
+    }
+    uint64_t end = bench_now();
+    *(pass ? fill_program : fill) = bench_per_op(start, end, count);
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    pn_program_t *program = pass ? sp : NULL;
+    uint64_t start = bench_now();
+    for (int i = 0; i < count; i++) {
+      bench_check(!scan_format(data, which, format->scan, program, copy), "scan failed");
+    }
+    uint64_t end = bench_now();
+    *(pass ? scan_program : scan) = bench_per_op(start, end, count);
+  }
+
+  pn_data_free(copy);
+  pn_data_free(data);
+  pn_program_free(sp);
+  pn_program_free(fp);
+}
+
+// nanoseconds per message sent, accepted and settled
+static double measure_engine(const Options_t *opts, bool settled)
+{
+  bench_link_pair_t pair;
+  bench_link_pair(&pair, opts->batch);
+
+  char *body = (char *) calloc(opts->msg_size, 1);
+  char tag[16];
+  int sent = 0;
+  int received = 0;
+
+  uint64_t start = bench_now();
+  while (received < opts->count) {
+    while (sent < opts->count && pn_link_credit(pair.sender) > 0) {
+      snprintf(tag, sizeof(tag), "%x", sent);
+      pn_delivery_t *d = pn_delivery(pair.sender, pn_dtag(tag, strlen(tag)));
+      pn_link_send(pair.sender, body, opts->msg_size);
+      pn_link_advance(pair.sender);
+      if (settled) pn_delivery_settle(d);
+      sent++;
+    }
+    bench_pump(&pair);
+
+    pn_delivery_t *d;
+    while ((d = pn_link_current(pair.receiver)) && !pn_delivery_partial(d)) {
+      pn_link_advance(pair.receiver);
+      if (!settled) pn_delivery_update(d, PN_ACCEPTED);
+      pn_delivery_settle(d);
+      received++;
+    }
+    pn_link_flow(pair.receiver, opts->batch - pn_link_credit(pair.receiver));
+    bench_pump(&pair);
+
+    if (!settled) {
+      pn_connection_t *conn = pair.client;
+      while ((d = pn_work_head(conn))) {
+        bench_check(pn_delivery_updated(d), "unexpected work");
+        pn_delivery_settle(d);
+      }
+    }
+  }
+  uint64_t end = bench_now();
+
+  free(body);
+  bench_link_pair_free(&pair);
+  return bench_per_op(start, end, opts->count);
+}
+
+int main(int argc, char** argv)
+{
+  Options_t opts;
+  parse_options(argc, argv, &opts);
+
+  const char *names[] = {"transfer", "flow", "disposition"};
+  printf("%12s %16s %16s\n", "performative", "generic ns", "decode ns");
+  for (int i = 0; i < 3; i++) {
+    printf("%12s %16.0f %16.0f\n", names[i], measure_generic(names[i], opts.count),
+           measure_decode(names[i], opts.count));
+  }
+
+  printf("\n%12s %12s %12s %12s %12s\n", "format", "fill ns", "compiled", "scan ns", "compiled");
+  for (size_t i = 0; i < sizeof(formats)/sizeof(formats[0]); i++) {
+    double fill, fill_program, scan, scan_program;
+    measure_format(i, opts.count, &fill, &fill_program, &scan, &scan_program);
+    printf("%12s %12.0f %12.0f %12.0f %12.0f\n", formats[i].name, fill, fill_program,
+           scan, scan_program);
+  }
+
+  printf("\n%12s %16s\n", "messages", "ns/message");
+  printf("%12s %16.0f\n", "presettled", measure_engine(&opts, true));
+  printf("%12s %16.0f\n", "acknowledged", measure_engine(&opts, false));
+
+  return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Measures the cost of pn_hash and pn_map operations as the number of
+ * entries grows.  Each key set is put, looked up, looked up again with
+ * keys that are not present, and deleted.  The cost per operation
+ * should not depend on the number of entries.
+ */
+
+#include "bench-common.h"
+
+#include <proton/object.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+  int max_entries;
+  int rounds;
+} Options_t;
+
+static void usage(int rc)
+{
+  printf("Usage: map-bench [OPTIONS] \n"
+         " -n # \tLargest number of entries to measure [1000000]\n"
+         " -r # \tRounds to run, the best of which is reported [3]\n"
+         );
+  exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+  int c;
+  opterr = 0;
+
+  opts->max_entries = 1000000;
+  opts->rounds = 3;
+
+  while ((c = getopt(argc, argv, "n:r:h")) != -1) {
+    switch (c) {
+    case 'n':
+      if (sscanf(optarg, "%d", &opts->max_entries) != 1) usage(1);
+      break;
+    case 'r':
+      if (sscanf(optarg, "%d", &opts->rounds) != 1) usage(1);
+      break;
+    case 'h':
+      usage(0);
+      break;
+    default:
+      usage(1);
+    }
+  }
+}
+
+typedef struct {
+  double put;
+  double get;
+  double miss;
+  double del;
+} result_t;
+
+// keys i*stride: stride 1 is a sequence of delivery ids or handles,
+// a large stride looks like a set of pointers
+static result_t measure_hash(int count, uintptr_t stride)
+{
+  result_t result;
+  void *value = pn_new(0, NULL);
+  pn_hash_t *hash = pn_hash(0, 0.75, PN_REFCOUNT);
+
+  uint64_t start = bench_now();
+  for (int i = 0; i < count; i++) {
+    pn_hash_put(hash, i*stride, value);
+  }
+  uint64_t end = bench_now();
+  result.put = bench_per_op(start, end, count);
+  bench_check(pn_hash_size(hash) == (size_t) count, "put failed");
+
+  start = bench_now();
+  for (int i = 0; i < count; i++) {
+    bench_check(pn_hash_get(hash, i*stride), "get failed");
+  }
+  end = bench_now();
+  result.get = bench_per_op(start, end, count);
+
+  start = bench_now();
+  for (int i = 0; i < count; i++) {
+    bench_check(!pn_hash_get(hash, (count + i)*stride), "miss failed");
+  }
+  end = bench_now();
+  result.miss = bench_per_op(start, end, count);
+
+  start = bench_now();
+  for (int i = 0; i < count; i++) {
+    pn_hash_del(hash, i*stride);
+  }
+  end = bench_now();
+  result.del = bench_per_op(start, end, count);
+  bench_check(pn_hash_size(hash) == 0, "del failed");
+
+  pn_free(hash);
+  pn_decref(value);
+  return result;
+}
+
+// string keys, as for the addresses and link names of a messenger
+static result_t measure_map(int count)
+{
+  result_t result;
+  void *value = pn_new(0, NULL);
+  pn_map_t *map = pn_map(0, 0.75, PN_REFCOUNT);
+  pn_list_t *keys = pn_list(2*count, PN_REFCOUNT);
+  for (int i = 0; i < 2*count; i++) {
+    pn_string_t *key = pn_string(NULL);
+    pn_string_format(key, "amqp://host/queue-%d", i);
+    pn_list_add(keys, key);
+    pn_decref(key);
+  }
+
+  uint64_t start = bench_now();
+  for (int i = 0; i < count; i++) {
+    pn_map_put(map, pn_list_get(keys, i), value);
+  }
+  uint64_t end = bench_now();
+  result.put = bench_per_op(start, end, count);
+  bench_check(pn_map_size(map) == (size_t) count, "put failed");
+
+  start = bench_now();
+  for (int i = 0; i < count; i++) {
+    bench_check(pn_map_get(map, pn_list_get(keys, i)), "get failed");
+  }
+  end = bench_now();
+  result.get = bench_per_op(start, end, count);
+
+  start = bench_now();
+  for (int i = 0; i < count; i++) {
+    bench_check(!pn_map_get(map, pn_list_get(keys, count + i)), "miss failed");
+  }
+  end = bench_now();
+  result.miss = bench_per_op(start, end, count);
+
+  start = bench_now();
+  for (int i = 0; i < count; i++) {
+    pn_map_del(map, pn_list_get(keys, i));
+  }
+  end = bench_now();
+  result.del = bench_per_op(start, end, count);
+  bench_check(pn_map_size(map) == 0, "del failed");
+
+  pn_free(map);
+  pn_free(keys);
+  pn_decref(value);
+  return result;
+}
+
+static void best(result_t *best, result_t result)
+{
+  if (result.put < best->put) best->put = result.put;
+  if (result.get < best->get) best->get = result.get;
+  if (result.miss < best->miss) best->miss = result.miss;
+  if (result.del < best->del) best->del = result.del;
+}
+
+// stride 0 measures string keys
+static void report(const char *name, int count, uintptr_t stride, int rounds)
+{
+  result_t result = {1e9, 1e9, 1e9, 1e9};
+  for (int i = 0; i < rounds; i++) {
+    best(&result, stride ? measure_hash(count, stride) : measure_map(count));
+  }
+  printf("%12s %10d %10.1f %10.1f %10.1f %10.1f\n", name, count,
+         result.put, result.get, result.miss, result.del);
+}
+
+int main(int argc, char** argv)
+{
+  Options_t opts;
+  parse_options(argc, argv, &opts);
+
+  printf("%12s %10s %10s %10s %10s %10s\n", "keys", "entries",
+         "put ns", "get ns", "miss ns", "del ns");
+  for (int n = 1000; n <= opts.max_entries; n *= 10) {
+    report("sequential", n, 1, opts.rounds);
+  }
+  for (int n = 1000; n <= opts.max_entries; n *= 10) {
+    report("strided", n, 4096, opts.rounds);
+  }
+  for (int n = 1000; n <= opts.max_entries; n *= 10) {
+    report("string", n, 0, opts.rounds);
+  }
+
+  return 0;
+}
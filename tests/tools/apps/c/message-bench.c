@@ -0,0 +1,184 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Measures the time and heap allocations per message of creating,
+ * encoding, decoding and clearing messages with a few properties and
+ * a small body.  Allocations are only counted with glibc, where
+ * malloc can be wrapped, and not under AddressSanitizer, which wraps it
+ * itself.
+ */
+
+#include "bench-common.h"
+
+#include <proton/message.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static uint64_t allocations = 0;
+
+void *malloc(size_t size)
+{
+  allocations++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+  allocations++;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  allocations++;
+  return __libc_realloc(ptr, size);
+}
+#else
+static uint64_t allocations = 0;
+#endif
+
+typedef struct {
+  int iterations;
+} Options_t;
+
+static void usage(int rc)
+{
+  printf("Usage: message-bench [OPTIONS] \n"
+         " -i # \tNumber of messages per measurement [100000]\n"
+         );
+  exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+  int c;
+  opterr = 0;
+
+  opts->iterations = 100000;
+
+  while ((c = getopt(argc, argv, "i:h")) != -1) {
+    switch (c) {
+    case 'i':
+      if (sscanf(optarg, "%d", &opts->iterations) != 1) usage(1);
+      break;
+    case 'h':
+      usage(0);
+      break;
+    default:
+      usage(1);
+    }
+  }
+}
+
+static char encoded[1024];
+static size_t encoded_size;
+
+static void fill(pn_message_t *msg)
+{
+  char body[] = "a small message body";
+  pn_message_set_address(msg, "amqp://127.0.0.1/queue");
+  pn_message_set_subject(msg, "subject");
+  pn_message_set_reply_to(msg, "amqp://127.0.0.1/replies");
+  pn_message_set_content_type(msg, "text/plain");
+  pn_data_put_string(pn_message_body(msg), pn_bytes(strlen(body), body));
+}
+
+static void create(void)
+{
+  pn_message_t *msg = pn_message();
+  fill(msg);
+  pn_message_free(msg);
+}
+
+static void encode(pn_message_t *msg)
+{
+  size_t size = sizeof(encoded);
+  bench_check(pn_message_encode(msg, encoded, &size) == 0, "encode failed");
+  encoded_size = size;
+}
+
+static pn_message_t *reused;
+
+static void fill_encode_clear(void)
+{
+  fill(reused);
+  encode(reused);
+  pn_message_clear(reused);
+}
+
+static void decode_clear(void)
+{
+  bench_check(pn_message_decode(reused, encoded, encoded_size) == 0, "decode failed");
+  bench_check(pn_message_get_address(reused), "no address");
+  pn_message_clear(reused);
+}
+
+static void round_trip(void)
+{
+  pn_message_t *msg = pn_message();
+  fill(msg);
+  encode(msg);
+  pn_message_free(msg);
+  msg = pn_message();
+  bench_check(pn_message_decode(msg, encoded, encoded_size) == 0, "decode failed");
+  bench_check(pn_message_get_address(msg), "no address");
+  pn_message_free(msg);
+}
+
+static void measure(const char *name, void (*cycle)(void), int iterations)
+{
+  // once to warm up any reused message
+  cycle();
+  uint64_t before = allocations;
+  uint64_t start = bench_now();
+  for (int i = 0; i < iterations; i++) {
+    cycle();
+  }
+  uint64_t end = bench_now();
+  printf("%20s %12.0f %12.1f\n", name, bench_per_op(start, end, iterations),
+         (double) (allocations - before) / iterations);
+}
+
+int main(int argc, char** argv)
+{
+  Options_t opts;
+  parse_options(argc, argv, &opts);
+
+  reused = pn_message();
+  fill_encode_clear();
+
+  printf("%20s %12s %12s\n", "cycle", "ns/message", "allocs");
+  measure("create, free", create, opts.iterations);
+  measure("fill, encode, clear", fill_encode_clear, opts.iterations);
+  measure("decode, clear", decode_clear, opts.iterations);
+  measure("new, encode, decode", round_trip, opts.iterations);
+
+  pn_message_free(reused);
+  return 0;
+}
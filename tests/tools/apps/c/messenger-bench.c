@@ -0,0 +1,165 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Measures the cost of a synchronous pn_messenger_put() and
+ * pn_messenger_send() as the outgoing window grows.  The receiver runs
+ * in a child process and settles every message it gets, so each send
+ * completes once the peer has settled the message, while the sender
+ * keeps a full window of tracked deliveries around.  The window is
+ * filled before timing starts.
+ */
+
+#include "bench-common.h"
+#include "proton/message.h"
+#include "proton/messenger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+typedef struct {
+  int port;
+  int max_window;
+  int iterations;
+} Options_t;
+
+static void usage(int rc)
+{
+  printf("Usage: messenger-bench [OPTIONS] \n"
+         " -p # \tPort to run the receiver on [5799]\n"
+         " -w # \tLargest outgoing window to measure [10000]\n"
+         " -i # \tNumber of messages per measurement [5000]\n"
+         );
+  exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+  int c;
+  opterr = 0;
+
+  opts->port = 5799;
+  opts->max_window = 10000;
+  opts->iterations = 5000;
+
+  while ((c = getopt(argc, argv, "p:w:i:h")) != -1) {
+    switch (c) {
+    case 'p':
+      if (sscanf(optarg, "%d", &opts->port) != 1) usage(1);
+      break;
+    case 'w':
+      if (sscanf(optarg, "%d", &opts->max_window) != 1) usage(1);
+      break;
+    case 'i':
+      if (sscanf(optarg, "%d", &opts->iterations) != 1) usage(1);
+      break;
+    case 'h':
+      usage(0);
+      break;
+    default:
+      usage(1);
+    }
+  }
+}
+
+// receives and settles messages until killed
+static void receiver(int port)
+{
+  char address[64];
+  snprintf(address, sizeof(address), "amqp://~127.0.0.1:%d", port);
+
+  pn_messenger_t *messenger = pn_messenger(NULL);
+  pn_message_t *message = pn_message();
+  bench_check(pn_messenger_start(messenger) == 0, "receiver start failed");
+  bench_check(pn_messenger_subscribe(messenger, address), "subscribe failed");
+
+  while (true) {
+    bench_check(pn_messenger_recv(messenger, -1) == 0, "recv failed");
+    while (pn_messenger_incoming(messenger)) {
+      bench_check(pn_messenger_get(messenger, message) == 0, "get failed");
+    }
+  }
+}
+
+static void put_and_send(pn_messenger_t *messenger, pn_message_t *message)
+{
+  bench_check(pn_messenger_put(messenger, message) == 0, "put failed");
+  bench_check(pn_messenger_send(messenger, -1) == 0, "send failed");
+}
+
+// nanoseconds per message sent with the given outgoing window
+static double measure(int port, int window, int iterations)
+{
+  char address[64];
+  snprintf(address, sizeof(address), "amqp://127.0.0.1:%d", port);
+
+  pn_messenger_t *messenger = pn_messenger(NULL);
+  pn_message_t *message = pn_message();
+  char body[] = "hello";
+  pn_messenger_set_outgoing_window(messenger, window);
+  bench_check(pn_messenger_start(messenger) == 0, "sender start failed");
+  pn_message_set_address(message, address);
+  pn_data_put_string(pn_message_body(message), pn_bytes(strlen(body), body));
+
+  for (int i = 0; i < window + 1; i++) {
+    put_and_send(messenger, message);
+  }
+
+  uint64_t start = bench_now();
+  for (int i = 0; i < iterations; i++) {
+    put_and_send(messenger, message);
+  }
+  uint64_t end = bench_now();
+
+  pn_messenger_stop(messenger);
+  pn_messenger_free(messenger);
+  pn_message_free(message);
+
+  return bench_per_op(start, end, iterations);
+}
+
+int main(int argc, char** argv)
+{
+  Options_t opts;
+  parse_options(argc, argv, &opts);
+
+  pid_t child = fork();
+  bench_check(child >= 0, "fork failed");
+  if (child == 0) {
+    receiver(opts.port);
+    return 0;
+  }
+  // give the receiver a chance to start listening
+  usleep(200000);
+
+  printf("%12s %16s\n", "window", "ns/message");
+  printf("%12d %16.0f\n", 0, measure(opts.port, 0, opts.iterations));
+  for (int window = 10; window <= opts.max_window; window *= 10) {
+    printf("%12d %16.0f\n", window, measure(opts.port, window, opts.iterations));
+  }
+
+  kill(child, SIGTERM);
+  waitpid(child, NULL, 0);
+  return 0;
+}
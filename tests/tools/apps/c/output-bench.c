@@ -0,0 +1,128 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Measures how fast a transport drains a large backlog of outgoing
+ * transfers.  The whole backlog is queued on a link before the first
+ * byte is taken, and output is then consumed in socket sized pieces,
+ * as a driver would when the peer is slow.  Drain throughput should
+ * not depend on the size of the backlog.
+ */
+
+#include "bench-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+  int max_backlog;  // in megabytes
+  int msg_size;
+  int read_size;
+} Options_t;
+
+static void usage(int rc)
+{
+  printf("Usage: output-bench [OPTIONS] \n"
+         " -m # \tLargest backlog to measure in megabytes [16]\n"
+         " -b # \tSize of each message in bytes [1024]\n"
+         " -r # \tBytes taken from the transport at a time [4096]\n"
+         );
+  exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+  int c;
+  opterr = 0;
+
+  opts->max_backlog = 16;
+  opts->msg_size = 1024;
+  opts->read_size = 4096;
+
+  while ((c = getopt(argc, argv, "m:b:r:h")) != -1) {
+    switch (c) {
+    case 'm':
+      if (sscanf(optarg, "%d", &opts->max_backlog) != 1) usage(1);
+      break;
+    case 'b':
+      if (sscanf(optarg, "%d", &opts->msg_size) != 1) usage(1);
+      break;
+    case 'r':
+      if (sscanf(optarg, "%d", &opts->read_size) != 1) usage(1);
+      break;
+    case 'h':
+      usage(0);
+      break;
+    default:
+      usage(1);
+    }
+  }
+}
+
+// megabytes per second draining a backlog of the given size
+static double measure(size_t backlog, int msg_size, int read_size)
+{
+  int count = backlog/msg_size;
+  bench_link_pair_t pair;
+  bench_link_pair(&pair, count);
+
+  char *body = (char *) calloc(msg_size, 1);
+  char tag[16];
+  for (int i = 0; i < count; i++) {
+    snprintf(tag, sizeof(tag), "%x", i);
+    pn_delivery(pair.sender, pn_dtag(tag, strlen(tag)));
+    pn_link_send(pair.sender, body, msg_size);
+    pn_link_advance(pair.sender);
+  }
+
+  uint64_t total = 0;
+  uint64_t start = bench_now();
+  while (true) {
+    ssize_t pending = pn_transport_pending(pair.client_transport);
+    if (pending <= 0) break;
+    size_t n = pending < read_size ? pending : read_size;
+    pn_transport_pop(pair.client_transport, n);
+    total += n;
+  }
+  uint64_t end = bench_now();
+
+  bench_check(total >= backlog, "backlog not written");
+
+  free(body);
+  bench_link_pair_free(&pair);
+
+  return (total/(1024.0*1024.0))/((end - start)/1e9);
+}
+
+int main(int argc, char** argv)
+{
+  Options_t opts;
+  parse_options(argc, argv, &opts);
+
+  printf("%12s %16s\n", "backlog MB", "drain MB/s");
+  for (int mb = 1; mb <= opts.max_backlog; mb *= 2) {
+    double rate = measure(((size_t) mb)*1024*1024, opts.msg_size, opts.read_size);
+    printf("%12d %16.1f\n", mb, rate);
+  }
+
+  return 0;
+}